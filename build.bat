@@ -27,7 +27,7 @@ if errorlevel 1 (
   exit /b 1
 )
 
-cl /EHsc /std:c++17 /utf-8 /I third_party\sqlite src\main.cpp third_party\sqlite\sqlite3.c build\app.res /Fo:build\ /Fe:build\cpp-gradebook.exe
+cl /EHsc /std:c++17 /utf-8 /I third_party\sqlite src\main.cpp third_party\sqlite\sqlite3.c build\app.res ws2_32.lib /Fo:build\ /Fe:build\cpp-gradebook.exe
 exit /b %errorlevel%
 
 
@@ -1,38 +1,92 @@
 ﻿#include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
 #include <cstdlib>
+#include <ctime>
+#include <deque>
 #include <fstream>
 #include <filesystem>
-#include <iomanip>
+#include <functional>
+#include <initializer_list>
 #include <iostream>
 #include <limits>
+#include <list>
 #include <map>
-#include <sstream>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <queue>
 #include <set>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include "sqlite3.h"
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__)
+#define GRADEBOOK_SIMD_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define GRADEBOOK_TARGET_AVX2
+#else
+#define GRADEBOOK_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
 #ifdef _WIN32
 #ifndef NOMINMAX
 #define NOMINMAX
 #endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
 #include <windows.h>
+#include <io.h>
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #endif
 
+constexpr int kMinGrade = 1;
+constexpr int kMaxGrade = 5;
+constexpr int kPassGrade = 3;
+constexpr int kGradeLevels = kMaxGrade - kMinGrade + 1;
+
+// version у всех сущностей - версия строки в базе (номер изменения, см. save_changes);
+// 0 - строка еще не записана.
 struct Student {
   int id = 0;
   std::string name;
   int group_id = 0;
+  int64_t version = 0;
 };
 
 struct Group {
   int id = 0;
   std::string name;
+  int64_t version = 0;
 };
 
 struct Subject {
   int id = 0;
   std::string name;
+  int64_t version = 0;
 };
 
 struct Grade {
@@ -41,32 +95,544 @@ struct Grade {
   int subject_id = 0;
   int value = 0;
   int attempt = 0;
+  int64_t created_at = 0;  // время выставления (Unix time), 0 - неизвестно
+  int semester = 0;        // код семестра (см. semester_for_time), 0 - без даты
+  int64_t version = 0;
+};
+
+// Распределение оценок: счетчик для каждого значения kMinGrade..kMaxGrade. Медиана,
+// мода и перцентили считаются по счетчикам, без сортировки самих оценок.
+struct GradeHistogram {
+  int64_t counts[kGradeLevels] = {};
+
+  void add(int value, int64_t delta = 1) {
+    if (value >= kMinGrade && value <= kMaxGrade) {
+      counts[value - kMinGrade] += delta;
+    }
+  }
+  void merge(const GradeHistogram& other) {
+    for (int i = 0; i < kGradeLevels; ++i) {
+      counts[i] += other.counts[i];
+    }
+  }
+  int64_t total() const {
+    int64_t sum = 0;
+    for (int64_t count : counts) {
+      sum += count;
+    }
+    return sum;
+  }
+};
+
+// Компактная запись оценки в памяти: 20 байт вместо 48 у Grade - столько же, сколько
+// занимала исходная запись из пяти int без даты и версии. Упакованы поля, кроме ID:
+// семестр задан партицией, оценка и номер попытки занимают один байт, предмет - 16 бит,
+// дата и версия - по 32 бита. Оценка, поля которой не помещаются, хранится целиком
+// в GradePartition::wide_grades и отмечена флагом kPackedWide.
+// ID оценки и студента хранятся как есть. ID оценок общие для всех семестров, и в
+// семестре больше чем на 65536 оценок разность с наименьшим ID партиции не помещается
+// в 16 бит: такой семестр почти целиком ушел бы в wide_grades. Номер студента вместо
+// ID требует таблицы ID -> номер, которая не меняется при удалении студентов и общая
+// для партиций и снимков; grade_at без нее не распакует оценку.
+struct PackedGrade {
+  int32_t id = 0;
+  int32_t student_id = 0;
+  uint32_t created_at = 0;
+  uint32_t version = 0;
+  uint16_t subject_id = 0;
+  uint8_t value_attempt = 0;  // биты 0-2 - оценка, 3-7 - номер попытки
+  uint8_t flags = 0;
+};
+
+constexpr uint8_t kPackedWide = 1;
+constexpr int kPackedMaxValue = 7;
+constexpr int kPackedMaxAttempt = 31;
+
+// Оценки одного семестра. Отчеты за период пропускают чужие партиции целиком,
+// поэтому стоимость отчета за текущий семестр не растет вместе с историей.
+// Оценки читаются и пишутся через grade_at/store/append, которые упаковывают
+// и распаковывают PackedGrade.
+struct GradePartition {
+  int semester = 0;
+  std::vector<PackedGrade> grades;
+  std::map<int, Grade> wide_grades;  // оценки, не поместившиеся в PackedGrade (по ID)
+  // Распределения оценок партиции по предметам; обновляются при каждом добавлении,
+  // изменении и удалении оценки (см. insert_grade, erase_grades_if, replace_grade).
+  std::map<int, GradeHistogram> subject_histograms;
+
+  size_t size() const { return grades.size(); }
+
+  Grade grade_at(size_t index) const {
+    const PackedGrade& packed = grades[index];
+    if (packed.flags & kPackedWide) {
+      return wide_grades.find(packed.id)->second;
+    }
+    Grade grade;
+    grade.id = packed.id;
+    grade.student_id = packed.student_id;
+    grade.subject_id = packed.subject_id;
+    grade.value = packed.value_attempt & kPackedMaxValue;
+    grade.attempt = packed.value_attempt >> 3;
+    grade.created_at = packed.created_at;
+    grade.semester = semester;
+    grade.version = packed.version;
+    return grade;
+  }
+
+  // Записывает оценку в позицию index (без пересчета распределений).
+  void store(size_t index, const Grade& grade) {
+    PackedGrade& packed = grades[index];
+    if (packed.flags & kPackedWide) {
+      wide_grades.erase(packed.id);
+    }
+    packed = PackedGrade();
+    packed.id = grade.id;
+    packed.student_id = grade.student_id;
+    bool fits = grade.semester == semester && grade.subject_id >= 0 && grade.subject_id <= UINT16_MAX &&
+                grade.value >= 0 && grade.value <= kPackedMaxValue && grade.attempt >= 0 &&
+                grade.attempt <= kPackedMaxAttempt && grade.created_at >= 0 && grade.created_at <= UINT32_MAX &&
+                grade.version >= 0 && grade.version <= UINT32_MAX;
+    if (!fits) {
+      packed.flags = kPackedWide;
+      wide_grades[grade.id] = grade;
+      return;
+    }
+    packed.subject_id = static_cast<uint16_t>(grade.subject_id);
+    packed.value_attempt = static_cast<uint8_t>(grade.value | (grade.attempt << 3));
+    packed.created_at = static_cast<uint32_t>(grade.created_at);
+    packed.version = static_cast<uint32_t>(grade.version);
+  }
+
+  void append(const Grade& grade) {
+    grades.emplace_back();
+    store(grades.size() - 1, grade);
+  }
+
+  // Память под оценки партиции в байтах (без распределений).
+  size_t memory_bytes() const {
+    return grades.capacity() * sizeof(PackedGrade) + wide_grades.size() * (sizeof(Grade) + 4 * sizeof(void*));
+  }
+};
+
+enum class Entity { kGroup, kStudent, kSubject, kGrade };
+enum class ChangeOp { kInsert, kUpdate, kDelete };
+
+// Изменение строки, еще не записанное в базу. base_version - версия строки,
+// от которой сделано изменение (для оптимистической проверки при записи).
+struct PendingChange {
+  Entity entity = Entity::kGroup;
+  ChangeOp op = ChangeOp::kInsert;
+  int id = 0;
+  int64_t base_version = 0;
+};
+
+// Копирование при записи: копия делит данные с оригиналом за O(1), а write() перед
+// изменением копирует данные, если их держит кто-то еще (снимок в другом потоке).
+// Читать можно только через const-доступ, поэтому правка мимо write() не скомпилируется.
+template <typename T>
+class Cow {
+ public:
+  Cow() : ptr_(std::make_shared<T>()) {}
+  Cow(T value) : ptr_(std::make_shared<T>(std::move(value))) {}
+  // Перенос тоже делит данные: у перенесенного объекта остается рабочее значение.
+  Cow(const Cow&) = default;
+  Cow& operator=(const Cow&) = default;
+
+  const T& get() const { return *ptr_; }
+  operator const T&() const { return *ptr_; }
+  const T* operator->() const { return ptr_.get(); }
+
+  T& write() {
+    if (ptr_.use_count() > 1) {
+      ptr_ = std::make_shared<T>(*ptr_);
+    } else {
+      // Снимок мог только что отпустить данные в другом потоке: его чтения должны
+      // завершиться до нашей записи.
+      std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    return *ptr_;
+  }
+
+ private:
+  std::shared_ptr<T> ptr_;
+};
+
+// Таблица сущностей с копированием при записи; читается как const std::vector.
+template <typename T>
+class CowTable : public Cow<std::vector<T>> {
+ public:
+  using value_type = T;
+  using const_iterator = typename std::vector<T>::const_iterator;
+
+  size_t size() const { return this->get().size(); }
+  bool empty() const { return this->get().empty(); }
+  const_iterator begin() const { return this->get().begin(); }
+  const_iterator end() const { return this->get().end(); }
+  const T& operator[](size_t index) const { return this->get()[index]; }
+  const T& front() const { return this->get().front(); }
+  const T& back() const { return this->get().back(); }
+
+  std::vector<T>& write() {
+    ++version_;
+    return Cow<std::vector<T>>::write();
+  }
+  // Растет при каждом write(): по нему NameIndex замечает правки мимо себя.
+  uint64_t version() const { return version_; }
+
+ private:
+  uint64_t version_ = 0;
+};
+
+// Нормализует имя для поиска дублей: пробелы по краям убираются, подряд идущие пробелы
+// сливаются в один, латиница и кириллица приводятся к нижнему регистру, "ё" - к "е".
+std::string normalize_name(std::string_view name) {
+  std::string out;
+  out.reserve(name.size());
+  bool space = false;
+  for (size_t i = 0; i < name.size(); ++i) {
+    unsigned char c = static_cast<unsigned char>(name[i]);
+    if (std::isspace(c)) {
+      space = !out.empty();
+      continue;
+    }
+    if (space) {
+      out.push_back(' ');
+      space = false;
+    }
+    unsigned char next = i + 1 < name.size() ? static_cast<unsigned char>(name[i + 1]) : 0;
+    if (c == 0xD0 && next >= 0x90 && next <= 0x9F) {  // А-П -> а-п
+      out.push_back('\xD0');
+      out.push_back(static_cast<char>(next + 0x20));
+      ++i;
+    } else if (c == 0xD0 && next >= 0xA0 && next <= 0xAF) {  // Р-Я -> р-я
+      out.push_back('\xD1');
+      out.push_back(static_cast<char>(next - 0x20));
+      ++i;
+    } else if ((c == 0xD0 && next == 0x81) || (c == 0xD1 && next == 0x91)) {  // Ё, ё -> е
+      out.append("\xD0\xB5");
+      ++i;
+    } else {
+      out.push_back(static_cast<char>(c < 0x80 ? std::tolower(c) : c));
+    }
+  }
+  return out;
+}
+
+// Ключи поиска дублей: студенты сравниваются внутри группы, группы и предметы - по названию.
+std::string name_key(const Student& student) {
+  return std::to_string(student.group_id) + "\t" + normalize_name(student.name);
+}
+
+std::string name_key(const Group& group) {
+  return normalize_name(group.name);
+}
+
+std::string name_key(const Subject& subject) {
+  return normalize_name(subject.name);
+}
+
+// Хэш-индекс нормализованных имен (name_key -> ID записей) для поиска дублей за O(1).
+// Строится при первом поиске, правки меню учитываются в нем сразу (note). Любая другая
+// запись в таблицу (синхронизация, журнал, удаление группы) сдвигает version() таблицы,
+// и индекс перестраивается при следующем поиске. Копия индекса пустая: снимкам данных
+// он не нужен, поэтому копирование DataStore не дорожает.
+template <typename Entity>
+class NameIndex {
+ public:
+  NameIndex() = default;
+  NameIndex(const NameIndex&) {}
+  NameIndex& operator=(const NameIndex&) {
+    ids_.clear();
+    built_ = false;
+    return *this;
+  }
+  NameIndex(NameIndex&&) = default;
+  NameIndex& operator=(NameIndex&&) = default;
+
+  // ID записей с тем же ключом, что у probe, по возрастанию.
+  std::vector<int> find(const CowTable<Entity>& table, const Entity& probe) {
+    refresh(table);
+    auto it = ids_.find(name_key(probe));
+    if (it == ids_.end()) {
+      return {};
+    }
+    std::vector<int> ids = it->second;
+    std::sort(ids.begin(), ids.end());
+    return ids;
+  }
+
+  // Наборы записей с одинаковым ключом (ID по возрастанию), упорядочены по первому ID.
+  std::vector<std::vector<int>> duplicates(const CowTable<Entity>& table) {
+    refresh(table);
+    std::vector<std::vector<int>> sets;
+    for (const auto& entry : ids_) {
+      if (entry.second.size() > 1) {
+        sets.push_back(entry.second);
+        std::sort(sets.back().begin(), sets.back().end());
+      }
+    }
+    std::sort(sets.begin(), sets.end());
+    return sets;
+  }
+
+  // Учитывает правку одной записи: before - version() таблицы до нее, old_row/new_row -
+  // запись до и после (nullptr - запись добавлена/удалена). Если с before таблицу меняли
+  // еще где-то, индекс просто перестроится при следующем поиске.
+  void note(uint64_t before, const CowTable<Entity>& table, const Entity* old_row, const Entity* new_row) {
+    if (!built_ || version_ != before) {
+      built_ = false;
+      return;
+    }
+    if (old_row) {
+      auto it = ids_.find(name_key(*old_row));
+      if (it != ids_.end()) {
+        std::vector<int>& ids = it->second;
+        ids.erase(std::remove(ids.begin(), ids.end(), old_row->id), ids.end());
+        if (ids.empty()) {
+          ids_.erase(it);
+        }
+      }
+    }
+    if (new_row) {
+      ids_[name_key(*new_row)].push_back(new_row->id);
+    }
+    version_ = table.version();
+  }
+
+ private:
+  void refresh(const CowTable<Entity>& table) {
+    if (built_ && version_ == table.version()) {
+      return;
+    }
+    ids_.clear();
+    ids_.reserve(table.size());
+    for (const auto& row : table) {
+      ids_[name_key(row)].push_back(row.id);
+    }
+    version_ = table.version();
+    built_ = true;
+  }
+
+  std::unordered_map<std::string, std::vector<int>> ids_;
+  uint64_t version_ = 0;
+  bool built_ = false;
+};
+
+// Последняя попытка пары студент-предмет: оценка с наибольшим ID.
+struct RetakePair {
+  int student_id = 0;
+  int grade_id = 0;  // 0 - последнюю попытку удалили, пара ждет пересчета (settle_retakes)
+  int value = 0;
+};
+
+// Последние попытки по одному предмету: пары по возрастанию ID студента и отдельно
+// долги (последняя оценка ниже kPassGrade) - (ID студента, оценка), тоже по возрастанию ID.
+struct SubjectRetakes {
+  std::vector<RetakePair> pairs;
+  std::vector<std::pair<int, int>> failing;
+};
+
+// Множество пересдач, которое хранилище поддерживает само: insert_grade, replace_grade
+// и erase_grades_if сообщают ему о каждой оценке, поэтому список пересдач за всю историю
+// и число долгов по группам строятся за время, пропорциональное числу долгов, а не оценок.
+// Удаление последней попытки при более ранних помечает пару: ее новую последнюю попытку
+// находит settle_retakes (один проход по оценкам на всю правку). Предметы копируются
+// при записи, как партиции оценок, поэтому снимок DataStore делит множество с оригиналом.
+class RetakeIndex {
+ public:
+  // Учитывает добавленную (или измененную, с тем же ID) оценку.
+  void add(const Grade& grade) {
+    SubjectRetakes& subject = subjects_[grade.subject_id].write();
+    auto it = find_pair(subject, grade.student_id);
+    if (it == subject.pairs.end() || it->student_id != grade.student_id) {
+      it = subject.pairs.insert(it, RetakePair{grade.student_id, 0, 0});
+    }
+    if (grade.id >= it->grade_id) {
+      set_latest(subject, *it, grade.id, grade.value);
+    }
+  }
+
+  // Учитывает удаленную оценку (или прежние поля измененной).
+  void remove(const Grade& grade) {
+    auto subject = subjects_.find(grade.subject_id);
+    if (subject == subjects_.end()) {
+      return;
+    }
+    const SubjectRetakes& current = subject->second;
+    auto it = find_pair(current, grade.student_id);
+    if (it == current.pairs.end() || it->student_id != grade.student_id || it->grade_id != grade.id) {
+      return;
+    }
+    size_t index = static_cast<size_t>(it - current.pairs.begin());
+    SubjectRetakes& writable = subject->second.write();
+    set_latest(writable, writable.pairs[index], 0, 0);
+    stale_.emplace_back(grade.subject_id, grade.student_id);
+  }
+
+  bool has_stale() const { return !stale_.empty(); }
+
+  // Пары (ID предмета, ID студента), ждущие пересчета; список очищается.
+  std::vector<std::pair<int, int>> take_stale() {
+    std::vector<std::pair<int, int>> stale;
+    stale.swap(stale_);
+    std::sort(stale.begin(), stale.end());
+    stale.erase(std::unique(stale.begin(), stale.end()), stale.end());
+    return stale;
+  }
+
+  // Записывает пересчитанную последнюю попытку пары; grade_id = 0 - оценок пары не осталось.
+  void resolve(int subject_id, int student_id, int grade_id, int value) {
+    auto subject = subjects_.find(subject_id);
+    if (subject == subjects_.end()) {
+      return;
+    }
+    SubjectRetakes& writable = subject->second.write();
+    auto it = find_pair(writable, student_id);
+    if (it == writable.pairs.end() || it->student_id != student_id) {
+      return;
+    }
+    set_latest(writable, *it, grade_id, value);
+    if (grade_id == 0) {
+      writable.pairs.erase(it);
+    }
+    if (writable.pairs.empty()) {
+      subjects_.erase(subject);
+    }
+  }
+
+  // Заменяет пары предмета целиком (pairs - по возрастанию ID студента, без пометок).
+  void assign(int subject_id, std::vector<RetakePair> pairs) {
+    SubjectRetakes subject;
+    subject.pairs = std::move(pairs);
+    for (const auto& pair : subject.pairs) {
+      if (pair.value < kPassGrade) {
+        subject.failing.emplace_back(pair.student_id, pair.value);
+      }
+    }
+    subjects_[subject_id] = Cow<SubjectRetakes>(std::move(subject));
+  }
+
+  void clear() {
+    subjects_.clear();
+    stale_.clear();
+  }
+
+  // Отделяет предметы от копий DataStore, как правка каждого (полная копия в --bench snapshot).
+  void detach() {
+    for (auto& entry : subjects_) {
+      entry.second.write();
+    }
+  }
+
+  // fn(ID предмета, ID студента, последняя оценка) для каждого долга: предметы и студенты
+  // внутри предмета - по возрастанию ID.
+  template <typename Fn>
+  void for_each_failing(Fn&& fn) const {
+    for (const auto& entry : subjects_) {
+      for (const auto& debt : entry.second->failing) {
+        fn(entry.first, debt.first, debt.second);
+      }
+    }
+  }
+
+ private:
+  static std::vector<RetakePair>::const_iterator find_pair(const SubjectRetakes& subject, int student_id) {
+    return std::lower_bound(subject.pairs.begin(), subject.pairs.end(), student_id,
+                            [](const RetakePair& pair, int id) { return pair.student_id < id; });
+  }
+  static std::vector<RetakePair>::iterator find_pair(SubjectRetakes& subject, int student_id) {
+    return std::lower_bound(subject.pairs.begin(), subject.pairs.end(), student_id,
+                            [](const RetakePair& pair, int id) { return pair.student_id < id; });
+  }
+
+  // Меняет последнюю попытку пары и поддерживает список долгов предмета.
+  static void set_latest(SubjectRetakes& subject, RetakePair& pair, int grade_id, int value) {
+    bool was_failing = pair.grade_id != 0 && pair.value < kPassGrade;
+    bool failing = grade_id != 0 && value < kPassGrade;
+    pair.grade_id = grade_id;
+    pair.value = value;
+    if (!was_failing && !failing) {
+      return;
+    }
+    auto it = std::lower_bound(subject.failing.begin(), subject.failing.end(), pair.student_id,
+                               [](const std::pair<int, int>& debt, int id) { return debt.first < id; });
+    if (was_failing && failing) {
+      it->second = value;
+    } else if (failing) {
+      subject.failing.insert(it, {pair.student_id, value});
+    } else {
+      subject.failing.erase(it);
+    }
+  }
+
+  std::map<int, Cow<SubjectRetakes>> subjects_;
+  std::vector<std::pair<int, int>> stale_;
 };
 
+// Данные приложения. Таблицы и партиции оценок копируются при записи, поэтому копия
+// DataStore (снимок для HTTP-сервера и фоновых отчетов) стоит O(числа партиций), а правка
+// копирует только измененную таблицу или партицию семестра, если ее держит снимок.
 struct DataStore {
-  std::vector<Student> students;
-  std::vector<Group> groups;
-  std::vector<Subject> subjects;
-  std::vector<Grade> grades;
+  CowTable<Student> students;
+  CowTable<Group> groups;
+  CowTable<Subject> subjects;
+  std::vector<Cow<GradePartition>> grade_partitions;  // упорядочены по semester
   int next_student_id = 1;
   int next_group_id = 1;
   int next_subject_id = 1;
   int next_grade_id = 1;
+  std::vector<PendingChange> pending_changes;
+  // pending_changes записываются целиком или не записываются (слияние дублей).
+  bool pending_all_or_nothing = false;
+  int64_t synced_seq = 0;  // последний номер изменения базы, учтенный в памяти
+  uint64_t generation = 0;  // растет при любом изменении данных в памяти (ключ кэша отчетов)
+  // Поиск дублей по именам (см. NameIndex).
+  NameIndex<Student> student_names;
+  NameIndex<Group> group_names;
+  NameIndex<Subject> subject_names;
+  RetakeIndex retakes;  // пересдачи за всю историю (см. RetakeIndex)
 };
 
-constexpr int kMinGrade = 1;
-constexpr int kMaxGrade = 5;
-constexpr int kPassGrade = 3;
+// Итог синхронизации с базой: ok - база доступна, conflicts - отклоненные изменения.
+struct SyncResult {
+  bool ok = true;
+  int conflicts = 0;
+  bool changed = false;  // данные в памяти изменились (свои правки или чужие)
+};
+
+// Хранилище данных (выбирается при запуске параметром --storage): загружает данные
+// и записывает накопленные изменения pending_changes.
+class StorageBackend {
+ public:
+  virtual ~StorageBackend() = default;
+  virtual const char* name() const = 0;
+  // Загружает данные; false - если хранилище недоступно.
+  virtual bool load(DataStore& data) = 0;
+  // Записывает изменения и, если хранилище это поддерживает, подтягивает чужие.
+  virtual SyncResult sync(DataStore& data) = 0;
+  // Дописывает данные на диск и останавливает фоновые потоки.
+  virtual void close() {}
+  // Сообщение о загрузке для пользователя (пусто - сообщать нечего).
+  virtual std::string load_message() const { return std::string(); }
+};
+
+constexpr int kSemesterAutumn = 1;  // сентябрь - январь
+constexpr int kSemesterSpring = 2;  // февраль - август
 constexpr char kCsvDelim = ';';
 const char* kDataDir = "data";
 const char* kExportDir = "exports";
 const char* kDbFileName = "data_store.db";
+constexpr int kBusyTimeoutMs = 5000;  // ожидание блокировки базы другим процессом
 
 std::string db_path();
 std::string export_path(const std::string& filename);
 void ensure_storage_dirs();
-bool save_data(const DataStore& data, const std::string& path);
-void autosave_or_warn(const DataStore& data);
+bool load_data(DataStore& data, const std::string& path);
+void sync_or_warn(DataStore& data);
+void publish_snapshot(const DataStore& data);
+void idle_precompute_start();
+void idle_precompute_stop();
+StorageBackend& storage();
 int create_group_record(DataStore& data, const std::string& name);
 
 // Удаляет пробелы по краям строки.
@@ -92,111 +658,535 @@ std::string to_lower_ascii(const std::string& input) {
   return out;
 }
 
-// Формирует путь к базе данных относительно корня проекта.
-std::string db_path() {
-  return (std::filesystem::path(kDataDir) / kDbFileName).string();
+// Кол-во установленных битов (переносимо, без зависимости от POPCNT).
+inline int popcount32(uint32_t v) {
+  v = v - ((v >> 1) & 0x55555555u);
+  v = (v & 0x33333333u) + ((v >> 2) & 0x33333333u);
+  return static_cast<int>((((v + (v >> 4)) & 0x0F0F0F0Fu) * 0x01010101u) >> 24);
 }
 
-// Формирует путь к файлу экспорта относительно корня проекта.
-std::string export_path(const std::string& filename) {
-  return (std::filesystem::path(kExportDir) / filename).string();
+// Скалярные версии: побайтовые циклы, они же запасной путь и эталон для бенчмарка.
+size_t utf8_length_scalar(const char* data, size_t size) {
+  size_t count = 0;
+  for (size_t i = 0; i < size; ++i) {
+    if ((static_cast<unsigned char>(data[i]) & 0xC0) != 0x80) {
+      ++count;
+    }
+  }
+  return count;
 }
 
-// Создает каталоги для хранения данных и экспортов.
-void ensure_storage_dirs() {
-  try {
-    std::filesystem::create_directories(kDataDir);
-    std::filesystem::create_directories(kExportDir);
-  } catch (...) {
-    std::cout << "Не удалось создать каталоги хранения.\n";
+// Продолжает поиск конца префикса с позиции start, уже насчитав count символов.
+size_t utf8_prefix_scalar_from(const char* data, size_t size, size_t start, size_t count, size_t max_chars) {
+  size_t i = start;
+  for (; i < size; ++i) {
+    unsigned char c = static_cast<unsigned char>(data[i]);
+    if ((c & 0xC0) != 0x80) {
+      if (count == max_chars) {
+        break;
+      }
+      ++count;
+    }
   }
+  return i;
 }
 
-// Читает строку из консоли с валидацией пустого ввода.
-std::string read_line(const std::string& prompt, bool allow_empty = false) {
-  while (true) {
-    std::cout << prompt;
-    std::string line;
-    if (!std::getline(std::cin, line)) {
-      std::cout << "\nВвод закрыт.\n";
-      std::exit(0);
+size_t utf8_prefix_scalar(const char* data, size_t size, size_t max_chars) {
+  if (max_chars == 0) {
+    return 0;
+  }
+  return utf8_prefix_scalar_from(data, size, 0, 0, max_chars);
+}
+
+// Проверяет одну последовательность UTF-8 с позиции i; возвращает ее длину или 0 при ошибке.
+size_t utf8_sequence_length(const unsigned char* s, size_t size, size_t i) {
+  unsigned char c = s[i];
+  if (c < 0x80) {
+    return 1;
+  }
+  size_t len = 0;
+  unsigned char lo = 0x80;
+  unsigned char hi = 0xBF;
+  if (c >= 0xC2 && c <= 0xDF) {
+    len = 2;
+  } else if (c >= 0xE0 && c <= 0xEF) {
+    len = 3;
+    if (c == 0xE0) {
+      lo = 0xA0;  // overlong
+    } else if (c == 0xED) {
+      hi = 0x9F;  // суррогаты
     }
-    if (allow_empty || !trim(line).empty()) {
-      return line;
+  } else if (c >= 0xF0 && c <= 0xF4) {
+    len = 4;
+    if (c == 0xF0) {
+      lo = 0x90;  // overlong
+    } else if (c == 0xF4) {
+      hi = 0x8F;  // больше U+10FFFF
+    }
+  } else {
+    return 0;
+  }
+  if (size - i < len) {
+    return 0;
+  }
+  if (s[i + 1] < lo || s[i + 1] > hi) {
+    return 0;
+  }
+  for (size_t k = 2; k < len; ++k) {
+    if ((s[i + k] & 0xC0) != 0x80) {
+      return 0;
     }
-    std::cout << "Поле не может быть пустым.\n";
   }
+  return len;
 }
 
-// Пробует разобрать целое число из строки.
-bool parse_int(const std::string& text, int& value) {
-  try {
-    size_t pos = 0;
-    int parsed = std::stoi(text, &pos);
-    if (pos != text.size()) {
+bool utf8_valid_scalar(const char* data, size_t size) {
+  const unsigned char* s = reinterpret_cast<const unsigned char*>(data);
+  size_t i = 0;
+  while (i < size) {
+    size_t len = utf8_sequence_length(s, size, i);
+    if (len == 0) {
       return false;
     }
-    value = parsed;
-    return true;
-  } catch (const std::exception&) {
-    return false;
+    i += len;
   }
+  return true;
 }
 
-// Пробует разобрать число с плавающей точкой из строки.
-bool parse_double(const std::string& text, double& value) {
-  try {
-    size_t pos = 0;
-    double parsed = std::stod(text, &pos);
-    if (pos != text.size()) {
-      return false;
+#ifdef GRADEBOOK_SIMD_X86
+// SSE2: байт является началом символа, если как знаковое число он больше -65 (0xBF).
+size_t utf8_length_sse2(const char* data, size_t size) {
+  const __m128i threshold = _mm_set1_epi8(-65);
+  const __m128i zero = _mm_setzero_si128();
+  size_t count = 0;
+  size_t i = 0;
+  while (i + 16 <= size) {
+    // Счетчики в байтах переполняются после 255 блоков, поэтому сворачиваем их пачками.
+    __m128i acc = _mm_setzero_si128();
+    size_t blocks = std::min<size_t>((size - i) / 16, 255);
+    for (size_t b = 0; b < blocks; ++b, i += 16) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+      acc = _mm_sub_epi8(acc, _mm_cmpgt_epi8(v, threshold));
     }
-    value = parsed;
-    return true;
-  } catch (const std::exception&) {
-    return false;
+    __m128i sums = _mm_sad_epu8(acc, zero);
+    count += static_cast<size_t>(_mm_cvtsi128_si32(sums)) +
+             static_cast<size_t>(_mm_cvtsi128_si32(_mm_srli_si128(sums, 8)));
   }
+  return count + utf8_length_scalar(data + i, size - i);
 }
 
-// Запрашивает у пользователя целое число в заданном диапазоне.
-int read_int(const std::string& prompt, int min_value, int max_value) {
-  while (true) {
-    std::string line = trim(read_line(prompt, true));
-    if (line.empty()) {
-      std::cout << "Введите число.\n";
-      continue;
-    }
-    int value = 0;
-    if (!parse_int(line, value)) {
-      std::cout << "Введите корректное целое число.\n";
-      continue;
-    }
-    if (value < min_value || value > max_value) {
-      std::cout << "Значение должно быть между " << min_value << " и " << max_value << ".\n";
-      continue;
+size_t utf8_prefix_sse2(const char* data, size_t size, size_t max_chars) {
+  if (max_chars == 0) {
+    return 0;
+  }
+  const __m128i threshold = _mm_set1_epi8(-65);
+  size_t count = 0;
+  size_t i = 0;
+  // Пропускаем целые блоки, пока граница префикса гарантированно дальше.
+  while (i + 16 <= size) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    size_t leads = static_cast<size_t>(popcount32(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(v, threshold)))));
+    if (count + leads > max_chars) {
+      break;
     }
-    return value;
+    count += leads;
+    i += 16;
   }
+  return utf8_prefix_scalar_from(data, size, i, count, max_chars);
 }
 
-// Запрашивает число, но допускает пустой ввод (false, если строка пустая).
-bool read_int_optional(const std::string& prompt, int min_value, int max_value, int& out) {
-  while (true) {
-    std::string line = trim(read_line(prompt, true));
-    if (line.empty()) {
-      return false;
-    }
-    int value = 0;
-    if (!parse_int(line, value)) {
-      std::cout << "Введите корректное целое число.\n";
-      continue;
+// SSE2 без pshufb: блоки из одного ASCII пропускаются целиком, остальное проверяется скалярно.
+bool utf8_valid_sse2(const char* data, size_t size) {
+  const unsigned char* s = reinterpret_cast<const unsigned char*>(data);
+  size_t i = 0;
+  while (i < size) {
+    if (i + 16 <= size) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+      if (_mm_movemask_epi8(v) == 0) {
+        i += 16;
+        continue;
+      }
     }
-    if (value < min_value || value > max_value) {
-      std::cout << "Значение должно быть между " << min_value << " и " << max_value << ".\n";
-      continue;
+    size_t len = utf8_sequence_length(s, size, i);
+    if (len == 0) {
+      return false;
     }
-    out = value;
-    return true;
+    i += len;
+  }
+  return true;
+}
+
+GRADEBOOK_TARGET_AVX2
+size_t utf8_length_avx2(const char* data, size_t size) {
+  const __m256i threshold = _mm256_set1_epi8(-65);
+  const __m256i zero = _mm256_setzero_si256();
+  size_t count = 0;
+  size_t i = 0;
+  while (i + 32 <= size) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t blocks = std::min<size_t>((size - i) / 32, 255);
+    for (size_t b = 0; b < blocks; ++b, i += 32) {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+      acc = _mm256_sub_epi8(acc, _mm256_cmpgt_epi8(v, threshold));
+    }
+    __m256i sums = _mm256_sad_epu8(acc, zero);
+    __m128i lo = _mm256_castsi256_si128(sums);
+    __m128i hi = _mm256_extracti128_si256(sums, 1);
+    __m128i total = _mm_add_epi64(lo, hi);
+    count += static_cast<size_t>(_mm_cvtsi128_si32(total)) +
+             static_cast<size_t>(_mm_cvtsi128_si32(_mm_srli_si128(total, 8)));
+  }
+  if (i + 16 <= size) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    count += static_cast<size_t>(popcount32(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(v, _mm_set1_epi8(-65))))));
+    i += 16;
+  }
+  // Сбрасываем верхние половины ymm перед переходом к не-VEX коду (иначе штраф SSE/AVX).
+  _mm256_zeroupper();
+  return count + utf8_length_scalar(data + i, size - i);
+}
+
+GRADEBOOK_TARGET_AVX2
+size_t utf8_prefix_avx2(const char* data, size_t size, size_t max_chars) {
+  if (max_chars == 0) {
+    return 0;
+  }
+  const __m256i threshold = _mm256_set1_epi8(-65);
+  size_t count = 0;
+  size_t i = 0;
+  while (i + 32 <= size) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    size_t leads = static_cast<size_t>(popcount32(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, threshold)))));
+    if (count + leads > max_chars) {
+      break;
+    }
+    count += leads;
+    i += 32;
+  }
+  _mm256_zeroupper();
+  return utf8_prefix_scalar_from(data, size, i, count, max_chars);
+}
+
+// Таблицы и шаги проверки UTF-8 по схеме "lookup" (Keiser, Lemire): ошибки
+// определяются по старшим/младшим полубайтам пары соседних байтов через vpshufb.
+GRADEBOOK_TARGET_AVX2
+inline __m256i utf8_avx2_prev(__m256i input, __m256i prev_input, int n) {
+  __m256i shifted = _mm256_permute2x128_si256(prev_input, input, 0x21);
+  switch (n) {
+    case 1:
+      return _mm256_alignr_epi8(input, shifted, 15);
+    case 2:
+      return _mm256_alignr_epi8(input, shifted, 14);
+    default:
+      return _mm256_alignr_epi8(input, shifted, 13);
+  }
+}
+
+GRADEBOOK_TARGET_AVX2
+inline __m256i utf8_avx2_check_block(__m256i input, __m256i prev_input) {
+  constexpr uint8_t kTooShort = 1 << 0;
+  constexpr uint8_t kTooLong = 1 << 1;
+  constexpr uint8_t kOverlong3 = 1 << 2;
+  constexpr uint8_t kTooLarge = 1 << 3;
+  constexpr uint8_t kSurrogate = 1 << 4;
+  constexpr uint8_t kOverlong2 = 1 << 5;
+  constexpr uint8_t kTooLarge1000 = 1 << 6;
+  constexpr uint8_t kOverlong4 = 1 << 6;
+  constexpr uint8_t kTwoConts = 1 << 7;
+  constexpr uint8_t kCarry = kTooShort | kTooLong | kTwoConts;
+
+  const __m256i low_nibble = _mm256_set1_epi8(0x0F);
+  __m256i prev1 = utf8_avx2_prev(input, prev_input, 1);
+  __m256i byte1_high_idx = _mm256_and_si256(_mm256_srli_epi16(prev1, 4), low_nibble);
+  __m256i byte1_low_idx = _mm256_and_si256(prev1, low_nibble);
+  __m256i byte2_high_idx = _mm256_and_si256(_mm256_srli_epi16(input, 4), low_nibble);
+
+#define GRADEBOOK_TABLE16(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+  const __m256i byte1_high_table = GRADEBOOK_TABLE16(
+      kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong,
+      kTwoConts, kTwoConts, kTwoConts, kTwoConts,
+      kTooShort | kOverlong2,
+      kTooShort,
+      kTooShort | kOverlong3 | kSurrogate,
+      static_cast<char>(kTooShort | kTooLarge | kTooLarge1000 | kOverlong4));
+  const __m256i byte1_low_table = GRADEBOOK_TABLE16(
+      kCarry | kOverlong3 | kOverlong2 | kOverlong4,
+      kCarry | kOverlong2,
+      kCarry,
+      kCarry,
+      kCarry | kTooLarge,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000 | kSurrogate,
+      kCarry | kTooLarge | kTooLarge1000,
+      kCarry | kTooLarge | kTooLarge1000);
+  const __m256i byte2_high_table = GRADEBOOK_TABLE16(
+      kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort,
+      kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge1000 | kOverlong4,
+      kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge,
+      kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge,
+      kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge,
+      kTooShort, kTooShort, kTooShort, kTooShort);
+#undef GRADEBOOK_TABLE16
+
+  __m256i special = _mm256_and_si256(
+      _mm256_and_si256(_mm256_shuffle_epi8(byte1_high_table, byte1_high_idx),
+                       _mm256_shuffle_epi8(byte1_low_table, byte1_low_idx)),
+      _mm256_shuffle_epi8(byte2_high_table, byte2_high_idx));
+
+  // Байты на позициях 3 и 4 многобайтовых символов обязаны быть продолжениями.
+  __m256i prev2 = utf8_avx2_prev(input, prev_input, 2);
+  __m256i prev3 = utf8_avx2_prev(input, prev_input, 3);
+  __m256i is_third = _mm256_subs_epu8(prev2, _mm256_set1_epi8(static_cast<char>(0xE0 - 0x80)));
+  __m256i is_fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8(static_cast<char>(0xF0 - 0x80)));
+  __m256i must23 = _mm256_and_si256(_mm256_or_si256(is_third, is_fourth),
+                                    _mm256_set1_epi8(static_cast<char>(0x80)));
+  return _mm256_xor_si256(must23, special);
+}
+
+GRADEBOOK_TARGET_AVX2
+bool utf8_valid_avx2(const char* data, size_t size) {
+  __m256i error = _mm256_setzero_si256();
+  __m256i prev = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    error = _mm256_or_si256(error, utf8_avx2_check_block(input, prev));
+    prev = input;
+  }
+  // Хвост дополняется нулями (ASCII), поэтому незавершенная последовательность
+  // в конце строки дает ошибку "слишком короткая" в дополнительном блоке.
+  alignas(32) char tail[32] = {};
+  std::copy(data + i, data + size, tail);
+  __m256i input = _mm256_load_si256(reinterpret_cast<const __m256i*>(tail));
+  error = _mm256_or_si256(error, utf8_avx2_check_block(input, prev));
+  bool ok = _mm256_testz_si256(error, error) != 0;
+  _mm256_zeroupper();
+  return ok;
+}
+
+// Проверяет поддержку AVX2 процессором и ОС.
+bool cpu_has_avx2() {
+#ifdef _MSC_VER
+  int info[4] = {};
+  __cpuid(info, 0);
+  if (info[0] < 7) {
+    return false;
+  }
+  __cpuid(info, 1);
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  bool avx = (info[2] & (1 << 28)) != 0;
+  if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+    return false;
+  }
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+#endif  // GRADEBOOK_SIMD_X86
+
+// Набор реализаций UTF-8 функций, выбранный под текущий процессор.
+struct Utf8Kernels {
+  const char* name = "scalar";
+  size_t (*length)(const char*, size_t) = utf8_length_scalar;
+  size_t (*prefix)(const char*, size_t, size_t) = utf8_prefix_scalar;
+  bool (*valid)(const char*, size_t) = utf8_valid_scalar;
+};
+
+const Utf8Kernels& utf8_kernels() {
+  static const Utf8Kernels kernels = [] {
+    Utf8Kernels k;
+#ifdef GRADEBOOK_SIMD_X86
+    if (cpu_has_avx2()) {
+      k = {"avx2", utf8_length_avx2, utf8_prefix_avx2, utf8_valid_avx2};
+    } else {
+      k = {"sse2", utf8_length_sse2, utf8_prefix_sse2, utf8_valid_sse2};
+    }
+#endif
+    return k;
+  }();
+  return kernels;
+}
+
+// Строки короче этого порога обрабатываются скалярно: векторный блок не заполнится.
+constexpr size_t kUtf8SimdMinBytes = 16;
+
+// Считает длину строки в символах UTF-8.
+size_t utf8_length(std::string_view text) {
+  if (text.size() < kUtf8SimdMinBytes) {
+    return utf8_length_scalar(text.data(), text.size());
+  }
+  return utf8_kernels().length(text.data(), text.size());
+}
+
+// Возвращает длину в байтах префикса, содержащего не более max_chars символов UTF-8.
+size_t utf8_prefix_bytes(std::string_view text, size_t max_chars) {
+  if (text.size() < kUtf8SimdMinBytes) {
+    return utf8_prefix_scalar(text.data(), text.size(), max_chars);
+  }
+  return utf8_kernels().prefix(text.data(), text.size(), max_chars);
+}
+
+// Обрезает строку до заданного количества символов UTF-8.
+std::string utf8_truncate(std::string_view text, size_t max_chars) {
+  return std::string(text.substr(0, utf8_prefix_bytes(text, max_chars)));
+}
+
+// Проверяет, что строка - корректный UTF-8 (без overlong, суррогатов и кодов > U+10FFFF).
+bool utf8_valid(std::string_view text) {
+  if (text.size() < kUtf8SimdMinBytes) {
+    return utf8_valid_scalar(text.data(), text.size());
+  }
+  return utf8_kernels().valid(text.data(), text.size());
+}
+
+// Путь к базе, заданный параметром --db (пусто - путь по умолчанию).
+std::string& db_path_override() {
+  static std::string path;
+  return path;
+}
+
+// Формирует путь к базе данных относительно корня проекта.
+std::string db_path() {
+  if (!db_path_override().empty()) {
+    return db_path_override();
+  }
+  return (std::filesystem::path(kDataDir) / kDbFileName).string();
+}
+
+// Формирует путь к файлу экспорта относительно корня проекта.
+std::string export_path(const std::string& filename) {
+  return (std::filesystem::path(kExportDir) / filename).string();
+}
+
+// Создает каталоги для хранения данных и экспортов.
+void ensure_storage_dirs() {
+  try {
+    std::filesystem::create_directories(kDataDir);
+    std::filesystem::create_directories(kExportDir);
+  } catch (...) {
+    std::cout << "Не удалось создать каталоги хранения.\n";
+  }
+}
+
+// Читает строку из консоли с валидацией пустого ввода.
+std::string read_line(const std::string& prompt, bool allow_empty = false) {
+  while (true) {
+    std::cout << prompt;
+    std::string line;
+    // Пока пользователь думает, фоновый поток прогревает отчеты; ввод его сразу останавливает.
+    idle_precompute_start();
+    bool has_line = static_cast<bool>(std::getline(std::cin, line));
+    idle_precompute_stop();
+    if (!has_line) {
+      std::cout << "\nВвод закрыт.\n";
+      std::exit(0);
+    }
+    // Отсекаем ввод не в UTF-8 (например, консоль в CP866/CP1251) до разбора.
+    if (!utf8_valid(line)) {
+      std::cout << "Некорректная кодировка ввода: ожидается UTF-8 (chcp 65001).\n";
+      continue;
+    }
+    if (allow_empty || !trim(line).empty()) {
+      return line;
+    }
+    std::cout << "Поле не может быть пустым.\n";
+  }
+}
+
+// Пробует разобрать целое число из строки.
+bool parse_int(const std::string& text, int& value) {
+  try {
+    size_t pos = 0;
+    int parsed = std::stoi(text, &pos);
+    if (pos != text.size()) {
+      return false;
+    }
+    value = parsed;
+    return true;
+  } catch (const std::exception&) {
+    return false;
+  }
+}
+
+// Пробует разобрать 64-битное целое число из строки.
+bool parse_int(const std::string& text, int64_t& value) {
+  try {
+    size_t pos = 0;
+    long long parsed = std::stoll(text, &pos);
+    if (pos != text.size()) {
+      return false;
+    }
+    value = parsed;
+    return true;
+  } catch (const std::exception&) {
+    return false;
+  }
+}
+
+// Пробует разобрать число с плавающей точкой из строки.
+bool parse_double(const std::string& text, double& value) {
+  try {
+    size_t pos = 0;
+    double parsed = std::stod(text, &pos);
+    if (pos != text.size()) {
+      return false;
+    }
+    value = parsed;
+    return true;
+  } catch (const std::exception&) {
+    return false;
+  }
+}
+
+// Запрашивает у пользователя целое число в заданном диапазоне.
+int read_int(const std::string& prompt, int min_value, int max_value) {
+  while (true) {
+    std::string line = trim(read_line(prompt, true));
+    if (line.empty()) {
+      std::cout << "Введите число.\n";
+      continue;
+    }
+    int value = 0;
+    if (!parse_int(line, value)) {
+      std::cout << "Введите корректное целое число.\n";
+      continue;
+    }
+    if (value < min_value || value > max_value) {
+      std::cout << "Значение должно быть между " << min_value << " и " << max_value << ".\n";
+      continue;
+    }
+    return value;
+  }
+}
+
+// Запрашивает число, но допускает пустой ввод (false, если строка пустая).
+bool read_int_optional(const std::string& prompt, int min_value, int max_value, int& out) {
+  while (true) {
+    std::string line = trim(read_line(prompt, true));
+    if (line.empty()) {
+      return false;
+    }
+    int value = 0;
+    if (!parse_int(line, value)) {
+      std::cout << "Введите корректное целое число.\n";
+      continue;
+    }
+    if (value < min_value || value > max_value) {
+      std::cout << "Значение должно быть между " << min_value << " и " << max_value << ".\n";
+      continue;
+    }
+    out = value;
+    return true;
   }
 }
 
@@ -221,16 +1211,6 @@ bool read_double_optional(const std::string& prompt, double min_value, double ma
   }
 }
 
-// Ищет студента по ID (изменяемая версия).
-Student* find_student(DataStore& data, int id) {
-  for (auto& student : data.students) {
-    if (student.id == id) {
-      return &student;
-    }
-  }
-  return nullptr;
-}
-
 // Ищет студента по ID (константная версия).
 const Student* find_student(const DataStore& data, int id) {
   for (const auto& student : data.students) {
@@ -241,16 +1221,6 @@ const Student* find_student(const DataStore& data, int id) {
   return nullptr;
 }
 
-// Ищет группу по ID (изменяемая версия).
-Group* find_group(DataStore& data, int id) {
-  for (auto& group : data.groups) {
-    if (group.id == id) {
-      return &group;
-    }
-  }
-  return nullptr;
-}
-
 // Ищет группу по ID (константная версия).
 const Group* find_group(const DataStore& data, int id) {
   for (const auto& group : data.groups) {
@@ -261,16 +1231,6 @@ const Group* find_group(const DataStore& data, int id) {
   return nullptr;
 }
 
-// Ищет предмет по ID (изменяемая версия).
-Subject* find_subject(DataStore& data, int id) {
-  for (auto& subject : data.subjects) {
-    if (subject.id == id) {
-      return &subject;
-    }
-  }
-  return nullptr;
-}
-
 // Ищет предмет по ID (константная версия).
 const Subject* find_subject(const DataStore& data, int id) {
   for (const auto& subject : data.subjects) {
@@ -281,1987 +1241,11561 @@ const Subject* find_subject(const DataStore& data, int id) {
   return nullptr;
 }
 
-// Ищет оценку по ID (изменяемая версия).
-Grade* find_grade(DataStore& data, int id) {
-  for (auto& grade : data.grades) {
-    if (grade.id == id) {
-      return &grade;
+// Запись таблицы с этим ID для изменения; nullptr - такой нет. Таблица копируется,
+// если ее держит снимок, поэтому для простого поиска нужны find_student/find_group/find_subject.
+template <typename Entity>
+Entity* entity_for_update(CowTable<Entity>& table, int id) {
+  for (size_t i = 0; i < table.size(); ++i) {
+    if (table[i].id == id) {
+      return &table.write()[i];
     }
   }
   return nullptr;
 }
 
-// Ищет оценку по ID (константная версия).
-const Grade* find_grade(const DataStore& data, int id) {
-  for (const auto& grade : data.grades) {
-    if (grade.id == id) {
-      return &grade;
+// Плотные номера (слоты) сущностей для агрегации в плоских таблицах вместо std::map:
+// слоты 0..count()-1 идут по возрастанию ID, поэтому обход таблицы по слотам дает
+// тот же порядок, что и обход std::map по ID. Строятся по вектору хранилища за O(max ID)
+// на время одного отчета.
+class EntitySlots {
+ public:
+  template <typename Table>
+  explicit EntitySlots(const Table& items) {
+    int max_id = 0;
+    for (const auto& item : items) {
+      max_id = std::max(max_id, item.id);
+    }
+    std::vector<int> position(static_cast<size_t>(max_id) + 1, -1);
+    for (size_t i = 0; i < items.size(); ++i) {
+      if (items[i].id > 0) {
+        position[static_cast<size_t>(items[i].id)] = static_cast<int>(i);
+      }
+    }
+    slot_.assign(position.size(), -1);
+    for (size_t id = 0; id < position.size(); ++id) {
+      if (position[id] >= 0) {
+        slot_[id] = static_cast<int>(index_.size());
+        index_.push_back(position[id]);
+      }
     }
   }
-  return nullptr;
-}
 
-// Вычисляет номер следующей попытки сдачи предмета.
-int next_attempt(const DataStore& data, int student_id, int subject_id) {
-  int attempt = 1;
-  for (const auto& grade : data.grades) {
-    if (grade.student_id == student_id && grade.subject_id == subject_id) {
-      // Берем максимальный номер попытки по имеющимся оценкам.
-      attempt = std::max(attempt, grade.attempt + 1);
-    }
+  size_t count() const { return index_.size(); }
+  // Слот сущности с этим ID; -1 - такой нет.
+  int slot(int id) const {
+    return id >= 0 && static_cast<size_t>(id) < slot_.size() ? slot_[static_cast<size_t>(id)] : -1;
   }
-  return attempt;
-}
+  // Позиция сущности слота в векторе хранилища.
+  size_t index(int slot) const { return static_cast<size_t>(index_[static_cast<size_t>(slot)]); }
 
-struct SubjectAggregate {
-  int sum = 0;
-  int count = 0;
-  int latest_grade_id = 0;
-  int latest_value = 0;
-  int latest_attempt = 0;
+ private:
+  std::vector<int> slot_;
+  std::vector<int> index_;
 };
 
-// Собирает статистику по предметам студента (сумма, количество, последняя оценка).
-std::map<int, SubjectAggregate> subject_aggregates_for_student(const DataStore& data, int student_id) {
-  std::map<int, SubjectAggregate> aggregates;
-  for (const auto& grade : data.grades) {
-    if (grade.student_id != student_id) {
-      continue;
-    }
-    SubjectAggregate& agg = aggregates[grade.subject_id];
-    agg.sum += grade.value;
-    agg.count += 1;
-    if (grade.id > agg.latest_grade_id) {
-      agg.latest_grade_id = grade.id;
-      agg.latest_value = grade.value;
-      agg.latest_attempt = grade.attempt;
-    }
+// Период отчетов: диапазон кодов семестров [from, to]; по умолчанию - вся история.
+struct Period {
+  int from = std::numeric_limits<int>::min();
+  int to = std::numeric_limits<int>::max();
+
+  bool contains(int semester) const { return semester >= from && semester <= to; }
+  bool is_all() const {
+    return from == std::numeric_limits<int>::min() && to == std::numeric_limits<int>::max();
   }
-  return aggregates;
+};
+
+// Разбирает Unix time в локальное календарное время.
+std::tm local_time(int64_t timestamp) {
+  std::time_t t = static_cast<std::time_t>(timestamp);
+  std::tm tm_value{};
+#ifdef _WIN32
+  localtime_s(&tm_value, &t);
+#else
+  localtime_r(&t, &tm_value);
+#endif
+  return tm_value;
 }
 
-// Считает средний балл студента по каждому предмету (все оценки), затем усредняет.
-double average_subjects_for_student(const DataStore& data, int student_id) {
-  auto aggregates = subject_aggregates_for_student(data, student_id);
-  if (aggregates.empty()) {
-    return -1.0;
-  }
-  double sum = 0.0;
-  int count = 0;
-  for (const auto& entry : aggregates) {
-    const SubjectAggregate& agg = entry.second;
-    if (agg.count > 0) {
-      sum += static_cast<double>(agg.sum) / static_cast<double>(agg.count);
-      ++count;
-    }
+// Текущее время в секундах Unix.
+int64_t now_unix() {
+  return static_cast<int64_t>(std::time(nullptr));
+}
+
+// Собирает код семестра: учебный год (год сентября) * 10 + номер полугодия.
+int make_semester(int academic_year, int term) {
+  return academic_year * 10 + term;
+}
+
+// Определяет семестр по дате: сентябрь-январь - осенний, февраль-август - весенний.
+int semester_for_time(int64_t timestamp) {
+  std::tm tm_value = local_time(timestamp);
+  int year = tm_value.tm_year + 1900;
+  int month = tm_value.tm_mon + 1;
+  if (month >= 9) {
+    return make_semester(year, kSemesterAutumn);
   }
-  if (count == 0) {
-    return -1.0;
+  if (month == 1) {
+    return make_semester(year - 1, kSemesterAutumn);
   }
-  return sum / static_cast<double>(count);
+  return make_semester(year - 1, kSemesterSpring);
 }
 
-// Считает средний балл по предмету по всем оценкам (все попытки).
-double average_all_for_subject(const DataStore& data, int subject_id, int* count_out) {
-  int sum = 0;
-  int count = 0;
-  for (const auto& grade : data.grades) {
-    if (grade.subject_id == subject_id) {
-      sum += grade.value;
-      ++count;
-    }
-  }
-  if (count_out) {
-    *count_out = count;
-  }
-  if (count == 0) {
-    return -1.0;
-  }
-  return static_cast<double>(sum) / static_cast<double>(count);
-}
-
-// Форматирует среднее значение для вывода.
-std::string format_avg(double value) {
-  if (value < 0.0) {
-    return "нет";
-  }
-  std::ostringstream out;
-  out << std::fixed << std::setprecision(2) << value;
-  return out.str();
+int current_semester() {
+  return semester_for_time(now_unix());
 }
 
-// Считает длину строки в символах UTF-8.
-size_t utf8_length(const std::string& text) {
-  size_t count = 0;
-  for (unsigned char c : text) {
-    if ((c & 0xC0) != 0x80) {
-      ++count;
-    }
+// Проверяет, что код семестра корректен (0 - оценки без даты).
+bool is_valid_semester(int semester) {
+  if (semester == 0) {
+    return true;
   }
-  return count;
+  int term = semester % 10;
+  int year = semester / 10;
+  return year >= 1900 && year <= 9999 && (term == kSemesterAutumn || term == kSemesterSpring);
 }
 
-// Обрезает строку до заданного количества символов UTF-8.
-std::string utf8_truncate(const std::string& text, size_t max_chars) {
-  if (max_chars == 0) {
-    return std::string();
+// Название семестра для вывода, например "2025/26 осень".
+std::string semester_name(int semester) {
+  if (semester == 0) {
+    return "без даты";
   }
-  size_t count = 0;
-  size_t i = 0;
-  for (; i < text.size(); ++i) {
-    unsigned char c = static_cast<unsigned char>(text[i]);
-    if ((c & 0xC0) != 0x80) {
-      if (count == max_chars) {
-        break;
-      }
-      ++count;
-    }
+  int year = semester / 10;
+  std::string out = std::to_string(year) + "/";
+  int next = (year + 1) % 100;
+  if (next < 10) {
+    out += '0';
   }
-  return text.substr(0, i);
+  out += std::to_string(next);
+  out += (semester % 10 == kSemesterAutumn) ? " осень" : " весна";
+  return out;
 }
 
-// Подгоняет строку под ширину, при необходимости добавляя многоточие.
-std::string fit_cell(const std::string& text, size_t width) {
-  if (utf8_length(text) <= width) {
-    return text;
+// Описание периода для заголовков отчетов.
+std::string period_name(const Period& period) {
+  if (period.is_all()) {
+    return "вся история";
   }
-  if (width <= 3) {
-    return utf8_truncate(text, width);
+  if (period.from == period.to) {
+    return semester_name(period.from);
   }
-  return utf8_truncate(text, width - 3) + "...";
+  std::string from = period.from == std::numeric_limits<int>::min() ? "начала" : semester_name(period.from);
+  std::string to = period.to == std::numeric_limits<int>::max() ? "текущего" : semester_name(period.to);
+  return from + " - " + to;
 }
 
-// Дополняет строку пробелами справа до нужной ширины.
-std::string pad_right_utf8(const std::string& text, size_t width) {
-  size_t len = utf8_length(text);
-  if (len >= width) {
-    return text;
+// Форматирует дату оценки (ДД.ММ.ГГГГ).
+std::string format_date(int64_t timestamp) {
+  if (timestamp <= 0) {
+    return "-";
   }
-  return text + std::string(width - len, ' ');
+  std::tm tm_value = local_time(timestamp);
+  char buf[16];
+  std::strftime(buf, sizeof(buf), "%d.%m.%Y", &tm_value);
+  return buf;
 }
 
-// Дополняет строку пробелами слева до нужной ширины.
-std::string pad_left_utf8(const std::string& text, size_t width) {
-  size_t len = utf8_length(text);
-  if (len >= width) {
-    return text;
-  }
-  return std::string(width - len, ' ') + text;
-}
+// Прерывание прогрева: бросается проходом по оценкам или приемником отчета, как только
+// меню снова получило ввод (см. IdlePrecompute).
+struct PrecomputeCancelled {};
 
-// Печатает строку таблицы с фиксированными ширинами столбцов.
-void print_table_row(const std::vector<std::string>& cols,
-                     const std::vector<int>& widths,
-                     const std::vector<bool>& align_right) {
-  for (size_t i = 0; i < widths.size(); ++i) {
-    size_t width = widths[i] < 1 ? 1 : static_cast<size_t>(widths[i]);
-    std::string cell = (i < cols.size()) ? fit_cell(cols[i], width) : std::string();
-    bool right = i < align_right.size() && align_right[i];
-    cell = right ? pad_left_utf8(cell, width) : pad_right_utf8(cell, width);
-    std::cout << "| " << cell << " ";
-  }
-  std::cout << "|\n";
+constexpr size_t kCancelCheckGrades = 65536;  // как часто проход по оценкам проверяет отмену
+
+// Флаг отмены отчета, который строит текущий поток; nullptr - отчет не прерывается.
+const std::atomic<bool>*& aggregation_cancel() {
+  thread_local const std::atomic<bool>* cancel = nullptr;
+  return cancel;
 }
 
-// Упрощенный вариант без выравнивания вправо.
-void print_table_row(const std::vector<std::string>& cols, const std::vector<int>& widths) {
-  print_table_row(cols, widths, {});
+void check_aggregation_cancel() {
+  const std::atomic<bool>* cancel = aggregation_cancel();
+  if (cancel && cancel->load(std::memory_order_relaxed)) {
+    throw PrecomputeCancelled{};
+  }
 }
 
-// Печатает линию-разделитель таблицы.
-void print_table_line(const std::vector<int>& widths) {
-  for (size_t i = 0; i < widths.size(); ++i) {
-    size_t width = widths[i] < 1 ? 1 : static_cast<size_t>(widths[i]);
-    std::cout << "+" << std::string(width + 2, '-');
+// Вызывает fn для каждой партиции, попадающей в период.
+template <typename Fn>
+void for_each_partition(const DataStore& data, const Period& period, Fn&& fn) {
+  auto it = std::lower_bound(data.grade_partitions.begin(), data.grade_partitions.end(), period.from,
+                             [](const GradePartition& part, int semester) { return part.semester < semester; });
+  for (; it != data.grade_partitions.end() && (*it)->semester <= period.to; ++it) {
+    check_aggregation_cancel();
+    fn(it->get());
   }
-  std::cout << "+\n";
 }
 
-// Собирает список оценок в строку.
-std::string join_grades(const std::vector<int>& values) {
-  std::ostringstream out;
-  for (size_t i = 0; i < values.size(); ++i) {
-    if (i > 0) {
-      out << ", ";
+// Вызывает fn для каждой оценки из партиций, попадающих в период. Отмена проверяется
+// между блоками по kCancelCheckGrades оценок, а не на каждой.
+template <typename Fn>
+void for_each_grade(const DataStore& data, const Period& period, Fn&& fn) {
+  for_each_partition(data, period, [&](const GradePartition& part) {
+    for (size_t begin = 0; begin < part.size(); begin += kCancelCheckGrades) {
+      if (begin > 0) {
+        check_aggregation_cancel();
+      }
+      size_t end = std::min(part.size(), begin + kCancelCheckGrades);
+      for (size_t i = begin; i < end; ++i) {
+        fn(part.grade_at(i));
+      }
     }
-    out << values[i];
-  }
-  return out.str();
+  });
 }
 
-double average_from_values(const std::vector<int>& values) {
-  if (values.empty()) {
-    return -1.0;
-  }
-  int sum = 0;
-  for (int value : values) {
-    sum += value;
+// Общее количество оценок во всех партициях.
+size_t grade_count(const DataStore& data) {
+  size_t count = 0;
+  for (const GradePartition& part : data.grade_partitions) {
+    count += part.grades.size();
   }
-  return static_cast<double>(sum) / static_cast<double>(values.size());
+  return count;
 }
 
-std::vector<int> grades_for_student_subject(const DataStore& data, int student_id, int subject_id) {
-  std::vector<Grade> grades;
-  for (const auto& grade : data.grades) {
-    if (grade.student_id == student_id && grade.subject_id == subject_id) {
-      grades.push_back(grade);
-    }
-  }
-  std::sort(grades.begin(), grades.end(),
-            [](const Grade& a, const Grade& b) { return a.attempt < b.attempt; });
-  std::vector<int> values;
-  values.reserve(grades.size());
-  for (const auto& grade : grades) {
-    values.push_back(grade.value);
+// Отдает лишнюю емкость массивов оценок (после загрузки большого объема данных).
+void shrink_grade_storage(DataStore& data) {
+  for (auto& part : data.grade_partitions) {
+    part.write().grades.shrink_to_fit();
   }
-  return values;
 }
 
-std::map<int, std::vector<int>> grades_by_subject_for_student(const DataStore& data, int student_id) {
-  std::map<int, std::vector<Grade>> by_subject;
-  for (const auto& grade : data.grades) {
-    if (grade.student_id == student_id) {
-      by_subject[grade.subject_id].push_back(grade);
-    }
-  }
-  std::map<int, std::vector<int>> result;
-  for (auto& entry : by_subject) {
-    auto& grades = entry.second;
-    std::sort(grades.begin(), grades.end(),
-              [](const Grade& a, const Grade& b) { return a.attempt < b.attempt; });
-    std::vector<int> values;
-    values.reserve(grades.size());
-    for (const auto& grade : grades) {
-      values.push_back(grade.value);
-    }
-    result[entry.first] = std::move(values);
+// Возвращает партицию семестра, создавая ее при необходимости (с сохранением порядка).
+GradePartition& partition_for_semester(DataStore& data, int semester) {
+  auto it = std::lower_bound(data.grade_partitions.begin(), data.grade_partitions.end(), semester,
+                             [](const GradePartition& part, int value) { return part.semester < value; });
+  if (it == data.grade_partitions.end() || (*it)->semester != semester) {
+    GradePartition part;
+    part.semester = semester;
+    it = data.grade_partitions.insert(it, Cow<GradePartition>(std::move(part)));
   }
-  return result;
+  return it->write();
 }
 
-bool matches_group_filter(const Student& student, int group_filter) {
-  if (group_filter == 0) {
-    return true;
-  }
-  if (group_filter == -1) {
-    return student.group_id == 0;
-  }
-  return student.group_id == group_filter;
+// Учитывает оценку в распределении предмета партиции (delta = 1) или убирает ее (-1).
+void count_grade(GradePartition& part, const Grade& grade, int delta) {
+  part.subject_histograms[grade.subject_id].add(grade.value, delta);
 }
 
-std::vector<const Student*> students_for_group_sorted(const DataStore& data, int group_filter) {
-  std::vector<const Student*> result;
-  for (const auto& student : data.students) {
-    if (matches_group_filter(student, group_filter)) {
-      result.push_back(&student);
-    }
+// Находит новые последние попытки пар, помеченных RetakeIndex::remove: один проход по
+// оценкам на все помеченные пары. Вызывается в конце каждой правки оценок.
+void settle_retakes(DataStore& data) {
+  if (!data.retakes.has_stale()) {
+    return;
   }
-  std::sort(result.begin(), result.end(), [](const Student* a, const Student* b) {
-    std::string a_name = to_lower_ascii(a->name);
-    std::string b_name = to_lower_ascii(b->name);
-    if (a_name != b_name) {
-      return a_name < b_name;
+  std::vector<std::pair<int, int>> stale = data.retakes.take_stale();
+  std::vector<RetakePair> latest(stale.size());
+  for_each_grade(data, Period(), [&](const Grade& grade) {
+    auto it = std::lower_bound(stale.begin(), stale.end(), std::make_pair(grade.subject_id, grade.student_id));
+    if (it == stale.end() || *it != std::make_pair(grade.subject_id, grade.student_id)) {
+      return;
+    }
+    RetakePair& pair = latest[static_cast<size_t>(it - stale.begin())];
+    if (grade.id > pair.grade_id) {
+      pair.grade_id = grade.id;
+      pair.value = grade.value;
     }
-    return a->id < b->id;
   });
-  return result;
+  for (size_t i = 0; i < stale.size(); ++i) {
+    data.retakes.resolve(stale[i].first, stale[i].second, latest[i].grade_id, latest[i].value);
+  }
 }
 
-
-// Возвращает имя студента или запасной текст, если не найден.
-std::string student_name_or_unknown(const DataStore& data, int id) {
-  const Student* student = find_student(data, id);
-  return student ? student->name : "Неизвестно";
+// Строит множество пересдач заново по всем оценкам (после загрузки).
+void rebuild_retakes(DataStore& data) {
+  std::map<int, std::vector<RetakePair>> subjects;
+  for_each_grade(data, Period(), [&](const Grade& grade) {
+    subjects[grade.subject_id].push_back({grade.student_id, grade.id, grade.value});
+  });
+  data.retakes.clear();
+  for (auto& entry : subjects) {
+    std::vector<RetakePair>& pairs = entry.second;
+    std::sort(pairs.begin(), pairs.end(), [](const RetakePair& a, const RetakePair& b) {
+      return a.student_id != b.student_id ? a.student_id < b.student_id : a.grade_id > b.grade_id;
+    });
+    // После сортировки первая запись студента - его последняя попытка.
+    pairs.erase(std::unique(pairs.begin(), pairs.end(),
+                            [](const RetakePair& a, const RetakePair& b) { return a.student_id == b.student_id; }),
+                pairs.end());
+    pairs.shrink_to_fit();
+    data.retakes.assign(entry.first, std::move(pairs));
+  }
 }
 
-// Возвращает название предмета или запасной текст, если не найден.
-std::string subject_name_or_unknown(const DataStore& data, int id) {
-  const Subject* subject = find_subject(data, id);
-  return subject ? subject->name : "Неизвестно";
+// Добавляет оценку в партицию ее семестра.
+void insert_grade(DataStore& data, const Grade& grade) {
+  GradePartition& part = partition_for_semester(data, grade.semester);
+  part.append(grade);
+  count_grade(part, grade, 1);
+  data.retakes.add(grade);
 }
 
-// Возвращает название группы или текст по умолчанию.
-std::string group_name_or_none(const DataStore& data, int id) {
-  if (id == 0) {
-    return "Без группы";
-  }
-  const Group* group = find_group(data, id);
-  return group ? group->name : "Неизвестная группа";
+// Заменяет оценку в позиции index партиции part новыми значениями полей. Если сменились
+// ID, студент или предмет, прежняя пара может ждать пересчета: после всех замен правки
+// нужен settle_retakes.
+void replace_grade(DataStore& data, Cow<GradePartition>& part, size_t index, const Grade& grade) {
+  Grade old = part->grade_at(index);
+  GradePartition& writable = part.write();
+  count_grade(writable, old, -1);
+  writable.store(index, grade);
+  count_grade(writable, grade, 1);
+  if (old.id != grade.id || old.student_id != grade.student_id || old.subject_id != grade.subject_id) {
+    data.retakes.remove(old);
+  }
+  data.retakes.add(grade);
 }
 
-// Запрашивает ID группы, 0 означает "без группы".
-int read_group_id_allow_none(const DataStore& data, const std::string& prompt) {
-  while (true) {
-    int id = read_int(prompt, 0, std::numeric_limits<int>::max());
-    if (id == 0) {
-      return 0;
-    }
-    if (find_group(data, id)) {
-      return id;
+// Заменяет оценку с ID grade.id; false - если такой оценки нет.
+bool replace_grade(DataStore& data, const Grade& grade) {
+  for (auto& part : data.grade_partitions) {
+    for (size_t i = 0; i < part->size(); ++i) {
+      if (part->grades[i].id == grade.id) {
+        replace_grade(data, part, i, grade);
+        settle_retakes(data);
+        return true;
+      }
     }
-    std::cout << "Группа не найдена.\n";
   }
+  return false;
 }
 
-// Запрашивает ID группы, допускает пустой ввод (false, если пусто).
-bool read_group_id_optional(const DataStore& data, const std::string& prompt, int& out) {
-  while (true) {
-    std::string line = trim(read_line(prompt, true));
-    if (line.empty()) {
-      return false;
-    }
-    int value = 0;
-    if (!parse_int(line, value)) {
-      std::cout << "Введите корректное целое число.\n";
-      continue;
+// Удаляет оценки по условию во всех партициях; возвращает число удаленных. В erased,
+// если он задан, добавляются ID и версии удаленных оценок (для record_deletes).
+template <typename Pred>
+size_t erase_grades_if(DataStore& data, Pred pred, std::vector<std::pair<int, int64_t>>* erased = nullptr) {
+  size_t removed = 0;
+  for (auto& cow : data.grade_partitions) {
+    // Партиция без подходящих оценок не трогается (и не копируется, если ее держит снимок).
+    size_t kept = 0;
+    while (kept < cow->size() && !pred(cow->grade_at(kept))) {
+      ++kept;
     }
-    if (value < 0) {
-      std::cout << "Значение должно быть 0 или больше.\n";
+    if (kept == cow->size()) {
       continue;
     }
-    if (value != 0 && !find_group(data, value)) {
-      std::cout << "Группа не найдена.\n";
-      continue;
+    GradePartition& part = cow.write();
+    for (size_t i = kept; i < part.size(); ++i) {
+      Grade grade = part.grade_at(i);
+      if (!pred(grade)) {
+        part.grades[kept++] = part.grades[i];
+        continue;
+      }
+      count_grade(part, grade, -1);
+      data.retakes.remove(grade);
+      if (part.grades[i].flags & kPackedWide) {
+        part.wide_grades.erase(grade.id);
+      }
+      if (erased) {
+        erased->emplace_back(grade.id, grade.version);
+      }
+      ++removed;
     }
-    out = value;
-    return true;
-  }
+    part.grades.resize(kept);
+  }
+  data.grade_partitions.erase(
+      std::remove_if(data.grade_partitions.begin(), data.grade_partitions.end(),
+                     [](const Cow<GradePartition>& part) { return part->grades.empty(); }),
+      data.grade_partitions.end());
+  settle_retakes(data);
+  return removed;
 }
 
-int read_student_id_or_cancel(const DataStore& data, const std::string& prompt) {
-  while (true) {
-    int id = read_int(prompt, 0, std::numeric_limits<int>::max());
-    if (id == 0) {
-      return 0;
-    }
-    if (find_student(data, id)) {
-      return id;
+// Ищет оценку по ID и распаковывает ее в out; false - если оценки нет.
+bool find_grade(const DataStore& data, int id, Grade& out) {
+  for (const GradePartition& part : data.grade_partitions) {
+    for (size_t i = 0; i < part.size(); ++i) {
+      if (part.grades[i].id == id) {
+        out = part.grade_at(i);
+        return true;
+      }
     }
-    std::cout << "Студент не найден.\n";
   }
+  return false;
 }
 
-int read_subject_id_or_cancel(const DataStore& data, const std::string& prompt) {
-  while (true) {
-    int id = read_int(prompt, 0, std::numeric_limits<int>::max());
-    if (id == 0) {
-      return 0;
+// Позиции оценок из pending_changes (партиция, номер), собранные за один проход: при
+// большом пакете правок (слияние дублей) find_grade на каждую правку стоил бы
+// O(правок x оценок). Позиция сверяется с ID (его мог сменить remap_new_id), иначе
+// оценка ищется заново.
+class PendingGrades {
+ public:
+  explicit PendingGrades(const DataStore& data) {
+    std::unordered_set<int> ids;
+    for (const auto& change : data.pending_changes) {
+      if (change.entity == Entity::kGrade && change.op != ChangeOp::kDelete) {
+        ids.insert(change.id);
+      }
     }
-    if (find_subject(data, id)) {
-      return id;
+    if (ids.empty()) {
+      return;
+    }
+    for (size_t p = 0; p < data.grade_partitions.size(); ++p) {
+      const GradePartition& part = data.grade_partitions[p];
+      for (size_t i = 0; i < part.size(); ++i) {
+        if (ids.count(part.grades[i].id) > 0) {
+          positions_[part.grades[i].id] = {p, i};
+        }
+      }
     }
-    std::cout << "Предмет не найден.\n";
   }
-}
 
-// Запрашивает фильтр по группе: 0 - все, -1 - без группы, >0 - конкретная группа.
-int read_group_filter(const DataStore& data, const std::string& prompt) {
-  while (true) {
-    int id = read_int(prompt, -1, std::numeric_limits<int>::max());
-    if (id <= 0) {
-      return id;
-    }
-    if (find_group(data, id)) {
-      return id;
+  bool find(const DataStore& data, int id, Grade& out) const {
+    auto it = positions_.find(id);
+    if (it != positions_.end() && it->second.first < data.grade_partitions.size()) {
+      const GradePartition& part = data.grade_partitions[it->second.first];
+      if (it->second.second < part.size() && part.grades[it->second.second].id == id) {
+        out = part.grade_at(it->second.second);
+        return true;
+      }
     }
-    std::cout << "Группа не найдена.\n";
+    return find_grade(data, id, out);
   }
-}
 
-// Печатает краткий список студентов.
-void print_students_simple(const DataStore& data) {
-  if (data.students.empty()) {
-    std::cout << "Нет студентов.\n";
-    return;
-  }
-  std::cout << "Студенты:\n";
-  const std::vector<int> widths = {4, 28, 20};
-  const std::vector<bool> align_right = {true, false, false};
-  print_table_line(widths);
-  print_table_row({"ID", "ФИО", "Группа"}, widths, align_right);
-  print_table_line(widths);
-  for (const auto& student : data.students) {
-    print_table_row({std::to_string(student.id),
-                     student.name,
-                     group_name_or_none(data, student.group_id)},
-                    widths,
-                    align_right);
-  }
-  print_table_line(widths);
-}
+ private:
+  std::unordered_map<int, std::pair<size_t, size_t>> positions_;
+};
 
-// Печатает краткий список групп.
-void print_groups_simple(const DataStore& data) {
-  if (data.groups.empty()) {
-    std::cout << "Нет групп.\n";
-    return;
-  }
-  std::cout << "Группы:\n";
-  const std::vector<int> widths = {4, 28};
-  const std::vector<bool> align_right = {true, false};
-  print_table_line(widths);
-  print_table_row({"ID", "Название"}, widths, align_right);
-  print_table_line(widths);
-  for (const auto& group : data.groups) {
-    print_table_row({std::to_string(group.id), group.name}, widths, align_right);
-  }
-  print_table_line(widths);
+// Вычисляет номер следующей попытки сдачи предмета (попытки сквозные по всем семестрам).
+int next_attempt(const DataStore& data, int student_id, int subject_id) {
+  int attempt = 1;
+  for_each_grade(data, Period(), [&](const Grade& grade) {
+    if (grade.student_id == student_id && grade.subject_id == subject_id) {
+      // Берем максимальный номер попытки по имеющимся оценкам.
+      attempt = std::max(attempt, grade.attempt + 1);
+    }
+  });
+  return attempt;
 }
 
-// Печатает краткий список предметов.
-void print_subjects_simple(const DataStore& data) {
-  if (data.subjects.empty()) {
-    std::cout << "Нет предметов.\n";
-    return;
-  }
-  std::cout << "Предметы:\n";
-  const std::vector<int> widths = {4, 28};
-  const std::vector<bool> align_right = {true, false};
-  print_table_line(widths);
-  print_table_row({"ID", "Название"}, widths, align_right);
-  print_table_line(widths);
-  for (const auto& subject : data.subjects) {
-    print_table_row({std::to_string(subject.id), subject.name}, widths, align_right);
+// Номера следующих попыток по предмету сразу для многих студентов: один проход по
+// оценкам вместо прохода next_attempt на каждого студента.
+std::unordered_map<int, int> next_attempts(const DataStore& data, int subject_id, const std::vector<int>& student_ids) {
+  std::unordered_map<int, int> next;
+  next.reserve(student_ids.size());
+  for (int id : student_ids) {
+    next[id] = 1;
   }
-  print_table_line(widths);
+  for_each_grade(data, Period(), [&](const Grade& grade) {
+    if (grade.subject_id != subject_id) {
+      return;
+    }
+    auto it = next.find(grade.student_id);
+    if (it != next.end()) {
+      it->second = std::max(it->second, grade.attempt + 1);
+    }
+  });
+  return next;
 }
 
-// Печатает краткий список оценок.
-void print_grades_simple(const DataStore& data) {
-  if (data.grades.empty()) {
-    std::cout << "Нет оценок.\n";
+// Запоминает изменение строки для записи в базу; повторные изменения одной строки
+// схлопываются (вставка + правка = вставка, вставка + удаление = ничего). Удаление
+// после правки переносится в конец: записанные раньше правки и удаления зависимых строк
+// (оценок удаляемого студента) не должны встретить строку, уже удаленную каскадом.
+void record_change(DataStore& data, Entity entity, ChangeOp op, int id, int64_t base_version) {
+  ++data.generation;
+  for (auto it = data.pending_changes.begin(); it != data.pending_changes.end(); ++it) {
+    if (it->entity != entity || it->id != id) {
+      continue;
+    }
+    if (it->op == ChangeOp::kInsert) {
+      if (op == ChangeOp::kDelete) {
+        data.pending_changes.erase(it);
+      }
+      return;
+    }
+    if (op == ChangeOp::kDelete) {
+      base_version = it->base_version;
+      data.pending_changes.erase(it);
+      break;
+    }
     return;
   }
-  std::cout << "Оценки:\n";
-  const std::vector<int> widths = {4, 24, 24, 8, 8};
-  const std::vector<bool> align_right = {true, false, false, true, true};
-  print_table_line(widths);
-  print_table_row({"ID", "Студент", "Предмет", "Попытка", "Оценка"}, widths, align_right);
-  print_table_line(widths);
-  for (const auto& grade : data.grades) {
-    print_table_row({std::to_string(grade.id),
-                     student_name_or_unknown(data, grade.student_id),
-                     subject_name_or_unknown(data, grade.subject_id),
-                     std::to_string(grade.attempt),
-                     std::to_string(grade.value)},
-                    widths,
-                    align_right);
-  }
-  print_table_line(widths);
+  data.pending_changes.push_back({entity, op, id, base_version});
 }
 
-// Печатает подробный список студентов с оценками по предметам.
-void list_students_detailed(const DataStore& data) {
-  if (data.students.empty()) {
-    std::cout << "Нет студентов.\n";
+// Запоминает удаление многих строк одной сущности (оценки удаляемого студента или
+// предмета) за один проход по pending_changes, с той же схлопкой, что record_change.
+void record_deletes(DataStore& data, Entity entity, const std::vector<std::pair<int, int64_t>>& rows) {
+  if (rows.empty()) {
     return;
   }
-  std::cout << "Список студентов:\n";
-  const std::vector<int> widths = {4, 28, 20, 12};
-  const std::vector<bool> align_right = {true, false, false, true};
-  print_table_line(widths);
-  print_table_row({"ID", "ФИО", "Группа", "Ср.балл"}, widths, align_right);
-  print_table_line(widths);
-  for (const auto& student : data.students) {
-    auto aggregates = subject_aggregates_for_student(data, student.id);
-    double avg = -1.0;
-    if (!aggregates.empty()) {
-      double sum = 0.0;
-      int count = 0;
-      for (const auto& entry : aggregates) {
-        const SubjectAggregate& agg = entry.second;
-        if (agg.count > 0) {
-          sum += static_cast<double>(agg.sum) / static_cast<double>(agg.count);
-          ++count;
-        }
-      }
-      if (count > 0) {
-        avg = sum / static_cast<double>(count);
-      }
-    }
-    print_table_row({std::to_string(student.id),
-                     student.name,
-                     group_name_or_none(data, student.group_id),
-                     format_avg(avg)},
-                    widths,
-                    align_right);
-
-    if (aggregates.empty()) {
-      std::cout << "  Предметы: нет\n";
-      continue;
+  ++data.generation;
+  std::unordered_map<int, int64_t> versions(rows.begin(), rows.end());
+  std::vector<PendingChange> kept;
+  kept.reserve(data.pending_changes.size() + rows.size());
+  for (const auto& change : data.pending_changes) {
+    auto it = change.entity == entity ? versions.find(change.id) : versions.end();
+    if (it == versions.end()) {
+      kept.push_back(change);
+    } else if (change.op == ChangeOp::kInsert) {
+      versions.erase(it);  // строки еще нет в базе: запись не нужна
+    } else {
+      it->second = change.base_version;
     }
-    std::cout << "  Предметы:\n";
-    const std::vector<int> subj_widths = {4, 26, 10, 10, 30};
-    const std::vector<bool> subj_align = {true, false, true, true, false};
-    print_table_line(subj_widths);
-    print_table_row({"ID", "Предмет", "Ср.балл", "Последн.", "Оценки"}, subj_widths, subj_align);
-    print_table_line(subj_widths);
-    for (const auto& entry : aggregates) {
-      const SubjectAggregate& agg = entry.second;
-      double subj_avg = (agg.count == 0) ? -1.0
-                                         : static_cast<double>(agg.sum) / static_cast<double>(agg.count);
-      std::vector<Grade> subject_grades;
-      subject_grades.reserve(static_cast<size_t>(agg.count));
-      for (const auto& grade : data.grades) {
-        if (grade.student_id == student.id && grade.subject_id == entry.first) {
-          subject_grades.push_back(grade);
-        }
-      }
-      std::sort(subject_grades.begin(), subject_grades.end(),
-                [](const Grade& a, const Grade& b) { return a.attempt < b.attempt; });
-      std::vector<int> values;
-      values.reserve(subject_grades.size());
-      for (const auto& grade : subject_grades) {
-        values.push_back(grade.value);
-      }
-      print_table_row({std::to_string(entry.first),
-                       subject_name_or_unknown(data, entry.first),
-                       format_avg(subj_avg),
-                       std::to_string(agg.latest_value),
-                       join_grades(values)},
-                      subj_widths,
-                      subj_align);
+  }
+  for (const auto& row : rows) {
+    auto it = versions.find(row.first);
+    if (it != versions.end()) {
+      kept.push_back({entity, ChangeOp::kDelete, row.first, it->second});
     }
-    print_table_line(subj_widths);
   }
-  print_table_line(widths);
+  data.pending_changes = std::move(kept);
 }
 
-struct StudentResult {
-  const Student* student = nullptr;
-  double avg = -1.0;
+struct SubjectAggregate {
+  int sum = 0;
+  int count = 0;
+  int latest_grade_id = 0;
+  int latest_value = 0;
+  int latest_attempt = 0;
 };
 
-// Формирует список студентов с учетом фильтров.
-std::vector<StudentResult> filter_students(const DataStore& data,
-                                           int group_filter,
-                                           const std::string& name_query,
-                                           bool use_min_avg,
-                                           double min_avg) {
-  std::vector<StudentResult> results;
-  std::string name_query_lower = to_lower_ascii(trim(name_query));
-  for (const auto& student : data.students) {
-    if (group_filter == -1 && student.group_id != 0) {
-      continue;
+// Собирает статистику по предметам студента (сумма, количество, последняя оценка):
+// пары (ID предмета, агрегат) по возрастанию ID, только предметы с оценками.
+std::vector<std::pair<int, SubjectAggregate>> subject_aggregates_for_student(const DataStore& data,
+                                                                             int student_id,
+                                                                             const Period& period) {
+  EntitySlots subjects(data.subjects);
+  std::vector<SubjectAggregate> table(subjects.count());
+  for_each_grade(data, period, [&](const Grade& grade) {
+    if (grade.student_id != student_id) {
+      return;
     }
-    if (group_filter > 0 && student.group_id != group_filter) {
-      continue;
+    int slot = subjects.slot(grade.subject_id);
+    if (slot < 0) {
+      return;
     }
-    if (!name_query_lower.empty()) {
-      std::string name_lower = to_lower_ascii(student.name);
-      if (name_lower.find(name_query_lower) == std::string::npos) {
-        continue;
-      }
+    SubjectAggregate& agg = table[static_cast<size_t>(slot)];
+    agg.sum += grade.value;
+    agg.count += 1;
+    if (grade.id > agg.latest_grade_id) {
+      agg.latest_grade_id = grade.id;
+      agg.latest_value = grade.value;
+      agg.latest_attempt = grade.attempt;
     }
-    double avg = average_subjects_for_student(data, student.id);
-    if (use_min_avg) {
-      if (avg < 0.0 || avg < min_avg) {
-        continue;
-      }
+  });
+  std::vector<std::pair<int, SubjectAggregate>> aggregates;
+  for (size_t slot = 0; slot < table.size(); ++slot) {
+    if (table[slot].count > 0) {
+      aggregates.emplace_back(data.subjects[subjects.index(static_cast<int>(slot))].id, table[slot]);
     }
-    results.push_back({&student, avg});
   }
-  return results;
+  return aggregates;
 }
 
-// Печатает результат поиска/фильтрации по студентам.
-void print_student_results(const DataStore& data, const std::vector<StudentResult>& results) {
-  if (results.empty()) {
-    std::cout << "Нет подходящих студентов.\n";
-    return;
-  }
-  std::cout << "Результаты (" << results.size() << "):\n";
-  const std::vector<int> widths = {4, 28, 20, 12};
-  const std::vector<bool> align_right = {true, false, false, true};
-  print_table_line(widths);
-  print_table_row({"ID", "ФИО", "Группа", "Ср.балл"}, widths, align_right);
-  print_table_line(widths);
-  for (const auto& item : results) {
-    const Student* student = item.student;
-    print_table_row({std::to_string(student->id),
-                     student->name,
-                     group_name_or_none(data, student->group_id),
-                     format_avg(item.avg)},
-                    widths,
-                    align_right);
+// Считает средний балл студента по каждому предмету (все оценки), затем усредняет.
+double average_subjects_for_student(const DataStore& data, int student_id, const Period& period) {
+  auto aggregates = subject_aggregates_for_student(data, student_id, period);
+  if (aggregates.empty()) {
+    return -1.0;
   }
-  print_table_line(widths);
-}
-
-// Создает запись студента и возвращает его ID.
-int create_student_record(DataStore& data, const std::string& name, int group_id) {
-  Student student;
-  student.id = data.next_student_id++;
-  student.name = name;
-  student.group_id = group_id;
-  data.students.push_back(student);
-  return student.id;
-}
-
-// Запрашивает группу при создании студента (включая создание новой).
-int read_group_for_new_student(DataStore& data) {
-  if (data.groups.empty()) {
-    int create_group_choice = read_int("Группы отсутствуют. Создать новую? 1-да, 0-нет: ", 0, 1);
-    if (create_group_choice == 1) {
-      std::string group_name = trim(read_line("Название новой группы: "));
-      int group_id = create_group_record(data, group_name);
-      std::cout << "Создана группа с ID " << group_id << ".\n";
-      return group_id;
+  double sum = 0.0;
+  int count = 0;
+  for (const auto& entry : aggregates) {
+    const SubjectAggregate& agg = entry.second;
+    if (agg.count > 0) {
+      sum += static_cast<double>(agg.sum) / static_cast<double>(agg.count);
+      ++count;
     }
-    return 0;
   }
-
-  print_groups_simple(data);
-  while (true) {
-    int group_id = read_int("ID группы (0 - без группы, -1 - создать новую): ",
-                            -1, std::numeric_limits<int>::max());
-    if (group_id == 0) {
-      return 0;
-    }
-    if (group_id == -1) {
-      std::string group_name = trim(read_line("Название новой группы: "));
-      int new_group_id = create_group_record(data, group_name);
-      std::cout << "Создана группа с ID " << new_group_id << ".\n";
-      return new_group_id;
-    }
-    if (find_group(data, group_id)) {
-      return group_id;
-    }
-    std::cout << "Группа не найдена.\n";
+  if (count == 0) {
+    return -1.0;
   }
+  return sum / static_cast<double>(count);
 }
 
-// Меню поиска, фильтрации и сортировки студентов.
-void students_search_menu(const DataStore& data) {
-  if (data.students.empty()) {
-    std::cout << "Нет студентов.\n";
+constexpr size_t kJournalBlockCells = 512 * 1024;  // агрегатов журнала на один проход
+
+// Обходит студентов в заданном порядке вместе с агрегатами по предметам:
+// fn(student, cells), где cells[i] - агрегат по data.subjects[i]. Студенты идут блоками:
+// на блок - один проход по оценкам периода и таблица не больше kJournalBlockCells
+// агрегатов, поэтому память не зависит ни от числа оценок, ни от числа студентов.
+// Последняя оценка - попытка с наибольшим номером, как в журнале по предмету.
+template <typename Fn>
+void for_each_journal_row(const DataStore& data, const Period& period,
+                          const std::vector<const Student*>& students, Fn&& fn) {
+  if (students.empty() || data.subjects.empty()) {
     return;
   }
-  if (!data.groups.empty()) {
-    print_groups_simple(data);
+  int max_student_id = 0;
+  for (const auto* student : students) {
+    max_student_id = std::max(max_student_id, student->id);
   }
-  int group_filter = read_group_filter(data, "ID группы (0 - все, -1 - без группы): ");
-  std::string name_query = read_line("ФИО (часть, пусто - без фильтра): ", true);
-  double min_avg = 0.0;
-  bool use_min_avg = read_double_optional("Мин. средний балл (пусто - без фильтра): ",
-                                          0.0, static_cast<double>(kMaxGrade), min_avg);
-
-  int sort_key = read_int("Сортировка: 1) ID 2) ФИО 3) Средний балл: ", 1, 3);
-  int sort_order = read_int("Порядок: 1) Возрастание 2) Убывание: ", 1, 2);
-  bool asc = (sort_order == 1);
-
-  std::vector<StudentResult> results =
-      filter_students(data, group_filter, name_query, use_min_avg, min_avg);
-
-  auto cmp_asc = [sort_key](const StudentResult& a, const StudentResult& b) {
-    if (sort_key == 1) {
-      return a.student->id < b.student->id;
+  int max_subject_id = 0;
+  for (const auto& subject : data.subjects) {
+    max_subject_id = std::max(max_subject_id, subject.id);
+  }
+  std::vector<int> subject_column(static_cast<size_t>(max_subject_id) + 1, -1);
+  for (size_t i = 0; i < data.subjects.size(); ++i) {
+    subject_column[static_cast<size_t>(data.subjects[i].id)] = static_cast<int>(i);
+  }
+  std::vector<int> student_row(static_cast<size_t>(max_student_id) + 1, -1);
+  const size_t subject_count = data.subjects.size();
+  const size_t block_students = std::max<size_t>(1, kJournalBlockCells / subject_count);
+  std::vector<SubjectAggregate> cells;
+  for (size_t first = 0; first < students.size(); first += block_students) {
+    size_t last = std::min(students.size(), first + block_students);
+    for (size_t i = first; i < last; ++i) {
+      student_row[static_cast<size_t>(students[i]->id)] = static_cast<int>(i - first);
     }
-    if (sort_key == 2) {
-      std::string a_name = to_lower_ascii(a.student->name);
-      std::string b_name = to_lower_ascii(b.student->name);
-      if (a_name != b_name) {
-        return a_name < b_name;
+    cells.assign((last - first) * subject_count, SubjectAggregate{});
+    for_each_grade(data, period, [&](const Grade& grade) {
+      if (grade.student_id < 0 || grade.student_id > max_student_id ||
+          grade.subject_id < 0 || grade.subject_id > max_subject_id) {
+        return;
       }
-      return a.student->id < b.student->id;
-    }
-    if (a.avg != b.avg) {
-      return a.avg < b.avg;
+      int row = student_row[static_cast<size_t>(grade.student_id)];
+      int column = subject_column[static_cast<size_t>(grade.subject_id)];
+      if (row < 0 || column < 0) {
+        return;
+      }
+      SubjectAggregate& agg = cells[static_cast<size_t>(row) * subject_count + static_cast<size_t>(column)];
+      agg.sum += grade.value;
+      agg.count += 1;
+      if (agg.count == 1 || grade.attempt >= agg.latest_attempt) {
+        agg.latest_grade_id = grade.id;
+        agg.latest_value = grade.value;
+        agg.latest_attempt = grade.attempt;
+      }
+    });
+    for (size_t i = first; i < last; ++i) {
+      student_row[static_cast<size_t>(students[i]->id)] = -1;
+      fn(*students[i], &cells[(i - first) * subject_count]);
     }
-    return a.student->id < b.student->id;
-  };
-
-  std::sort(results.begin(), results.end(),
-            [&](const StudentResult& a, const StudentResult& b) {
-              return asc ? cmp_asc(a, b) : cmp_asc(b, a);
-            });
+  }
+}
 
-  print_student_results(data, results);
+// Средний балл по агрегатам журнала: среднее по каждому предмету, затем по предметам.
+double journal_row_average(const SubjectAggregate* cells, size_t count) {
+  double sum = 0.0;
+  int subjects = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (cells[i].count > 0) {
+      sum += static_cast<double>(cells[i].sum) / static_cast<double>(cells[i].count);
+      ++subjects;
+    }
+  }
+  return subjects == 0 ? -1.0 : sum / static_cast<double>(subjects);
 }
 
-// Добавляет нового студента в список.
-void add_student(DataStore& data) {
-  std::string name = trim(read_line("Имя студента: "));
-  int group_id = read_group_for_new_student(data);
-  int student_id = create_student_record(data, name, group_id);
-  std::cout << "Добавлен студент с ID " << student_id << ".\n";
-  autosave_or_warn(data);
+// Средние баллы студентов (как average_subjects_for_student) за блочные проходы
+// for_each_journal_row вместо прохода по всем оценкам на каждого студента;
+// result[i] - для students[i].
+std::vector<double> student_averages(const DataStore& data, const Period& period,
+                                     const std::vector<const Student*>& students) {
+  std::vector<double> result;
+  result.reserve(students.size());
+  for_each_journal_row(data, period, students, [&](const Student&, const SubjectAggregate* cells) {
+    result.push_back(journal_row_average(cells, data.subjects.size()));
+  });
+  result.resize(students.size(), -1.0);
+  return result;
 }
 
-// Добавляет студента в выбранную группу.
-void add_student_to_group(DataStore& data) {
-  if (data.groups.empty()) {
-    std::cout << "Сначала добавьте группы.\n";
-    return;
+// Средние баллы всех студентов; result[i] - для data.students[i].
+std::vector<double> student_averages(const DataStore& data, const Period& period) {
+  std::vector<const Student*> students;
+  students.reserve(data.students.size());
+  for (const auto& student : data.students) {
+    students.push_back(&student);
   }
-  print_groups_simple(data);
-  while (true) {
-    int group_id = read_int("ID группы для добавления студента: ", 1,
-                            std::numeric_limits<int>::max());
-    if (!find_group(data, group_id)) {
-      std::cout << "Группа не найдена.\n";
-      continue;
+  return student_averages(data, period, students);
+}
+
+struct SubjectTotal {
+  int64_t sum = 0;
+  int count = 0;
+
+  // Средний балл по всем оценкам (все попытки); -1 - оценок нет.
+  double average() const { return count == 0 ? -1.0 : static_cast<double>(sum) / static_cast<double>(count); }
+};
+
+// Сумма и число оценок каждого предмета за один проход; result[i] - для data.subjects[i].
+std::vector<SubjectTotal> subject_totals(const DataStore& data, const Period& period) {
+  EntitySlots subjects(data.subjects);
+  std::vector<SubjectTotal> by_slot(subjects.count());
+  for_each_grade(data, period, [&](const Grade& grade) {
+    int slot = subjects.slot(grade.subject_id);
+    if (slot >= 0) {
+      by_slot[static_cast<size_t>(slot)].sum += grade.value;
+      ++by_slot[static_cast<size_t>(slot)].count;
     }
-    std::string name = trim(read_line("Имя студента: "));
-    int student_id = create_student_record(data, name, group_id);
-    std::cout << "Добавлен студент с ID " << student_id << ".\n";
-    autosave_or_warn(data);
-    return;
+  });
+  std::vector<SubjectTotal> result(data.subjects.size());
+  for (size_t slot = 0; slot < by_slot.size(); ++slot) {
+    result[subjects.index(static_cast<int>(slot))] = by_slot[slot];
   }
+  return result;
 }
 
-// Редактирует данные студента.
-void edit_student(DataStore& data) {
-  if (data.students.empty()) {
-    std::cout << "Нет студентов для редактирования.\n";
-    return;
-  }
-  print_students_simple(data);
-  int id = read_int("ID студента для редактирования: ", 1, std::numeric_limits<int>::max());
-  Student* student = find_student(data, id);
-  if (!student) {
-    std::cout << "Студент не найден.\n";
-    return;
-  }
-  bool changed = false;
-  std::string new_name = trim(read_line("Новое имя (пусто - оставить): ", true));
-  if (!new_name.empty() && new_name != student->name) {
-    student->name = new_name;
-    changed = true;
-  }
-  if (!data.groups.empty()) {
-    print_groups_simple(data);
-    int new_group_id = 0;
-    if (read_group_id_optional(data, "Новый ID группы (пусто - оставить, 0 - без группы): ",
-                               new_group_id)) {
-      if (new_group_id != student->group_id) {
-        student->group_id = new_group_id;
-        changed = true;
-      }
+// Сводка распределения оценок; для пустого распределения средние равны -1, мода 0.
+struct GradeDistribution {
+  int64_t count = 0;
+  double mean = -1.0;
+  double stddev = -1.0;
+  double median = -1.0;
+  int mode = 0;
+  double pass_rate = -1.0;  // доля оценок не ниже kPassGrade (0..1)
+};
+
+// Значение k-й по возрастанию оценки (k от 0) по счетчикам распределения.
+int histogram_nth(const GradeHistogram& histogram, int64_t k) {
+  for (int i = 0; i < kGradeLevels; ++i) {
+    if (k < histogram.counts[i]) {
+      return kMinGrade + i;
     }
+    k -= histogram.counts[i];
   }
-  std::cout << "Студент обновлен.\n";
-  if (changed) {
-    autosave_or_warn(data);
+  return kMaxGrade;
+}
+
+// Перцентиль p (0..1) методом ближайшего ранга; 0 - если оценок нет.
+int histogram_percentile(const GradeHistogram& histogram, double p) {
+  int64_t count = histogram.total();
+  if (count == 0) {
+    return 0;
   }
+  int64_t rank = static_cast<int64_t>(std::ceil(p * static_cast<double>(count)));
+  return histogram_nth(histogram, std::clamp<int64_t>(rank - 1, 0, count - 1));
 }
 
-// Удаляет студента и связанные оценки.
-void delete_student(DataStore& data) {
-  if (data.students.empty()) {
-    std::cout << "Нет студентов для удаления.\n";
-    return;
+// Считает медиану, моду, среднее, отклонение и долю сдавших за один проход по счетчикам.
+GradeDistribution describe_distribution(const GradeHistogram& histogram) {
+  GradeDistribution result;
+  int64_t sum = 0;
+  int64_t sum_squares = 0;
+  int64_t passed = 0;
+  int64_t best = 0;
+  for (int i = 0; i < kGradeLevels; ++i) {
+    int64_t count = histogram.counts[i];
+    int64_t value = kMinGrade + i;
+    result.count += count;
+    sum += count * value;
+    sum_squares += count * value * value;
+    if (value >= kPassGrade) {
+      passed += count;
+    }
+    // При равенстве мода - меньшая оценка.
+    if (count > best) {
+      best = count;
+      result.mode = static_cast<int>(value);
+    }
   }
-  print_students_simple(data);
-  int id = read_int("ID студента для удаления: ", 1, std::numeric_limits<int>::max());
-  auto it = std::find_if(data.students.begin(), data.students.end(),
-                         [id](const Student& s) { return s.id == id; });
-  if (it == data.students.end()) {
-    std::cout << "Студент не найден.\n";
-    return;
+  if (result.count == 0) {
+    return result;
   }
-  data.students.erase(it);
-  // Удаляем все оценки, связанные с этим студентом.
-  size_t before = data.grades.size();
-  data.grades.erase(
-      std::remove_if(data.grades.begin(), data.grades.end(),
-                     [id](const Grade& g) { return g.student_id == id; }),
-      data.grades.end());
-  size_t removed = before - data.grades.size();
-  std::cout << "Студент удален. Удалено связанных оценок: " << removed << ".\n";
-  autosave_or_warn(data);
+  double n = static_cast<double>(result.count);
+  result.mean = static_cast<double>(sum) / n;
+  result.stddev = std::sqrt(std::max(0.0, static_cast<double>(sum_squares) / n - result.mean * result.mean));
+  result.median = (histogram_nth(histogram, (result.count - 1) / 2) + histogram_nth(histogram, result.count / 2)) / 2.0;
+  result.pass_rate = static_cast<double>(passed) / n;
+  return result;
 }
 
-// Создает запись группы и возвращает ее ID.
-int create_group_record(DataStore& data, const std::string& name) {
-  Group group;
-  group.id = data.next_group_id++;
-  group.name = name;
-  data.groups.push_back(group);
-  return group.id;
+// Распределение оценок предмета за период: складывает готовые счетчики партиций,
+// поэтому не зависит от количества оценок.
+GradeHistogram subject_histogram(const DataStore& data, int subject_id, const Period& period) {
+  GradeHistogram histogram;
+  for_each_partition(data, period, [&](const GradePartition& part) {
+    auto it = part.subject_histograms.find(subject_id);
+    if (it != part.subject_histograms.end()) {
+      histogram.merge(it->second);
+    }
+  });
+  return histogram;
 }
 
-// Добавляет новую группу.
-void add_group(DataStore& data) {
-  std::string name = trim(read_line("Название группы: "));
-  int group_id = create_group_record(data, name);
-  std::cout << "Добавлена группа с ID " << group_id << ".\n";
-  autosave_or_warn(data);
+constexpr size_t kOutputFlushThreshold = 64 * 1024;
+
+// Дописывает целое число в строку через std::to_chars (без потоков и временных строк).
+void append_int(std::string& out, long long value) {
+  char buf[24];
+  auto result = std::to_chars(buf, buf + sizeof(buf), value);
+  out.append(buf, static_cast<size_t>(result.ptr - buf));
 }
 
-// Редактирует данные группы.
-void edit_group(DataStore& data) {
-  if (data.groups.empty()) {
-    std::cout << "Нет групп для редактирования.\n";
+// Дописывает среднее значение с двумя знаками после точки ("нет" для отрицательных).
+void append_avg(std::string& out, double value) {
+  if (value < 0.0) {
+    out += "нет";
     return;
   }
-  print_groups_simple(data);
-  int id = read_int("ID группы для редактирования: ", 1, std::numeric_limits<int>::max());
-  Group* group = find_group(data, id);
-  if (!group) {
-    std::cout << "Группа не найдена.\n";
+  char buf[64];
+  auto result = std::to_chars(buf, buf + sizeof(buf), value, std::chars_format::fixed, 2);
+  if (result.ec != std::errc()) {
+    out += std::to_string(value);
     return;
   }
-  bool changed = false;
-  std::string new_name = trim(read_line("Новое название (пусто - оставить): ", true));
-  if (!new_name.empty() && new_name != group->name) {
-    group->name = new_name;
-    changed = true;
+  out.append(buf, static_cast<size_t>(result.ptr - buf));
+}
+
+// Форматирует среднее значение для вывода.
+std::string format_avg(double value) {
+  std::string out;
+  append_avg(out, value);
+  return out;
+}
+
+// Буфер вывода: текст собирается в одной переиспользуемой строке и
+// сбрасывается в поток крупными блоками вместо множества мелких операций <<.
+class OutputBuffer {
+ public:
+  explicit OutputBuffer(std::ostream& out, size_t flush_threshold = kOutputFlushThreshold)
+      : out_(out), flush_threshold_(flush_threshold) {
+    buffer_.reserve(flush_threshold_ + 1024);
   }
-  std::cout << "Группа обновлена.\n";
-  if (changed) {
-    autosave_or_warn(data);
+  ~OutputBuffer() {
+    flush();
+    out_.flush();
   }
-}
+  OutputBuffer(const OutputBuffer&) = delete;
+  OutputBuffer& operator=(const OutputBuffer&) = delete;
 
-// Удаляет группу и снимает привязку у студентов.
-void delete_group(DataStore& data) {
-  if (data.groups.empty()) {
-    std::cout << "Нет групп для удаления.\n";
-    return;
+  // Прямой доступ к буферу; после дописывания целой строки нужно вызвать commit().
+  std::string& raw() { return buffer_; }
+
+  void append(std::string_view text) {
+    buffer_.append(text);
+    commit();
   }
-  print_groups_simple(data);
-  int id = read_int("ID группы для удаления: ", 1, std::numeric_limits<int>::max());
-  auto it = std::find_if(data.groups.begin(), data.groups.end(),
-                         [id](const Group& g) { return g.id == id; });
-  if (it == data.groups.end()) {
-    std::cout << "Группа не найдена.\n";
-    return;
+
+  void append_int(long long value) {
+    ::append_int(buffer_, value);
+    commit();
   }
-  data.groups.erase(it);
+
+  void append_avg(double value) {
+    ::append_avg(buffer_, value);
+    commit();
+  }
+
+  // Сбрасывает буфер по достижении порога. Вызывается только между целыми
+  // фрагментами, поэтому символы UTF-8 не разрываются между блоками.
+  void commit() {
+    if (buffer_.size() >= flush_threshold_) {
+      flush();
+    }
+  }
+
+  void flush() {
+    if (!buffer_.empty()) {
+      out_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+      buffer_.clear();
+    }
+  }
+
+ private:
+  std::ostream& out_;
+  size_t flush_threshold_;
+  std::string buffer_;
+};
+
+// Табличный вывод с фиксированными ширинами столбцов: длина ячейки в символах
+// UTF-8 измеряется один раз, обрезка и выравнивание пишутся прямо в буфер.
+class TableWriter {
+ public:
+  TableWriter(OutputBuffer& out, const std::vector<int>& widths, const std::vector<bool>& align_right = {})
+      : out_(out), align_right_(align_right) {
+    widths_.reserve(widths.size());
+    for (int width : widths) {
+      widths_.push_back(width < 1 ? 1 : static_cast<size_t>(width));
+    }
+    align_right_.resize(widths_.size(), false);
+    for (size_t width : widths_) {
+      line_ += '+';
+      line_.append(width + 2, '-');
+    }
+    line_ += "+\n";
+  }
+
+  // Печатает линию-разделитель таблицы.
+  void line() { out_.append(line_); }
+
+  // Печатает строку целиком (например, заголовок).
+  void row(std::initializer_list<std::string_view> cols) {
+    for (std::string_view col : cols) {
+      cell(col);
+    }
+    end_row();
+  }
+
+  void row(const std::vector<std::string>& cols) {
+    for (const auto& col : cols) {
+      cell(col);
+    }
+    end_row();
+  }
+
+  void cell(std::string_view text) { cell_measured(text, utf8_length(text)); }
+
+  // Ячейка с заранее измеренной длиной в символах.
+  void cell_measured(std::string_view text, size_t length) {
+    if (column_ >= widths_.size()) {
+      return;
+    }
+    size_t width = widths_[column_];
+    bool right = align_right_[column_];
+    std::string& buf = out_.raw();
+    buf += "| ";
+    if (length > width) {
+      // Не помещается: обрезаем и при возможности добавляем многоточие.
+      size_t keep = width <= 3 ? width : width - 3;
+      buf.append(text.data(), utf8_prefix_bytes(text, keep));
+      if (width > 3) {
+        buf += "...";
+      }
+    } else if (right) {
+      buf.append(width - length, ' ');
+      buf.append(text);
+    } else {
+      buf.append(text);
+      buf.append(width - length, ' ');
+    }
+    buf += ' ';
+    ++column_;
+  }
+
+  void cell_int(long long value) {
+    char buf[24];
+    auto result = std::to_chars(buf, buf + sizeof(buf), value);
+    size_t size = static_cast<size_t>(result.ptr - buf);
+    cell_measured(std::string_view(buf, size), size);
+  }
+
+  void cell_avg(double value) {
+    if (value < 0.0) {
+      cell("нет");
+      return;
+    }
+    scratch_.clear();
+    append_avg(scratch_, value);
+    cell_measured(scratch_, scratch_.size());
+  }
+
+  // Завершает строку, дополняя недостающие столбцы пустыми ячейками.
+  void end_row() {
+    while (column_ < widths_.size()) {
+      cell_measured(std::string_view(), 0);
+    }
+    out_.raw() += "|\n";
+    column_ = 0;
+    out_.commit();
+  }
+
+ private:
+  OutputBuffer& out_;
+  std::vector<size_t> widths_;
+  std::vector<bool> align_right_;
+  std::string line_;
+  std::string scratch_;
+  size_t column_ = 0;
+};
+
+// Таблица с автоподбором ширины: ячейки накапливаются вместе с длиной в символах,
+// а ширины столбцов вычисляются в том же проходе (но не больше max_widths).
+class AutoWidthTable {
+ public:
+  AutoWidthTable(const std::vector<std::string>& header,
+                 const std::vector<bool>& align_right,
+                 const std::vector<int>& max_widths)
+      : columns_(header.size()), align_right_(align_right), max_widths_(max_widths) {
+    max_widths_.resize(columns_, std::numeric_limits<int>::max());
+    widths_.assign(columns_, 1);
+    add_row(header);
+  }
+
+  void add_row(const std::vector<std::string>& cols) {
+    for (size_t i = 0; i < columns_; ++i) {
+      std::string text = i < cols.size() ? cols[i] : std::string();
+      size_t length = utf8_length(text);
+      int width = static_cast<int>(std::min<size_t>(length, static_cast<size_t>(max_widths_[i])));
+      widths_[i] = std::max(widths_[i], width);
+      cells_.push_back({std::move(text), length});
+    }
+  }
+
+  // Количество строк данных (без заголовка).
+  size_t size() const { return columns_ == 0 ? 0 : cells_.size() / columns_ - 1; }
+
+  void render(OutputBuffer& out) const {
+    TableWriter table(out, widths_, align_right_);
+    table.line();
+    for (size_t i = 0; i < cells_.size(); ++i) {
+      table.cell_measured(cells_[i].text, cells_[i].length);
+      if ((i + 1) % columns_ == 0) {
+        table.end_row();
+        if (i + 1 == columns_) {
+          table.line();
+        }
+      }
+    }
+    table.line();
+  }
+
+ private:
+  struct Cell {
+    std::string text;
+    size_t length = 0;
+  };
+
+  size_t columns_ = 0;
+  std::vector<bool> align_right_;
+  std::vector<int> max_widths_;
+  std::vector<int> widths_;
+  std::vector<Cell> cells_;
+};
+
+// Построитель JSON в строку; запятые между элементами расставляются автоматически.
+class JsonWriter {
+ public:
+  std::string& str() { return out_; }
+
+  void begin_object() {
+    separate();
+    out_.push_back('{');
+    first_.push_back(true);
+  }
+
+  void end_object() {
+    out_.push_back('}');
+    first_.pop_back();
+  }
+
+  void begin_array() {
+    separate();
+    out_.push_back('[');
+    first_.push_back(true);
+  }
+
+  void end_array() {
+    out_.push_back(']');
+    first_.pop_back();
+  }
+
+  void key(std::string_view name) {
+    separate();
+    append_escaped(name);
+    out_.push_back(':');
+    after_key_ = true;
+  }
+
+  void value(std::string_view text) {
+    separate();
+    append_escaped(text);
+  }
+
+  void value(const char* text) { value(std::string_view(text)); }
+
+  void value(long long number) {
+    separate();
+    ::append_int(out_, number);
+  }
+
+  void value(int number) { value(static_cast<long long>(number)); }
+
+  // Среднее с двумя знаками; отрицательное (нет оценок) - null.
+  void value_avg(double avg) {
+    separate();
+    if (avg < 0.0) {
+      out_ += "null";
+    } else {
+      ::append_avg(out_, avg);
+    }
+  }
+
+  void value_null() {
+    separate();
+    out_ += "null";
+  }
+
+  template <typename T>
+  void field(std::string_view name, const T& field_value) {
+    key(name);
+    value(field_value);
+  }
+
+ private:
+  void separate() {
+    if (after_key_) {
+      after_key_ = false;
+      return;
+    }
+    if (!first_.empty()) {
+      if (!first_.back()) {
+        out_.push_back(',');
+      }
+      first_.back() = false;
+    }
+  }
+
+  void append_escaped(std::string_view text) {
+    out_.push_back('"');
+    for (char c : text) {
+      unsigned char byte = static_cast<unsigned char>(c);
+      if (c == '"' || c == '\\') {
+        out_.push_back('\\');
+        out_.push_back(c);
+      } else if (byte < 0x20) {
+        static const char kHex[] = "0123456789abcdef";
+        out_ += "\\u00";
+        out_.push_back(kHex[byte >> 4]);
+        out_.push_back(kHex[byte & 0x0f]);
+      } else {
+        out_.push_back(c);
+      }
+    }
+    out_.push_back('"');
+  }
+
+  std::string out_;
+  std::vector<bool> first_;
+  bool after_key_ = false;
+};
+
+// Экранирует значение для CSV с учетом разделителя.
+std::string csv_escape(const std::string& text, char delim) {
+  bool needs_quotes = false;
+  for (char c : text) {
+    if (c == delim || c == '"' || c == '\n' || c == '\r') {
+      needs_quotes = true;
+      break;
+    }
+  }
+  if (!needs_quotes) {
+    return text;
+  }
+  std::string out;
+  out.reserve(text.size() + 2);
+  out.push_back('"');
+  for (char c : text) {
+    if (c == '"') {
+      out.push_back('"');
+      out.push_back('"');
+    } else {
+      out.push_back(c);
+    }
+  }
+  out.push_back('"');
+  return out;
+}
+
+// Формат вывода отчета: таблица для консоли или машиночитаемый формат для конвейеров.
+enum class ReportFormat { kTable, kTsv, kCsv, kJson, kNdjson };
+
+struct ReportFormatName {
+  const char* name;
+  ReportFormat format;
+};
+
+const ReportFormatName kReportFormats[] = {
+    {"table", ReportFormat::kTable}, {"tsv", ReportFormat::kTsv}, {"csv", ReportFormat::kCsv},
+    {"json", ReportFormat::kJson},   {"ndjson", ReportFormat::kNdjson},
+};
+
+bool parse_report_format(const std::string& name, ReportFormat& format) {
+  for (const auto& entry : kReportFormats) {
+    if (name == entry.name) {
+      format = entry.format;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Столбец отчета. Ширина и выравнивание нужны только таблице; auto_width - ширина
+// подбирается по данным (но не больше width), для этого таблица копит строки.
+struct ReportColumn {
+  std::string name;
+  int width = 10;
+  bool align_right = false;
+  bool auto_width = false;
+};
+
+// Приемник строк отчета. Отчет описывает столбцы и отдает ячейки по строкам, а приемник
+// сразу пишет их в OutputBuffer в своем формате. Текст вне таблицы (заголовок, период,
+// итоги) адресован человеку, поэтому машиночитаемые форматы его пропускают.
+class ReportSink {
+ public:
+  explicit ReportSink(OutputBuffer& out) : out_(out) {}
+  virtual ~ReportSink() = default;
+  ReportSink(const ReportSink&) = delete;
+  ReportSink& operator=(const ReportSink&) = delete;
+
+  virtual void text(std::string_view) {}
+  virtual void begin_table(const std::vector<ReportColumn>& columns) = 0;
+  virtual void cell(std::string_view text) = 0;
+  virtual void cell_int(long long value) = 0;
+  // Среднее с двумя знаками; отрицательное - нет оценок.
+  virtual void cell_avg(double value) = 0;
+  // Значение отсутствует; shown - как это показать в таблице ("нет", "-").
+  virtual void cell_none(std::string_view shown) = 0;
+  virtual void end_row() = 0;
+  virtual void end_table() {}
+  // Завершает вывод целиком (для JSON - закрывает массив).
+  virtual void finish() {}
+
+  void text_int(long long value) {
+    scratch_.clear();
+    append_int(scratch_, value);
+    text(scratch_);
+  }
+
+  void text_avg(double value) {
+    scratch_.clear();
+    append_avg(scratch_, value);
+    text(scratch_);
+  }
+
+ protected:
+  OutputBuffer& out_;
+
+ private:
+  std::string scratch_;
+};
+
+// Таблица с рамкой для консоли (через TableWriter или AutoWidthTable).
+class TableSink : public ReportSink {
+ public:
+  using ReportSink::ReportSink;
+
+  void text(std::string_view text) override { out_.append(text); }
+
+  void begin_table(const std::vector<ReportColumn>& columns) override {
+    std::vector<int> widths;
+    std::vector<bool> align_right;
+    std::vector<std::string> header;
+    bool auto_width = false;
+    for (const auto& column : columns) {
+      widths.push_back(column.width);
+      align_right.push_back(column.align_right);
+      header.push_back(column.name);
+      auto_width = auto_width || column.auto_width;
+    }
+    if (auto_width) {
+      auto_table_ = std::make_unique<AutoWidthTable>(header, align_right, widths);
+      return;
+    }
+    table_ = std::make_unique<TableWriter>(out_, widths, align_right);
+    table_->line();
+    table_->row(header);
+    table_->line();
+  }
+
+  void cell(std::string_view text) override {
+    if (auto_table_) {
+      row_.emplace_back(text);
+    } else {
+      table_->cell(text);
+    }
+  }
+
+  void cell_int(long long value) override {
+    if (auto_table_) {
+      row_.push_back(std::to_string(value));
+    } else {
+      table_->cell_int(value);
+    }
+  }
+
+  void cell_avg(double value) override {
+    if (auto_table_) {
+      row_.push_back(format_avg(value));
+    } else {
+      table_->cell_avg(value);
+    }
+  }
+
+  void cell_none(std::string_view shown) override { cell(shown); }
+
+  void end_row() override {
+    if (auto_table_) {
+      auto_table_->add_row(row_);
+      row_.clear();
+    } else {
+      table_->end_row();
+    }
+  }
+
+  void end_table() override {
+    if (auto_table_) {
+      auto_table_->render(out_);
+      auto_table_.reset();
+    } else if (table_) {
+      table_->line();
+      table_.reset();
+    }
+  }
+
+ private:
+  std::unique_ptr<TableWriter> table_;
+  std::unique_ptr<AutoWidthTable> auto_table_;
+  std::vector<std::string> row_;
+};
+
+// TSV или CSV: строка заголовка, затем по строке текста на строку отчета.
+// В TSV табуляции и переводы строк внутри значений заменяются пробелами,
+// CSV следует RFC 4180 (разделитель - запятая, кавычки при необходимости).
+class DelimitedSink : public ReportSink {
+ public:
+  DelimitedSink(OutputBuffer& out, bool csv) : ReportSink(out), csv_(csv) {}
+
+  void begin_table(const std::vector<ReportColumn>& columns) override {
+    for (const auto& column : columns) {
+      cell(column.name);
+    }
+    end_row();
+  }
+
+  void cell(std::string_view text) override {
+    separate();
+    std::string& buf = out_.raw();
+    if (csv_) {
+      buf += csv_escape(std::string(text), ',');
+      return;
+    }
+    for (char c : text) {
+      buf.push_back(c == '\t' || c == '\n' || c == '\r' ? ' ' : c);
+    }
+  }
+
+  void cell_int(long long value) override {
+    separate();
+    ::append_int(out_.raw(), value);
+  }
+
+  void cell_avg(double value) override {
+    separate();
+    if (value >= 0.0) {
+      ::append_avg(out_.raw(), value);
+    }
+  }
+
+  void cell_none(std::string_view) override { separate(); }
+
+  void end_row() override {
+    out_.raw() += csv_ ? "\r\n" : "\n";
+    column_ = 0;
+    out_.commit();
+  }
+
+ private:
+  void separate() {
+    if (column_++ > 0) {
+      out_.raw().push_back(csv_ ? ',' : '\t');
+    }
+  }
+
+  bool csv_ = false;
+  size_t column_ = 0;
+};
+
+// JSON (массив объектов) или NDJSON (объект на строку). Ключи - названия столбцов,
+// числа остаются числами, отсутствующие значения - null. Каждый объект уходит
+// в буфер вывода сразу после своей строки, поэтому массив не копится в памяти.
+class JsonSink : public ReportSink {
+ public:
+  JsonSink(OutputBuffer& out, bool ndjson) : ReportSink(out), ndjson_(ndjson) {}
+
+  void begin_table(const std::vector<ReportColumn>& columns) override {
+    names_.clear();
+    for (const auto& column : columns) {
+      names_.push_back(column.name);
+    }
+  }
+
+  void cell(std::string_view text) override {
+    key();
+    json_.value(text);
+  }
+
+  void cell_int(long long value) override {
+    key();
+    json_.value(value);
+  }
+
+  void cell_avg(double value) override {
+    key();
+    json_.value_avg(value);
+  }
+
+  void cell_none(std::string_view) override {
+    key();
+    json_.value_null();
+  }
+
+  void end_row() override {
+    if (column_ == 0) {
+      json_.str().clear();
+      json_.begin_object();
+    }
+    json_.end_object();
+    if (ndjson_) {
+      out_.raw() += json_.str();
+      out_.raw() += '\n';
+    } else {
+      out_.raw() += rows_ == 0 ? "[\n" : ",\n";
+      out_.raw() += json_.str();
+    }
+    ++rows_;
+    column_ = 0;
+    out_.commit();
+  }
+
+  void finish() override {
+    if (!ndjson_) {
+      out_.append(rows_ == 0 ? "[]\n" : "\n]\n");
+    }
+  }
+
+ private:
+  // Начинает объект строки на первой ячейке и пишет ключ очередного столбца.
+  void key() {
+    if (column_ == 0) {
+      json_.str().clear();
+      json_.begin_object();
+    }
+    if (column_ < names_.size()) {
+      json_.key(names_[column_]);
+    } else {
+      json_.key(std::to_string(column_ + 1));
+    }
+    ++column_;
+  }
+
+  bool ndjson_ = false;
+  JsonWriter json_;
+  std::vector<std::string> names_;
+  size_t column_ = 0;
+  long long rows_ = 0;
+};
+
+std::unique_ptr<ReportSink> make_report_sink(ReportFormat format, OutputBuffer& out) {
+  switch (format) {
+    case ReportFormat::kTsv:
+      return std::make_unique<DelimitedSink>(out, false);
+    case ReportFormat::kCsv:
+      return std::make_unique<DelimitedSink>(out, true);
+    case ReportFormat::kJson:
+      return std::make_unique<JsonSink>(out, false);
+    case ReportFormat::kNdjson:
+      return std::make_unique<JsonSink>(out, true);
+    case ReportFormat::kTable:
+    default:
+      return std::make_unique<TableSink>(out);
+  }
+}
+
+// Дописывает список оценок через запятую.
+template <typename Values>
+void append_grades(std::string& out, const Values& values) {
+  for (size_t i = 0; i < values.size(); ++i) {
+    if (i > 0) {
+      out += ", ";
+    }
+    append_int(out, values[i]);
+  }
+}
+
+constexpr size_t kReportCacheMaxEntries = 256;
+constexpr size_t kReportCacheGenerations = 4;
+
+// Кэш готовых результатов отчетов. Ключ - вид отчета и его параметры; результат годен
+// только для поколения данных, на котором он посчитан (любое изменение поднимает
+// DataStore::generation). Результаты хранятся отдельно для нескольких последних
+// поколений: сервер отвечает по своему снимку, пока меню уже правит следующее поколение,
+// и запросы по разным снимкам не вытесняют друг друга. Когда поколений больше
+// kReportCacheGenerations, отбрасывается то, к которому дольше всего не обращались.
+class ReportCache {
+ public:
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    size_t entries = 0;
+    uint64_t generation = 0;
+  };
+
+  std::shared_ptr<const std::string> find(const std::string& key, uint64_t generation) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Bucket* bucket = touch(generation);
+    if (bucket) {
+      auto it = bucket->entries.find(key);
+      if (it != bucket->entries.end()) {
+        ++hits_;
+        return it->second;
+      }
+    }
+    ++misses_;
+    return nullptr;
+  }
+
+  std::shared_ptr<const std::string> store(const std::string& key, uint64_t generation, std::string text) {
+    std::shared_ptr<const std::string> value = std::make_shared<const std::string>(std::move(text));
+    std::lock_guard<std::mutex> lock(mutex_);
+    Bucket* bucket = touch(generation);
+    if (!bucket) {
+      buckets_.push_front({generation, {}});
+      bucket = &buckets_.front();
+      if (buckets_.size() > kReportCacheGenerations) {
+        buckets_.pop_back();
+      }
+    }
+    if (bucket->entries.size() >= kReportCacheMaxEntries) {
+      bucket->entries.clear();
+    }
+    bucket->entries[key] = value;
+    return value;
+  }
+
+  // Есть ли годный результат (без учета в статистике попаданий).
+  bool contains(const std::string& key, uint64_t generation) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& bucket : buckets_) {
+      if (bucket.generation == generation) {
+        return bucket.entries.count(key) > 0;
+      }
+    }
+    return false;
+  }
+
+  Stats stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats{hits_, misses_, 0, 0};
+    for (const auto& bucket : buckets_) {
+      stats.entries += bucket.entries.size();
+      stats.generation = std::max(stats.generation, bucket.generation);
+    }
+    return stats;
+  }
+
+ private:
+  struct Bucket {
+    uint64_t generation = 0;
+    std::map<std::string, std::shared_ptr<const std::string>> entries;
+  };
+
+  // Результаты поколения, поднятые в начало списка как последние использованные.
+  Bucket* touch(uint64_t generation) {
+    for (auto it = buckets_.begin(); it != buckets_.end(); ++it) {
+      if (it->generation == generation) {
+        buckets_.splice(buckets_.begin(), buckets_, it);
+        return &buckets_.front();
+      }
+    }
+    return nullptr;
+  }
+
+  mutable std::mutex mutex_;
+  std::list<Bucket> buckets_;  // в начале - поколение, к которому обращались последним
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+};
+
+ReportCache& report_cache() {
+  static ReportCache cache;
+  return cache;
+}
+
+// Ключ кэша: вид отчета, период и параметры фильтров.
+std::string report_key(const char* kind, const Period& period, std::initializer_list<int> params = {}) {
+  std::string key = kind;
+  key += '|';
+  append_int(key, period.from);
+  key += '|';
+  append_int(key, period.to);
+  for (int param : params) {
+    key += '|';
+    append_int(key, param);
+  }
+  return key;
+}
+
+// Печатает отчет из кэша, а при промахе строит его через render (в табличном виде)
+// и запоминает текст.
+template <typename Fn>
+void print_cached(const DataStore& data, const std::string& key, Fn&& render) {
+  ReportCache& cache = report_cache();
+  std::shared_ptr<const std::string> text = cache.find(key, data.generation);
+  if (!text) {
+    std::ostringstream stream;
+    {
+      OutputBuffer out(stream);
+      TableSink sink(out);
+      render(sink);
+    }
+    text = cache.store(key, data.generation, stream.str());
+  }
+  std::cout.write(text->data(), static_cast<std::streamsize>(text->size()));
+  std::cout.flush();
+}
+
+// Доля попаданий в кэш (0..1); -1, если обращений еще не было.
+double cache_hit_rate(const ReportCache::Stats& stats) {
+  uint64_t lookups = stats.hits + stats.misses;
+  return lookups == 0 ? -1.0 : static_cast<double>(stats.hits) / static_cast<double>(lookups);
+}
+
+// Печатает статистику кэша отчетов.
+void print_cache_stats(const DataStore& data) {
+  ReportCache::Stats stats = report_cache().stats();
+  OutputBuffer out(std::cout);
+  out.append("Кэш отчетов: попаданий ");
+  out.append_int(static_cast<long long>(stats.hits));
+  out.append(", промахов ");
+  out.append_int(static_cast<long long>(stats.misses));
+  out.append(", доля попаданий ");
+  double rate = cache_hit_rate(stats);
+  out.append_avg(rate < 0.0 ? rate : rate * 100.0);
+  out.append(rate < 0.0 ? "" : "%");
+  out.append(", записей ");
+  out.append_int(static_cast<long long>(stats.entries));
+  out.append("\nПоколение данных: ");
+  out.append_int(static_cast<long long>(data.generation));
+  out.append("\n");
+}
+
+// Выделения памяти под временные данные отчетов (для --bench arena): сколько раз
+// и сколько байт запрошено у кучи.
+struct ReportMemoryStats {
+  std::atomic<uint64_t> allocations{0};
+  std::atomic<uint64_t> bytes{0};
+};
+
+ReportMemoryStats& report_memory_stats() {
+  static ReportMemoryStats stats;
+  return stats;
+}
+
+// Куча с подсчетом выделений в report_memory_stats().
+class CountingResource : public std::pmr::memory_resource {
+ private:
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    ReportMemoryStats& stats = report_memory_stats();
+    stats.allocations.fetch_add(1, std::memory_order_relaxed);
+    stats.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+    std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
+
+std::pmr::memory_resource* report_heap() {
+  static CountingResource heap;
+  return &heap;
+}
+
+// false - отчеты берут память прямо из кучи (для сравнения в --bench arena).
+bool& report_arena_enabled() {
+  static bool enabled = true;
+  return enabled;
+}
+
+constexpr size_t kReportArenaInline = 16 * 1024;
+
+// Арена одного отчета: временные контейнеры отчета берут память подряд из буфера
+// на стеке, потом из растущих блоков кучи, и освобождаются все разом вместе с ареной.
+// release() возвращает арену к пустому буферу - для повторного использования в цикле.
+class ReportArena {
+ public:
+  ReportArena() : arena_(initial_, sizeof(initial_), report_heap()) {}
+  ReportArena(const ReportArena&) = delete;
+  ReportArena& operator=(const ReportArena&) = delete;
+
+  std::pmr::memory_resource* resource() { return report_arena_enabled() ? &arena_ : report_heap(); }
+  void release() { arena_.release(); }
+
+ private:
+  alignas(std::max_align_t) std::byte initial_[kReportArenaInline];
+  std::pmr::monotonic_buffer_resource arena_;
+};
+
+template <typename Values>
+double average_from_values(const Values& values) {
+  if (values.empty()) {
+    return -1.0;
+  }
+  int sum = 0;
+  for (int value : values) {
+    sum += value;
+  }
+  return static_cast<double>(sum) / static_cast<double>(values.size());
+}
+
+// Оценки подряд в памяти без владения: весь вектор или его отрезок.
+struct GradeValues {
+  const int* first = nullptr;
+  size_t count = 0;
+
+  GradeValues() = default;
+  GradeValues(const int* values, size_t size) : first(values), count(size) {}
+  GradeValues(const std::vector<int>& values) : first(values.data()), count(values.size()) {}
+
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  int operator[](size_t i) const { return first[i]; }
+  int back() const { return first[count - 1]; }
+  const int* begin() const { return first; }
+  const int* end() const { return first + count; }
+};
+
+// Плоская таблица оценок по ключу (предмет или студент): значения подряд, по ключу -
+// отрезок. Ключи добавляются по возрастанию, все оценки ключа - подряд.
+class GradeRuns {
+ public:
+  explicit GradeRuns(std::pmr::memory_resource* memory) : values_(memory), runs_(memory) {}
+
+  void add(int key, int value) {
+    if (runs_.empty() || runs_.back().key != key) {
+      runs_.push_back({key, values_.size()});
+    }
+    values_.push_back(value);
+  }
+
+  bool empty() const { return runs_.empty(); }
+
+  // Оценки ключа (пустой список, если их нет).
+  GradeValues find(int key) const {
+    auto it = std::lower_bound(runs_.begin(), runs_.end(), key, [](const Run& run, int k) { return run.key < k; });
+    if (it == runs_.end() || it->key != key) {
+      return GradeValues();
+    }
+    return values_of(static_cast<size_t>(it - runs_.begin()));
+  }
+
+  // fn(key, values) по возрастанию ключа.
+  template <typename Fn>
+  void for_each(Fn&& fn) const {
+    for (size_t i = 0; i < runs_.size(); ++i) {
+      fn(runs_[i].key, values_of(i));
+    }
+  }
+
+ private:
+  struct Run {
+    int key;
+    size_t begin;
+  };
+
+  GradeValues values_of(size_t i) const {
+    size_t end = i + 1 < runs_.size() ? runs_[i + 1].begin : values_.size();
+    return GradeValues(values_.data() + runs_[i].begin, end - runs_[i].begin);
+  }
+
+  std::pmr::vector<int> values_;
+  std::pmr::vector<Run> runs_;
+};
+
+// Оценки студента по предметам (по возрастанию ID предмета), в каждом - по порядку попыток.
+using GradesBySubject = GradeRuns;
+
+// Оценки студента за период одним проходом; таблица - в памяти memory (обычно арена отчета).
+GradesBySubject grades_by_subject_for_student(const DataStore& data, int student_id, const Period& period,
+                                              std::pmr::memory_resource* memory) {
+  std::pmr::vector<Grade> grades(memory);
+  for_each_grade(data, period, [&](const Grade& grade) {
+    if (grade.student_id == student_id) {
+      grades.push_back(grade);
+    }
+  });
+  std::sort(grades.begin(), grades.end(), [](const Grade& a, const Grade& b) {
+    if (a.subject_id != b.subject_id) {
+      return a.subject_id < b.subject_id;
+    }
+    if (a.attempt != b.attempt) {
+      return a.attempt < b.attempt;
+    }
+    return a.id < b.id;
+  });
+  GradesBySubject result(memory);
+  for (const auto& grade : grades) {
+    result.add(grade.subject_id, grade.value);
+  }
+  return result;
+}
+
+// Средний балл по таблице оценок студента: среднее по предметам, затем по студенту,
+// как average_subjects_for_student.
+double average_by_subject(const GradesBySubject& by_subject) {
+  double sum = 0.0;
+  int count = 0;
+  by_subject.for_each([&](int, GradeValues values) {
+    sum += average_from_values(values);
+    ++count;
+  });
+  return count > 0 ? sum / static_cast<double>(count) : -1.0;
+}
+
+// Оценки предмета за период по студентам (по возрастанию ID), у каждого - по порядку попыток.
+GradeRuns subject_grades_by_student(const DataStore& data, int subject_id, const Period& period,
+                                    std::pmr::memory_resource* memory) {
+  std::pmr::vector<Grade> grades(memory);
+  for_each_grade(data, period, [&](const Grade& grade) {
+    if (grade.subject_id == subject_id) {
+      grades.push_back(grade);
+    }
+  });
+  std::sort(grades.begin(), grades.end(), [](const Grade& a, const Grade& b) {
+    if (a.student_id != b.student_id) {
+      return a.student_id < b.student_id;
+    }
+    if (a.attempt != b.attempt) {
+      return a.attempt < b.attempt;
+    }
+    return a.id < b.id;
+  });
+  GradeRuns result(memory);
+  for (const auto& grade : grades) {
+    result.add(grade.student_id, grade.value);
+  }
+  return result;
+}
+
+bool matches_group_filter(const Student& student, int group_filter) {
+  if (group_filter == 0) {
+    return true;
+  }
+  if (group_filter == -1) {
+    return student.group_id == 0;
+  }
+  return student.group_id == group_filter;
+}
+
+std::vector<const Student*> students_for_group_sorted(const DataStore& data, int group_filter) {
+  // Ключи сортировки (имя в нижнем регистре) строятся один раз на студента в общем
+  // буфере арены, а не заново в каждом сравнении.
+  struct Entry {
+    size_t offset;
+    size_t size;
+    const Student* student;
+  };
+  ReportArena arena;
+  std::pmr::string keys(arena.resource());
+  std::pmr::vector<Entry> entries(arena.resource());
+  for (const auto& student : data.students) {
+    if (matches_group_filter(student, group_filter)) {
+      entries.push_back({keys.size(), student.name.size(), &student});
+      for (unsigned char c : student.name) {
+        keys.push_back(static_cast<char>(std::tolower(c)));
+      }
+    }
+  }
+  auto key = [&keys](const Entry& entry) { return std::string_view(keys).substr(entry.offset, entry.size); };
+  std::sort(entries.begin(), entries.end(), [&key](const Entry& a, const Entry& b) {
+    std::string_view a_key = key(a);
+    std::string_view b_key = key(b);
+    if (a_key != b_key) {
+      return a_key < b_key;
+    }
+    return a.student->id < b.student->id;
+  });
+  std::vector<const Student*> result;
+  result.reserve(entries.size());
+  for (const auto& entry : entries) {
+    result.push_back(entry.student);
+  }
+  return result;
+}
+
+
+// Возвращает название предмета или запасной текст, если не найден.
+std::string subject_name_or_unknown(const DataStore& data, int id) {
+  const Subject* subject = find_subject(data, id);
+  return subject ? subject->name : "Неизвестно";
+}
+
+// Предмет для строки отчета по оценке, чей предмет уже удален: ID сохраняется,
+// название - тот же запасной текст, что у subject_name_or_unknown.
+Subject unknown_subject(int id) {
+  Subject subject;
+  subject.id = id;
+  subject.name = "Неизвестно";
+  return subject;
+}
+
+// Возвращает название группы или текст по умолчанию.
+std::string group_name_or_none(const DataStore& data, int id) {
+  if (id == 0) {
+    return "Без группы";
+  }
+  const Group* group = find_group(data, id);
+  return group ? group->name : "Неизвестная группа";
+}
+
+// Запрашивает ID группы, 0 означает "без группы".
+int read_group_id_allow_none(const DataStore& data, const std::string& prompt) {
+  while (true) {
+    int id = read_int(prompt, 0, std::numeric_limits<int>::max());
+    if (id == 0) {
+      return 0;
+    }
+    if (find_group(data, id)) {
+      return id;
+    }
+    std::cout << "Группа не найдена.\n";
+  }
+}
+
+// Запрашивает ID группы, допускает пустой ввод (false, если пусто).
+bool read_group_id_optional(const DataStore& data, const std::string& prompt, int& out) {
+  while (true) {
+    std::string line = trim(read_line(prompt, true));
+    if (line.empty()) {
+      return false;
+    }
+    int value = 0;
+    if (!parse_int(line, value)) {
+      std::cout << "Введите корректное целое число.\n";
+      continue;
+    }
+    if (value < 0) {
+      std::cout << "Значение должно быть 0 или больше.\n";
+      continue;
+    }
+    if (value != 0 && !find_group(data, value)) {
+      std::cout << "Группа не найдена.\n";
+      continue;
+    }
+    out = value;
+    return true;
+  }
+}
+
+int read_student_id_or_cancel(const DataStore& data, const std::string& prompt) {
+  while (true) {
+    int id = read_int(prompt, 0, std::numeric_limits<int>::max());
+    if (id == 0) {
+      return 0;
+    }
+    if (find_student(data, id)) {
+      return id;
+    }
+    std::cout << "Студент не найден.\n";
+  }
+}
+
+int read_subject_id_or_cancel(const DataStore& data, const std::string& prompt) {
+  while (true) {
+    int id = read_int(prompt, 0, std::numeric_limits<int>::max());
+    if (id == 0) {
+      return 0;
+    }
+    if (find_subject(data, id)) {
+      return id;
+    }
+    std::cout << "Предмет не найден.\n";
+  }
+}
+
+// Запрашивает фильтр по группе: 0 - все, -1 - без группы, >0 - конкретная группа.
+int read_group_filter(const DataStore& data, const std::string& prompt) {
+  while (true) {
+    int id = read_int(prompt, -1, std::numeric_limits<int>::max());
+    if (id <= 0) {
+      return id;
+    }
+    if (find_group(data, id)) {
+      return id;
+    }
+    std::cout << "Группа не найдена.\n";
+  }
+}
+
+// Печатает краткий список студентов.
+void print_students_simple(const DataStore& data) {
+  if (data.students.empty()) {
+    std::cout << "Нет студентов.\n";
+    return;
+  }
+  OutputBuffer out(std::cout);
+  out.append("Студенты:\n");
+  TableWriter table(out, {4, 28, 20}, {true, false, false});
+  table.line();
+  table.row({"ID", "ФИО", "Группа"});
+  table.line();
+  for (const auto& student : data.students) {
+    table.cell_int(student.id);
+    table.cell(student.name);
+    table.cell(group_name_or_none(data, student.group_id));
+    table.end_row();
+  }
+  table.line();
+}
+
+// Печатает краткий список групп.
+void print_groups_simple(const DataStore& data) {
+  if (data.groups.empty()) {
+    std::cout << "Нет групп.\n";
+    return;
+  }
+  OutputBuffer out(std::cout);
+  out.append("Группы:\n");
+  TableWriter table(out, {4, 28}, {true, false});
+  table.line();
+  table.row({"ID", "Название"});
+  table.line();
+  for (const auto& group : data.groups) {
+    table.cell_int(group.id);
+    table.cell(group.name);
+    table.end_row();
+  }
+  table.line();
+}
+
+// Печатает краткий список предметов.
+void print_subjects_simple(const DataStore& data) {
+  if (data.subjects.empty()) {
+    std::cout << "Нет предметов.\n";
+    return;
+  }
+  OutputBuffer out(std::cout);
+  out.append("Предметы:\n");
+  TableWriter table(out, {4, 28}, {true, false});
+  table.line();
+  table.row({"ID", "Название"});
+  table.line();
+  for (const auto& subject : data.subjects) {
+    table.cell_int(subject.id);
+    table.cell(subject.name);
+    table.end_row();
+  }
+  table.line();
+}
+
+// Печатает краткий список оценок.
+void print_grades_simple(const DataStore& data) {
+  if (grade_count(data) == 0) {
+    std::cout << "Нет оценок.\n";
+    return;
+  }
+  OutputBuffer out(std::cout);
+  out.append("Оценки:\n");
+  TableWriter table(out, {4, 24, 24, 8, 8, 10, 14}, {true, false, false, true, true, false, false});
+  table.line();
+  table.row({"ID", "Студент", "Предмет", "Попытка", "Оценка", "Дата", "Семестр"});
+  table.line();
+  EntitySlots students(data.students);
+  EntitySlots subjects(data.subjects);
+  for (const GradePartition& part : data.grade_partitions) {
+    std::string semester = semester_name(part.semester);
+    for (size_t i = 0; i < part.size(); ++i) {
+      Grade grade = part.grade_at(i);
+      int student = students.slot(grade.student_id);
+      int subject = subjects.slot(grade.subject_id);
+      table.cell_int(grade.id);
+      table.cell(student >= 0 ? std::string_view(data.students[students.index(student)].name) : "Неизвестно");
+      table.cell(subject >= 0 ? std::string_view(data.subjects[subjects.index(subject)].name) : "Неизвестно");
+      table.cell_int(grade.attempt);
+      table.cell_int(grade.value);
+      table.cell(format_date(grade.created_at));
+      table.cell(semester);
+      table.end_row();
+    }
+  }
+  table.line();
+}
+
+// Печатает подробный список студентов с оценками по предметам.
+void list_students_detailed(const DataStore& data) {
+  if (data.students.empty()) {
+    std::cout << "Нет студентов.\n";
+    return;
+  }
+  OutputBuffer out(std::cout);
+  out.append("Список студентов:\n");
+  TableWriter table(out, {4, 28, 20, 12}, {true, false, false, true});
+  TableWriter subj_table(out, {4, 26, 10, 10, 30}, {true, false, true, true, false});
+  table.line();
+  table.row({"ID", "ФИО", "Группа", "Ср.балл"});
+  table.line();
+  // Все оценки одним плоским массивом по студенту, предмету и попытке: оценки студента
+  // и каждого его предмета идут подряд, без прохода по всем оценкам на каждого студента.
+  struct Attempt {
+    int student_id;
+    int subject_id;
+    int attempt;
+    int grade_id;
+    int value;
+  };
+  ReportArena arena;
+  std::pmr::vector<Attempt> attempts(arena.resource());
+  for_each_grade(data, Period(), [&](const Grade& grade) {
+    attempts.push_back({grade.student_id, grade.subject_id, grade.attempt, grade.id, grade.value});
+  });
+  std::sort(attempts.begin(), attempts.end(), [](const Attempt& a, const Attempt& b) {
+    if (a.student_id != b.student_id) {
+      return a.student_id < b.student_id;
+    }
+    if (a.subject_id != b.subject_id) {
+      return a.subject_id < b.subject_id;
+    }
+    if (a.attempt != b.attempt) {
+      return a.attempt < b.attempt;
+    }
+    return a.grade_id < b.grade_id;
+  });
+  std::string grades_text;
+  for (const auto& student : data.students) {
+    auto first = std::lower_bound(attempts.begin(), attempts.end(), student.id,
+                                  [](const Attempt& a, int id) { return a.student_id < id; });
+    auto last = first;
+    while (last != attempts.end() && last->student_id == student.id) {
+      ++last;
+    }
+    // Среднее по предметам, затем по студенту - как average_subjects_for_student.
+    double sum = 0.0;
+    int count = 0;
+    for (auto it = first; it != last;) {
+      int subject_sum = 0;
+      int subject_count = 0;
+      int subject_id = it->subject_id;
+      for (; it != last && it->subject_id == subject_id; ++it) {
+        subject_sum += it->value;
+        ++subject_count;
+      }
+      sum += static_cast<double>(subject_sum) / static_cast<double>(subject_count);
+      ++count;
+    }
+    table.cell_int(student.id);
+    table.cell(student.name);
+    table.cell(group_name_or_none(data, student.group_id));
+    table.cell_avg(count > 0 ? sum / static_cast<double>(count) : -1.0);
+    table.end_row();
+
+    if (first == last) {
+      out.append("  Предметы: нет\n");
+      continue;
+    }
+    out.append("  Предметы:\n");
+    subj_table.line();
+    subj_table.row({"ID", "Предмет", "Ср.балл", "Последн.", "Оценки"});
+    subj_table.line();
+    for (auto it = first; it != last;) {
+      int subject_id = it->subject_id;
+      int subject_sum = 0;
+      int subject_count = 0;
+      int latest_id = 0;
+      int latest_value = 0;
+      grades_text.clear();
+      for (; it != last && it->subject_id == subject_id; ++it) {
+        if (subject_count > 0) {
+          grades_text += ", ";
+        }
+        append_int(grades_text, it->value);
+        subject_sum += it->value;
+        ++subject_count;
+        if (it->grade_id > latest_id) {
+          latest_id = it->grade_id;
+          latest_value = it->value;
+        }
+      }
+      subj_table.cell_int(subject_id);
+      subj_table.cell(subject_name_or_unknown(data, subject_id));
+      subj_table.cell_avg(static_cast<double>(subject_sum) / static_cast<double>(subject_count));
+      subj_table.cell_int(latest_value);
+      subj_table.cell(grades_text);
+      subj_table.end_row();
+    }
+    subj_table.line();
+  }
+  table.line();
+}
+
+struct StudentResult {
+  const Student* student = nullptr;
+  double avg = -1.0;
+};
+
+// Формирует список студентов с учетом фильтров.
+std::vector<StudentResult> filter_students(const DataStore& data,
+                                           int group_filter,
+                                           const std::string& name_query,
+                                           bool use_min_avg,
+                                           double min_avg) {
+  std::string name_query_lower = to_lower_ascii(trim(name_query));
+  std::vector<const Student*> matched;
+  for (const auto& student : data.students) {
+    if (group_filter == -1 && student.group_id != 0) {
+      continue;
+    }
+    if (group_filter > 0 && student.group_id != group_filter) {
+      continue;
+    }
+    if (!name_query_lower.empty()) {
+      std::string name_lower = to_lower_ascii(student.name);
+      if (name_lower.find(name_query_lower) == std::string::npos) {
+        continue;
+      }
+    }
+    matched.push_back(&student);
+  }
+  std::vector<double> averages = student_averages(data, Period(), matched);
+  std::vector<StudentResult> results;
+  for (size_t i = 0; i < matched.size(); ++i) {
+    double avg = averages[i];
+    if (use_min_avg) {
+      if (avg < 0.0 || avg < min_avg) {
+        continue;
+      }
+    }
+    results.push_back({matched[i], avg});
+  }
+  return results;
+}
+
+// Печатает результат поиска/фильтрации по студентам.
+void print_student_results(const DataStore& data, const std::vector<StudentResult>& results) {
+  if (results.empty()) {
+    std::cout << "Нет подходящих студентов.\n";
+    return;
+  }
+  OutputBuffer out(std::cout);
+  out.append("Результаты (");
+  out.append_int(static_cast<long long>(results.size()));
+  out.append("):\n");
+  TableWriter table(out, {4, 28, 20, 12}, {true, false, false, true});
+  table.line();
+  table.row({"ID", "ФИО", "Группа", "Ср.балл"});
+  table.line();
+  for (const auto& item : results) {
+    const Student* student = item.student;
+    table.cell_int(student->id);
+    table.cell(student->name);
+    table.cell(group_name_or_none(data, student->group_id));
+    table.cell_avg(item.avg);
+    table.end_row();
+  }
+  table.line();
+}
+
+// Создает запись студента и возвращает его ID.
+int create_student_record(DataStore& data, const std::string& name, int group_id) {
+  Student student;
+  student.id = data.next_student_id++;
+  student.name = name;
+  student.group_id = group_id;
+  uint64_t before = data.students.version();
+  data.students.write().push_back(student);
+  data.student_names.note(before, data.students, nullptr, &student);
+  record_change(data, Entity::kStudent, ChangeOp::kInsert, student.id, 0);
+  return student.id;
+}
+
+// ID записей с тем же именем (см. name_key), по возрастанию.
+std::vector<int> same_name_students(DataStore& data, const std::string& name, int group_id) {
+  Student probe;
+  probe.name = name;
+  probe.group_id = group_id;
+  return data.student_names.find(data.students, probe);
+}
+
+std::vector<int> same_name_groups(DataStore& data, const std::string& name) {
+  Group probe;
+  probe.name = name;
+  return data.group_names.find(data.groups, probe);
+}
+
+std::vector<int> same_name_subjects(DataStore& data, const std::string& name) {
+  Subject probe;
+  probe.name = name;
+  return data.subject_names.find(data.subjects, probe);
+}
+
+// "ID 3, 17, 40" (не больше пяти номеров).
+std::string id_list(const std::vector<int>& ids) {
+  const size_t kShown = 5;
+  std::string text = "ID ";
+  for (size_t i = 0; i < ids.size() && i < kShown; ++i) {
+    if (i > 0) {
+      text += ", ";
+    }
+    text += std::to_string(ids[i]);
+  }
+  if (ids.size() > kShown) {
+    text += " и еще " + std::to_string(ids.size() - kShown);
+  }
+  return text;
+}
+
+// Предупреждает о записях с тем же именем; true - добавлять запись.
+bool confirm_despite_duplicates(const std::vector<int>& same, const char* what) {
+  if (same.empty()) {
+    return true;
+  }
+  std::cout << what << " (" << id_list(same) << ").\n";
+  return read_int("Все равно добавить? 1-да, 0-нет: ", 0, 1) == 1;
+}
+
+// Создает группу для нового студента; если группа с таким названием уже есть,
+// предлагает взять ее. Возвращает ID группы.
+int create_group_for_student(DataStore& data, const std::string& name) {
+  std::vector<int> same = same_name_groups(data, name);
+  if (!same.empty()) {
+    std::cout << "Группа с таким названием уже есть (" << id_list(same) << ").\n";
+    if (read_int("Взять группу с ID " + std::to_string(same.front()) + "? 1-да, 0-создать новую: ", 0, 1) == 1) {
+      return same.front();
+    }
+  }
+  int group_id = create_group_record(data, name);
+  std::cout << "Создана группа с ID " << group_id << ".\n";
+  return group_id;
+}
+
+// Запрашивает группу при создании студента (включая создание новой).
+int read_group_for_new_student(DataStore& data) {
+  if (data.groups.empty()) {
+    int create_group_choice = read_int("Группы отсутствуют. Создать новую? 1-да, 0-нет: ", 0, 1);
+    if (create_group_choice == 1) {
+      std::string group_name = trim(read_line("Название новой группы: "));
+      return create_group_for_student(data, group_name);
+    }
+    return 0;
+  }
+
+  print_groups_simple(data);
+  while (true) {
+    int group_id = read_int("ID группы (0 - без группы, -1 - создать новую): ",
+                            -1, std::numeric_limits<int>::max());
+    if (group_id == 0) {
+      return 0;
+    }
+    if (group_id == -1) {
+      std::string group_name = trim(read_line("Название новой группы: "));
+      return create_group_for_student(data, group_name);
+    }
+    if (find_group(data, group_id)) {
+      return group_id;
+    }
+    std::cout << "Группа не найдена.\n";
+  }
+}
+
+// Меню поиска, фильтрации и сортировки студентов.
+void students_search_menu(const DataStore& data) {
+  if (data.students.empty()) {
+    std::cout << "Нет студентов.\n";
+    return;
+  }
+  if (!data.groups.empty()) {
+    print_groups_simple(data);
+  }
+  int group_filter = read_group_filter(data, "ID группы (0 - все, -1 - без группы): ");
+  std::string name_query = read_line("ФИО (часть, пусто - без фильтра): ", true);
+  double min_avg = 0.0;
+  bool use_min_avg = read_double_optional("Мин. средний балл (пусто - без фильтра): ",
+                                          0.0, static_cast<double>(kMaxGrade), min_avg);
+
+  int sort_key = read_int("Сортировка: 1) ID 2) ФИО 3) Средний балл: ", 1, 3);
+  int sort_order = read_int("Порядок: 1) Возрастание 2) Убывание: ", 1, 2);
+  bool asc = (sort_order == 1);
+
+  std::vector<StudentResult> results =
+      filter_students(data, group_filter, name_query, use_min_avg, min_avg);
+
+  auto cmp_asc = [sort_key](const StudentResult& a, const StudentResult& b) {
+    if (sort_key == 1) {
+      return a.student->id < b.student->id;
+    }
+    if (sort_key == 2) {
+      std::string a_name = to_lower_ascii(a.student->name);
+      std::string b_name = to_lower_ascii(b.student->name);
+      if (a_name != b_name) {
+        return a_name < b_name;
+      }
+      return a.student->id < b.student->id;
+    }
+    if (a.avg != b.avg) {
+      return a.avg < b.avg;
+    }
+    return a.student->id < b.student->id;
+  };
+
+  std::sort(results.begin(), results.end(),
+            [&](const StudentResult& a, const StudentResult& b) {
+              return asc ? cmp_asc(a, b) : cmp_asc(b, a);
+            });
+
+  print_student_results(data, results);
+}
+
+// Добавляет нового студента в список.
+void add_student(DataStore& data) {
+  std::string name = trim(read_line("Имя студента: "));
+  int group_id = read_group_for_new_student(data);
+  if (!confirm_despite_duplicates(same_name_students(data, name, group_id),
+                                  group_id == 0 ? "Студент с таким ФИО без группы уже есть"
+                                                : "Студент с таким ФИО уже есть в этой группе")) {
+    std::cout << "Студент не добавлен.\n";
+    sync_or_warn(data);
+    return;
+  }
+  int student_id = create_student_record(data, name, group_id);
+  std::cout << "Добавлен студент с ID " << student_id << ".\n";
+  sync_or_warn(data);
+}
+
+// Добавляет студента в выбранную группу.
+void add_student_to_group(DataStore& data) {
+  if (data.groups.empty()) {
+    std::cout << "Сначала добавьте группы.\n";
+    return;
+  }
+  print_groups_simple(data);
+  while (true) {
+    int group_id = read_int("ID группы для добавления студента: ", 1,
+                            std::numeric_limits<int>::max());
+    if (!find_group(data, group_id)) {
+      std::cout << "Группа не найдена.\n";
+      continue;
+    }
+    std::string name = trim(read_line("Имя студента: "));
+    if (!confirm_despite_duplicates(same_name_students(data, name, group_id),
+                                    "Студент с таким ФИО уже есть в этой группе")) {
+      std::cout << "Студент не добавлен.\n";
+      return;
+    }
+    int student_id = create_student_record(data, name, group_id);
+    std::cout << "Добавлен студент с ID " << student_id << ".\n";
+    sync_or_warn(data);
+    return;
+  }
+}
+
+// Редактирует данные студента.
+void edit_student(DataStore& data) {
+  if (data.students.empty()) {
+    std::cout << "Нет студентов для редактирования.\n";
+    return;
+  }
+  print_students_simple(data);
+  int id = read_int("ID студента для редактирования: ", 1, std::numeric_limits<int>::max());
+  if (!find_student(data, id)) {
+    std::cout << "Студент не найден.\n";
+    return;
+  }
+  // Запись меняется только после всех вопросов: до этого таблицу не нужно копировать.
+  std::string new_name = trim(read_line("Новое имя (пусто - оставить): ", true));
+  int new_group_id = find_student(data, id)->group_id;
+  if (!data.groups.empty()) {
+    print_groups_simple(data);
+    read_group_id_optional(data, "Новый ID группы (пусто - оставить, 0 - без группы): ", new_group_id);
+  }
+  const Student* current = find_student(data, id);
+  bool changed = (!new_name.empty() && new_name != current->name) || new_group_id != current->group_id;
+  std::cout << "Студент обновлен.\n";
+  if (changed) {
+    Student old_row = *current;
+    uint64_t before = data.students.version();
+    Student* student = entity_for_update(data.students, id);
+    if (!new_name.empty()) {
+      student->name = new_name;
+    }
+    student->group_id = new_group_id;
+    data.student_names.note(before, data.students, &old_row, student);
+    record_change(data, Entity::kStudent, ChangeOp::kUpdate, student->id, student->version);
+    sync_or_warn(data);
+  }
+}
+
+// Удаляет студента и связанные оценки.
+void delete_student(DataStore& data) {
+  if (data.students.empty()) {
+    std::cout << "Нет студентов для удаления.\n";
+    return;
+  }
+  print_students_simple(data);
+  int id = read_int("ID студента для удаления: ", 1, std::numeric_limits<int>::max());
+  auto it = std::find_if(data.students.begin(), data.students.end(),
+                         [id](const Student& s) { return s.id == id; });
+  if (it == data.students.end()) {
+    std::cout << "Студент не найден.\n";
+    return;
+  }
+  Student old_row = *it;
+  size_t index = static_cast<size_t>(it - data.students.begin());
+  uint64_t before = data.students.version();
+  std::vector<Student>& students = data.students.write();  // it указывает в прежнюю копию таблицы
+  students.erase(students.begin() + static_cast<std::ptrdiff_t>(index));
+  data.student_names.note(before, data.students, &old_row, nullptr);
+  // Удаляем все оценки, связанные с этим студентом. Удаления оценок записываются до
+  // удаления студента, чтобы дойти до ленты изменений (каскад в базе их бы не показал).
+  std::vector<std::pair<int, int64_t>> erased;
+  size_t removed = erase_grades_if(data, [id](const Grade& g) { return g.student_id == id; }, &erased);
+  record_deletes(data, Entity::kGrade, erased);
+  record_change(data, Entity::kStudent, ChangeOp::kDelete, id, old_row.version);
+  std::cout << "Студент удален. Удалено связанных оценок: " << removed << ".\n";
+  sync_or_warn(data);
+}
+
+// Создает запись группы и возвращает ее ID.
+int create_group_record(DataStore& data, const std::string& name) {
+  Group group;
+  group.id = data.next_group_id++;
+  group.name = name;
+  uint64_t before = data.groups.version();
+  data.groups.write().push_back(group);
+  data.group_names.note(before, data.groups, nullptr, &group);
+  record_change(data, Entity::kGroup, ChangeOp::kInsert, group.id, 0);
+  return group.id;
+}
+
+// Добавляет новую группу.
+void add_group(DataStore& data) {
+  std::string name = trim(read_line("Название группы: "));
+  if (!confirm_despite_duplicates(same_name_groups(data, name), "Группа с таким названием уже есть")) {
+    std::cout << "Группа не добавлена.\n";
+    return;
+  }
+  int group_id = create_group_record(data, name);
+  std::cout << "Добавлена группа с ID " << group_id << ".\n";
+  sync_or_warn(data);
+}
+
+// Редактирует данные группы.
+void edit_group(DataStore& data) {
+  if (data.groups.empty()) {
+    std::cout << "Нет групп для редактирования.\n";
+    return;
+  }
+  print_groups_simple(data);
+  int id = read_int("ID группы для редактирования: ", 1, std::numeric_limits<int>::max());
+  if (!find_group(data, id)) {
+    std::cout << "Группа не найдена.\n";
+    return;
+  }
+  bool changed = false;
+  std::string new_name = trim(read_line("Новое название (пусто - оставить): ", true));
+  Group* group = nullptr;
+  if (!new_name.empty() && new_name != find_group(data, id)->name) {
+    Group old_row = *find_group(data, id);
+    uint64_t before = data.groups.version();
+    group = entity_for_update(data.groups, id);
+    group->name = new_name;
+    data.group_names.note(before, data.groups, &old_row, group);
+    changed = true;
+  }
+  std::cout << "Группа обновлена.\n";
+  if (changed) {
+    record_change(data, Entity::kGroup, ChangeOp::kUpdate, group->id, group->version);
+    sync_or_warn(data);
+  }
+}
+
+// Удаляет группу и снимает привязку у студентов.
+void delete_group(DataStore& data) {
+  if (data.groups.empty()) {
+    std::cout << "Нет групп для удаления.\n";
+    return;
+  }
+  print_groups_simple(data);
+  int id = read_int("ID группы для удаления: ", 1, std::numeric_limits<int>::max());
+  auto it = std::find_if(data.groups.begin(), data.groups.end(),
+                         [id](const Group& g) { return g.id == id; });
+  if (it == data.groups.end()) {
+    std::cout << "Группа не найдена.\n";
+    return;
+  }
+  Group old_row = *it;
+  size_t index = static_cast<size_t>(it - data.groups.begin());
+  uint64_t before = data.groups.version();
+  std::vector<Group>& groups = data.groups.write();  // it указывает в прежнюю копию таблицы
+  groups.erase(groups.begin() + static_cast<std::ptrdiff_t>(index));
+  data.group_names.note(before, data.groups, &old_row, nullptr);
+  // Перевод студентов в "без группы" записывается правками до удаления группы.
   int updated = 0;
-  for (auto& student : data.students) {
-    if (student.group_id == id) {
+  for (size_t i = 0; i < data.students.size(); ++i) {
+    if (data.students[i].group_id == id) {
+      Student& student = data.students.write()[i];
+      record_change(data, Entity::kStudent, ChangeOp::kUpdate, student.id, student.version);
+      student.group_id = 0;
+      ++updated;
+    }
+  }
+  record_change(data, Entity::kGroup, ChangeOp::kDelete, id, old_row.version);
+  std::cout << "Группа удалена. Студентов обновлено: " << updated << ".\n";
+  sync_or_warn(data);
+}
+
+// Создает запись предмета и возвращает его ID.
+int create_subject_record(DataStore& data, const std::string& name) {
+  Subject subject;
+  subject.id = data.next_subject_id++;
+  subject.name = name;
+  uint64_t before = data.subjects.version();
+  data.subjects.write().push_back(subject);
+  data.subject_names.note(before, data.subjects, nullptr, &subject);
+  record_change(data, Entity::kSubject, ChangeOp::kInsert, subject.id, 0);
+  return subject.id;
+}
+
+// Добавляет новый предмет.
+void add_subject(DataStore& data) {
+  std::string name = trim(read_line("Название предмета: "));
+  if (!confirm_despite_duplicates(same_name_subjects(data, name), "Предмет с таким названием уже есть")) {
+    std::cout << "Предмет не добавлен.\n";
+    return;
+  }
+  int subject_id = create_subject_record(data, name);
+  std::cout << "Добавлен предмет с ID " << subject_id << ".\n";
+  sync_or_warn(data);
+}
+
+// Редактирует данные предмета.
+void edit_subject(DataStore& data) {
+  if (data.subjects.empty()) {
+    std::cout << "Нет предметов для редактирования.\n";
+    return;
+  }
+  print_subjects_simple(data);
+  int id = read_int("ID предмета для редактирования: ", 1, std::numeric_limits<int>::max());
+  if (!find_subject(data, id)) {
+    std::cout << "Предмет не найден.\n";
+    return;
+  }
+  bool changed = false;
+  std::string new_name = trim(read_line("Новое название (пусто - оставить): ", true));
+  Subject* subject = nullptr;
+  if (!new_name.empty() && new_name != find_subject(data, id)->name) {
+    Subject old_row = *find_subject(data, id);
+    uint64_t before = data.subjects.version();
+    subject = entity_for_update(data.subjects, id);
+    subject->name = new_name;
+    data.subject_names.note(before, data.subjects, &old_row, subject);
+    changed = true;
+  }
+  std::cout << "Предмет обновлен.\n";
+  if (changed) {
+    record_change(data, Entity::kSubject, ChangeOp::kUpdate, subject->id, subject->version);
+    sync_or_warn(data);
+  }
+}
+
+// Удаляет предмет и связанные оценки.
+void delete_subject(DataStore& data) {
+  if (data.subjects.empty()) {
+    std::cout << "Нет предметов для удаления.\n";
+    return;
+  }
+  print_subjects_simple(data);
+  int id = read_int("ID предмета для удаления: ", 1, std::numeric_limits<int>::max());
+  auto it = std::find_if(data.subjects.begin(), data.subjects.end(),
+                         [id](const Subject& s) { return s.id == id; });
+  if (it == data.subjects.end()) {
+    std::cout << "Предмет не найден.\n";
+    return;
+  }
+  Subject old_row = *it;
+  size_t index = static_cast<size_t>(it - data.subjects.begin());
+  uint64_t before = data.subjects.version();
+  std::vector<Subject>& subjects = data.subjects.write();  // it указывает в прежнюю копию таблицы
+  subjects.erase(subjects.begin() + static_cast<std::ptrdiff_t>(index));
+  data.subject_names.note(before, data.subjects, &old_row, nullptr);
+  // Удаляем все оценки, связанные с этим предметом (записываются до удаления предмета,
+  // как у студента).
+  std::vector<std::pair<int, int64_t>> erased;
+  size_t removed = erase_grades_if(data, [id](const Grade& g) { return g.subject_id == id; }, &erased);
+  record_deletes(data, Entity::kGrade, erased);
+  record_change(data, Entity::kSubject, ChangeOp::kDelete, id, old_row.version);
+  std::cout << "Предмет удален. Удалено связанных оценок: " << removed << ".\n";
+  sync_or_warn(data);
+}
+
+// Создает оценку с текущей датой и заданным номером попытки; возвращает ее копию.
+Grade create_grade_record(DataStore& data, int student_id, int subject_id, int value, int attempt) {
+  Grade grade;
+  grade.id = data.next_grade_id++;
+  grade.student_id = student_id;
+  grade.subject_id = subject_id;
+  grade.value = value;
+  grade.attempt = attempt;
+  grade.created_at = now_unix();
+  grade.semester = semester_for_time(grade.created_at);
+  insert_grade(data, grade);
+  record_change(data, Entity::kGrade, ChangeOp::kInsert, grade.id, 0);
+  return grade;
+}
+
+// Создает оценку с текущей датой и следующим номером попытки; возвращает ее копию.
+Grade create_grade_record(DataStore& data, int student_id, int subject_id, int value) {
+  // Номер попытки зависит от количества прошлых оценок по предмету.
+  return create_grade_record(data, student_id, subject_id, value, next_attempt(data, student_id, subject_id));
+}
+
+// Оценка ведомости: студент и значение.
+struct SheetEntry {
+  int student_id = 0;
+  int value = 0;
+};
+
+// Добавляет оценки ведомости по одному предмету; attempts - номера следующих попыток
+// студентов (результат next_attempts, посчитанный один раз на всю ведомость). Изменения
+// только копятся в pending_changes, запись в базу - одной синхронизацией после ведомости.
+std::vector<Grade> create_sheet_grades(DataStore& data, int subject_id, const std::vector<SheetEntry>& entries,
+                                       std::unordered_map<int, int> attempts) {
+  std::vector<Grade> grades;
+  grades.reserve(entries.size());
+  for (const auto& entry : entries) {
+    int& attempt = attempts[entry.student_id];
+    grades.push_back(create_grade_record(data, entry.student_id, subject_id, entry.value, attempt));
+    ++attempt;
+  }
+  return grades;
+}
+
+std::vector<Grade> create_sheet_grades(DataStore& data, int subject_id, const std::vector<SheetEntry>& entries) {
+  std::vector<int> student_ids;
+  student_ids.reserve(entries.size());
+  for (const auto& entry : entries) {
+    student_ids.push_back(entry.student_id);
+  }
+  return create_sheet_grades(data, subject_id, entries, next_attempts(data, subject_id, student_ids));
+}
+
+// Ведомость: оценки по одному предмету всей группе подряд, в порядке журнала
+// (пусто - пропустить студента, 0 - закончить), затем одна запись в базу.
+void grade_sheet(DataStore& data) {
+  if (data.students.empty() || data.subjects.empty()) {
+    std::cout << "Сначала добавьте студентов и предметы.\n";
+    return;
+  }
+  print_subjects_simple(data);
+  int subject_id = read_subject_id_or_cancel(data, "ID предмета (0 - отмена): ");
+  if (subject_id == 0) {
+    std::cout << "Операция отменена.\n";
+    return;
+  }
+  if (!data.groups.empty()) {
+    print_groups_simple(data);
+  }
+  int group_id = read_group_filter(data, "ID группы (-1 - студенты без группы, 0 - отмена): ");
+  if (group_id == 0) {
+    std::cout << "Операция отменена.\n";
+    return;
+  }
+  // Имена копируются: пока идет ввод, синхронизации нет, но указатели на таблицу держать незачем.
+  std::vector<Student> roster;
+  for (const Student* student : students_for_group_sorted(data, group_id)) {
+    roster.push_back(*student);
+  }
+  if (roster.empty()) {
+    std::cout << "В группе нет студентов.\n";
+    return;
+  }
+  std::vector<int> roster_ids;
+  roster_ids.reserve(roster.size());
+  for (const auto& student : roster) {
+    roster_ids.push_back(student.id);
+  }
+  // Номера попыток считаются один раз: они же показываются при вводе и они же пишутся
+  // в оценки (пока идет ввод, данные не синхронизируются и не меняются).
+  std::unordered_map<int, int> attempts = next_attempts(data, subject_id, roster_ids);
+
+  std::cout << "Ведомость: " << subject_name_or_unknown(data, subject_id) << ", "
+            << group_name_or_none(data, group_id == -1 ? 0 : group_id) << ", студентов " << roster.size()
+            << ".\nОценка " << kMinGrade << "-" << kMaxGrade << ", пусто - пропустить, 0 - закончить.\n";
+  std::vector<SheetEntry> entries;
+  for (size_t i = 0; i < roster.size(); ++i) {
+    std::string prompt = std::to_string(i + 1) + "/" + std::to_string(roster.size()) + " " + roster[i].name +
+                         " (попытка " + std::to_string(attempts[roster[i].id]) + "): ";
+    bool finished = false;
+    while (true) {
+      std::string line = trim(read_line(prompt, true));
+      if (line.empty()) {
+        break;
+      }
+      int value = 0;
+      if (!parse_int(line, value) || (value != 0 && (value < kMinGrade || value > kMaxGrade))) {
+        std::cout << "Введите оценку " << kMinGrade << "-" << kMaxGrade << ", 0 или пустую строку.\n";
+        continue;
+      }
+      if (value == 0) {
+        finished = true;
+      } else {
+        entries.push_back({roster[i].id, value});
+      }
+      break;
+    }
+    if (finished) {
+      break;
+    }
+  }
+  if (entries.empty()) {
+    std::cout << "Оценки не введены.\n";
+    return;
+  }
+  if (read_int("Сохранить оценок: " + std::to_string(entries.size()) + "? 1-да, 0-нет: ", 0, 1) != 1) {
+    std::cout << "Ведомость не сохранена.\n";
+    return;
+  }
+  std::vector<Grade> grades = create_sheet_grades(data, subject_id, entries, std::move(attempts));
+  std::cout << "Добавлено оценок: " << grades.size() << " (ID " << grades.front().id << "-" << grades.back().id
+            << ", семестр " << semester_name(grades.front().semester) << ").\n";
+  sync_or_warn(data);
+}
+
+// Добавляет оценку студенту по предмету.
+void add_grade(DataStore& data) {
+  if (data.students.empty()) {
+    int choice = read_int("Студентов нет. Создать сейчас? 1-да, 0-нет: ", 0, 1);
+    if (choice == 1) {
+      add_student(data);
+    }
+    if (data.students.empty()) {
+      std::cout << "Сначала добавьте студентов.\n";
+      return;
+    }
+  }
+  if (data.subjects.empty()) {
+    int choice = read_int("Предметов нет. Создать сейчас? 1-да, 0-нет: ", 0, 1);
+    if (choice == 1) {
+      add_subject(data);
+    }
+    if (data.subjects.empty()) {
+      std::cout << "Сначала добавьте предметы.\n";
+      return;
+    }
+  }
+  print_students_simple(data);
+  int student_id = read_student_id_or_cancel(data, "ID студента (0 - отмена): ");
+  if (student_id == 0) {
+    std::cout << "Операция отменена.\n";
+    return;
+  }
+  print_subjects_simple(data);
+  int subject_id = read_subject_id_or_cancel(data, "ID предмета (0 - отмена): ");
+  if (subject_id == 0) {
+    std::cout << "Операция отменена.\n";
+    return;
+  }
+  int value = read_int("Оценка (1-5): ", kMinGrade, kMaxGrade);
+  Grade grade = create_grade_record(data, student_id, subject_id, value);
+  std::cout << "Добавлена оценка с ID " << grade.id << " (попытка "
+            << grade.attempt << ", семестр " << semester_name(grade.semester) << ").\n";
+  sync_or_warn(data);
+}
+
+
+// Редактирует значение оценки.
+void edit_grade(DataStore& data) {
+  if (grade_count(data) == 0) {
+    std::cout << "Нет оценок для редактирования.\n";
+    return;
+  }
+  print_grades_simple(data);
+  int id = read_int("ID оценки для редактирования: ", 1, std::numeric_limits<int>::max());
+  Grade grade;
+  if (!find_grade(data, id, grade)) {
+    std::cout << "Оценка не найдена.\n";
+    return;
+  }
+  bool changed = false;
+  int new_value = 0;
+  if (read_int_optional("Новая оценка (1-5, пусто - оставить): ", kMinGrade, kMaxGrade, new_value)) {
+    if (new_value != grade.value) {
+      grade.value = new_value;
+      replace_grade(data, grade);
+      changed = true;
+    }
+  }
+  std::cout << "Оценка обновлена.\n";
+  if (changed) {
+    record_change(data, Entity::kGrade, ChangeOp::kUpdate, grade.id, grade.version);
+    sync_or_warn(data);
+  }
+}
+
+// Удаляет оценку по ID.
+void delete_grade(DataStore& data) {
+  if (grade_count(data) == 0) {
+    std::cout << "Нет оценок для удаления.\n";
+    return;
+  }
+  print_grades_simple(data);
+  int id = read_int("ID оценки для удаления: ", 1, std::numeric_limits<int>::max());
+  Grade grade;
+  if (!find_grade(data, id, grade)) {
+    std::cout << "Оценка не найдена.\n";
+    return;
+  }
+  record_change(data, Entity::kGrade, ChangeOp::kDelete, id, grade.version);
+  erase_grades_if(data, [id](const Grade& g) { return g.id == id; });
+  std::cout << "Оценка удалена.\n";
+  sync_or_warn(data);
+}
+
+// Параметры отчета, выбранные в меню или переданные в командной строке (--report).
+struct ReportRequest {
+  Period period;
+  int id = 0;     // предмет или студент - для отчетов по одному предмету/студенту
+  int group = 0;  // фильтр группы: 0 - все, -1 - без группы
+  int n = 10;     // размер топа
+};
+
+using ReportRenderFn = void (*)(const DataStore&, const ReportRequest&, ReportSink&);
+
+constexpr size_t kIdleRecentViews = 8;  // сколько последних отчетов меню прогревать
+constexpr int kIdleDelayMs = 300;       // простой ввода, после которого начинается прогрев
+
+// Приемник прогрева: передает вывод дальше и на каждой строке проверяет флаг отмены.
+class CancellableSink : public ReportSink {
+ public:
+  CancellableSink(OutputBuffer& out, ReportSink& inner, const std::atomic<bool>& cancel)
+      : ReportSink(out), inner_(inner), cancel_(cancel) {}
+
+  void text(std::string_view text) override {
+    check();
+    inner_.text(text);
+  }
+  void begin_table(const std::vector<ReportColumn>& columns) override {
+    check();
+    inner_.begin_table(columns);
+  }
+  void cell(std::string_view text) override { inner_.cell(text); }
+  void cell_int(long long value) override { inner_.cell_int(value); }
+  void cell_avg(double value) override { inner_.cell_avg(value); }
+  void cell_none(std::string_view shown) override { inner_.cell_none(shown); }
+  void end_row() override {
+    inner_.end_row();
+    check();
+  }
+  void end_table() override { inner_.end_table(); }
+  void finish() override { inner_.finish(); }
+
+ private:
+  void check() const {
+    if (cancel_.load(std::memory_order_relaxed)) {
+      throw PrecomputeCancelled{};
+    }
+  }
+
+  ReportSink& inner_;
+  const std::atomic<bool>& cancel_;
+};
+
+// Прогрев кэша отчетов, пока меню ждет ввода. read_line вызывает start() перед чтением
+// строки и stop() сразу после. start() снимает копию DataStore с общими таблицами (см. Cow),
+// и фоновый поток читает только ее. Прогреваются последние открытые в меню отчеты (среди них
+// сводный журнал последней выбранной группы) и сводные средние, если их результат в кэше
+// устарел. stop() только отменяет прогрев: ввод оценок не ждет отчет, а отчет не видит
+// недописанных правок; отмена срабатывает на ближайшей строке отчета или на следующем
+// блоке оценок в проходе (check_aggregation_cancel), так что поток не досчитывает
+// ненужный отчет параллельно с работой меню. Результаты пишутся в кэш под поколением
+// снимка и не вытесняют результаты других поколений (см. ReportCache).
+class IdlePrecompute {
+ public:
+  struct Stats {
+    uint64_t warmed = 0;     // отчетов подготовлено в простое
+    uint64_t cancelled = 0;  // прогревов прервано вводом
+  };
+
+  ~IdlePrecompute() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      shutdown_ = true;
+      cancel_ = true;
+    }
+    wake_.notify_all();
+    if (worker_.joinable()) {
+      worker_.join();
+    }
+  }
+
+  // Включает прогрев для данных меню; data должен жить до конца программы.
+  void attach(const DataStore& data) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    data_ = &data;
+    if (!worker_.joinable()) {
+      worker_ = std::thread([this]() { run(); });
+    }
+  }
+
+  // Запоминает отчет, открытый в меню; последний открытый прогревается первым.
+  void remember(const std::string& key, ReportRenderFn render, const ReportRequest& request) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = std::find_if(views_.begin(), views_.end(), [&](const View& view) { return view.key == key; });
+    if (it != views_.end()) {
+      views_.erase(it);
+    }
+    views_.insert(views_.begin(), View{key, render, request});
+    if (views_.size() > kIdleRecentViews) {
+      views_.pop_back();
+    }
+  }
+
+  void start() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!data_) {
+        return;
+      }
+      // Снимок стоит O(числа партиций); таблицы копирует только правка, сделанная,
+      // пока поток еще читает снимок.
+      snapshot_ = std::make_shared<const DataStore>(*data_);
+      idle_ = true;
+      ++session_;
+    }
+    wake_.notify_all();
+  }
+
+  // Не ждет поток: он дочитывает свой снимок, а меню уже может менять данные.
+  void stop() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cancel_ = true;
+    idle_ = false;
+    snapshot_.reset();
+    wake_.notify_all();
+  }
+
+  Stats stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+ private:
+  struct View {
+    std::string key;
+    ReportRenderFn render;
+    ReportRequest request;
+  };
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      wake_.wait(lock, [this]() { return shutdown_ || idle_; });
+      if (shutdown_) {
+        return;
+      }
+      // Короткие паузы между вводами (и ввод из файла) не прогреваем.
+      uint64_t session = session_;
+      if (wake_.wait_for(lock, std::chrono::milliseconds(kIdleDelayMs),
+                         [&]() { return shutdown_ || !idle_ || session_ != session; })) {
+        continue;
+      }
+      std::vector<View> views = views_;
+      std::shared_ptr<const DataStore> data = snapshot_;
+      cancel_ = false;
+      lock.unlock();
+      Stats session_stats = warm(*data, views);
+      data.reset();
+      lock.lock();
+      stats_.warmed += session_stats.warmed;
+      stats_.cancelled += session_stats.cancelled;
+      // Все отчеты готовы или прогрев прерван: ждем следующего ожидания ввода.
+      wake_.wait(lock, [&]() { return shutdown_ || session_ != session; });
+    }
+  }
+
+  Stats warm(const DataStore& data, const std::vector<View>& views) {
+    Stats stats;
+    ReportCache& cache = report_cache();
+    for (const auto& view : views) {
+      if (cancel_) {
+        ++stats.cancelled;
+        break;
+      }
+      if (cache.contains(view.key, data.generation)) {
+        continue;
+      }
+      std::ostringstream stream;
+      // Отмену проверяют и строки отчета (CancellableSink), и проходы по оценкам: без
+      // этого долгая агрегация до первой строки продолжалась бы после ввода.
+      aggregation_cancel() = &cancel_;
+      try {
+        OutputBuffer out(stream);
+        TableSink table(out);
+        CancellableSink sink(out, table, cancel_);
+        view.render(data, view.request, sink);
+      } catch (const PrecomputeCancelled&) {
+        aggregation_cancel() = nullptr;
+        ++stats.cancelled;
+        break;
+      }
+      aggregation_cancel() = nullptr;
+      cache.store(view.key, data.generation, stream.str());
+      ++stats.warmed;
+    }
+    return stats;
+  }
+
+  mutable std::mutex mutex_;
+  std::condition_variable wake_;
+  std::thread worker_;
+  const DataStore* data_ = nullptr;  // читается только потоком меню (в start())
+  std::shared_ptr<const DataStore> snapshot_;
+  std::vector<View> views_;
+  std::atomic<bool> cancel_{false};
+  bool idle_ = false;
+  bool shutdown_ = false;
+  uint64_t session_ = 0;
+  Stats stats_;
+};
+
+IdlePrecompute& idle_precompute() {
+  static IdlePrecompute precompute;
+  return precompute;
+}
+
+void idle_precompute_start() {
+  idle_precompute().start();
+}
+
+void idle_precompute_stop() {
+  idle_precompute().stop();
+}
+
+// Печатает, сколько отчетов подготовлено в простое.
+void print_idle_stats() {
+  IdlePrecompute::Stats stats = idle_precompute().stats();
+  std::cout << "Прогрев в простое: подготовлено отчетов " << stats.warmed << ", прервано вводом "
+            << stats.cancelled << "\n";
+}
+
+// Печатает отчет меню через кэш и запоминает его для прогрева в простое.
+void print_report(const DataStore& data, const std::string& key, ReportRenderFn render,
+                  const ReportRequest& request) {
+  idle_precompute().remember(key, render, request);
+  print_cached(data, key, [&](ReportSink& sink) { render(data, request, sink); });
+}
+
+// Добавляет строку с периодом отчета, если выбрана не вся история.
+void append_period_line(ReportSink& sink, const Period& period) {
+  if (period.is_all()) {
+    return;
+  }
+  sink.text("Период: ");
+  sink.text(period_name(period));
+  sink.text("\n");
+}
+
+// Строка фильтра группы для заголовка журнала (пусто - все группы).
+std::string group_line(const DataStore& data, int group_filter) {
+  if (group_filter == -1) {
+    return "Группа: без группы\n";
+  }
+  if (group_filter > 0) {
+    return "Группа: " + group_name_or_none(data, group_filter) + "\n";
+  }
+  return std::string();
+}
+
+void render_overall_averages(const DataStore& data, const ReportRequest& request, ReportSink& sink) {
+  sink.text("Средние по студентам (все оценки по предметам):\n");
+  append_period_line(sink, request.period);
+  sink.begin_table({{"ID", 4, true}, {"ФИО", 28}, {"Группа", 20}, {"Ср.балл", 12, true}});
+  double total = 0.0;
+  int count = 0;
+  std::vector<double> averages = student_averages(data, request.period);
+  for (size_t i = 0; i < data.students.size(); ++i) {
+    const Student& student = data.students[i];
+    double avg = averages[i];
+    sink.cell_int(student.id);
+    sink.cell(student.name);
+    sink.cell(group_name_or_none(data, student.group_id));
+    sink.cell_avg(avg);
+    sink.end_row();
+    if (avg >= 0.0) {
+      total += avg;
+      ++count;
+    }
+  }
+  sink.end_table();
+  sink.text("Общий средний балл: ");
+  sink.text_avg(count > 0 ? total / static_cast<double>(count) : -1.0);
+  sink.text("\n");
+}
+
+// Отчет: средние баллы по студентам и общий средний.
+void report_overall_averages(const DataStore& data, const Period& period) {
+  if (data.students.empty()) {
+    std::cout << "Нет студентов.\n";
+    return;
+  }
+  ReportRequest request;
+  request.period = period;
+  print_report(data, report_key("overall", period), render_overall_averages, request);
+}
+
+void render_subject_averages(const DataStore& data, const ReportRequest& request, ReportSink& sink) {
+  sink.text("Средние по предметам (все оценки):\n");
+  append_period_line(sink, request.period);
+  sink.begin_table({{"ID", 4, true}, {"Предмет", 28}, {"Ср.балл", 12, true}, {"Оценок", 10, true}});
+  std::vector<SubjectTotal> totals = subject_totals(data, request.period);
+  for (size_t i = 0; i < data.subjects.size(); ++i) {
+    const Subject& subject = data.subjects[i];
+    sink.cell_int(subject.id);
+    sink.cell(subject.name);
+    sink.cell_avg(totals[i].average());
+    sink.cell_int(totals[i].count);
+    sink.end_row();
+  }
+  sink.end_table();
+}
+
+// Отчет: средние баллы по предметам.
+void report_subject_averages(const DataStore& data, const Period& period) {
+  if (data.subjects.empty()) {
+    std::cout << "Нет предметов.\n";
+    return;
+  }
+  ReportRequest request;
+  request.period = period;
+  print_report(data, report_key("subject_averages", period), render_subject_averages, request);
+}
+
+// Заголовок и шапка таблицы подробностей по предмету.
+void begin_subject_detail(ReportSink& sink, std::string_view subject_name, const Period& period) {
+  sink.text("Подробности по предмету: ");
+  sink.text(subject_name);
+  sink.text("\n");
+  append_period_line(sink, period);
+  sink.begin_table({{"Студент", 28}, {"Ср.балл", 10, true}, {"Последн.", 10, true}, {"Оценки", 36}});
+}
+
+// Строка подробностей: оценки студента по порядку попыток (не пустой список).
+void append_subject_detail_row(ReportSink& sink, std::string_view student_name, GradeValues values) {
+  std::string grades_text;
+  append_grades(grades_text, values);
+  sink.cell(student_name);
+  sink.cell_avg(average_from_values(values));
+  sink.cell_int(values.back());
+  sink.cell(grades_text);
+  sink.end_row();
+}
+
+void append_subject_detail_empty(ReportSink& sink, std::string_view subject_name, const Period& period) {
+  sink.text("Нет оценок по предмету ");
+  sink.text(subject_name);
+  sink.text(" за период: ");
+  sink.text(period_name(period));
+  sink.text(".\n");
+}
+
+// Подробности по предмету request.id (предмет должен существовать).
+void render_subject_detail(const DataStore& data, const ReportRequest& request, ReportSink& sink) {
+  const Subject* subject = find_subject(data, request.id);
+  if (!subject) {
+    return;
+  }
+  ReportArena arena;
+  GradeRuns by_student = subject_grades_by_student(data, subject->id, request.period, arena.resource());
+  if (by_student.empty()) {
+    append_subject_detail_empty(sink, subject->name, request.period);
+    return;
+  }
+  begin_subject_detail(sink, subject->name, request.period);
+  EntitySlots students(data.students);
+  by_student.for_each([&](int student_id, GradeValues values) {
+    int slot = students.slot(student_id);
+    append_subject_detail_row(
+        sink, slot >= 0 ? std::string_view(data.students[students.index(slot)].name) : std::string_view("Неизвестно"),
+        values);
+  });
+  sink.end_table();
+}
+
+// Отчет: подробности по выбранному предмету.
+void report_subject_detail(const DataStore& data, const Period& period) {
+  if (data.subjects.empty()) {
+    std::cout << "Нет предметов.\n";
+    return;
+  }
+  print_subjects_simple(data);
+  int subject_id = read_int("ID предмета для подробностей: ", 1, std::numeric_limits<int>::max());
+  if (!find_subject(data, subject_id)) {
+    std::cout << "Предмет не найден.\n";
+    return;
+  }
+  ReportRequest request;
+  request.period = period;
+  request.id = subject_id;
+  print_report(data, report_key("subject_detail", period, {subject_id}), render_subject_detail, request);
+}
+
+struct RankedStudent {
+  int student_id = 0;
+  double avg = -1.0;
+};
+
+// Студенты с оценками за период, по убыванию среднего балла (при равенстве - по ID).
+std::vector<RankedStudent> ranked_students(const DataStore& data, const Period& period) {
+  std::vector<RankedStudent> entries;
+  std::vector<double> averages = student_averages(data, period);
+  for (size_t i = 0; i < data.students.size(); ++i) {
+    if (averages[i] >= 0.0) {
+      entries.push_back({data.students[i].id, averages[i]});
+    }
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const RankedStudent& a, const RankedStudent& b) {
+              if (a.avg != b.avg) {
+                return a.avg > b.avg;
+              }
+              return a.student_id < b.student_id;
+            });
+  return entries;
+}
+
+// Выводит первые n строк рейтинга.
+void append_top_table(const DataStore& data, const Period& period,
+                      const std::vector<RankedStudent>& entries, int n, ReportSink& sink) {
+  sink.text("Топ ");
+  sink.text_int(n);
+  sink.text(" студентов:\n");
+  append_period_line(sink, period);
+  sink.begin_table({{"#", 3, true}, {"ФИО", 28}, {"Группа", 20}, {"Ср.балл", 12, true}});
+  for (int i = 0; i < n; ++i) {
+    const RankedStudent& entry = entries[i];
+    const Student* student = find_student(data, entry.student_id);
+    sink.cell_int(i + 1);
+    if (student) {
+      sink.cell(student->name);
+      sink.cell(group_name_or_none(data, student->group_id));
+    } else {
+      sink.cell("Неизвестно");
+      sink.cell("Неизвестно");
+    }
+    sink.cell_avg(entry.avg);
+    sink.end_row();
+  }
+  sink.end_table();
+}
+
+void render_top_n(const DataStore& data, const ReportRequest& request, ReportSink& sink) {
+  std::vector<RankedStudent> entries = ranked_students(data, request.period);
+  int n = std::min(request.n, static_cast<int>(entries.size()));
+  append_top_table(data, request.period, entries, n, sink);
+}
+
+// Отчет: топ-N студентов по среднему баллу.
+void report_top_n(const DataStore& data, const Period& period) {
+  if (data.students.empty()) {
+    std::cout << "Нет студентов.\n";
+    return;
+  }
+  std::vector<RankedStudent> entries = ranked_students(data, period);
+  if (entries.empty()) {
+    std::cout << "Нет оценок.\n";
+    return;
+  }
+  int max_n = static_cast<int>(entries.size());
+  int n = read_int("Топ N (1.." + std::to_string(max_n) + "): ", 1, max_n);
+  OutputBuffer out(std::cout);
+  TableSink sink(out);
+  append_top_table(data, period, entries, n, sink);
+}
+
+// Обходит пересдачи периода проходом по оценкам (см. for_each_retake).
+template <typename Fn>
+void for_each_retake_scan(const DataStore& data, const Period& period, Fn&& fn) {
+  // Один проход по оценкам периода: после сортировки последняя оценка пары студент-предмет
+  // стоит в конце своей серии.
+  struct Attempt {
+    int student_id;
+    int subject_id;
+    int grade_id;
+    int value;
+  };
+  EntitySlots subjects(data.subjects);
+  ReportArena arena;
+  std::pmr::vector<Attempt> attempts(arena.resource());
+  for_each_grade(data, period, [&](const Grade& grade) {
+    attempts.push_back({grade.student_id, grade.subject_id, grade.id, grade.value});
+  });
+  std::sort(attempts.begin(), attempts.end(), [](const Attempt& a, const Attempt& b) {
+    if (a.student_id != b.student_id) {
+      return a.student_id < b.student_id;
+    }
+    if (a.subject_id != b.subject_id) {
+      return a.subject_id < b.subject_id;
+    }
+    return a.grade_id < b.grade_id;
+  });
+  for (const auto& student : data.students) {
+    auto it = std::lower_bound(attempts.begin(), attempts.end(), student.id,
+                               [](const Attempt& a, int id) { return a.student_id < id; });
+    for (; it != attempts.end() && it->student_id == student.id; ++it) {
+      auto next = it + 1;
+      if ((next != attempts.end() && next->student_id == student.id && next->subject_id == it->subject_id) ||
+          it->value >= kPassGrade) {
+        continue;
+      }
+      int slot = subjects.slot(it->subject_id);
+      if (slot >= 0) {
+        fn(student, data.subjects[subjects.index(slot)], it->value);
+      } else {
+        fn(student, unknown_subject(it->subject_id), it->value);
+      }
+    }
+  }
+}
+
+// Обходит пересдачи периода: fn(student, subject, value) для каждой пары студент-предмет,
+// где последняя оценка (с наибольшим ID, как в subject_aggregates_for_student) ниже
+// kPassGrade. Студенты - в порядке data.students, предметы - по возрастанию ID; долг
+// по удаленному предмету приходит с unknown_subject.
+template <typename Fn>
+void for_each_retake(const DataStore& data, const Period& period, Fn&& fn) {
+  if (!period.is_all() || data.retakes.has_stale()) {
+    for_each_retake_scan(data, period, fn);
+    return;
+  }
+  // За всю историю - из множества пересдач хранилища. Долги идут по предметам; раскладка
+  // подсчетом по позициям студентов сохраняет порядок предметов и обходится без сортировки.
+  struct Debt {
+    size_t student;  // позиция в data.students
+    int subject_id;
+    int value;
+  };
+  EntitySlots students(data.students);
+  EntitySlots subjects(data.subjects);
+  std::vector<Debt> debts;
+  std::vector<size_t> offsets(data.students.size() + 1, 0);
+  data.retakes.for_each_failing([&](int subject_id, int student_id, int value) {
+    int student = students.slot(student_id);
+    if (student >= 0) {
+      debts.push_back({students.index(student), subject_id, value});
+      ++offsets[debts.back().student + 1];
+    }
+  });
+  for (size_t i = 1; i < offsets.size(); ++i) {
+    offsets[i] += offsets[i - 1];
+  }
+  std::vector<Debt> ordered(debts.size());
+  for (const auto& debt : debts) {
+    ordered[offsets[debt.student]++] = debt;
+  }
+  for (const auto& debt : ordered) {
+    int subject = subjects.slot(debt.subject_id);
+    if (subject >= 0) {
+      fn(data.students[debt.student], data.subjects[subjects.index(subject)], debt.value);
+    } else {
+      fn(data.students[debt.student], unknown_subject(debt.subject_id), debt.value);
+    }
+  }
+}
+
+void render_retakes(const DataStore& data, const ReportRequest& request, ReportSink& sink) {
+  sink.text("Пересдачи (последняя оценка < ");
+  sink.text_int(kPassGrade);
+  sink.text("):\n");
+  append_period_line(sink, request.period);
+  // Ширины столбцов подбираются по данным (не шире прежних 28/28/10).
+  bool empty = true;
+  for_each_retake(data, request.period, [&](const Student& student, const Subject& subject, int value) {
+    if (empty) {
+      sink.begin_table({{"Студент", 28, false, true}, {"Предмет", 28, false, true}, {"Оценка", 10, true, true}});
+      empty = false;
+    }
+    sink.cell(student.name);
+    sink.cell(subject.name);
+    sink.cell_int(value);
+    sink.end_row();
+  });
+  if (empty) {
+    sink.text("  Нет.\n");
+    return;
+  }
+  sink.end_table();
+}
+
+// Отчет: список пересдач по последним оценкам.
+void report_retakes(const DataStore& data, const Period& period) {
+  if (data.students.empty() || data.subjects.empty()) {
+    std::cout << "Нет студентов или предметов.\n";
+    return;
+  }
+  ReportRequest request;
+  request.period = period;
+  print_report(data, report_key("retakes", period), render_retakes, request);
+}
+
+// Строка таблицы распределения: название, количество, счетчики по оценкам и сводка.
+struct DistributionRow {
+  std::string name;
+  GradeHistogram histogram;
+};
+
+// Выводит таблицу распределений (по строке на предмет, группу и т.п.).
+void append_distribution_table(ReportSink& sink, const char* title, const std::vector<DistributionRow>& rows) {
+  std::vector<ReportColumn> columns = {{title, 28}, {"Оценок", 8, true}};
+  for (int value = kMinGrade; value <= kMaxGrade; ++value) {
+    columns.push_back({std::to_string(value), 6, true});
+  }
+  for (const char* column : {"Медиана", "Мода", "Ср.балл", "Откл.", "Сдано %"}) {
+    columns.push_back({column, 7, true});
+  }
+  sink.begin_table(columns);
+  for (const auto& row : rows) {
+    GradeDistribution stats = describe_distribution(row.histogram);
+    sink.cell(row.name);
+    sink.cell_int(stats.count);
+    for (int64_t count : row.histogram.counts) {
+      sink.cell_int(count);
+    }
+    sink.cell_avg(stats.median);
+    if (stats.mode == 0) {
+      sink.cell_none("нет");
+    } else {
+      sink.cell_int(stats.mode);
+    }
+    sink.cell_avg(stats.mean);
+    sink.cell_avg(stats.stddev);
+    sink.cell_avg(stats.pass_rate < 0.0 ? stats.pass_rate : stats.pass_rate * 100.0);
+    sink.end_row();
+  }
+  sink.end_table();
+}
+
+void render_distribution_by_subject(const DataStore& data, const ReportRequest& request, ReportSink& sink) {
+  sink.text("Распределение оценок по предметам (все попытки, сдано - оценка не ниже ");
+  sink.text_int(kPassGrade);
+  sink.text("):\n");
+  append_period_line(sink, request.period);
+  std::vector<DistributionRow> rows;
+  GradeHistogram total;
+  for (const auto& subject : data.subjects) {
+    rows.push_back({subject.name, subject_histogram(data, subject.id, request.period)});
+    total.merge(rows.back().histogram);
+  }
+  rows.push_back({"Все предметы", total});
+  append_distribution_table(sink, "Предмет", rows);
+}
+
+// Отчет: распределение оценок по предметам (из счетчиков партиций, без прохода по оценкам).
+void report_distribution_by_subject(const DataStore& data, const Period& period) {
+  if (data.subjects.empty()) {
+    std::cout << "Нет предметов.\n";
+    return;
+  }
+  ReportRequest request;
+  request.period = period;
+  print_report(data, report_key("distribution_subjects", period), render_distribution_by_subject, request);
+}
+
+void render_distribution_by_group(const DataStore& data, const ReportRequest& request, ReportSink& sink) {
+  sink.text("Распределение оценок по группам (все попытки):\n");
+  append_period_line(sink, request.period);
+  // Гистограмма группы - в плоской таблице по позиции группы в data.groups, последняя -
+  // без группы. Столбец студента - по его ID: индекс вместо поиска на каждую оценку.
+  const int none = static_cast<int>(data.groups.size());
+  EntitySlots groups(data.groups);
+  std::vector<int> group_of(static_cast<size_t>(data.next_student_id), none);
+  for (const auto& student : data.students) {
+    if (student.id > 0 && student.id < data.next_student_id) {
+      int slot = groups.slot(student.group_id);
+      group_of[static_cast<size_t>(student.id)] =
+          student.group_id == 0 ? none : (slot >= 0 ? static_cast<int>(groups.index(slot)) : -1);
+    }
+  }
+  std::vector<GradeHistogram> by_group(data.groups.size() + 1);
+  bool has_none = false;
+  for_each_grade(data, request.period, [&](const Grade& grade) {
+    if (grade.student_id > 0 && grade.student_id < data.next_student_id) {
+      int column = group_of[static_cast<size_t>(grade.student_id)];
+      if (column >= 0) {
+        by_group[static_cast<size_t>(column)].add(grade.value);
+        has_none = has_none || column == none;
+      }
+    }
+  });
+  std::vector<DistributionRow> rows;
+  GradeHistogram total;
+  for (size_t i = 0; i < data.groups.size(); ++i) {
+    rows.push_back({data.groups[i].name, by_group[i]});
+    total.merge(rows.back().histogram);
+  }
+  if (has_none) {
+    rows.push_back({"Без группы", by_group.back()});
+    total.merge(rows.back().histogram);
+  }
+  rows.push_back({"Все группы", total});
+  append_distribution_table(sink, "Группа", rows);
+}
+
+// Отчет: распределение оценок по группам (один проход по оценкам периода).
+void report_distribution_by_group(const DataStore& data, const Period& period) {
+  if (data.students.empty()) {
+    std::cout << "Нет студентов.\n";
+    return;
+  }
+  ReportRequest request;
+  request.period = period;
+  print_report(data, report_key("distribution_groups", period), render_distribution_by_group, request);
+}
+
+// Распределение оценок студента request.id (студент должен существовать).
+void render_distribution_by_student(const DataStore& data, const ReportRequest& request, ReportSink& sink) {
+  const Student* student = find_student(data, request.id);
+  if (!student) {
+    return;
+  }
+  sink.text("Распределение оценок студента: ");
+  sink.text(student->name);
+  sink.text("\n");
+  append_period_line(sink, request.period);
+  EntitySlots subjects(data.subjects);
+  std::vector<GradeHistogram> by_subject(subjects.count());
+  std::vector<bool> has_grades(subjects.count(), false);
+  for_each_grade(data, request.period, [&](const Grade& grade) {
+    int slot = grade.student_id == student->id ? subjects.slot(grade.subject_id) : -1;
+    if (slot >= 0) {
+      by_subject[static_cast<size_t>(slot)].add(grade.value);
+      has_grades[static_cast<size_t>(slot)] = true;
+    }
+  });
+  std::vector<DistributionRow> rows;
+  GradeHistogram total;
+  for (const auto& subject : data.subjects) {
+    size_t slot = static_cast<size_t>(subjects.slot(subject.id));
+    if (has_grades[slot]) {
+      rows.push_back({subject.name, by_subject[slot]});
+      total.merge(by_subject[slot]);
+    }
+  }
+  rows.push_back({"Все предметы", total});
+  append_distribution_table(sink, "Предмет", rows);
+}
+
+// Отчет: распределение оценок студента по предметам.
+void report_distribution_by_student(const DataStore& data, const Period& period) {
+  if (data.students.empty()) {
+    std::cout << "Нет студентов.\n";
+    return;
+  }
+  print_students_simple(data);
+  int student_id = read_student_id_or_cancel(data, "ID студента (0 - отмена): ");
+  if (student_id == 0) {
+    std::cout << "Операция отменена.\n";
+    return;
+  }
+  if (!find_student(data, student_id)) {
+    std::cout << "Студент не найден.\n";
+    return;
+  }
+  ReportRequest request;
+  request.period = period;
+  request.id = student_id;
+  print_report(data, report_key("distribution_student", period, {student_id}), render_distribution_by_student,
+               request);
+}
+
+// Отчет: распределение оценок с выбором разреза.
+void report_distribution(const DataStore& data, const Period& period) {
+  int choice = read_int("Распределение: 1-по предметам, 2-по группам, 3-по студенту, 0-отмена: ", 0, 3);
+  switch (choice) {
+    case 1:
+      report_distribution_by_subject(data, period);
+      break;
+    case 2:
+      report_distribution_by_group(data, period);
+      break;
+    case 3:
+      report_distribution_by_student(data, period);
+      break;
+    default:
+      break;
+  }
+}
+
+constexpr size_t kGroupReportParallelGrades = 200000;  // с какого числа оценок считать в потоках
+constexpr unsigned kGroupReportMaxThreads = 8;
+
+// Последняя оценка каждой пары студент-предмет, встреченной в проходе: открытая
+// адресация по ключу (ID студента << 32 | столбец предмета), значение - (ID оценки << 8 |
+// оценка), побеждает наибольшее. Размер растет с числом встреченных пар, а не с
+// числом студентов x предметов. Ключ 0 - пустая ячейка (ID студента больше 0).
+class LatestGrades {
+ public:
+  void update(uint64_t key, uint64_t packed) {
+    if ((size_ + 1) * 2 > entries_.size()) {
+      grow();
+    }
+    Entry& entry = find(key);
+    if (entry.key == 0) {
+      entry.key = key;
+      ++size_;
+    }
+    entry.value = std::max(entry.value, packed);
+  }
+
+  // fn(ключ, значение) для каждой пары.
+  template <typename Fn>
+  void for_each(Fn fn) const {
+    for (const Entry& entry : entries_) {
+      if (entry.key != 0) {
+        fn(entry.key, entry.value);
+      }
+    }
+  }
+
+ private:
+  struct Entry {
+    uint64_t key = 0;
+    uint64_t value = 0;
+  };
+
+  Entry& find(uint64_t key) {
+    size_t mask = entries_.size() - 1;
+    size_t i = static_cast<size_t>((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+    while (entries_[i].key != 0 && entries_[i].key != key) {
+      i = (i + 1) & mask;
+    }
+    return entries_[i];
+  }
+
+  void grow() {
+    std::vector<Entry> old;
+    old.swap(entries_);
+    entries_.resize(old.empty() ? 1024 : old.size() * 2);
+    for (const Entry& entry : old) {
+      if (entry.key != 0) {
+        find(entry.key) = entry;
+      }
+    }
+  }
+
+  std::vector<Entry> entries_;
+  size_t size_ = 0;
+};
+
+// Итоги для сравнения групп. Слот группы - индекс в data.groups, последний слот -
+// студенты без группы. Ячейки группа x предмет: слот * subject_count + индекс предмета.
+struct GroupAggregates {
+  size_t subject_count = 0;
+  std::vector<int> students;
+  std::vector<GradeHistogram> histograms;
+  std::vector<int64_t> repeat_attempts;  // оценки с номером попытки больше 1
+  std::vector<int64_t> debts;            // предметы, где последняя оценка ниже проходного балла
+  std::vector<int64_t> cell_sum;
+  std::vector<int64_t> cell_count;
+};
+
+// Считает итоги по группам за один проход по оценкам периода. Группа оценки берется
+// по индексу student_id -> слот группы, предмет - по индексу subject_id -> столбец,
+// поэтому на оценку нет ни поиска, ни сортировки. Для долгов нужна последняя оценка
+// каждой пары студент-предмет: она хранится как (ID оценки << 8 | оценка), и побеждает
+// наибольший ID - как в отчете о пересдачах. Если оценок периода мало по сравнению
+// с числом студентов x предметы (отчет за семестр), последние оценки хранятся только
+// для встреченных пар (LatestGrades, своя у каждого потока); для длинного периода -
+// в общей плотной таблице студенты x предметы с атомарным максимумом.
+// При большом числе оценок партиции режутся на куски и делятся между потоками (отчет
+// за один семестр тоже считается в потоках): у каждого потока свои счетчики групп
+// (их мало, они складываются в конце).
+GroupAggregates aggregate_by_group(const DataStore& data, const Period& period) {
+  GroupAggregates result;
+  const size_t slots = data.groups.size() + 1;
+  const size_t none_slot = data.groups.size();
+  const size_t subject_count = data.subjects.size();
+  result.subject_count = subject_count;
+  result.students.assign(slots, 0);
+  result.histograms.assign(slots, GradeHistogram{});
+  result.repeat_attempts.assign(slots, 0);
+  result.debts.assign(slots, 0);
+  result.cell_sum.assign(slots * subject_count, 0);
+  result.cell_count.assign(slots * subject_count, 0);
+
+  EntitySlots groups(data.groups);
+  const int student_limit = data.next_student_id;
+  std::vector<int> slot_of(static_cast<size_t>(std::max(student_limit, 1)), -1);
+  std::vector<int> index_of(slot_of.size(), -1);
+  for (size_t i = 0; i < data.students.size(); ++i) {
+    const Student& student = data.students[i];
+    if (student.id <= 0 || student.id >= student_limit) {
+      continue;
+    }
+    int group_slot = groups.slot(student.group_id);
+    size_t slot = group_slot >= 0 ? groups.index(group_slot) : none_slot;
+    slot_of[static_cast<size_t>(student.id)] = static_cast<int>(slot);
+    index_of[static_cast<size_t>(student.id)] = static_cast<int>(i);
+    ++result.students[slot];
+  }
+  int max_subject_id = 0;
+  for (const auto& subject : data.subjects) {
+    max_subject_id = std::max(max_subject_id, subject.id);
+  }
+  std::vector<int> column_of(static_cast<size_t>(max_subject_id) + 1, -1);
+  for (size_t i = 0; i < subject_count; ++i) {
+    column_of[static_cast<size_t>(data.subjects[i].id)] = static_cast<int>(i);
+  }
+
+  std::vector<const GradePartition*> parts;
+  size_t grades = 0;
+  for_each_partition(data, period, [&](const GradePartition& part) {
+    parts.push_back(&part);
+    grades += part.size();
+  });
+  // За всю историю долги берутся из множества пересдач, и таблица последних оценок не нужна.
+  const bool debts_from_index = period.is_all() && !data.retakes.has_stale();
+  // Хеш-таблица занимает 32-64 байта на пару, плотная - 8 байт на ячейку: плотная
+  // выгоднее, когда пар (их не больше, чем оценок) может набраться на четверть ячеек.
+  const size_t cells = data.students.size() * subject_count;
+  const bool dense_latest = !debts_from_index && grades * 4 >= cells;
+  const size_t latest_cells = dense_latest ? cells : 0;
+  std::unique_ptr<std::atomic<uint64_t>[]> dense(new std::atomic<uint64_t>[latest_cells]);
+  for (size_t i = 0; i < latest_cells; ++i) {
+    dense[i].store(0, std::memory_order_relaxed);
+  }
+
+  struct Range {
+    const GradePartition* part;
+    size_t begin;
+    size_t end;
+  };
+  struct Partial {
+    std::vector<GradeHistogram> histograms;
+    std::vector<int64_t> repeat_attempts;
+    std::vector<int64_t> cell_sum;
+    std::vector<int64_t> cell_count;
+    LatestGrades latest;  // если не dense_latest
+    std::vector<Range> ranges;
+    size_t grades = 0;
+  };
+  unsigned threads = 1;
+  if (grades >= kGroupReportParallelGrades) {
+    threads = std::min<unsigned>(std::max(1u, std::thread::hardware_concurrency()), kGroupReportMaxThreads);
+  }
+  std::vector<Partial> partials(threads);
+  for (auto& partial : partials) {
+    partial.histograms.assign(slots, GradeHistogram{});
+    partial.repeat_attempts.assign(slots, 0);
+    partial.cell_sum.assign(slots * subject_count, 0);
+    partial.cell_count.assign(slots * subject_count, 0);
+  }
+  // Куски не больше доли одного потока; крупные раздаются первыми, каждый - наименее
+  // загруженному потоку.
+  const size_t chunk = std::max<size_t>(1, (grades + threads - 1) / threads);
+  std::vector<Range> ranges;
+  for (const GradePartition* part : parts) {
+    for (size_t begin = 0; begin < part->size(); begin += chunk) {
+      ranges.push_back({part, begin, std::min(part->size(), begin + chunk)});
+    }
+  }
+  std::sort(ranges.begin(), ranges.end(),
+            [](const Range& a, const Range& b) { return a.end - a.begin > b.end - b.begin; });
+  for (const Range& range : ranges) {
+    auto lightest = std::min_element(partials.begin(), partials.end(),
+                                     [](const Partial& a, const Partial& b) { return a.grades < b.grades; });
+    lightest->ranges.push_back(range);
+    lightest->grades += range.end - range.begin;
+  }
+
+  // Флаг отмены прогрева читается здесь: у рабочих потоков свой aggregation_cancel().
+  const std::atomic<bool>* cancel = aggregation_cancel();
+  auto scan = [&](Partial& partial) {
+    for (const Range& range : partial.ranges) {
+      if (cancel && cancel->load(std::memory_order_relaxed)) {
+        return;
+      }
+      for (size_t i = range.begin; i < range.end; ++i) {
+        Grade grade = range.part->grade_at(i);
+        if (grade.student_id <= 0 || grade.student_id >= student_limit) {
+          continue;
+        }
+        int slot = slot_of[static_cast<size_t>(grade.student_id)];
+        if (slot < 0) {
+          continue;
+        }
+        partial.histograms[static_cast<size_t>(slot)].add(grade.value);
+        if (grade.attempt > 1) {
+          ++partial.repeat_attempts[static_cast<size_t>(slot)];
+        }
+        if (grade.subject_id < 0 || grade.subject_id > max_subject_id) {
+          continue;
+        }
+        int column = column_of[static_cast<size_t>(grade.subject_id)];
+        if (column < 0) {
+          continue;
+        }
+        size_t cell = static_cast<size_t>(slot) * subject_count + static_cast<size_t>(column);
+        partial.cell_sum[cell] += grade.value;
+        ++partial.cell_count[cell];
+        if (debts_from_index) {
+          continue;
+        }
+        uint64_t packed = (static_cast<uint64_t>(static_cast<uint32_t>(grade.id)) << 8) |
+                          static_cast<uint8_t>(grade.value);
+        if (!dense_latest) {
+          partial.latest.update((static_cast<uint64_t>(grade.student_id) << 32) | static_cast<uint32_t>(column),
+                                packed);
+          continue;
+        }
+        std::atomic<uint64_t>& current = dense[static_cast<size_t>(index_of[static_cast<size_t>(grade.student_id)]) *
+                                                   subject_count + static_cast<size_t>(column)];
+        uint64_t seen = current.load(std::memory_order_relaxed);
+        while (seen < packed && !current.compare_exchange_weak(seen, packed, std::memory_order_relaxed)) {
+        }
+      }
+    }
+  };
+  if (threads == 1) {
+    scan(partials[0]);
+  } else {
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < threads; ++t) {
+      workers.emplace_back(scan, std::ref(partials[t]));
+    }
+    scan(partials[0]);
+    for (auto& worker : workers) {
+      worker.join();
+    }
+  }
+  check_aggregation_cancel();
+
+  for (const auto& partial : partials) {
+    for (size_t slot = 0; slot < slots; ++slot) {
+      result.histograms[slot].merge(partial.histograms[slot]);
+      result.repeat_attempts[slot] += partial.repeat_attempts[slot];
+    }
+    for (size_t cell = 0; cell < slots * subject_count; ++cell) {
+      result.cell_sum[cell] += partial.cell_sum[cell];
+      result.cell_count[cell] += partial.cell_count[cell];
+    }
+  }
+  if (debts_from_index) {
+    data.retakes.for_each_failing([&](int subject_id, int student_id, int) {
+      if (student_id <= 0 || student_id >= student_limit || subject_id < 0 || subject_id > max_subject_id ||
+          column_of[static_cast<size_t>(subject_id)] < 0) {
+        return;
+      }
+      int slot = slot_of[static_cast<size_t>(student_id)];
+      if (slot >= 0) {
+        ++result.debts[static_cast<size_t>(slot)];
+      }
+    });
+    return result;
+  }
+  if (dense_latest) {
+    for (size_t i = 0; i < data.students.size(); ++i) {
+      const Student& student = data.students[i];
+      if (student.id <= 0 || student.id >= student_limit) {
+        continue;
+      }
+      size_t slot = static_cast<size_t>(slot_of[static_cast<size_t>(student.id)]);
+      for (size_t column = 0; column < subject_count; ++column) {
+        uint64_t packed = dense[i * subject_count + column].load(std::memory_order_relaxed);
+        if (packed != 0 && static_cast<int>(packed & 0xFF) < kPassGrade) {
+          ++result.debts[slot];
+        }
+      }
+    }
+    return result;
+  }
+  LatestGrades& latest = partials[0].latest;
+  for (size_t t = 1; t < partials.size(); ++t) {
+    partials[t].latest.for_each([&](uint64_t key, uint64_t packed) { latest.update(key, packed); });
+  }
+  latest.for_each([&](uint64_t key, uint64_t packed) {
+    if (static_cast<int>(packed & 0xFF) < kPassGrade) {
+      ++result.debts[static_cast<size_t>(slot_of[static_cast<size_t>(key >> 32)])];
+    }
+  });
+  return result;
+}
+
+// Название строки сравнения групп по слоту.
+std::string group_slot_name(const DataStore& data, size_t slot) {
+  return slot < data.groups.size() ? data.groups[slot].name : "Без группы";
+}
+
+// Слот "без группы" показывается, только если в нем есть студенты.
+bool group_slot_visible(const DataStore& data, const GroupAggregates& totals, size_t slot) {
+  return slot < data.groups.size() || totals.students[slot] > 0;
+}
+
+void render_group_summary(const DataStore& data, const ReportRequest& request, ReportSink& sink) {
+  sink.text("Сравнение групп (все оценки; сдано - оценка не ниже ");
+  sink.text_int(kPassGrade);
+  sink.text(", долги - предметы с последней оценкой ниже):\n");
+  append_period_line(sink, request.period);
+  GroupAggregates totals = aggregate_by_group(data, request.period);
+  sink.begin_table({{"Группа", 24}, {"Студентов", 9, true}, {"Оценок", 9, true}, {"Ср.балл", 8, true},
+                    {"Сдано %", 8, true}, {"Повторных", 9, true}, {"Долгов", 8, true}});
+  GradeHistogram all;
+  int64_t students = 0;
+  int64_t repeats = 0;
+  int64_t debts = 0;
+  auto append_row = [&](const std::string& name, int64_t row_students, const GradeHistogram& histogram,
+                        int64_t row_repeats, int64_t row_debts) {
+    GradeDistribution stats = describe_distribution(histogram);
+    sink.cell(name);
+    sink.cell_int(row_students);
+    sink.cell_int(stats.count);
+    sink.cell_avg(stats.mean);
+    sink.cell_avg(stats.pass_rate < 0.0 ? stats.pass_rate : stats.pass_rate * 100.0);
+    sink.cell_int(row_repeats);
+    sink.cell_int(row_debts);
+    sink.end_row();
+  };
+  for (size_t slot = 0; slot < totals.students.size(); ++slot) {
+    if (!group_slot_visible(data, totals, slot)) {
+      continue;
+    }
+    append_row(group_slot_name(data, slot), totals.students[slot], totals.histograms[slot],
+               totals.repeat_attempts[slot], totals.debts[slot]);
+    all.merge(totals.histograms[slot]);
+    students += totals.students[slot];
+    repeats += totals.repeat_attempts[slot];
+    debts += totals.debts[slot];
+  }
+  append_row("Все группы", students, all, repeats, debts);
+  sink.end_table();
+}
+
+void render_group_subjects(const DataStore& data, const ReportRequest& request, ReportSink& sink) {
+  sink.text("Средний балл: группы x предметы (все оценки):\n");
+  append_period_line(sink, request.period);
+  GroupAggregates totals = aggregate_by_group(data, request.period);
+  std::vector<ReportColumn> columns = {{"Группа", 24}};
+  for (const auto& subject : data.subjects) {
+    columns.push_back({subject.name, 8, true});
+  }
+  columns.push_back({"Все", 8, true});
+  sink.begin_table(columns);
+  const size_t subjects = totals.subject_count;
+  std::vector<int64_t> column_sum(subjects, 0);
+  std::vector<int64_t> column_count(subjects, 0);
+  auto append_cells = [&](const int64_t* sums, const int64_t* counts) {
+    int64_t row_sum = 0;
+    int64_t row_count = 0;
+    for (size_t column = 0; column < subjects; ++column) {
+      if (counts[column] == 0) {
+        sink.cell_none("-");
+      } else {
+        sink.cell_avg(static_cast<double>(sums[column]) / static_cast<double>(counts[column]));
+      }
+      row_sum += sums[column];
+      row_count += counts[column];
+    }
+    sink.cell_avg(row_count > 0 ? static_cast<double>(row_sum) / static_cast<double>(row_count) : -1.0);
+    sink.end_row();
+  };
+  for (size_t slot = 0; slot < totals.students.size(); ++slot) {
+    if (!group_slot_visible(data, totals, slot)) {
+      continue;
+    }
+    const int64_t* sums = totals.cell_sum.data() + slot * subjects;
+    const int64_t* counts = totals.cell_count.data() + slot * subjects;
+    for (size_t column = 0; column < subjects; ++column) {
+      column_sum[column] += sums[column];
+      column_count[column] += counts[column];
+    }
+    sink.cell(group_slot_name(data, slot));
+    append_cells(sums, counts);
+  }
+  sink.cell("Все группы");
+  append_cells(column_sum.data(), column_count.data());
+  sink.end_table();
+}
+
+// Отчет: сравнение групп (сводка или группы x предметы).
+void report_groups(const DataStore& data, const Period& period) {
+  if (data.groups.empty()) {
+    std::cout << "Нет групп.\n";
+    return;
+  }
+  int choice = read_int("Сравнение групп: 1-сводка по группам, 2-группы x предметы, 0-отмена: ", 0, 2);
+  ReportRequest request;
+  request.period = period;
+  if (choice == 1) {
+    print_report(data, report_key("groups", period), render_group_summary, request);
+  } else if (choice == 2) {
+    print_report(data, report_key("group_subjects", period), render_group_subjects, request);
+  }
+}
+
+void render_journal_matrix(const DataStore& data, const ReportRequest& request, ReportSink& sink) {
+  auto students = students_for_group_sorted(data, request.group);
+  if (students.empty()) {
+    sink.text("Нет студентов для выбранного фильтра.\n");
+    return;
+  }
+  sink.text("Электронный журнал (последние оценки):\n");
+  append_period_line(sink, request.period);
+  sink.text(group_line(data, request.group));
+
+  std::vector<ReportColumn> columns = {{"ID", 4, true}, {"ФИО", 24}, {"Группа", 18}};
+  for (const auto& subject : data.subjects) {
+    columns.push_back({subject.name, 8, true});
+  }
+  columns.push_back({"Ср.балл", 10, true});
+  sink.begin_table(columns);
+  for_each_journal_row(data, request.period, students, [&](const Student& student, const SubjectAggregate* cells) {
+    sink.cell_int(student.id);
+    sink.cell(student.name);
+    sink.cell(group_name_or_none(data, student.group_id));
+    for (size_t i = 0; i < data.subjects.size(); ++i) {
+      if (cells[i].count == 0) {
+        sink.cell_none("-");
+      } else {
+        sink.cell_int(cells[i].latest_value);
+      }
+    }
+    sink.cell_avg(journal_row_average(cells, data.subjects.size()));
+    sink.end_row();
+  });
+  sink.end_table();
+}
+
+void journal_matrix(const DataStore& data, const Period& period) {
+  if (data.students.empty()) {
+    std::cout << "Нет студентов.\n";
+    return;
+  }
+  if (data.subjects.empty()) {
+    std::cout << "Нет предметов.\n";
+    return;
+  }
+  ReportRequest request;
+  request.period = period;
+  if (!data.groups.empty()) {
+    print_groups_simple(data);
+    request.group = read_group_filter(data, "ID группы (0 - все, -1 - без группы): ");
+  }
+  print_report(data, report_key("journal_matrix", period, {request.group}), render_journal_matrix, request);
+}
+
+// Заголовок и шапка журнала по предмету.
+void begin_subject_journal(ReportSink& sink, std::string_view subject_name, const Period& period,
+                           std::string_view group_text) {
+  sink.text("Электронный журнал по предмету: ");
+  sink.text(subject_name);
+  sink.text("\n");
+  append_period_line(sink, period);
+  sink.text(group_text);
+  sink.begin_table({{"ID", 4, true}, {"ФИО", 24}, {"Группа", 18}, {"Оценки", 24},
+                    {"Ср.балл", 10, true}, {"Последн.", 10, true}, {"Попыток", 8, true}});
+}
+
+// Строка журнала по предмету: оценки студента по порядку попыток (может быть пустой).
+void append_subject_journal_row(ReportSink& sink, int student_id, std::string_view name,
+                                std::string_view group_name, GradeValues values) {
+  sink.cell_int(student_id);
+  sink.cell(name);
+  sink.cell(group_name);
+  if (values.empty()) {
+    sink.cell_none("нет");
+    sink.cell_avg(-1.0);
+    sink.cell_none("нет");
+  } else {
+    std::string grades_text;
+    append_grades(grades_text, values);
+    sink.cell(grades_text);
+    sink.cell_avg(average_from_values(values));
+    sink.cell_int(values.back());
+  }
+  sink.cell_int(static_cast<long long>(values.size()));
+  sink.end_row();
+}
+
+// Журнал по предмету request.id (предмет должен существовать): один проход по оценкам
+// предмета, попытки каждого студента - по порядку сдачи.
+void render_journal_by_subject(const DataStore& data, const ReportRequest& request, ReportSink& sink) {
+  const Subject* subject = find_subject(data, request.id);
+  if (!subject) {
+    return;
+  }
+  auto students = students_for_group_sorted(data, request.group);
+  if (students.empty()) {
+    sink.text("Нет студентов для выбранного фильтра.\n");
+    return;
+  }
+  begin_subject_journal(sink, subject->name, request.period, group_line(data, request.group));
+
+  ReportArena arena;
+  GradeRuns by_student = subject_grades_by_student(data, subject->id, request.period, arena.resource());
+  for (const auto* student : students) {
+    append_subject_journal_row(sink, student->id, student->name, group_name_or_none(data, student->group_id),
+                               by_student.find(student->id));
+  }
+  sink.end_table();
+}
+
+void journal_by_subject(const DataStore& data, const Period& period) {
+  if (data.students.empty()) {
+    std::cout << "Нет студентов.\n";
+    return;
+  }
+  if (data.subjects.empty()) {
+    std::cout << "Нет предметов.\n";
+    return;
+  }
+  print_subjects_simple(data);
+  int subject_id = read_subject_id_or_cancel(data, "ID предмета (0 - отмена): ");
+  if (subject_id == 0) {
+    std::cout << "Операция отменена.\n";
+    return;
+  }
+  if (!find_subject(data, subject_id)) {
+    std::cout << "Предмет не найден.\n";
+    return;
+  }
+  ReportRequest request;
+  request.period = period;
+  request.id = subject_id;
+  if (!data.groups.empty()) {
+    print_groups_simple(data);
+    request.group = read_group_filter(data, "ID группы (0 - все, -1 - без группы): ");
+  }
+  print_report(data, report_key("journal_by_subject", period, {subject_id, request.group}),
+               render_journal_by_subject, request);
+}
+
+// Журнал студента целиком: by_subject - оценки по предметам в порядке попыток.
+// Средний балл - среднее по предметам со средними по каждому, как average_subjects_for_student.
+void append_student_journal(ReportSink& sink, std::string_view name, std::string_view group_name,
+                            const Period& period, const std::vector<Subject>& subjects,
+                            const GradesBySubject& by_subject) {
+  sink.text("Электронный журнал студента: ");
+  sink.text(name);
+  sink.text("\nГруппа: ");
+  sink.text(group_name);
+  sink.text("\n");
+  append_period_line(sink, period);
+
+  sink.begin_table({{"ID", 4, true}, {"Предмет", 26}, {"Оценки", 24},
+                    {"Ср.балл", 10, true}, {"Последн.", 10, true}, {"Попыток", 8, true}});
+  std::string grades_text;
+  for (const auto& subject : subjects) {
+    GradeValues values = by_subject.find(subject.id);
+    grades_text.clear();
+    append_grades(grades_text, values);
+    sink.cell_int(subject.id);
+    sink.cell(subject.name);
+    if (values.empty()) {
+      sink.cell_none("нет");
+      sink.cell_avg(-1.0);
+      sink.cell_none("нет");
+    } else {
+      sink.cell(grades_text);
+      sink.cell_avg(average_from_values(values));
+      sink.cell_int(values.back());
+    }
+    sink.cell_int(static_cast<long long>(values.size()));
+    sink.end_row();
+  }
+  sink.end_table();
+  sink.text("Средний балл по предметам: ");
+  sink.text_avg(average_by_subject(by_subject));
+  sink.text("\n");
+}
+
+// Журнал студента request.id (студент должен существовать).
+void render_journal_by_student(const DataStore& data, const ReportRequest& request, ReportSink& sink) {
+  const Student* student = find_student(data, request.id);
+  if (!student) {
+    return;
+  }
+  ReportArena arena;
+  append_student_journal(sink, student->name, group_name_or_none(data, student->group_id), request.period,
+                         data.subjects,
+                         grades_by_subject_for_student(data, student->id, request.period, arena.resource()));
+}
+
+void journal_by_student(const DataStore& data, const Period& period) {
+  if (data.students.empty()) {
+    std::cout << "Нет студентов.\n";
+    return;
+  }
+  print_students_simple(data);
+  int student_id = read_student_id_or_cancel(data, "ID студента (0 - отмена): ");
+  if (student_id == 0) {
+    std::cout << "Операция отменена.\n";
+    return;
+  }
+  if (!find_student(data, student_id)) {
+    std::cout << "Студент не найден.\n";
+    return;
+  }
+  if (data.subjects.empty()) {
+    std::cout << "Нет предметов.\n";
+    return;
+  }
+  ReportRequest request;
+  request.period = period;
+  request.id = student_id;
+  print_report(data, report_key("journal_by_student", period, {student_id}), render_journal_by_student, request);
+}
+
+// Отчеты, доступные из командной строки (--report ИМЯ). Параметр id - предмет или студент.
+enum class ReportParam { kNone, kSubject, kStudent };
+
+struct ReportEntry {
+  const char* name;
+  ReportParam param;
+  void (*render)(const DataStore&, const ReportRequest&, ReportSink&);
+};
+
+const ReportEntry kReports[] = {
+    {"overall", ReportParam::kNone, render_overall_averages},
+    {"subjects", ReportParam::kNone, render_subject_averages},
+    {"subject-detail", ReportParam::kSubject, render_subject_detail},
+    {"top", ReportParam::kNone, render_top_n},
+    {"retakes", ReportParam::kNone, render_retakes},
+    {"distribution-subjects", ReportParam::kNone, render_distribution_by_subject},
+    {"distribution-groups", ReportParam::kNone, render_distribution_by_group},
+    {"distribution-student", ReportParam::kStudent, render_distribution_by_student},
+    {"groups", ReportParam::kNone, render_group_summary},
+    {"group-subjects", ReportParam::kNone, render_group_subjects},
+    {"journal", ReportParam::kNone, render_journal_matrix},
+    {"journal-subject", ReportParam::kSubject, render_journal_by_subject},
+    {"journal-student", ReportParam::kStudent, render_journal_by_student},
+};
+
+const ReportEntry* find_report(const std::string& name) {
+  for (const auto& entry : kReports) {
+    if (name == entry.name) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+void journal_menu(DataStore& data, const Period& period) {
+  while (true) {
+    std::cout << "\n[Электронный журнал] период: " << period_name(period) << "\n"
+              << "1) Сводный журнал (последние оценки)\n"
+              << "2) Журнал по предмету (все попытки)\n"
+              << "3) Журнал по студенту (все попытки)\n"
+              << "0) Назад\n";
+    int choice = read_int("Выберите: ", 0, 3);
+    sync_or_warn(data);
+    switch (choice) {
+      case 1:
+        journal_matrix(data, period);
+        break;
+      case 2:
+        journal_by_subject(data, period);
+        break;
+      case 3:
+        journal_by_student(data, period);
+        break;
+      case 0:
+        return;
+      default:
+        break;
+    }
+  }
+}
+
+// Выполняет SQL без возвращаемых строк.
+// Пока true, exec_sql в этом потоке не печатает ошибки: вызывающий ждет их сам
+// (блокировка базы в stress_forced_rollback).
+bool& sqlite_errors_expected() {
+  thread_local bool expected = false;
+  return expected;
+}
+
+bool exec_sql(sqlite3* db, const std::string& sql) {
+  char* err = nullptr;
+  int rc = sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &err);
+  if (rc != SQLITE_OK) {
+    if (err) {
+      if (!sqlite_errors_expected()) {
+        std::cout << "Ошибка SQLite: " << err << "\n";
+      }
+      sqlite3_free(err);
+    }
+    return false;
+  }
+  return true;
+}
+
+// Проверяет наличие колонки в таблице.
+bool column_exists(sqlite3* db, const std::string& table, const std::string& column) {
+  sqlite3_stmt* stmt = nullptr;
+  std::string sql = "PRAGMA table_info(" + table + ");";
+  bool found = false;
+  if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK) {
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+      const unsigned char* name = sqlite3_column_text(stmt, 1);
+      if (name && column == reinterpret_cast<const char*>(name)) {
+        found = true;
+        break;
+      }
+    }
+  }
+  if (stmt) {
+    sqlite3_finalize(stmt);
+  }
+  return found;
+}
+
+// Добавляет колонку в существующую таблицу, если ее еще нет (миграция старых баз).
+bool ensure_column(sqlite3* db, const std::string& table, const std::string& column, const std::string& decl) {
+  if (column_exists(db, table, column)) {
+    return true;
+  }
+  return exec_sql(db, "ALTER TABLE " + table + " ADD COLUMN " + column + " " + decl + ";");
+}
+
+// Создает таблицы, если они еще не созданы.
+bool init_db(sqlite3* db) {
+  const char* sql =
+      "PRAGMA foreign_keys = ON;"
+      "CREATE TABLE IF NOT EXISTS groups ("
+      "  id INTEGER PRIMARY KEY,"
+      "  name TEXT NOT NULL"
+      ");"
+      "CREATE TABLE IF NOT EXISTS students ("
+      "  id INTEGER PRIMARY KEY,"
+      "  name TEXT NOT NULL,"
+      "  group_id INTEGER,"
+      "  FOREIGN KEY(group_id) REFERENCES groups(id)"
+      ");"
+      "CREATE TABLE IF NOT EXISTS subjects ("
+      "  id INTEGER PRIMARY KEY,"
+      "  name TEXT NOT NULL"
+      ");"
+      "CREATE TABLE IF NOT EXISTS grades ("
+      "  id INTEGER PRIMARY KEY,"
+      "  student_id INTEGER NOT NULL,"
+      "  subject_id INTEGER NOT NULL,"
+      "  value INTEGER NOT NULL,"
+      "  attempt INTEGER NOT NULL,"
+      "  created_at INTEGER NOT NULL DEFAULT 0,"
+      "  semester INTEGER NOT NULL DEFAULT 0,"
+      "  FOREIGN KEY(student_id) REFERENCES students(id),"
+      "  FOREIGN KEY(subject_id) REFERENCES subjects(id)"
+      ");";
+  if (!exec_sql(db, sql)) {
+    return false;
+  }
+  // Базы, созданные до появления семестров: старые оценки попадают в семестр 0 ("без даты").
+  if (!ensure_column(db, "grades", "created_at", "INTEGER NOT NULL DEFAULT 0") ||
+      !ensure_column(db, "grades", "semester", "INTEGER NOT NULL DEFAULT 0")) {
+    return false;
+  }
+  // Версии строк и журнал удалений для совместной работы нескольких процессов (см. save_changes).
+  for (const char* table : {"groups", "students", "subjects", "grades"}) {
+    if (!ensure_column(db, table, "version", "INTEGER NOT NULL DEFAULT 0")) {
+      return false;
+    }
+  }
+  return exec_sql(db,
+                  "CREATE INDEX IF NOT EXISTS idx_grades_semester ON grades(semester, id);"
+                  "CREATE INDEX IF NOT EXISTS idx_groups_version ON groups(version);"
+                  "CREATE INDEX IF NOT EXISTS idx_students_version ON students(version);"
+                  "CREATE INDEX IF NOT EXISTS idx_subjects_version ON subjects(version);"
+                  "CREATE INDEX IF NOT EXISTS idx_grades_version ON grades(version);"
+                  "DROP INDEX IF EXISTS idx_grades_student;"
+                  "CREATE INDEX IF NOT EXISTS idx_grades_student_subject ON grades(student_id, subject_id, semester, value);"
+                  "CREATE INDEX IF NOT EXISTS idx_grades_subject ON grades(subject_id);"
+                  "CREATE TABLE IF NOT EXISTS meta (key TEXT PRIMARY KEY, value INTEGER NOT NULL);"
+                  "INSERT OR IGNORE INTO meta(key, value) VALUES('seq', 0);"
+                  "CREATE TABLE IF NOT EXISTS tombstones ("
+                  "  seq INTEGER NOT NULL,"
+                  "  entity INTEGER NOT NULL,"
+                  "  id INTEGER NOT NULL"
+                  ");"
+                  "CREATE INDEX IF NOT EXISTS idx_tombstones_seq ON tombstones(seq);");
+}
+
+// Открывает базу: ожидание блокировки другим процессом, внешние ключи, схема.
+sqlite3* open_db(const std::string& path) {
+  sqlite3* db = nullptr;
+  if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
+    if (db) {
+      sqlite3_close(db);
+    }
+    return nullptr;
+  }
+  // Без WAL: база может лежать на сетевом диске, где WAL не работает.
+  sqlite3_busy_timeout(db, kBusyTimeoutMs);
+  if (!init_db(db)) {
+    sqlite3_close(db);
+    return nullptr;
+  }
+  return db;
+}
+
+// Постоянное соединение на время работы приложения: через него пишутся изменения
+// и отслеживается PRAGMA data_version (меняется, когда базу изменил другой процесс).
+struct DbSession {
+  sqlite3* db = nullptr;
+  int64_t data_version = 0;
+
+  ~DbSession() {
+    if (db) {
+      sqlite3_close(db);
+    }
+  }
+};
+
+// Читает PRAGMA data_version соединения.
+int64_t read_data_version(sqlite3* db) {
+  sqlite3_stmt* stmt = nullptr;
+  int64_t version = 0;
+  if (sqlite3_prepare_v2(db, "PRAGMA data_version;", -1, &stmt, nullptr) == SQLITE_OK &&
+      sqlite3_step(stmt) == SQLITE_ROW) {
+    version = sqlite3_column_int64(stmt, 0);
+  }
+  if (stmt) {
+    sqlite3_finalize(stmt);
+  }
+  return version;
+}
+
+// Возвращает сессию, открывая соединение с db_path() при первом обращении.
+DbSession& db_session() {
+  static DbSession session;
+  if (!session.db) {
+    session.db = open_db(db_path());
+    if (session.db) {
+      session.data_version = read_data_version(session.db);
+    }
+  }
+  return session;
+}
+
+// Закрывает соединение сессии; следующее обращение откроет базу db_path() заново.
+void close_db_session() {
+  DbSession& session = db_session();
+  if (session.db) {
+    sqlite3_close(session.db);
+    session.db = nullptr;
+    session.data_version = 0;
+  }
+}
+
+// Безопасно читает текстовую колонку.
+std::string column_text(sqlite3_stmt* stmt, int col) {
+  const unsigned char* text = sqlite3_column_text(stmt, col);
+  if (!text) {
+    return std::string();
+  }
+  return std::string(reinterpret_cast<const char*>(text));
+}
+
+// Выполняет запрос с целочисленными параметрами до конца; false - при ошибке.
+bool exec_bound(sqlite3* db, const char* sql, std::initializer_list<int64_t> args) {
+  sqlite3_stmt* stmt = nullptr;
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+    return false;
+  }
+  int index = 1;
+  for (int64_t arg : args) {
+    sqlite3_bind_int64(stmt, index++, arg);
+  }
+  bool ok = sqlite3_step(stmt) == SQLITE_DONE;
+  sqlite3_finalize(stmt);
+  return ok;
+}
+
+// Читает одно целое значение запроса (с необязательным параметром); fallback - если строки нет.
+int64_t query_int64(sqlite3* db, const char* sql, int64_t arg, int64_t fallback) {
+  sqlite3_stmt* stmt = nullptr;
+  int64_t value = fallback;
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK) {
+    sqlite3_bind_int64(stmt, 1, arg);
+    if (sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_type(stmt, 0) != SQLITE_NULL) {
+      value = sqlite3_column_int64(stmt, 0);
+    }
+  }
+  if (stmt) {
+    sqlite3_finalize(stmt);
+  }
+  return value;
+}
+
+// Текущий номер изменения базы (растет с каждой записью любого процесса).
+int64_t read_change_seq(sqlite3* db) {
+  return query_int64(db, "SELECT value FROM meta WHERE key = 'seq';", 0, 0);
+}
+
+// Имя таблицы сущности.
+const char* entity_table(Entity entity) {
+  switch (entity) {
+    case Entity::kGroup:
+      return "groups";
+    case Entity::kStudent:
+      return "students";
+    case Entity::kSubject:
+      return "subjects";
+    case Entity::kGrade:
+      return "grades";
+  }
+  return "";
+}
+
+// Название сущности для сообщений (родительный падеж).
+const char* entity_name(Entity entity) {
+  switch (entity) {
+    case Entity::kGroup:
+      return "группы";
+    case Entity::kStudent:
+      return "студента";
+    case Entity::kSubject:
+      return "предмета";
+    case Entity::kGrade:
+      return "оценки";
+  }
+  return "";
+}
+
+// Номер строки ленты изменений ({"seq":N,...}); -1 - строка не из ленты.
+int64_t feed_line_seq(std::string_view line) {
+  constexpr std::string_view kPrefix = "{\"seq\":";
+  if (line.substr(0, kPrefix.size()) != kPrefix) {
+    return -1;
+  }
+  int64_t seq = -1;
+  const char* begin = line.data() + kPrefix.size();
+  std::from_chars(begin, line.data() + line.size(), seq);
+  return seq;
+}
+
+constexpr int kFeedRetryIntervalMs = 500;
+constexpr size_t kFeedTailBytes = 64 * 1024;
+
+// Именованный канал Windows (\\.\pipe\ИМЯ).
+bool is_windows_pipe(const std::string& path) {
+  return path.rfind("\\\\.\\pipe\\", 0) == 0;
+}
+
+// Полный путь к файлу, одинаковый при любом способе его задать (имя базы в поле "db"
+// строк ленты и ленты в <база>.feeds).
+std::string normalized_path(const std::string& path) {
+  std::error_code ec;
+  std::filesystem::path full = std::filesystem::absolute(path, ec);
+  return (ec ? std::filesystem::path(path) : full).lexically_normal().string();
+}
+
+// Файл <база>.feeds: ленты, в которые писались изменения базы, по одной в строке.
+// По нему --maintain находит ленты, которым нужна строка reset.
+std::string feed_registry_path(const std::string& db) {
+  return std::filesystem::path(db).replace_extension(".feeds").string();
+}
+
+std::vector<std::string> read_feed_registry(const std::string& db) {
+  std::vector<std::string> feeds;
+  std::ifstream in(feed_registry_path(db));
+  std::string line;
+  while (std::getline(in, line)) {
+    if (!line.empty()) {
+      feeds.push_back(line);
+    }
+  }
+  return feeds;
+}
+
+void register_feed(const std::string& db, const std::string& feed) {
+  std::vector<std::string> feeds = read_feed_registry(db);
+  if (std::find(feeds.begin(), feeds.end(), feed) != feeds.end()) {
+    return;
+  }
+  std::ofstream out(feed_registry_path(db), std::ios::app);
+  out << feed << "\n";
+}
+
+// Лента изменений (--feed ПУТЬ): каждое записанное в хранилище изменение дописывается
+// строкой NDJSON (см. feed_changes). Номер seq растет на единицу с каждой строкой и
+// продолжается после перезапуска: он берется из последней целой строки файла и из
+// файла <лента>.feedseq (для канала, у которого нет хвоста; для канала Windows - из
+// data/<имя канала>.feedseq). Номер принадлежит ленте, а не базе: с --shards в одну
+// ленту пишут несколько баз, и строки различаются полем "db". Строки копятся в буфере,
+// а в файл или именованный канал их пишет фоновый поток, поэтому меню не ждет ни диска,
+// ни читателя канала. Канал без читателя не теряет строк: поток повторяет запись.
+class ChangeFeed {
+ public:
+  ~ChangeFeed() { close(); }
+
+  bool enabled() const { return writer_.joinable(); }
+
+  bool open(const std::string& path) {
+    path_ = path;
+    if (is_windows_pipe(path)) {
+      state_path_ = (std::filesystem::path(kDataDir) / (path.substr(9) + ".feedseq")).string();
+    } else {
+      state_path_ = path + ".feedseq";
+    }
+    db_.clear();
+    std::error_code ec;
+    pipe_ = is_windows_pipe(path) || std::filesystem::is_fifo(path, ec);
+    assigned_ = read_state();
+    if (!pipe_) {
+      if (!recover_tail()) {
+        return false;
+      }
+      file_ = std::fopen(path_.c_str(), "ab");
+      if (!file_) {
+        return false;
+      }
+      std::error_code size_ec;
+      size_ = std::filesystem::file_size(path_, size_ec);
+      if (size_ec) {
+        return false;
+      }
+    }
+#ifndef _WIN32
+    // Читатель канала может уйти в любой момент: запись вернет ошибку вместо SIGPIPE.
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+    stopping_ = false;
+    writer_ = std::thread([this]() { writer_loop(); });
+    return true;
+  }
+
+  // Номер для следующей строки; вызывается только из потока, который синхронизирует данные.
+  int64_t next_seq() { return ++assigned_; }
+  int64_t last_seq() const { return assigned_; }
+
+  // Значение поля "db" для строк базы path; при первой записи в базу лента отмечается
+  // в ее <база>.feeds. Вызывается из того же потока, что и next_seq.
+  const std::string& database(const std::string& path) {
+    if (path != db_path_) {
+      db_path_ = path;
+      db_ = normalized_path(path);
+      register_feed(path, is_windows_pipe(path_) ? path_ : normalized_path(path_));
+    }
+    return db_;
+  }
+
+  // Отдает строки фоновому потоку; last_seq - номер последней из них.
+  void append(const std::string& lines, int64_t last_seq) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      buffer_ += lines;
+      buffer_seq_ = last_seq;
+    }
+    wake_.notify_one();
+  }
+
+  // Дописывает буфер и останавливает поток. Если канал так и не открыли, строки
+  // теряются, но их номера не выдаются повторно.
+  void close() {
+    if (!writer_.joinable()) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_one();
+    writer_.join();
+    if (!buffer_.empty()) {
+      std::cout << "Лента изменений: не доставлено строк - "
+                << std::count(buffer_.begin(), buffer_.end(), '\n') << " (" << path_ << " не открыт читателем).\n";
+      buffer_.clear();
+    }
+    write_state(assigned_);
+    if (file_) {
+      std::fclose(file_);
+      file_ = nullptr;
+    }
+  }
+
+ private:
+  int64_t read_state() const {
+    std::ifstream in(state_path_);
+    long long seq = 0;
+    return (in >> seq) ? seq : 0;
+  }
+
+  void write_state(int64_t seq) const {
+    std::FILE* file = std::fopen(state_path_.c_str(), "wb");
+    if (file) {
+      std::fprintf(file, "%lld\n", static_cast<long long>(seq));
+      std::fclose(file);
+    }
+  }
+
+  // Номер последней целой строки файла; недописанный хвост (сбой во время записи) отрезается.
+  bool recover_tail() {
+    std::error_code ec;
+    if (!std::filesystem::exists(path_, ec)) {
+      return true;
+    }
+    uint64_t size = std::filesystem::file_size(path_, ec);
+    if (ec) {
+      return false;
+    }
+    uint64_t from = size > kFeedTailBytes ? size - kFeedTailBytes : 0;
+    std::ifstream in(path_, std::ios::binary);
+    std::string tail(static_cast<size_t>(size - from), '\0');
+    in.seekg(static_cast<std::streamoff>(from));
+    if (!in.read(tail.data(), static_cast<std::streamsize>(tail.size()))) {
+      return false;
+    }
+    in.close();
+    size_t end = tail.rfind('\n');
+    if (end == std::string::npos) {
+      // Ни одной целой строки в хвосте: файл целиком недописан, если он короче хвоста.
+      if (from == 0) {
+        std::filesystem::resize_file(path_, 0, ec);
+      }
+      return !ec;
+    }
+    if (end + 1 != tail.size()) {
+      std::filesystem::resize_file(path_, from + end + 1, ec);
+      if (ec) {
+        return false;
+      }
+    }
+    size_t start = tail.rfind('\n', end == 0 ? 0 : end - 1);
+    start = (start == std::string::npos || end == 0) ? 0 : start + 1;
+    assigned_ = std::max(assigned_, feed_line_seq(std::string_view(tail).substr(start, end - start)));
+    return true;
+  }
+
+  std::FILE* open_output() const {
+#ifdef _WIN32
+    return std::fopen(path_.c_str(), pipe_ ? "wb" : "ab");
+#else
+    if (!pipe_) {
+      return std::fopen(path_.c_str(), "ab");
+    }
+    // Без O_NONBLOCK открытие канала ждало бы читателя и не давало остановить поток.
+    int fd = ::open(path_.c_str(), O_WRONLY | O_NONBLOCK);
+    if (fd < 0) {
+      return nullptr;
+    }
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    return ::fdopen(fd, "wb");
+#endif
+  }
+
+  bool write_batch(const std::string& batch) {
+    if (!file_) {
+      file_ = open_output();
+      if (!file_) {
+        return false;
+      }
+    }
+    if (std::fwrite(batch.data(), 1, batch.size(), file_) != batch.size() || std::fflush(file_) != 0) {
+      // Читатель канала ушел: строки пишутся заново следующему (дубли он пропустит по seq).
+      std::fclose(file_);
+      file_ = nullptr;
+      if (!pipe_) {
+        // В файле часть пакета (диск заполнен) отрезается: повтор допишет его целиком,
+        // без оборванной строки и повторных номеров.
+        std::error_code ec;
+        std::filesystem::resize_file(path_, size_, ec);
+      }
+      return false;
+    }
+    size_ += batch.size();
+    return true;
+  }
+
+  void writer_loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      wake_.wait(lock, [this]() { return stopping_ || !buffer_.empty(); });
+      if (buffer_.empty()) {
+        break;
+      }
+      std::string batch;
+      batch.swap(buffer_);
+      int64_t batch_seq = buffer_seq_;
+      lock.unlock();
+      bool written = write_batch(batch);
+      if (written) {
+        write_state(batch_seq);
+      }
+      lock.lock();
+      if (written) {
+        continue;
+      }
+      buffer_.insert(0, batch);
+      if (stopping_) {
+        break;
+      }
+      wake_.wait_for(lock, std::chrono::milliseconds(kFeedRetryIntervalMs), [this]() { return stopping_; });
+    }
+  }
+
+  std::string path_;
+  std::string state_path_;
+  std::string db_path_;  // база последних строк (как ее задал db_path())
+  std::string db_;       // и ее имя в поле "db"
+  bool pipe_ = false;
+  std::FILE* file_ = nullptr;  // открывает open() (файл) или фоновый поток (канал)
+  uint64_t size_ = 0;          // размер файла после последнего целого пакета
+  int64_t assigned_ = 0;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::string buffer_;
+  int64_t buffer_seq_ = 0;
+  bool stopping_ = false;
+  std::thread writer_;
+};
+
+ChangeFeed& change_feed() {
+  static ChangeFeed feed;
+  return feed;
+}
+
+// Ключ сущности в строках ленты изменений.
+const char* entity_key(Entity entity) {
+  switch (entity) {
+    case Entity::kGroup:
+      return "group";
+    case Entity::kStudent:
+      return "student";
+    case Entity::kSubject:
+      return "subject";
+    case Entity::kGrade:
+      return "grade";
+  }
+  return "";
+}
+
+// Дописывает в ленту записанные изменения: {"seq","ts","db","op","entity","id"} и для
+// insert/update - поля строки из памяти. Оценки удаляемого студента или предмета и
+// студенты удаляемой группы приходят отдельными строками перед удалением (см.
+// record_deletes). Строка, удаленная позже в том же пакете, пропускается.
+void feed_changes(const DataStore& data, const PendingGrades& grades, const std::vector<PendingChange>& changes) {
+  ChangeFeed& feed = change_feed();
+  if (!feed.enabled() || changes.empty()) {
+    return;
+  }
+  static const char* kOpNames[] = {"insert", "update", "delete"};
+  long long ts = now_unix();
+  const std::string& db = feed.database(db_path());
+  std::string lines;
+  for (const auto& change : changes) {
+    const Group* group = nullptr;
+    const Student* student = nullptr;
+    const Subject* subject = nullptr;
+    Grade grade;
+    bool found = true;
+    if (change.op != ChangeOp::kDelete) {
+      switch (change.entity) {
+        case Entity::kGroup:
+          found = (group = find_group(data, change.id)) != nullptr;
+          break;
+        case Entity::kStudent:
+          found = (student = find_student(data, change.id)) != nullptr;
+          break;
+        case Entity::kSubject:
+          found = (subject = find_subject(data, change.id)) != nullptr;
+          break;
+        case Entity::kGrade:
+          found = grades.find(data, change.id, grade);
+          break;
+      }
+    }
+    if (!found) {
+      continue;
+    }
+    JsonWriter json;
+    json.begin_object();
+    json.field("seq", static_cast<long long>(feed.next_seq()));
+    json.field("ts", ts);
+    json.field("db", db);
+    json.field("op", kOpNames[static_cast<int>(change.op)]);
+    json.field("entity", entity_key(change.entity));
+    json.field("id", change.id);
+    if (group) {
+      json.field("name", group->name);
+    } else if (student) {
+      json.field("name", student->name);
+      json.key("group_id");
+      if (student->group_id == 0) {
+        json.value_null();
+      } else {
+        json.value(student->group_id);
+      }
+    } else if (subject) {
+      json.field("name", subject->name);
+    } else if (change.entity == Entity::kGrade && change.op != ChangeOp::kDelete) {
+      json.field("student_id", grade.student_id);
+      json.field("subject_id", grade.subject_id);
+      json.field("value", grade.value);
+      json.field("attempt", grade.attempt);
+      json.field("semester", grade.semester);
+      json.field("created_at", static_cast<long long>(grade.created_at));
+    }
+    json.end_object();
+    lines += json.str();
+    lines.push_back('\n');
+  }
+  if (!lines.empty()) {
+    feed.append(lines, feed.last_seq());
+  }
+}
+
+// Дописывает строку {"seq","ts","db","op":"reset"}: ID базы перенумерованы (--maintain),
+// и потребителю нужна полная выгрузка. Возвращает номер строки.
+int64_t feed_reset(ChangeFeed& feed, const std::string& path) {
+  JsonWriter json;
+  json.begin_object();
+  json.field("seq", static_cast<long long>(feed.next_seq()));
+  json.field("ts", static_cast<long long>(now_unix()));
+  json.field("db", feed.database(path));
+  json.field("op", "reset");
+  json.end_object();
+  feed.append(json.str() + "\n", feed.last_seq());
+  return feed.last_seq();
+}
+
+// То же для всех накопленных изменений (хранилища, которые записывают их целиком).
+void feed_pending_changes(const DataStore& data) {
+  if (change_feed().enabled() && !data.pending_changes.empty()) {
+    feed_changes(data, PendingGrades(data), data.pending_changes);
+  }
+}
+
+// Колонки строк в порядке, который ожидают read_*_row.
+const char* kGroupColumns = "id, name, version";
+const char* kStudentColumns = "id, name, group_id, version";
+const char* kSubjectColumns = "id, name, version";
+const char* kGradeColumns = "id, student_id, subject_id, value, attempt, created_at, semester, version";
+
+// Читают текущую строку результата в структуру (колонки - см. k*Columns).
+Group read_group_row(sqlite3_stmt* stmt) {
+  Group group;
+  group.id = sqlite3_column_int(stmt, 0);
+  group.name = column_text(stmt, 1);
+  group.version = sqlite3_column_int64(stmt, 2);
+  return group;
+}
+
+Student read_student_row(sqlite3_stmt* stmt) {
+  Student student;
+  student.id = sqlite3_column_int(stmt, 0);
+  student.name = column_text(stmt, 1);
+  if (sqlite3_column_type(stmt, 2) != SQLITE_NULL) {
+    student.group_id = sqlite3_column_int(stmt, 2);
+  }
+  student.version = sqlite3_column_int64(stmt, 3);
+  return student;
+}
+
+Subject read_subject_row(sqlite3_stmt* stmt) {
+  Subject subject;
+  subject.id = sqlite3_column_int(stmt, 0);
+  subject.name = column_text(stmt, 1);
+  subject.version = sqlite3_column_int64(stmt, 2);
+  return subject;
+}
+
+Grade read_grade_row(sqlite3_stmt* stmt) {
+  Grade grade;
+  grade.id = sqlite3_column_int(stmt, 0);
+  grade.student_id = sqlite3_column_int(stmt, 1);
+  grade.subject_id = sqlite3_column_int(stmt, 2);
+  grade.value = sqlite3_column_int(stmt, 3);
+  grade.attempt = sqlite3_column_int(stmt, 4);
+  grade.created_at = sqlite3_column_int64(stmt, 5);
+  grade.semester = sqlite3_column_int(stmt, 6);
+  grade.version = sqlite3_column_int64(stmt, 7);
+  return grade;
+}
+
+// Выполняет SELECT и передает каждую строку в fn.
+template <typename Fn>
+bool for_each_row(sqlite3* db, const std::string& sql, int64_t arg, Fn&& fn) {
+  sqlite3_stmt* stmt = nullptr;
+  if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+    return false;
+  }
+  sqlite3_bind_int64(stmt, 1, arg);
+  int rc = SQLITE_ROW;
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    fn(stmt);
+  }
+  sqlite3_finalize(stmt);
+  return rc == SQLITE_DONE;
+}
+
+// Привязывает поля строки из памяти (параметры 1..N); возвращает N или 0, если строки нет.
+int bind_row_fields(sqlite3_stmt* stmt, const DataStore& data, const PendingGrades& grades, Entity entity,
+                    int id) {
+  switch (entity) {
+    case Entity::kGroup: {
+      const Group* group = find_group(data, id);
+      if (!group) {
+        return 0;
+      }
+      sqlite3_bind_text(stmt, 1, group->name.c_str(), -1, SQLITE_TRANSIENT);
+      return 1;
+    }
+    case Entity::kStudent: {
+      const Student* student = find_student(data, id);
+      if (!student) {
+        return 0;
+      }
+      sqlite3_bind_text(stmt, 1, student->name.c_str(), -1, SQLITE_TRANSIENT);
+      if (student->group_id == 0) {
+        sqlite3_bind_null(stmt, 2);
+      } else {
+        sqlite3_bind_int(stmt, 2, student->group_id);
+      }
+      return 2;
+    }
+    case Entity::kSubject: {
+      const Subject* subject = find_subject(data, id);
+      if (!subject) {
+        return 0;
+      }
+      sqlite3_bind_text(stmt, 1, subject->name.c_str(), -1, SQLITE_TRANSIENT);
+      return 1;
+    }
+    case Entity::kGrade: {
+      Grade grade;
+      if (!grades.find(data, id, grade)) {
+        return 0;
+      }
+      sqlite3_bind_int(stmt, 1, grade.student_id);
+      sqlite3_bind_int(stmt, 2, grade.subject_id);
+      sqlite3_bind_int(stmt, 3, grade.value);
+      sqlite3_bind_int(stmt, 4, grade.attempt);
+      sqlite3_bind_int64(stmt, 5, grade.created_at);
+      sqlite3_bind_int(stmt, 6, grade.semester);
+      return 6;
+    }
+  }
+  return 0;
+}
+
+// SQL вставки: поля строки, затем version и id.
+const char* insert_sql(Entity entity) {
+  switch (entity) {
+    case Entity::kGroup:
+      return "INSERT INTO groups(name, version, id) VALUES(?, ?, ?);";
+    case Entity::kStudent:
+      return "INSERT INTO students(name, group_id, version, id) VALUES(?, ?, ?, ?);";
+    case Entity::kSubject:
+      return "INSERT INTO subjects(name, version, id) VALUES(?, ?, ?);";
+    case Entity::kGrade:
+      return "INSERT INTO grades(student_id, subject_id, value, attempt, created_at, semester, version, id) "
+             "VALUES(?, ?, ?, ?, ?, ?, ?, ?);";
+  }
+  return "";
+}
+
+// SQL правки: поля строки, затем новая version, id и ожидаемая (старая) version.
+const char* update_sql(Entity entity) {
+  switch (entity) {
+    case Entity::kGroup:
+      return "UPDATE groups SET name = ?, version = ? WHERE id = ? AND version = ?;";
+    case Entity::kStudent:
+      return "UPDATE students SET name = ?, group_id = ?, version = ? WHERE id = ? AND version = ?;";
+    case Entity::kSubject:
+      return "UPDATE subjects SET name = ?, version = ? WHERE id = ? AND version = ?;";
+    case Entity::kGrade:
+      return "UPDATE grades SET student_id = ?, subject_id = ?, value = ?, attempt = ?, created_at = ?, "
+             "semester = ?, version = ? WHERE id = ? AND version = ?;";
+  }
+  return "";
+}
+
+// Меняет ID новой строки, занятый другим процессом, вместе со ссылками на нее в памяти
+// и в pending_changes: если транзакция откатится, повторная запись найдет строку по новому ID.
+void remap_new_id(DataStore& data, Entity entity, int old_id, int new_id) {
+  ++data.generation;
+  for (auto& change : data.pending_changes) {
+    if (change.entity == entity && change.id == old_id) {
+      change.id = new_id;
+    }
+  }
+  switch (entity) {
+    case Entity::kGroup:
+      entity_for_update(data.groups, old_id)->id = new_id;
+      for (size_t i = 0; i < data.students.size(); ++i) {
+        if (data.students[i].group_id == old_id) {
+          data.students.write()[i].group_id = new_id;
+        }
+      }
+      data.next_group_id = std::max(data.next_group_id, new_id + 1);
+      break;
+    case Entity::kStudent:
+      entity_for_update(data.students, old_id)->id = new_id;
+      for (auto& part : data.grade_partitions) {
+        for (size_t i = 0; i < part->size(); ++i) {
+          Grade grade = part->grade_at(i);
+          if (grade.student_id == old_id) {
+            data.retakes.remove(grade);
+            grade.student_id = new_id;
+            part.write().store(i, grade);
+            data.retakes.add(grade);
+          }
+        }
+      }
+      data.next_student_id = std::max(data.next_student_id, new_id + 1);
+      break;
+    case Entity::kSubject:
+      entity_for_update(data.subjects, old_id)->id = new_id;
+      for (auto& part : data.grade_partitions) {
+        for (size_t i = 0; i < part->size(); ++i) {
+          Grade grade = part->grade_at(i);
+          if (grade.subject_id == old_id) {
+            data.retakes.remove(grade);
+            grade.subject_id = new_id;
+            part.write().store(i, grade);
+            data.retakes.add(grade);
+          }
+        }
+        if (part->subject_histograms.count(old_id) > 0) {
+          std::map<int, GradeHistogram>& histograms = part.write().subject_histograms;
+          GradeHistogram moved = histograms[old_id];
+          histograms.erase(old_id);
+          histograms[new_id].merge(moved);
+        }
+      }
+      data.next_subject_id = std::max(data.next_subject_id, new_id + 1);
+      break;
+    case Entity::kGrade:
+      for (auto& part : data.grade_partitions) {
+        for (size_t i = 0; i < part->size(); ++i) {
+          if (part->grades[i].id == old_id) {
+            Grade grade = part->grade_at(i);
+            data.retakes.remove(grade);
+            grade.id = new_id;
+            part.write().store(i, grade);
+            data.retakes.add(grade);
+          }
+        }
+      }
+      data.next_grade_id = std::max(data.next_grade_id, new_id + 1);
+      break;
+  }
+  settle_retakes(data);
+}
+
+// Следующий свободный ID сущности в памяти.
+int next_id_for(const DataStore& data, Entity entity) {
+  switch (entity) {
+    case Entity::kGroup:
+      return data.next_group_id;
+    case Entity::kStudent:
+      return data.next_student_id;
+    case Entity::kSubject:
+      return data.next_subject_id;
+    case Entity::kGrade:
+      return data.next_grade_id;
+  }
+  return 1;
+}
+
+// Вставляет новую строку; при занятом другим процессом ID выдает следующий свободный
+// (id - итоговый ID строки). Возвращает false при ошибке базы, conflict - если строка
+// ссылается на удаленную другим процессом.
+bool insert_row(sqlite3* db, DataStore& data, const PendingGrades& grades, const PendingChange& change, int64_t seq,
+                int& id, bool& conflict) {
+  id = change.id;
+  while (true) {
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, insert_sql(change.entity), -1, &stmt, nullptr) != SQLITE_OK) {
+      return false;
+    }
+    int fields = bind_row_fields(stmt, data, grades, change.entity, id);
+    if (fields == 0) {
+      sqlite3_finalize(stmt);
+      return true;
+    }
+    sqlite3_bind_int64(stmt, fields + 1, seq);
+    sqlite3_bind_int(stmt, fields + 2, id);
+    int rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    if (rc == SQLITE_DONE) {
+      return true;
+    }
+    int extended = sqlite3_extended_errcode(db);
+    if (extended == SQLITE_CONSTRAINT_PRIMARYKEY) {
+      std::string sql = std::string("SELECT MAX(id) FROM ") + entity_table(change.entity) + ";";
+      int new_id = static_cast<int>(std::max<int64_t>(next_id_for(data, change.entity),
+                                                      query_int64(db, sql.c_str(), 0, 0) + 1));
+      std::cout << "ID " << entity_name(change.entity) << " " << id
+                << " уже занят другим пользователем, новая запись получила ID " << new_id << ".\n";
+      remap_new_id(data, change.entity, id, new_id);
+      id = new_id;
+      continue;
+    }
+    if (extended == SQLITE_CONSTRAINT_FOREIGNKEY) {
+      conflict = true;
+      return true;
+    }
+    return false;
+  }
+}
+
+// Применяет правку строки при совпадении версии (оптимистическая блокировка).
+bool update_row(sqlite3* db, const DataStore& data, const PendingGrades& grades, const PendingChange& change,
+                int64_t seq, bool& conflict) {
+  sqlite3_stmt* stmt = nullptr;
+  if (sqlite3_prepare_v2(db, update_sql(change.entity), -1, &stmt, nullptr) != SQLITE_OK) {
+    return false;
+  }
+  int fields = bind_row_fields(stmt, data, grades, change.entity, change.id);
+  if (fields == 0) {
+    sqlite3_finalize(stmt);
+    return true;
+  }
+  sqlite3_bind_int64(stmt, fields + 1, seq);
+  sqlite3_bind_int(stmt, fields + 2, change.id);
+  sqlite3_bind_int64(stmt, fields + 3, change.base_version);
+  int rc = sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  if (rc == SQLITE_DONE) {
+    if (sqlite3_changes(db) == 0) {
+      conflict = true;
+    }
+    return true;
+  }
+  if (sqlite3_extended_errcode(db) == SQLITE_CONSTRAINT_FOREIGNKEY) {
+    conflict = true;
+    return true;
+  }
+  return false;
+}
+
+// Удаляет строку при совпадении версии вместе с зависимыми данными и пишет журнал удалений.
+bool delete_row(sqlite3* db, const PendingChange& change, int64_t seq, bool& conflict) {
+  std::string table = entity_table(change.entity);
+  std::string sql = "SELECT version FROM " + table + " WHERE id = ?;";
+  if (query_int64(db, sql.c_str(), change.id, -1) != change.base_version) {
+    conflict = true;
+    return true;
+  }
+  bool ok = true;
+  int64_t grade_entity = static_cast<int64_t>(Entity::kGrade);
+  if (change.entity == Entity::kStudent) {
+    ok = exec_bound(db, "INSERT INTO tombstones(seq, entity, id) SELECT ?, ?, id FROM grades WHERE student_id = ?;",
+                    {seq, grade_entity, change.id}) &&
+         exec_bound(db, "DELETE FROM grades WHERE student_id = ?;", {change.id});
+  } else if (change.entity == Entity::kSubject) {
+    ok = exec_bound(db, "INSERT INTO tombstones(seq, entity, id) SELECT ?, ?, id FROM grades WHERE subject_id = ?;",
+                    {seq, grade_entity, change.id}) &&
+         exec_bound(db, "DELETE FROM grades WHERE subject_id = ?;", {change.id});
+  } else if (change.entity == Entity::kGroup) {
+    ok = exec_bound(db, "UPDATE students SET group_id = NULL, version = ? WHERE group_id = ?;", {seq, change.id});
+  }
+  sql = "DELETE FROM " + table + " WHERE id = ?;";
+  return ok && exec_bound(db, sql.c_str(), {change.id}) &&
+         exec_bound(db, "INSERT INTO tombstones(seq, entity, id) VALUES(?, ?, ?);",
+                    {seq, static_cast<int64_t>(change.entity), change.id});
+}
+
+// Записывает накопленные изменения одной транзакцией. Каждая запись получает новый
+// номер изменения базы, он же становится версией затронутых строк. Правка или удаление
+// строки, которую успел изменить другой процесс, не применяются (conflicts); при
+// pending_all_or_nothing такой конфликт откатывает всю транзакцию.
+bool save_changes(DataStore& data, sqlite3* db, int& conflicts) {
+  if (!exec_sql(db, "BEGIN IMMEDIATE;")) {
+    return false;
+  }
+  int conflicts_before = conflicts;
+  PendingGrades grades(data);
+  int64_t seq = read_change_seq(db) + 1;
+  bool ok = exec_bound(db, "UPDATE meta SET value = ? WHERE key = 'seq';", {seq});
+  // Для ленты изменений: примененные правки с итоговыми ID.
+  bool feeding = change_feed().enabled();
+  std::vector<PendingChange> applied;
+  for (const auto& change : data.pending_changes) {
+    if (!ok) {
+      break;
+    }
+    bool conflict = false;
+    int id = change.id;
+    if (change.op == ChangeOp::kInsert) {
+      ok = insert_row(db, data, grades, change, seq, id, conflict);
+    } else if (change.op == ChangeOp::kUpdate) {
+      ok = update_row(db, data, grades, change, seq, conflict);
+    } else {
+      ok = delete_row(db, change, seq, conflict);
+    }
+    if (conflict) {
+      ++conflicts;
+    } else if (feeding) {
+      applied.push_back(change);
+      applied.back().id = id;
+    }
+  }
+  if (ok && conflicts > conflicts_before && data.pending_all_or_nothing) {
+    // Изменения не записаны; вызывающий перечитает базу, как при любом конфликте.
+    exec_sql(db, "ROLLBACK;");
+    data.pending_changes.clear();
+    return true;
+  }
+  if (ok) {
+    ok = exec_sql(db, "COMMIT;");
+  }
+  if (!ok) {
+    exec_sql(db, "ROLLBACK;");
+    return false;
+  }
+  feed_changes(data, grades, applied);
+  data.pending_changes.clear();
+  return true;
+}
+
+// Обновляет или добавляет строку справочника по ID.
+template <typename T>
+void upsert_by_id(CowTable<T>& table, const T& row) {
+  std::vector<T>& items = table.write();
+  auto it = std::find_if(items.begin(), items.end(), [&](const T& item) { return item.id == row.id; });
+  if (it == items.end()) {
+    items.push_back(row);
+  } else {
+    *it = row;
+  }
+}
+
+// Удаляет строки справочника по условию; таблица копируется, только если есть что удалять.
+template <typename T, typename Pred>
+void erase_rows_if(CowTable<T>& table, Pred pred) {
+  if (std::none_of(table.begin(), table.end(), pred)) {
+    return;
+  }
+  std::vector<T>& items = table.write();
+  items.erase(std::remove_if(items.begin(), items.end(), pred), items.end());
+}
+
+// Подтягивает строки, измененные после data.synced_seq (в том числе своими записями),
+// и применяет журнал удалений.
+bool pull_changes(DataStore& data, sqlite3* db) {
+  if (!exec_sql(db, "BEGIN;")) {
+    return false;
+  }
+  int64_t since = data.synced_seq;
+  int64_t seq = read_change_seq(db);
+  std::vector<int> removed[4];
+  bool ok = for_each_row(db, "SELECT entity, id FROM tombstones WHERE seq > ?;", since, [&](sqlite3_stmt* stmt) {
+    int entity = sqlite3_column_int(stmt, 0);
+    if (entity >= 0 && entity < 4) {
+      removed[entity].push_back(sqlite3_column_int(stmt, 1));
+    }
+  });
+  std::vector<Group> groups;
+  std::vector<Student> students;
+  std::vector<Subject> subjects;
+  std::vector<Grade> grades;
+  ok = ok && for_each_row(db, std::string("SELECT ") + kGroupColumns + " FROM groups WHERE version > ?;", since,
+                          [&](sqlite3_stmt* stmt) { groups.push_back(read_group_row(stmt)); });
+  ok = ok && for_each_row(db, std::string("SELECT ") + kStudentColumns + " FROM students WHERE version > ?;", since,
+                          [&](sqlite3_stmt* stmt) { students.push_back(read_student_row(stmt)); });
+  ok = ok && for_each_row(db, std::string("SELECT ") + kSubjectColumns + " FROM subjects WHERE version > ?;", since,
+                          [&](sqlite3_stmt* stmt) { subjects.push_back(read_subject_row(stmt)); });
+  ok = ok && for_each_row(db, std::string("SELECT ") + kGradeColumns + " FROM grades WHERE version > ?;", since,
+                          [&](sqlite3_stmt* stmt) { grades.push_back(read_grade_row(stmt)); });
+  exec_sql(db, "COMMIT;");
+  if (!ok) {
+    return false;
+  }
+
+  // Сначала удаления: освобожденный ID мог быть снова выдан новой строке.
+  auto contains = [](std::vector<int>& ids, int id) { return std::binary_search(ids.begin(), ids.end(), id); };
+  for (auto& ids : removed) {
+    std::sort(ids.begin(), ids.end());
+  }
+  std::vector<int>& removed_groups = removed[static_cast<int>(Entity::kGroup)];
+  std::vector<int>& removed_students = removed[static_cast<int>(Entity::kStudent)];
+  std::vector<int>& removed_subjects = removed[static_cast<int>(Entity::kSubject)];
+  std::vector<int>& removed_grades = removed[static_cast<int>(Entity::kGrade)];
+  erase_rows_if(data.groups, [&](const Group& g) { return contains(removed_groups, g.id); });
+  erase_rows_if(data.students, [&](const Student& s) { return contains(removed_students, s.id); });
+  erase_rows_if(data.subjects, [&](const Subject& s) { return contains(removed_subjects, s.id); });
+  if (!removed_grades.empty()) {
+    erase_grades_if(data, [&](const Grade& g) { return contains(removed_grades, g.id); });
+  }
+  if (!groups.empty() || !students.empty() || !subjects.empty() || !grades.empty() ||
+      std::any_of(std::begin(removed), std::end(removed), [](const std::vector<int>& ids) { return !ids.empty(); })) {
+    ++data.generation;
+  }
+
+  for (const auto& group : groups) {
+    upsert_by_id(data.groups, group);
+    data.next_group_id = std::max(data.next_group_id, group.id + 1);
+  }
+  for (const auto& student : students) {
+    upsert_by_id(data.students, student);
+    data.next_student_id = std::max(data.next_student_id, student.id + 1);
+  }
+  for (const auto& subject : subjects) {
+    upsert_by_id(data.subjects, subject);
+    data.next_subject_id = std::max(data.next_subject_id, subject.id + 1);
+  }
+  if (!grades.empty()) {
+    // Один проход по партициям: известные оценки обновляются, остальные добавляются.
+    std::sort(grades.begin(), grades.end(), [](const Grade& a, const Grade& b) { return a.id < b.id; });
+    std::vector<bool> applied(grades.size(), false);
+    for (auto& part : data.grade_partitions) {
+      for (size_t i = 0; i < part->size(); ++i) {
+        int id = part->grades[i].id;
+        auto it = std::lower_bound(grades.begin(), grades.end(), id,
+                                   [](const Grade& g, int value) { return g.id < value; });
+        if (it != grades.end() && it->id == id) {
+          replace_grade(data, part, i, *it);
+          applied[it - grades.begin()] = true;
+        }
+      }
+    }
+    for (size_t i = 0; i < grades.size(); ++i) {
+      if (!applied[i]) {
+        insert_grade(data, grades[i]);
+      }
+      data.next_grade_id = std::max(data.next_grade_id, grades[i].id + 1);
+    }
+    settle_retakes(data);
+  }
+  data.synced_seq = seq;
+  return true;
+}
+
+// Синхронизирует память с базой: записывает накопленные изменения и, если базу
+// менял другой процесс, подтягивает его изменения.
+SyncResult sync_with_db(DataStore& data) {
+  SyncResult result;
+  DbSession& session = db_session();
+  if (!session.db) {
+    result.ok = false;
+    return result;
+  }
+  bool saved = false;
+  if (!data.pending_changes.empty()) {
+    // Правки уже применены в памяти, даже если запись в базу не удастся.
+    result.changed = true;
+    if (!save_changes(data, session.db, result.conflicts)) {
+      result.ok = false;
+      return result;
+    }
+    saved = true;
+  }
+  int64_t version = read_data_version(session.db);
+  if (result.conflicts > 0) {
+    // Чужие правки пересеклись с нашими: проще и надежнее перечитать базу целиком.
+    result.ok = load_data(data, db_path());
+  } else if (saved || version != session.data_version) {
+    result.ok = pull_changes(data, session.db);
+    result.changed = true;
+  }
+  if (result.ok) {
+    session.data_version = version;
+  }
+  return result;
+}
+
+// Синхронизирует данные с базой и сообщает пользователю о проблемах.
+void sync_or_warn(DataStore& data) {
+  bool all_or_nothing = data.pending_all_or_nothing;
+  SyncResult result = storage().sync(data);
+  if (data.pending_changes.empty()) {
+    data.pending_all_or_nothing = false;
+  }
+  if (result.changed) {
+    publish_snapshot(data);
+  }
+  if (result.conflicts > 0 && all_or_nothing) {
+    std::cout << "Изменения не сохранены: часть записей уже изменил или удалил другой пользователь. "
+                 "Данные перечитаны.\n";
+  } else if (result.conflicts > 0) {
+    std::cout << "Часть изменений (" << result.conflicts
+              << ") не сохранена: эти записи уже изменил или удалил другой пользователь. Данные перечитаны.\n";
+  }
+  if (!result.ok) {
+    std::cout << "Синхронизация с базой не удалась (база занята?). Изменения будут записаны при следующем действии.\n";
+  }
+}
+
+// Открывает соединение только для чтения (схему создает и обновляет open_db).
+sqlite3* open_db_readonly(const std::string& path) {
+  sqlite3* db = nullptr;
+  if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK) {
+    if (db) {
+      sqlite3_close(db);
+    }
+    return nullptr;
+  }
+  sqlite3_busy_timeout(db, kBusyTimeoutMs);
+  return db;
+}
+
+// Выполняет read в читающей транзакции; seq - номер изменения базы, которому
+// соответствуют прочитанные строки (блокировка держится до COMMIT).
+bool read_in_transaction(sqlite3* db, int64_t& seq, const std::function<bool(sqlite3*)>& read) {
+  if (!exec_sql(db, "BEGIN;")) {
+    return false;
+  }
+  seq = read_change_seq(db);
+  bool ok = read(db);
+  exec_sql(db, "COMMIT;");
+  return ok;
+}
+
+// Множество ID для проверки ссылок при загрузке: битовая карта, если ID плотные
+// (их выдают подряд), иначе бинарный поиск по отсортированному вектору.
+class IdSet {
+ public:
+  // ids должны быть отсортированы по возрастанию.
+  explicit IdSet(std::vector<int> ids) : ids_(std::move(ids)) {
+    int max_id = ids_.empty() ? 0 : ids_.back();
+    if (max_id >= 0 && static_cast<size_t>(max_id) <= ids_.size() * 64 + 1024) {
+      bits_.assign(static_cast<size_t>(max_id) + 1, false);
+      for (int id : ids_) {
+        if (id >= 0) {
+          bits_[static_cast<size_t>(id)] = true;
+        }
+      }
+      dense_ = true;
+    }
+  }
+
+  bool contains(int id) const {
+    if (dense_) {
+      return id >= 0 && static_cast<size_t>(id) < bits_.size() && bits_[static_cast<size_t>(id)];
+    }
+    return std::binary_search(ids_.begin(), ids_.end(), id);
+  }
+
+ private:
+  std::vector<int> ids_;
+  std::vector<bool> bits_;
+  bool dense_ = false;
+};
+
+// Собирает отсортированные ID строк (строки читаются в порядке id).
+template <typename T>
+std::vector<int> sorted_ids(const CowTable<T>& items) {
+  std::vector<int> ids;
+  ids.reserve(items.size());
+  for (const auto& item : items) {
+    ids.push_back(item.id);
+  }
+  return ids;
+}
+
+constexpr int kParallelLoadAttempts = 3;
+
+// Загружает данные из SQLite; false - если базу открыть не удалось. Четыре таблицы
+// читаются параллельно в отдельных соединениях только для чтения. Каждое соединение
+// запоминает номер изменения базы (meta.seq): если другой процесс успел записать
+// между чтениями, номера разойдутся и чтение повторяется, а после kParallelLoadAttempts
+// неудач все таблицы читаются одной транзакцией.
+bool load_data(DataStore& data, const std::string& path) {
+  sqlite3* db = open_db(path);
+  if (!db) {
+    return false;
+  }
+
+  DataStore temp;
+  int max_group_id = 0;
+  int max_student_id = 0;
+  int max_subject_id = 0;
+  int max_grade_id = 0;
+  auto read_groups = [&](sqlite3* conn) {
+    return for_each_row(conn, std::string("SELECT ") + kGroupColumns + " FROM groups ORDER BY id;", 0,
+                        [&](sqlite3_stmt* stmt) {
+                          temp.groups.write().push_back(read_group_row(stmt));
+                          max_group_id = std::max(max_group_id, temp.groups.back().id);
+                        });
+  };
+  auto read_students = [&](sqlite3* conn) {
+    return for_each_row(conn, std::string("SELECT ") + kStudentColumns + " FROM students ORDER BY id;", 0,
+                        [&](sqlite3_stmt* stmt) {
+                          temp.students.write().push_back(read_student_row(stmt));
+                          max_student_id = std::max(max_student_id, temp.students.back().id);
+                        });
+  };
+  auto read_subjects = [&](sqlite3* conn) {
+    return for_each_row(conn, std::string("SELECT ") + kSubjectColumns + " FROM subjects ORDER BY id;", 0,
+                        [&](sqlite3_stmt* stmt) {
+                          temp.subjects.write().push_back(read_subject_row(stmt));
+                          max_subject_id = std::max(max_subject_id, temp.subjects.back().id);
+                        });
+  };
+  // Оценки читаются в порядке id (последовательный проход по таблице без индекса);
+  // соседние строки обычно из одного семестра, поэтому партиция ищется только при смене.
+  auto read_grades = [&](sqlite3* conn) {
+    GradePartition* part = nullptr;
+    return for_each_row(conn, std::string("SELECT ") + kGradeColumns + " FROM grades ORDER BY id;", 0,
+                        [&](sqlite3_stmt* stmt) {
+                          Grade grade = read_grade_row(stmt);
+                          if (!part || part->semester != grade.semester) {
+                            part = &partition_for_semester(temp, grade.semester);
+                          }
+                          part->append(grade);
+                          count_grade(*part, grade, 1);
+                          max_grade_id = std::max(max_grade_id, grade.id);
+                        });
+  };
+  const std::function<bool(sqlite3*)> readers[] = {read_groups, read_students, read_subjects, read_grades};
+  constexpr size_t kReaders = sizeof(readers) / sizeof(readers[0]);
+
+  bool consistent = false;
+  bool ok = true;
+  for (int attempt = 0; attempt < kParallelLoadAttempts && !consistent; ++attempt) {
+    temp = DataStore();
+    max_group_id = max_student_id = max_subject_id = max_grade_id = 0;
+    int64_t seqs[kReaders] = {};
+    bool oks[kReaders] = {};
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < kReaders; ++i) {
+      threads.emplace_back([&, i]() {
+        sqlite3* conn = open_db_readonly(path);
+        oks[i] = conn && read_in_transaction(conn, seqs[i], readers[i]);
+        if (conn) {
+          sqlite3_close(conn);
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    ok = std::all_of(std::begin(oks), std::end(oks), [](bool value) { return value; });
+    consistent = ok && std::all_of(std::begin(seqs), std::end(seqs), [&](int64_t seq) { return seq == seqs[0]; });
+    temp.synced_seq = seqs[0];
+  }
+  if (!consistent) {
+    temp = DataStore();
+    max_group_id = max_student_id = max_subject_id = max_grade_id = 0;
+    ok = read_in_transaction(db, temp.synced_seq, [&](sqlite3* conn) {
+      return std::all_of(std::begin(readers), std::end(readers),
+                         [&](const std::function<bool(sqlite3*)>& read) { return read(conn); });
+    });
+  }
+  sqlite3_close(db);
+  if (!ok) {
+    return false;
+  }
+
+  IdSet group_ids(sorted_ids(temp.groups));
+  for (auto& student : temp.students.write()) {
+    if (student.group_id != 0 && !group_ids.contains(student.group_id)) {
       student.group_id = 0;
-      ++updated;
     }
   }
-  std::cout << "Группа удалена. Студентов обновлено: " << updated << ".\n";
-  autosave_or_warn(data);
+  IdSet student_ids(sorted_ids(temp.students));
+  IdSet subject_ids(sorted_ids(temp.subjects));
+  erase_grades_if(temp, [&](const Grade& g) {
+    return !student_ids.contains(g.student_id) || !subject_ids.contains(g.subject_id);
+  });
+  rebuild_retakes(temp);
+
+  temp.next_student_id = max_student_id + 1;
+  temp.next_subject_id = max_subject_id + 1;
+  temp.next_group_id = max_group_id + 1;
+  temp.next_grade_id = max_grade_id + 1;
+  shrink_grade_storage(temp);
+
+  // Поколение не сбрасывается при перечитывании, иначе кэш отчетов выдал бы старые результаты.
+  temp.generation = data.generation + 1;
+  data = std::move(temp);
+  return true;
+}
+
+// Полный снимок: все таблицы переписываются одной транзакцией. Используется при
+// уплотнении журнала изменений; строки получают версию нового номера изменения.
+bool save_snapshot(const DataStore& data, const std::string& path) {
+  sqlite3* db = open_db(path);
+  if (!db) {
+    return false;
+  }
+  if (!exec_sql(db, "BEGIN IMMEDIATE;")) {
+    sqlite3_close(db);
+    return false;
+  }
+  int64_t seq = read_change_seq(db) + 1;
+  bool ok = exec_bound(db, "UPDATE meta SET value = ? WHERE key = 'seq';", {seq}) &&
+            exec_sql(db,
+                     "DELETE FROM grades; DELETE FROM students; DELETE FROM subjects; DELETE FROM groups;"
+                     "DELETE FROM tombstones;");
+
+  // Вставляет строки сущности: bind привязывает поля (1..N) и возвращает N.
+  auto insert_all = [&](Entity entity, const auto& items, auto bind) {
+    sqlite3_stmt* stmt = nullptr;
+    if (!ok || sqlite3_prepare_v2(db, insert_sql(entity), -1, &stmt, nullptr) != SQLITE_OK) {
+      ok = false;
+      return;
+    }
+    for (const auto& item : items) {
+      int fields = bind(stmt, item);
+      sqlite3_bind_int64(stmt, fields + 1, seq);
+      sqlite3_bind_int(stmt, fields + 2, item.id);
+      if (sqlite3_step(stmt) != SQLITE_DONE) {
+        ok = false;
+        break;
+      }
+      sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+  };
+  insert_all(Entity::kGroup, data.groups, [](sqlite3_stmt* stmt, const Group& group) {
+    sqlite3_bind_text(stmt, 1, group.name.c_str(), -1, SQLITE_TRANSIENT);
+    return 1;
+  });
+  insert_all(Entity::kStudent, data.students, [](sqlite3_stmt* stmt, const Student& student) {
+    sqlite3_bind_text(stmt, 1, student.name.c_str(), -1, SQLITE_TRANSIENT);
+    if (student.group_id == 0) {
+      sqlite3_bind_null(stmt, 2);
+    } else {
+      sqlite3_bind_int(stmt, 2, student.group_id);
+    }
+    return 2;
+  });
+  insert_all(Entity::kSubject, data.subjects, [](sqlite3_stmt* stmt, const Subject& subject) {
+    sqlite3_bind_text(stmt, 1, subject.name.c_str(), -1, SQLITE_TRANSIENT);
+    return 1;
+  });
+  for (const GradePartition& part : data.grade_partitions) {
+    std::vector<Grade> grades(part.size());
+    for (size_t i = 0; i < part.size(); ++i) {
+      grades[i] = part.grade_at(i);
+    }
+    insert_all(Entity::kGrade, grades, [](sqlite3_stmt* stmt, const Grade& grade) {
+      sqlite3_bind_int(stmt, 1, grade.student_id);
+      sqlite3_bind_int(stmt, 2, grade.subject_id);
+      sqlite3_bind_int(stmt, 3, grade.value);
+      sqlite3_bind_int(stmt, 4, grade.attempt);
+      sqlite3_bind_int64(stmt, 5, grade.created_at);
+      sqlite3_bind_int(stmt, 6, grade.semester);
+      return 6;
+    });
+  }
+
+  if (ok) {
+    ok = exec_sql(db, "COMMIT;");
+  } else {
+    exec_sql(db, "ROLLBACK;");
+  }
+  sqlite3_close(db);
+  return ok;
+}
+
+// Журнал изменений (режим --storage log): каждая правка дописывается в конец файла
+// компактной двоичной записью с контрольной суммой. Формат записи:
+//   u32 длина тела, u32 CRC-32 тела, тело = u8 сущность, u8 удаление, поля строки.
+// Поля - целые little-endian и строки (u32 длина + байты UTF-8). Запись "строка"
+// несет полный образ строки, поэтому повторное применение записи ничего не портит.
+const char kLogMagic[8] = {'G', 'B', 'L', 'O', 'G', '0', '0', '1'};
+constexpr int kLogFsyncIntervalMs = 50;               // окно пакетного fsync
+constexpr uint64_t kLogCompactBytes = 4 * 1024 * 1024;  // размер журнала для уплотнения
+
+// CRC-32 (полином ZIP). Для подсчета по частям передайте результат предыдущего вызова в crc.
+uint32_t crc32(const char* data, size_t size, uint32_t crc = 0) {
+  static const std::vector<uint32_t> table = []() {
+    std::vector<uint32_t> values(256);
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) {
+        c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      }
+      values[i] = c;
+    }
+    return values;
+  }();
+  crc ^= 0xFFFFFFFFu;
+  for (size_t i = 0; i < size; ++i) {
+    crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+  }
+  return crc ^ 0xFFFFFFFFu;
+}
+
+void put_u16(std::string& out, uint16_t value) {
+  out.push_back(static_cast<char>(value & 0xFF));
+  out.push_back(static_cast<char>(value >> 8));
+}
+
+void put_u32(std::string& out, uint32_t value) {
+  for (int i = 0; i < 4; ++i) {
+    out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+  }
+}
+
+void put_i64(std::string& out, int64_t value) {
+  uint64_t bits = static_cast<uint64_t>(value);
+  for (int i = 0; i < 8; ++i) {
+    out.push_back(static_cast<char>((bits >> (8 * i)) & 0xFF));
+  }
+}
+
+void put_str(std::string& out, const std::string& text) {
+  put_u32(out, static_cast<uint32_t>(text.size()));
+  out += text;
+}
+
+// Последовательное чтение полей записи; при выходе за границы ok становится false.
+struct LogReader {
+  const char* pos = nullptr;
+  const char* end = nullptr;
+  bool ok = true;
+
+  uint32_t u32() {
+    if (end - pos < 4) {
+      ok = false;
+      return 0;
+    }
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) {
+      value |= static_cast<uint32_t>(static_cast<unsigned char>(pos[i])) << (8 * i);
+    }
+    pos += 4;
+    return value;
+  }
+
+  int64_t i64() {
+    if (end - pos < 8) {
+      ok = false;
+      return 0;
+    }
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) {
+      value |= static_cast<uint64_t>(static_cast<unsigned char>(pos[i])) << (8 * i);
+    }
+    pos += 8;
+    return static_cast<int64_t>(value);
+  }
+
+  int i32() { return static_cast<int>(static_cast<int32_t>(u32())); }
+
+  std::string str() {
+    uint32_t size = u32();
+    if (!ok || static_cast<uint64_t>(end - pos) < size) {
+      ok = false;
+      return std::string();
+    }
+    std::string text(pos, size);
+    pos += size;
+    return text;
+  }
+};
+
+// Дописывает в out запись для накопленного изменения (строка берется из памяти).
+void encode_change(std::string& out, const DataStore& data, const PendingGrades& grades,
+                   const PendingChange& change) {
+  std::string body;
+  body.push_back(static_cast<char>(change.entity));
+  body.push_back(change.op == ChangeOp::kDelete ? 1 : 0);
+  put_u32(body, static_cast<uint32_t>(change.id));
+  if (change.op != ChangeOp::kDelete) {
+    switch (change.entity) {
+      case Entity::kGroup: {
+        const Group* group = find_group(data, change.id);
+        if (!group) {
+          return;
+        }
+        put_str(body, group->name);
+        break;
+      }
+      case Entity::kStudent: {
+        const Student* student = find_student(data, change.id);
+        if (!student) {
+          return;
+        }
+        put_u32(body, static_cast<uint32_t>(student->group_id));
+        put_str(body, student->name);
+        break;
+      }
+      case Entity::kSubject: {
+        const Subject* subject = find_subject(data, change.id);
+        if (!subject) {
+          return;
+        }
+        put_str(body, subject->name);
+        break;
+      }
+      case Entity::kGrade: {
+        Grade grade;
+        if (!grades.find(data, change.id, grade)) {
+          return;
+        }
+        put_u32(body, static_cast<uint32_t>(grade.student_id));
+        put_u32(body, static_cast<uint32_t>(grade.subject_id));
+        put_u32(body, static_cast<uint32_t>(grade.value));
+        put_u32(body, static_cast<uint32_t>(grade.attempt));
+        put_i64(body, grade.created_at);
+        put_u32(body, static_cast<uint32_t>(grade.semester));
+        break;
+      }
+    }
+  }
+  put_u32(out, static_cast<uint32_t>(body.size()));
+  put_u32(out, crc32(body.data(), body.size()));
+  out += body;
+}
+
+// Применяет тело записи к данным в памяти (те же правила каскада, что и в меню).
+bool apply_log_record(DataStore& data, LogReader& reader) {
+  if (reader.end - reader.pos < 2) {
+    return false;
+  }
+  int entity = static_cast<unsigned char>(*reader.pos++);
+  bool is_delete = *reader.pos++ != 0;
+  int id = reader.i32();
+  if (is_delete) {
+    if (!reader.ok) {
+      return false;
+    }
+    switch (static_cast<Entity>(entity)) {
+      case Entity::kGroup:
+        erase_rows_if(data.groups, [id](const Group& g) { return g.id == id; });
+        for (size_t i = 0; i < data.students.size(); ++i) {
+          if (data.students[i].group_id == id) {
+            data.students.write()[i].group_id = 0;
+          }
+        }
+        return true;
+      case Entity::kStudent:
+        erase_rows_if(data.students, [id](const Student& s) { return s.id == id; });
+        erase_grades_if(data, [id](const Grade& g) { return g.student_id == id; });
+        return true;
+      case Entity::kSubject:
+        erase_rows_if(data.subjects, [id](const Subject& s) { return s.id == id; });
+        erase_grades_if(data, [id](const Grade& g) { return g.subject_id == id; });
+        return true;
+      case Entity::kGrade:
+        erase_grades_if(data, [id](const Grade& g) { return g.id == id; });
+        return true;
+    }
+    return false;
+  }
+  // Новые строки (ID не меньше следующего свободного) добавляются без поиска.
+  switch (static_cast<Entity>(entity)) {
+    case Entity::kGroup: {
+      Group group;
+      group.id = id;
+      group.name = reader.str();
+      if (!reader.ok) {
+        return false;
+      }
+      if (id >= data.next_group_id) {
+        data.groups.write().push_back(group);
+        data.next_group_id = id + 1;
+      } else {
+        upsert_by_id(data.groups, group);
+      }
+      return true;
+    }
+    case Entity::kStudent: {
+      Student student;
+      student.id = id;
+      student.group_id = reader.i32();
+      student.name = reader.str();
+      if (!reader.ok) {
+        return false;
+      }
+      if (id >= data.next_student_id) {
+        data.students.write().push_back(student);
+        data.next_student_id = id + 1;
+      } else {
+        upsert_by_id(data.students, student);
+      }
+      return true;
+    }
+    case Entity::kSubject: {
+      Subject subject;
+      subject.id = id;
+      subject.name = reader.str();
+      if (!reader.ok) {
+        return false;
+      }
+      if (id >= data.next_subject_id) {
+        data.subjects.write().push_back(subject);
+        data.next_subject_id = id + 1;
+      } else {
+        upsert_by_id(data.subjects, subject);
+      }
+      return true;
+    }
+    case Entity::kGrade: {
+      Grade grade;
+      grade.id = id;
+      grade.student_id = reader.i32();
+      grade.subject_id = reader.i32();
+      grade.value = reader.i32();
+      grade.attempt = reader.i32();
+      grade.created_at = reader.i64();
+      grade.semester = reader.i32();
+      if (!reader.ok) {
+        return false;
+      }
+      if (id >= data.next_grade_id || !replace_grade(data, grade)) {
+        insert_grade(data, grade);
+        data.next_grade_id = std::max(data.next_grade_id, id + 1);
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+// Сбрасывает на диск уже переданные системе данные файла (без буфера stdio).
+void fsync_file(std::FILE* file) {
+#ifdef _WIN32
+  _commit(_fileno(file));
+#else
+  fsync(fileno(file));
+#endif
+}
+
+void sync_file(std::FILE* file) {
+  std::fflush(file);
+  fsync_file(file);
+}
+
+// Хранилище на журнале изменений поверх уплотненного снимка data_store.db.
+// Запись: одна последовательная дозапись, fsync выполняет фоновый поток не чаще раза
+// в kLogFsyncIntervalMs (группирует несколько правок) и без mutex_, поэтому дозапись
+// не ждет диска; sync_mutex_ не дает закрыть файл во время fsync. Уплотнение: журнал
+// переименовывается в *.log.old, новые правки идут в чистый журнал, а фоновый поток
+// записывает снимок данных в базу и удаляет *.log.old. При запуске снимок из базы
+// дополняется записями *.log.old (если уплотнение прервалось) и *.log.
+class LogStore {
+ public:
+  ~LogStore() { close(); }
+
+  // Загружает данные и открывает журнал для дозаписи.
+  bool open(DataStore& data) {
+    std::filesystem::path base(db_path());
+    log_path_ = base.replace_extension(".log").string();
+    old_path_ = log_path_ + ".old";
+    if (!load_data(data, db_path())) {
+      return false;
+    }
+    bool has_old = std::filesystem::exists(old_path_);
+    if ((has_old && !replay(old_path_, data)) || !replay(log_path_, data)) {
+      return false;
+    }
+    if (!open_log_file()) {
+      return false;
+    }
+    flusher_ = std::thread([this]() { flusher_loop(); });
+    if (has_old) {
+      // Прошлое уплотнение не завершилось: повторяем его с текущими данными.
+      start_compaction(data);
+    }
+    return true;
+  }
+
+  // Дописывает накопленные изменения одной записью в файл.
+  bool append(DataStore& data) {
+    if (data.pending_changes.empty()) {
+      return true;
+    }
+    if (!file_) {
+      return false;
+    }
+    std::string buffer;
+    PendingGrades grades(data);
+    for (const auto& change : data.pending_changes) {
+      encode_change(buffer, data, grades, change);
+    }
+    bool written = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      written = std::fwrite(buffer.data(), 1, buffer.size(), file_) == buffer.size() && std::fflush(file_) == 0;
+      if (written) {
+        size_ += buffer.size();
+        dirty_ = true;
+      }
+    }
+    if (!written) {
+      discard_partial_write();
+      return false;
+    }
+    feed_changes(data, grades, data.pending_changes);
+    data.pending_changes.clear();
+    if (size_ >= compact_at_) {
+      start_compaction(data);
+    }
+    return true;
+  }
+
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_all();
+    if (flusher_.joinable()) {
+      flusher_.join();
+    }
+    {
+      std::lock_guard<std::mutex> guard(compactor_mutex_);
+      if (compactor_.joinable()) {
+        compactor_.join();
+      }
+    }
+    if (file_) {
+      sync_file(file_);
+      std::fclose(file_);
+      file_ = nullptr;
+    }
+  }
+
+  uint64_t size() const { return size_; }
+  uint64_t replayed() const { return replayed_; }
+
+ private:
+  // Применяет записи файла; битый или недописанный хвост (сбой во время записи) отрезается.
+  bool replay(const std::string& path, DataStore& data) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+      return true;
+    }
+    std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    if (content.size() < sizeof(kLogMagic) || content.compare(0, sizeof(kLogMagic), kLogMagic, sizeof(kLogMagic)) != 0) {
+      std::cout << "Файл " << path << " не является журналом изменений.\n";
+      return false;
+    }
+    size_t pos = sizeof(kLogMagic);
+    while (content.size() - pos >= 8) {
+      LogReader header{content.data() + pos, content.data() + content.size()};
+      uint32_t size = header.u32();
+      uint32_t crc = header.u32();
+      if (content.size() - pos - 8 < size || crc32(header.pos, size) != crc) {
+        break;
+      }
+      LogReader body{header.pos, header.pos + size};
+      if (!apply_log_record(data, body)) {
+        break;
+      }
+      ++replayed_;
+      pos += 8 + size;
+    }
+    if (pos < content.size()) {
+      std::cout << "Журнал " << path << ": отброшен поврежденный хвост (" << content.size() - pos << " байт).\n";
+      std::error_code ec;
+      std::filesystem::resize_file(path, pos, ec);
+    }
+    if (replayed_ > 0) {
+      ++data.generation;
+    }
+    return true;
+  }
+
+  // Короткая запись (например, диск заполнен) оставила бы в журнале обрывок записи, а
+  // воспроизведение останавливается на первой битой записи и потеряло бы все следующие.
+  // Файл закрывается (вместе с остатком буфера stdio) и обрезается до размера перед записью.
+  void discard_partial_write() {
+    std::lock_guard<std::mutex> sync_lock(sync_mutex_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::fclose(file_);
+    std::error_code ec;
+    std::filesystem::resize_file(log_path_, size_, ec);
+    file_ = std::fopen(log_path_.c_str(), "ab");
+  }
+
+  bool open_log_file() {
+    bool exists = std::filesystem::exists(log_path_);
+    file_ = std::fopen(log_path_.c_str(), "ab");
+    if (!file_) {
+      return false;
+    }
+    size_ = exists ? std::filesystem::file_size(log_path_) : 0;
+    if (size_ == 0) {
+      std::fwrite(kLogMagic, 1, sizeof(kLogMagic), file_);
+      sync_file(file_);
+      size_ = sizeof(kLogMagic);
+    }
+    return true;
+  }
+
+  void flusher_loop() {
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait_for(lock, std::chrono::milliseconds(kLogFsyncIntervalMs));
+        if (stopping_) {
+          return;
+        }
+        if (!dirty_ || !file_) {
+          continue;
+        }
+      }
+      // Порядок блокировок везде один: sync_mutex_, затем mutex_.
+      std::lock_guard<std::mutex> sync_lock(sync_mutex_);
+      std::FILE* file = nullptr;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        file = file_;
+        dirty_ = false;
+      }
+      if (file) {
+        // append уже сбросил буфер stdio; дескриптор синхронизируется без mutex_.
+        fsync_file(file);
+      }
+    }
+  }
+
+  // Переключает журнал и уплотняет его в базу в фоне (если уплотнение еще не идет).
+  // Поток прошлого уплотнения присоединяется до запуска нового: присваивание
+  // работающему std::thread завершило бы программу (std::terminate).
+  void start_compaction(const DataStore& data) {
+    std::lock_guard<std::mutex> guard(compactor_mutex_);
+    if (compacting_) {
+      return;
+    }
+    if (compactor_.joinable()) {
+      compactor_.join();
+    }
+    if (!std::filesystem::exists(old_path_)) {
+      std::lock_guard<std::mutex> sync_lock(sync_mutex_);
+      std::lock_guard<std::mutex> lock(mutex_);
+      sync_file(file_);
+      std::fclose(file_);
+      file_ = nullptr;
+      std::error_code ec;
+      std::filesystem::rename(log_path_, old_path_, ec);
+      if (ec || !open_log_file()) {
+        // Следующая попытка - когда журнал вырастет еще на kLogCompactBytes, а не на
+        // каждой дозаписи (иначе каждая правка ждала бы fsync и повторное открытие).
+        file_ = std::fopen(log_path_.c_str(), "ab");
+        compact_at_ = size_ + kLogCompactBytes;
+        std::cout << "Не удалось переключить журнал " << log_path_ << " для уплотнения"
+                  << (ec ? ": " + ec.message() : std::string()) << ".\n";
+        return;
+      }
+    }
+    compact_at_ = kLogCompactBytes;
+    compacting_ = true;
+    // Копия данных соответствует состоянию на момент переключения журнала.
+    std::shared_ptr<const DataStore> snapshot = std::make_shared<const DataStore>(data);
+    compactor_ = std::thread([this, snapshot]() {
+      if (save_snapshot(*snapshot, db_path())) {
+        std::error_code ec;
+        std::filesystem::remove(old_path_, ec);
+      }
+      compacting_ = false;
+    });
+  }
+
+  std::string log_path_;
+  std::string old_path_;
+  std::FILE* file_ = nullptr;
+  uint64_t size_ = 0;
+  uint64_t compact_at_ = kLogCompactBytes;  // размер журнала для следующего уплотнения
+  uint64_t replayed_ = 0;
+  std::mutex sync_mutex_;  // держит фоновый fsync и закрытие файла
+  std::mutex mutex_;       // file_, dirty_, stopping_
+  std::condition_variable wake_;
+  bool dirty_ = false;
+  bool stopping_ = false;
+  std::thread flusher_;
+  std::mutex compactor_mutex_;  // compactor_: запуск и присоединение
+  std::thread compactor_;
+  std::atomic<bool> compacting_{false};
+};
+
+// Построчное хранение в SQLite (по умолчанию): каждая синхронизация записывает только
+// измененные строки и подтягивает правки других процессов.
+class SqliteBackend : public StorageBackend {
+ public:
+  const char* name() const override { return "sqlite"; }
+  // Базовое значение data_version берется до чтения: изменения, сделанные другими
+  // процессами во время загрузки, будут подтянуты при первой синхронизации.
+  bool load(DataStore& data) override { return db_session().db && load_data(data, db_path()); }
+  SyncResult sync(DataStore& data) override { return sync_with_db(data); }
+};
+
+// Полный снимок в SQLite: каждая синхронизация с изменениями переписывает все таблицы
+// (так приложение сохраняло данные до построчной записи). Рассчитано на один процесс.
+class SnapshotBackend : public StorageBackend {
+ public:
+  const char* name() const override { return "snapshot"; }
+  bool load(DataStore& data) override { return load_data(data, db_path()); }
+  SyncResult sync(DataStore& data) override {
+    SyncResult result;
+    if (data.pending_changes.empty()) {
+      return result;
+    }
+    result.changed = true;
+    result.ok = save_snapshot(data, db_path());
+    if (result.ok) {
+      feed_pending_changes(data);
+      data.pending_changes.clear();
+    }
+    return result;
+  }
+};
+
+// Журнал изменений поверх уплотненного снимка (см. LogStore). Рассчитано на один процесс.
+class LogBackend : public StorageBackend {
+ public:
+  const char* name() const override { return "log"; }
+  bool load(DataStore& data) override { return store_.open(data); }
+  SyncResult sync(DataStore& data) override {
+    // Изменений других процессов нет, только дозапись.
+    SyncResult result;
+    result.changed = !data.pending_changes.empty();
+    result.ok = store_.append(data);
+    return result;
+  }
+  void close() override { store_.close(); }
+  std::string load_message() const override {
+    if (store_.replayed() == 0) {
+      return std::string();
+    }
+    return "Применено записей журнала изменений: " + std::to_string(store_.replayed()) + ".";
+  }
+
+ private:
+  LogStore store_;
+};
+
+// Без сохранения: данные читаются из базы при запуске, изменения живут только в памяти
+// (для бенчмарков и пробной работы с копией данных).
+class MemoryBackend : public StorageBackend {
+ public:
+  const char* name() const override { return "memory"; }
+  bool load(DataStore& data) override {
+    if (std::filesystem::exists(db_path())) {
+      return load_data(data, db_path());
+    }
+    return true;
+  }
+  SyncResult sync(DataStore& data) override {
+    SyncResult result;
+    result.changed = !data.pending_changes.empty();
+    feed_pending_changes(data);
+    data.pending_changes.clear();
+    return result;
+  }
+};
+
+const char* kStorageBackendNames[] = {"sqlite", "snapshot", "log", "memory"};
+
+// Создает хранилище по имени; nullptr - если имя неизвестно.
+std::unique_ptr<StorageBackend> make_storage_backend(const std::string& name) {
+  if (name == "sqlite") {
+    return std::make_unique<SqliteBackend>();
+  }
+  if (name == "snapshot") {
+    return std::make_unique<SnapshotBackend>();
+  }
+  if (name == "log") {
+    return std::make_unique<LogBackend>();
+  }
+  if (name == "memory") {
+    return std::make_unique<MemoryBackend>();
+  }
+  return nullptr;
+}
+
+std::unique_ptr<StorageBackend>& storage_slot() {
+  static std::unique_ptr<StorageBackend> backend = std::make_unique<SqliteBackend>();
+  return backend;
+}
+
+// Текущее хранилище приложения (по умолчанию sqlite).
+StorageBackend& storage() {
+  return *storage_slot();
+}
+
+// Экспортирует данные в CSV-файлы для открытия в Excel (оценки - за выбранный период).
+void export_csv(const DataStore& data, const Period& period) {
+  ensure_storage_dirs();
+  std::ofstream groups_file(export_path("export_groups.csv"), std::ios::binary);
+  std::ofstream students_file(export_path("export_students.csv"), std::ios::binary);
+  std::ofstream subjects_file(export_path("export_subjects.csv"), std::ios::binary);
+  std::ofstream grades_file(export_path("export_grades.csv"), std::ios::binary);
+  if (!groups_file || !students_file || !subjects_file || !grades_file) {
+    std::cout << "Не удалось открыть файлы для экспорта.\n";
+    return;
+  }
+
+  auto write_utf8_bom = [](std::ofstream& out) {
+    const unsigned char bom[] = {0xEF, 0xBB, 0xBF};
+    out.write(reinterpret_cast<const char*>(bom), sizeof(bom));
+  };
+  write_utf8_bom(groups_file);
+  write_utf8_bom(students_file);
+  write_utf8_bom(subjects_file);
+  write_utf8_bom(grades_file);
+
+
+  groups_file << "ID_группы" << kCsvDelim << "Название_группы\n";
+  for (const auto& group : data.groups) {
+    groups_file << group.id << kCsvDelim
+                << csv_escape(group.name, kCsvDelim) << "\n";
+  }
+
+  // Используем точку с запятой - привычный разделитель для Excel в RU локали.
+  students_file << "ID_студента" << kCsvDelim << "Имя_студента" << kCsvDelim
+                << "ID_группы" << kCsvDelim << "Группа\n";
+  for (const auto& student : data.students) {
+    students_file << student.id << kCsvDelim
+                  << csv_escape(student.name, kCsvDelim) << kCsvDelim
+                  << student.group_id << kCsvDelim
+                  << csv_escape(group_name_or_none(data, student.group_id), kCsvDelim) << "\n";
+  }
+
+  subjects_file << "ID_предмета" << kCsvDelim << "Название_предмета\n";
+  for (const auto& subject : data.subjects) {
+    subjects_file << subject.id << kCsvDelim
+                  << csv_escape(subject.name, kCsvDelim) << "\n";
+  }
+
+  grades_file << "ID_оценки" << kCsvDelim << "ID_студента" << kCsvDelim
+              << "ID_предмета" << kCsvDelim << "Попытка" << kCsvDelim
+              << "Оценка" << kCsvDelim << "Дата" << kCsvDelim << "Семестр\n";
+  for_each_grade(data, period, [&](const Grade& grade) {
+    grades_file << grade.id << kCsvDelim
+                << grade.student_id << kCsvDelim
+                << grade.subject_id << kCsvDelim
+                << grade.attempt << kCsvDelim
+                << grade.value << kCsvDelim
+                << format_date(grade.created_at) << kCsvDelim
+                << semester_name(grade.semester) << "\n";
+  });
+
+  std::cout << "Экспортировано в папку '" << kExportDir << "': "
+               "export_groups.csv, export_students.csv, "
+               "export_subjects.csv, export_grades.csv\n";
+  if (!period.is_all()) {
+    std::cout << "Оценки выгружены за период: " << period_name(period) << ".\n";
+  }
+}
+
+// Потоковая запись ZIP-архива без сжатия (метод stored). Данные записи сразу уходят
+// в файл через небольшой буфер, CRC считается на лету, а CRC и размер дописываются
+// в локальный заголовок после окончания записи. В памяти - только оглавление архива.
+// ZIP64 не поддерживается: архив и каждая запись должны быть меньше 4 ГБ.
+class ZipWriter {
+ public:
+  explicit ZipWriter(const std::string& path) : out_(path, std::ios::binary | std::ios::trunc) {
+    std::tm tm_value = local_time(now_unix());
+    dos_time_ = static_cast<uint16_t>((tm_value.tm_hour << 11) | (tm_value.tm_min << 5) | (tm_value.tm_sec / 2));
+    dos_date_ = static_cast<uint16_t>(((tm_value.tm_year - 80) << 9) | ((tm_value.tm_mon + 1) << 5) | tm_value.tm_mday);
+  }
+
+  bool ok() const {
+    return static_cast<bool>(out_) && !too_large_;
+  }
+
+  bool too_large() const {
+    return too_large_;
+  }
+
+  uint64_t bytes_written() const {
+    return offset_ + buffer_.size();
+  }
+
+  void begin(const std::string& name) {
+    entries_.push_back({name, 0, 0, bytes_written()});
+    std::string header;
+    put_u32(header, 0x04034b50u);
+    append_entry_fields(header, entries_.back());
+    put_u16(header, 0);  // длина дополнительного поля
+    header += name;
+    write_raw(header.data(), header.size());
+  }
+
+  void write(const char* data, size_t size) {
+    Entry& entry = entries_.back();
+    entry.crc = crc32(data, size, entry.crc);
+    entry.size += size;
+    write_raw(data, size);
+  }
+
+  void write(const std::string& text) {
+    write(text.data(), text.size());
+  }
+
+  // Закрывает текущую запись: возвращается к ее заголовку и проставляет CRC и размеры.
+  void end() {
+    flush();
+    const Entry& entry = entries_.back();
+    if (entry.size > 0xFFFFFFFFull || entry.offset > 0xFFFFFFFFull) {
+      too_large_ = true;
+      return;
+    }
+    std::string fields;
+    put_u32(fields, entry.crc);
+    put_u32(fields, static_cast<uint32_t>(entry.size));
+    put_u32(fields, static_cast<uint32_t>(entry.size));
+    out_.seekp(static_cast<std::streamoff>(entry.offset + 14));
+    out_.write(fields.data(), static_cast<std::streamsize>(fields.size()));
+    out_.seekp(0, std::ios::end);
+  }
+
+  // Пишет центральный каталог и завершает архив.
+  bool finish() {
+    uint64_t directory_offset = bytes_written();
+    std::string directory;
+    for (const auto& entry : entries_) {
+      put_u32(directory, 0x02014b50u);
+      put_u16(directory, 20);  // версия, создавшая архив
+      append_entry_fields(directory, entry);
+      put_u16(directory, 0);  // длина дополнительного поля
+      put_u16(directory, 0);  // длина комментария
+      put_u16(directory, 0);  // номер диска
+      put_u16(directory, 0);  // внутренние атрибуты
+      put_u32(directory, 0);  // внешние атрибуты
+      put_u32(directory, static_cast<uint32_t>(entry.offset));
+      directory += entry.name;
+    }
+    if (directory_offset + directory.size() > 0xFFFFFFFFull || entries_.size() > 0xFFFF) {
+      too_large_ = true;
+      return false;
+    }
+    size_t directory_size = directory.size();
+    put_u32(directory, 0x06054b50u);
+    put_u16(directory, 0);
+    put_u16(directory, 0);
+    put_u16(directory, static_cast<uint16_t>(entries_.size()));
+    put_u16(directory, static_cast<uint16_t>(entries_.size()));
+    put_u32(directory, static_cast<uint32_t>(directory_size));
+    put_u32(directory, static_cast<uint32_t>(directory_offset));
+    put_u16(directory, 0);
+    write_raw(directory.data(), directory.size());
+    flush();
+    out_.close();
+    return ok();
+  }
+
+ private:
+  struct Entry {
+    std::string name;
+    uint32_t crc = 0;
+    uint64_t size = 0;
+    uint64_t offset = 0;
+  };
+
+  static constexpr size_t kBufferSize = 64 * 1024;
+
+  // Общая часть локального заголовка и записи каталога: от версии до длины имени.
+  void append_entry_fields(std::string& out, const Entry& entry) const {
+    put_u16(out, 20);      // версия для распаковки
+    put_u16(out, 0x0800);  // имена в UTF-8
+    put_u16(out, 0);       // метод stored
+    put_u16(out, dos_time_);
+    put_u16(out, dos_date_);
+    put_u32(out, entry.crc);
+    put_u32(out, static_cast<uint32_t>(std::min<uint64_t>(entry.size, 0xFFFFFFFFull)));
+    put_u32(out, static_cast<uint32_t>(std::min<uint64_t>(entry.size, 0xFFFFFFFFull)));
+    put_u16(out, static_cast<uint16_t>(entry.name.size()));
+  }
+
+  void write_raw(const char* data, size_t size) {
+    buffer_.append(data, size);
+    if (buffer_.size() >= kBufferSize) {
+      flush();
+    }
+  }
+
+  void flush() {
+    out_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+    offset_ += buffer_.size();
+    buffer_.clear();
+  }
+
+  std::ofstream out_;
+  std::vector<Entry> entries_;
+  std::string buffer_;
+  uint64_t offset_ = 0;
+  uint16_t dos_time_ = 0;
+  uint16_t dos_date_ = 0;
+  bool too_large_ = false;
+};
+
+// Дописывает текст в XML: экранирует спецсимволы и выбрасывает управляющие символы,
+// недопустимые в XML 1.0.
+void append_xml_text(std::string& out, const std::string& text) {
+  for (char ch : text) {
+    unsigned char code = static_cast<unsigned char>(ch);
+    switch (ch) {
+      case '&':
+        out += "&amp;";
+        break;
+      case '<':
+        out += "&lt;";
+        break;
+      case '>':
+        out += "&gt;";
+        break;
+      case '"':
+        out += "&quot;";
+        break;
+      default:
+        if (code >= 0x20 || ch == '\t' || ch == '\n' || ch == '\r') {
+          out.push_back(ch);
+        }
+        break;
+    }
+  }
+}
+
+// Номер дня по григорианскому календарю (0 = 01.01.1970).
+int64_t days_from_civil(int year, int month, int day) {
+  year -= month <= 2 ? 1 : 0;
+  int64_t era = (year >= 0 ? year : year - 399) / 400;
+  int64_t year_of_era = year - era * 400;
+  int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + day_of_era - 719468;
+}
+
+// Дата в формате Excel (число дней от 30.12.1899) по локальному календарю, как format_date.
+int64_t excel_date(int64_t timestamp) {
+  std::tm tm_value = local_time(timestamp);
+  return days_from_civil(tm_value.tm_year + 1900, tm_value.tm_mon + 1, tm_value.tm_mday) -
+         days_from_civil(1899, 12, 30);
+}
+
+// Потоковая запись книги XLSX. Листы пишутся построчно прямо в ZIP-архив, поэтому
+// память не зависит от числа строк. Строки текста идут через общую таблицу
+// (sharedStrings.xml): одинаковые имена хранятся в книге один раз. Таблица растет
+// только с числом разных строк - имен групп, студентов, предметов и семестров.
+class XlsxWriter {
+ public:
+  // Excel открывает не больше 1 048 576 строк на листе; длинные таблицы продолжаются
+  // на следующих листах с тем же заголовком.
+  static constexpr int kMaxSheetRows = 1048576;
+  // Имя листа в Excel - не длиннее 31 символа и не повторяется в книге.
+  static constexpr size_t kMaxSheetTitle = 31;
+
+  enum Style { kStyleDefault = 0, kStyleHeader = 1, kStyleDate = 2, kStyleDecimal = 3 };
+
+  explicit XlsxWriter(const std::string& path) : zip_(path) {}
+
+  bool ok() const {
+    return zip_.ok();
+  }
+
+  bool too_large() const {
+    return zip_.too_large();
+  }
+
+  uint64_t bytes_written() const {
+    return zip_.bytes_written();
+  }
+
+  long long rows_written() const {
+    return rows_total_;
+  }
+
+  // Индекс строки в общей таблице; одинаковые строки получают один индекс.
+  int shared_string(const std::string& text) {
+    auto inserted = strings_.emplace(text, static_cast<int>(string_order_.size()));
+    if (inserted.second) {
+      string_order_.push_back(&inserted.first->first);
+    }
+    return inserted.first->second;
+  }
+
+  // Начинает таблицу: лист с шапкой и шириной колонок.
+  void begin_table(const std::string& title, const std::vector<std::string>& header,
+                   const std::vector<int>& widths) {
+    title_ = title;
+    header_ = header;
+    widths_ = widths;
+    part_ = 1;
+    open_sheet();
+  }
+
+  void begin_row() {
+    if (row_ >= kMaxSheetRows) {
+      close_sheet();
+      ++part_;
+      open_sheet();
+    }
+    start_row();
+  }
+
+  void cell_int(long long value) {
+    append_cell_ref(kStyleDefault);
+    chunk_ += "><v>";
+    append_int(chunk_, value);
+    chunk_ += "</v></c>";
+  }
+
+  void cell_decimal(double value) {
+    append_cell_ref(kStyleDecimal);
+    char buf[32];
+    auto result = std::to_chars(buf, buf + sizeof(buf), value);
+    chunk_ += "><v>";
+    chunk_.append(buf, static_cast<size_t>(result.ptr - buf));
+    chunk_ += "</v></c>";
+  }
+
+  void cell_string(int index, Style style = kStyleDefault) {
+    append_cell_ref(style);
+    chunk_ += " t=\"s\"><v>";
+    append_int(chunk_, index);
+    chunk_ += "</v></c>";
+    ++string_refs_;
+  }
+
+  void cell_string(const std::string& text, Style style = kStyleDefault) {
+    cell_string(shared_string(text), style);
+  }
+
+  void cell_date(int64_t timestamp) {
+    if (timestamp <= 0) {
+      cell_empty();
+      return;
+    }
+    append_cell_ref(kStyleDate);
+    chunk_ += "><v>";
+    append_int(chunk_, excel_date(timestamp));
+    chunk_ += "</v></c>";
+  }
+
+  void cell_empty() {
+    ++column_;
+  }
+
+  void end_row() {
+    chunk_ += "</row>";
+    ++rows_total_;
+    flush_chunk(false);
+  }
+
+  void end_table() {
+    close_sheet();
+  }
+
+  // Дописывает служебные части книги и закрывает архив.
+  bool finish() {
+    std::string xml = kXmlHeader;
+    xml += "<sst xmlns=\"" + std::string(kMainNs) + "\" count=\"" + std::to_string(string_refs_) +
+           "\" uniqueCount=\"" + std::to_string(string_order_.size()) + "\">";
+    zip_.begin("xl/sharedStrings.xml");
+    for (const std::string* text : string_order_) {
+      xml += "<si><t xml:space=\"preserve\">";
+      append_xml_text(xml, *text);
+      xml += "</t></si>";
+      if (xml.size() >= kChunkSize) {
+        zip_.write(xml);
+        xml.clear();
+      }
+    }
+    xml += "</sst>";
+    zip_.write(xml);
+    zip_.end();
+
+    std::string types = kXmlHeader;
+    types +=
+        "<Types xmlns=\"http://schemas.openxmlformats.org/package/2006/content-types\">"
+        "<Default Extension=\"rels\" ContentType=\"application/vnd.openxmlformats-package.relationships+xml\"/>"
+        "<Default Extension=\"xml\" ContentType=\"application/xml\"/>"
+        "<Override PartName=\"/xl/workbook.xml\" "
+        "ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.sheet.main+xml\"/>"
+        "<Override PartName=\"/xl/styles.xml\" "
+        "ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.styles+xml\"/>"
+        "<Override PartName=\"/xl/sharedStrings.xml\" "
+        "ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.sharedStrings+xml\"/>";
+    std::string workbook = kXmlHeader;
+    workbook += "<workbook xmlns=\"" + std::string(kMainNs) + "\" xmlns:r=\"" + kRelNs + "\"><sheets>";
+    std::string workbook_rels = kXmlHeader;
+    workbook_rels += "<Relationships xmlns=\"http://schemas.openxmlformats.org/package/2006/relationships\">";
+    for (size_t i = 0; i < sheet_titles_.size(); ++i) {
+      std::string number = std::to_string(i + 1);
+      types += "<Override PartName=\"/xl/worksheets/sheet" + number +
+               ".xml\" ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.worksheet+xml\"/>";
+      workbook += "<sheet name=\"";
+      append_xml_text(workbook, sheet_titles_[i]);
+      workbook += "\" sheetId=\"" + number + "\" r:id=\"rId" + number + "\"/>";
+      workbook_rels += "<Relationship Id=\"rId" + number + "\" Type=\"" + kRelNs +
+                       "/worksheet\" Target=\"worksheets/sheet" + number + ".xml\"/>";
+    }
+    std::string extra = std::to_string(sheet_titles_.size() + 1);
+    workbook_rels += "<Relationship Id=\"rId" + extra + "\" Type=\"" + kRelNs +
+                     "/styles\" Target=\"styles.xml\"/>";
+    extra = std::to_string(sheet_titles_.size() + 2);
+    workbook_rels += "<Relationship Id=\"rId" + extra + "\" Type=\"" + kRelNs +
+                     "/sharedStrings\" Target=\"sharedStrings.xml\"/>";
+    workbook_rels += "</Relationships>";
+    workbook += "</sheets></workbook>";
+    types += "</Types>";
+
+    add_part("[Content_Types].xml", types);
+    add_part("_rels/.rels",
+             std::string(kXmlHeader) +
+                 "<Relationships xmlns=\"http://schemas.openxmlformats.org/package/2006/relationships\">"
+                 "<Relationship Id=\"rId1\" Type=\"" + kRelNs +
+                 "/officeDocument\" Target=\"xl/workbook.xml\"/></Relationships>");
+    add_part("xl/workbook.xml", workbook);
+    add_part("xl/_rels/workbook.xml.rels", workbook_rels);
+    add_part("xl/styles.xml",
+             std::string(kXmlHeader) + "<styleSheet xmlns=\"" + kMainNs + "\">"
+             "<fonts count=\"2\"><font><sz val=\"11\"/><name val=\"Calibri\"/></font>"
+             "<font><b/><sz val=\"11\"/><name val=\"Calibri\"/></font></fonts>"
+             "<fills count=\"2\"><fill><patternFill patternType=\"none\"/></fill>"
+             "<fill><patternFill patternType=\"gray125\"/></fill></fills>"
+             "<borders count=\"1\"><border><left/><right/><top/><bottom/><diagonal/></border></borders>"
+             "<cellStyleXfs count=\"1\"><xf numFmtId=\"0\" fontId=\"0\" fillId=\"0\" borderId=\"0\"/></cellStyleXfs>"
+             "<cellXfs count=\"4\">"
+             "<xf numFmtId=\"0\" fontId=\"0\" fillId=\"0\" borderId=\"0\" xfId=\"0\"/>"
+             "<xf numFmtId=\"0\" fontId=\"1\" fillId=\"0\" borderId=\"0\" xfId=\"0\" applyFont=\"1\"/>"
+             "<xf numFmtId=\"14\" fontId=\"0\" fillId=\"0\" borderId=\"0\" xfId=\"0\" applyNumberFormat=\"1\"/>"
+             "<xf numFmtId=\"2\" fontId=\"0\" fillId=\"0\" borderId=\"0\" xfId=\"0\" applyNumberFormat=\"1\"/>"
+             "</cellXfs>"
+             "<cellStyles count=\"1\"><cellStyle name=\"Normal\" xfId=\"0\" builtinId=\"0\"/></cellStyles>"
+             "</styleSheet>");
+    return zip_.finish();
+  }
+
+ private:
+  static constexpr const char* kXmlHeader = "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n";
+  static constexpr const char* kMainNs = "http://schemas.openxmlformats.org/spreadsheetml/2006/main";
+  static constexpr const char* kRelNs = "http://schemas.openxmlformats.org/officeDocument/2006/relationships";
+  static constexpr size_t kChunkSize = 64 * 1024;
+
+  void add_part(const std::string& name, const std::string& content) {
+    zip_.begin(name);
+    zip_.write(content);
+    zip_.end();
+  }
+
+  // Открывает новый лист текущей таблицы и пишет шапку.
+  // Имя листа: у продолжений таблицы - номер части. Длинное имя обрезается по границе
+  // символа UTF-8 так, чтобы номер уместился; занятое имя (Excel сравнивает имена без
+  // учета регистра) получает следующий свободный номер.
+  std::string sheet_title() {
+    for (int number = part_;; ++number) {
+      std::string suffix = number == 1 ? "" : " (" + std::to_string(number) + ")";
+      std::string title = utf8_truncate(title_, kMaxSheetTitle - suffix.size()) + suffix;
+      if (used_titles_.insert(to_lower_ascii(title)).second) {
+        return title;
+      }
+    }
+  }
+
+  void open_sheet() {
+    sheet_titles_.push_back(sheet_title());
+    zip_.begin("xl/worksheets/sheet" + std::to_string(sheet_titles_.size()) + ".xml");
+    chunk_ = kXmlHeader;
+    chunk_ += "<worksheet xmlns=\"" + std::string(kMainNs) + "\">"
+              "<sheetViews><sheetView workbookViewId=\"0\">"
+              "<pane ySplit=\"1\" topLeftCell=\"A2\" activePane=\"bottomLeft\" state=\"frozen\"/>"
+              "</sheetView></sheetViews><cols>";
+    for (size_t i = 0; i < widths_.size(); ++i) {
+      std::string column = std::to_string(i + 1);
+      chunk_ += "<col min=\"" + column + "\" max=\"" + column + "\" width=\"" +
+                std::to_string(widths_[i]) + "\" customWidth=\"1\"/>";
+    }
+    chunk_ += "</cols><sheetData>";
+    row_ = 0;
+    start_row();
+    for (const auto& text : header_) {
+      cell_string(text, kStyleHeader);
+    }
+    chunk_ += "</row>";
+  }
+
+  void close_sheet() {
+    chunk_ += "</sheetData></worksheet>";
+    flush_chunk(true);
+    zip_.end();
+  }
+
+  void start_row() {
+    ++row_;
+    column_ = 0;
+    row_ref_.clear();
+    append_int(row_ref_, row_);
+    chunk_ += "<row r=\"" + row_ref_ + "\">";
+  }
+
+  // Пишет начало ячейки с адресом (A1, B1, ...) и стилем.
+  void append_cell_ref(Style style) {
+    char letters[4];
+    int length = 0;
+    for (int n = column_ + 1; n > 0; n = (n - 1) / 26) {
+      letters[length++] = static_cast<char>('A' + (n - 1) % 26);
+    }
+    chunk_ += "<c r=\"";
+    while (length > 0) {
+      chunk_.push_back(letters[--length]);
+    }
+    chunk_ += row_ref_;
+    chunk_ += '"';
+    if (style != kStyleDefault) {
+      chunk_ += " s=\"";
+      append_int(chunk_, static_cast<int>(style));
+      chunk_ += '"';
+    }
+    ++column_;
+  }
+
+  void flush_chunk(bool force) {
+    if (force || chunk_.size() >= kChunkSize) {
+      zip_.write(chunk_);
+      chunk_.clear();
+    }
+  }
+
+  ZipWriter zip_;
+  std::map<std::string, int> strings_;
+  std::vector<const std::string*> string_order_;
+  std::vector<std::string> sheet_titles_;
+  std::set<std::string> used_titles_;  // имена листов в нижнем регистре (ASCII)
+  std::string title_;
+  std::vector<std::string> header_;
+  std::vector<int> widths_;
+  std::string chunk_;
+  std::string row_ref_;
+  int part_ = 1;
+  int row_ = 0;
+  int column_ = 0;
+  long long rows_total_ = 0;
+  long long string_refs_ = 0;
+};
+
+// Экспортирует данные в одну книгу XLSX: по листу на таблицу, оценки - за выбранный период.
+// with_journal добавляет лист сводного журнала (последняя оценка по каждому предмету).
+void export_xlsx(const DataStore& data, const Period& period, bool with_journal) {
+  ensure_storage_dirs();
+  const std::string filename = "export.xlsx";
+  const std::string path = export_path(filename);
+  auto started = std::chrono::steady_clock::now();
+  XlsxWriter book(path);
+  if (!book.ok()) {
+    std::cout << "Не удалось открыть файл для экспорта (возможно, он открыт в Excel).\n";
+    return;
+  }
+
+  // Индексы общих строк с названиями - по позиции сущности в векторе хранилища,
+  // по ID - через плотные слоты; -1 - сущности нет.
+  EntitySlots group_slots(data.groups);
+  EntitySlots student_slots(data.students);
+  EntitySlots subject_slots(data.subjects);
+  auto name_of = [](const EntitySlots& slots, const std::vector<int>& names, int id) {
+    int slot = slots.slot(id);
+    return slot >= 0 ? names[slots.index(slot)] : -1;
+  };
+  std::vector<int> group_names;
+  book.begin_table("Группы", {"ID группы", "Название группы"}, {12, 30});
+  for (const auto& group : data.groups) {
+    int name = book.shared_string(group.name);
+    group_names.push_back(name);
+    book.begin_row();
+    book.cell_int(group.id);
+    book.cell_string(name);
+    book.end_row();
+  }
+  book.end_table();
+
+  std::vector<int> student_names;
+  book.begin_table("Студенты", {"ID студента", "ФИО", "ID группы", "Группа"}, {12, 36, 12, 30});
+  for (const auto& student : data.students) {
+    int name = book.shared_string(student.name);
+    student_names.push_back(name);
+    book.begin_row();
+    book.cell_int(student.id);
+    book.cell_string(name);
+    int group = name_of(group_slots, group_names, student.group_id);
+    if (group >= 0) {
+      book.cell_int(student.group_id);
+      book.cell_string(group);
+    } else {
+      book.cell_empty();
+      book.cell_string("Без группы");
+    }
+    book.end_row();
+  }
+  book.end_table();
+
+  std::vector<int> subject_names;
+  book.begin_table("Предметы", {"ID предмета", "Название предмета"}, {12, 36});
+  for (const auto& subject : data.subjects) {
+    int name = book.shared_string(subject.name);
+    subject_names.push_back(name);
+    book.begin_row();
+    book.cell_int(subject.id);
+    book.cell_string(name);
+    book.end_row();
+  }
+  book.end_table();
+
+  book.begin_table("Оценки",
+                   {"ID оценки", "ID студента", "Студент", "ID предмета", "Предмет", "Попытка",
+                    "Оценка", "Дата", "Семестр"},
+                   {12, 12, 36, 12, 30, 10, 10, 12, 16});
+  for_each_partition(data, period, [&](const GradePartition& part) {
+    int semester = book.shared_string(semester_name(part.semester));
+    for (size_t i = 0; i < part.size(); ++i) {
+      Grade grade = part.grade_at(i);
+      book.begin_row();
+      book.cell_int(grade.id);
+      book.cell_int(grade.student_id);
+      int student = name_of(student_slots, student_names, grade.student_id);
+      if (student >= 0) {
+        book.cell_string(student);
+      } else {
+        book.cell_empty();
+      }
+      book.cell_int(grade.subject_id);
+      int subject = name_of(subject_slots, subject_names, grade.subject_id);
+      if (subject >= 0) {
+        book.cell_string(subject);
+      } else {
+        book.cell_empty();
+      }
+      book.cell_int(grade.attempt);
+      book.cell_int(grade.value);
+      book.cell_date(grade.created_at);
+      book.cell_string(semester);
+      book.end_row();
+    }
+  });
+  book.end_table();
+
+  if (with_journal && !data.students.empty() && !data.subjects.empty()) {
+    std::vector<std::string> header = {"ID", "ФИО", "Группа"};
+    std::vector<int> widths = {8, 36, 24};
+    for (const auto& subject : data.subjects) {
+      header.push_back(subject.name);
+      widths.push_back(12);
+    }
+    header.push_back("Ср.балл");
+    widths.push_back(10);
+    book.begin_table("Журнал", header, widths);
+    // Агрегаты считаются блоками студентов (см. for_each_journal_row), поэтому память
+    // ограничена и при сотнях тысяч студентов, ценой нескольких проходов по оценкам.
+    auto students = students_for_group_sorted(data, 0);
+    for_each_journal_row(data, period, students, [&](const Student& student, const SubjectAggregate* cells) {
+      book.begin_row();
+      book.cell_int(student.id);
+      book.cell_string(name_of(student_slots, student_names, student.id));
+      int group = name_of(group_slots, group_names, student.group_id);
+      book.cell_string(group >= 0 ? group : book.shared_string("Без группы"));
+      for (size_t i = 0; i < data.subjects.size(); ++i) {
+        if (cells[i].count == 0) {
+          book.cell_empty();
+        } else {
+          book.cell_int(cells[i].latest_value);
+        }
+      }
+      double avg = journal_row_average(cells, data.subjects.size());
+      if (avg >= 0.0) {
+        book.cell_decimal(avg);
+      }
+      book.end_row();
+    });
+    book.end_table();
+  }
+
+  bool written = book.finish();
+  if (!written) {
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+    if (book.too_large()) {
+      std::cout << "Книга получается больше 4 ГБ - такой размер не поддерживается. "
+                   "Сузьте период или используйте экспорт в CSV.\n";
+    } else {
+      std::cout << "Не удалось записать файл экспорта.\n";
+    }
+    return;
+  }
+  long long elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                             std::chrono::steady_clock::now() - started).count();
+  std::cout << "Экспортировано в '" << path << "': " << book.rows_written() << " строк, "
+            << (book.bytes_written() + 1023) / 1024 << " КБ за " << elapsed_ms << " мс.\n";
+  if (!period.is_all()) {
+    std::cout << "Оценки выгружены за период: " << period_name(period) << ".\n";
+  }
+}
+
+// Меню экспорта: CSV-файлы или книга XLSX.
+void export_menu(const DataStore& data, const Period& period) {
+  std::cout << "\nЭкспорт в Excel:\n"
+            << "1) CSV (файл на таблицу, разделитель ';')\n"
+            << "2) XLSX (одна книга, лист на таблицу)\n"
+            << "3) XLSX с листом журнала\n"
+            << "0) Назад\n";
+  int choice = read_int("Выберите: ", 0, 3);
+  switch (choice) {
+    case 1:
+      export_csv(data, period);
+      break;
+    case 2:
+      export_xlsx(data, period, false);
+      break;
+    case 3:
+      export_xlsx(data, period, true);
+      break;
+    default:
+      break;
+  }
+}
+
+// Печатает список семестров, в которых есть оценки.
+void print_semesters(const DataStore& data) {
+  if (data.grade_partitions.empty()) {
+    std::cout << "Нет оценок.\n";
+    return;
+  }
+  OutputBuffer out(std::cout);
+  out.append("Семестры:\n");
+  TableWriter table(out, {8, 16, 10}, {true, false, true});
+  table.line();
+  table.row({"Код", "Семестр", "Оценок"});
+  table.line();
+  for (const GradePartition& part : data.grade_partitions) {
+    table.cell_int(part.semester);
+    table.cell(semester_name(part.semester));
+    table.cell_int(static_cast<long long>(part.grades.size()));
+    table.end_row();
+  }
+  table.line();
+}
+
+// Запрашивает код семестра (ГГГГ1 - осень, ГГГГ2 - весна учебного года ГГГГ/ГГГГ+1).
+int read_semester(const std::string& prompt) {
+  while (true) {
+    int semester = read_int(prompt, 0, std::numeric_limits<int>::max());
+    if (is_valid_semester(semester)) {
+      return semester;
+    }
+    std::cout << "Код семестра: год и номер полугодия, например 20251 (осень) или 20252 (весна).\n";
+  }
+}
+
+// Меню выбора периода для отчетов, журналов и экспорта.
+Period read_period(const DataStore& data, const Period& current) {
+  int now = current_semester();
+  std::cout << "\n[Период отчетов] сейчас: " << period_name(current) << "\n"
+            << "1) Вся история\n"
+            << "2) Текущий семестр (" << semester_name(now) << ")\n"
+            << "3) Один семестр\n"
+            << "4) Диапазон семестров\n"
+            << "0) Оставить без изменений\n";
+  int choice = read_int("Выберите: ", 0, 4);
+  Period period = current;
+  switch (choice) {
+    case 1:
+      period = Period();
+      break;
+    case 2:
+      period.from = now;
+      period.to = now;
+      break;
+    case 3:
+      print_semesters(data);
+      period.from = read_semester("Код семестра: ");
+      period.to = period.from;
+      break;
+    case 4: {
+      print_semesters(data);
+      int from = read_semester("С семестра (код): ");
+      int to = read_semester("По семестр (код): ");
+      period.from = std::min(from, to);
+      period.to = std::max(from, to);
+      break;
+    }
+    default:
+      break;
+  }
+  return period;
+}
+
+// Итог слияния дублей.
+struct MergeStats {
+  int removed = 0;     // удалено записей-дублей
+  int moved = 0;       // перенесено оценок (студенты, предметы) или студентов (группы)
+  int renumbered = 0;  // оценок с пересчитанным номером попытки
+};
+
+// Сливает каждый набор дублей (ID по возрастанию) в запись с наименьшим ID: оценки
+// дублей студента или предмета (студенты дублей группы) переходят к ней, номера попыток
+// затронутых пар "студент - предмет" пересчитываются по порядку выставления, дубли
+// удаляются. Все правки копятся в pending_changes, который должен быть пуст, и
+// записываются одной транзакцией целиком или не записываются (pending_all_or_nothing).
+MergeStats merge_duplicates(DataStore& data, Entity entity, const std::vector<std::vector<int>>& sets) {
+  MergeStats stats;
+  // Записи, которых уже нет (удалил другой пользователь), пропускаются: остается
+  // наименьший из существующих ID набора.
+  auto exists = [&](int id) {
+    switch (entity) {
+      case Entity::kStudent:
+        return find_student(data, id) != nullptr;
+      case Entity::kGroup:
+        return find_group(data, id) != nullptr;
+      case Entity::kSubject:
+        return find_subject(data, id) != nullptr;
+      case Entity::kGrade:
+        break;
+    }
+    return false;
+  };
+  std::unordered_map<int, int> target;  // ID дубля -> ID остающейся записи
+  for (const auto& ids : sets) {
+    int keep = 0;
+    for (int id : ids) {
+      if (!exists(id)) {
+        continue;
+      }
+      if (keep == 0) {
+        keep = id;
+      } else {
+        target[id] = keep;
+      }
+    }
+  }
+  if (target.empty()) {
+    return stats;
+  }
+  auto target_of = [&target](int id) {
+    auto it = target.find(id);
+    return it == target.end() ? 0 : it->second;
+  };
+  // Каждая строка попадает в pending_changes один раз, с версией до слияния.
+  std::unordered_set<int> recorded;
+  auto record_grade = [&](const Grade& grade) {
+    if (recorded.insert(grade.id).second) {
+      data.pending_changes.push_back({Entity::kGrade, ChangeOp::kUpdate, grade.id, grade.version});
+    }
+  };
+
+  if (entity == Entity::kGroup) {
+    for (size_t i = 0; i < data.students.size(); ++i) {
+      int to = target_of(data.students[i].group_id);
+      if (to != 0) {
+        Student& student = data.students.write()[i];
+        data.pending_changes.push_back({Entity::kStudent, ChangeOp::kUpdate, student.id, student.version});
+        student.group_id = to;
+        ++stats.moved;
+      }
+    }
+  } else {
+    bool by_student = entity == Entity::kStudent;
+    auto pair_key = [](const Grade& grade) {
+      return (static_cast<uint64_t>(static_cast<uint32_t>(grade.student_id)) << 32) |
+             static_cast<uint32_t>(grade.subject_id);
+    };
+    std::unordered_set<uint64_t> pairs;
+    for (auto& part : data.grade_partitions) {
+      for (size_t i = 0; i < part->size(); ++i) {
+        Grade grade = part->grade_at(i);
+        int& field = by_student ? grade.student_id : grade.subject_id;
+        int to = target_of(field);
+        if (to == 0) {
+          continue;
+        }
+        record_grade(grade);
+        field = to;
+        replace_grade(data, part, i, grade);
+        pairs.insert(pair_key(grade));
+        ++stats.moved;
+      }
+    }
+
+    // Попытки затронутых пар нумеруются заново в порядке выставления (дата, затем ID).
+    struct AttemptRef {
+      uint64_t pair;
+      int64_t created_at;
+      int id;
+      int attempt;
+      size_t part;
+      size_t index;
+    };
+    std::vector<AttemptRef> refs;
+    for (size_t p = 0; p < data.grade_partitions.size(); ++p) {
+      const GradePartition& part = data.grade_partitions[p];
+      for (size_t i = 0; i < part.size(); ++i) {
+        Grade grade = part.grade_at(i);
+        uint64_t key = pair_key(grade);
+        if (pairs.count(key) > 0) {
+          refs.push_back({key, grade.created_at, grade.id, grade.attempt, p, i});
+        }
+      }
+    }
+    std::sort(refs.begin(), refs.end(), [](const AttemptRef& a, const AttemptRef& b) {
+      if (a.pair != b.pair) {
+        return a.pair < b.pair;
+      }
+      if (a.created_at != b.created_at) {
+        return a.created_at < b.created_at;
+      }
+      return a.id < b.id;
+    });
+    int attempt = 0;
+    for (size_t k = 0; k < refs.size(); ++k) {
+      attempt = (k > 0 && refs[k].pair == refs[k - 1].pair) ? attempt + 1 : 1;
+      if (refs[k].attempt == attempt) {
+        continue;
+      }
+      Cow<GradePartition>& part = data.grade_partitions[refs[k].part];
+      Grade grade = part->grade_at(refs[k].index);
+      record_grade(grade);
+      grade.attempt = attempt;
+      replace_grade(data, part, refs[k].index, grade);
+      ++stats.renumbered;
+    }
+    settle_retakes(data);
+  }
+
+  // Дубли удаляются последними: в базе удаление студента или предмета каскадом
+  // удалило бы еще не перенесенные оценки.
+  auto remove_duplicates = [&](auto& table) {
+    for (const auto& row : table) {
+      if (target.count(row.id) > 0) {
+        data.pending_changes.push_back({entity, ChangeOp::kDelete, row.id, row.version});
+      }
+    }
+    erase_rows_if(table, [&](const auto& row) { return target.count(row.id) > 0; });
+  };
+  if (entity == Entity::kStudent) {
+    remove_duplicates(data.students);
+  } else if (entity == Entity::kGroup) {
+    remove_duplicates(data.groups);
+  } else {
+    remove_duplicates(data.subjects);
+  }
+  stats.removed = static_cast<int>(target.size());
+  data.pending_all_or_nothing = true;
+  ++data.generation;
+  return stats;
+}
+
+// Печатает наборы дублей: имя первой записи и ID всех записей набора.
+template <typename Entity, typename Describe>
+void print_duplicate_sets(const CowTable<Entity>& table, const std::vector<std::vector<int>>& sets,
+                          const char* title, Describe describe) {
+  const size_t kShownSets = 50;
+  OutputBuffer out(std::cout);
+  out.append(title);
+  out.append(": ");
+  if (sets.empty()) {
+    out.append("нет\n");
+    return;
+  }
+  out.append_int(static_cast<long long>(sets.size()));
+  out.append("\n");
+  for (size_t i = 0; i < sets.size() && i < kShownSets; ++i) {
+    auto it = std::find_if(table.begin(), table.end(), [&](const Entity& row) { return row.id == sets[i].front(); });
+    out.append("  ");
+    if (it != table.end()) {
+      out.append(describe(*it));
+    }
+    out.append(": ");
+    std::string ids;
+    for (size_t k = 0; k < sets[i].size(); ++k) {
+      ids += (k == 0 ? "ID " : ", ") + std::to_string(sets[i][k]);
+    }
+    out.append(ids);
+    out.append("\n");
+  }
+  if (sets.size() > kShownSets) {
+    out.append("  ... и еще ");
+    out.append_int(static_cast<long long>(sets.size() - kShownSets));
+    out.append("\n");
+  }
+}
+
+// Меню поиска и слияния дублей (одинаковые имена после normalize_name).
+void duplicates_menu(DataStore& data) {
+  while (true) {
+    std::vector<std::vector<int>> students = data.student_names.duplicates(data.students);
+    std::vector<std::vector<int>> groups = data.group_names.duplicates(data.groups);
+    std::vector<std::vector<int>> subjects = data.subject_names.duplicates(data.subjects);
+    auto extra = [](const std::vector<std::vector<int>>& sets) {
+      size_t count = 0;
+      for (const auto& ids : sets) {
+        count += ids.size() - 1;
+      }
+      return count;
+    };
+    std::cout << "\n[Дубли]\n"
+              << "Студентов с одинаковым ФИО в группе: наборов " << students.size() << ", лишних записей "
+              << extra(students) << "\n"
+              << "Групп с одинаковым названием: наборов " << groups.size() << ", лишних записей " << extra(groups)
+              << "\n"
+              << "Предметов с одинаковым названием: наборов " << subjects.size() << ", лишних записей "
+              << extra(subjects) << "\n"
+              << "1) Показать дубли\n"
+              << "2) Слить дубли студентов\n"
+              << "3) Слить дубли групп\n"
+              << "4) Слить дубли предметов\n"
+              << "0) Назад\n";
+    int choice = read_int("Выберите: ", 0, 4);
+    if (choice == 0) {
+      return;
+    }
+    if (choice == 1) {
+      print_duplicate_sets(data.students, students, "Студенты", [&](const Student& student) {
+        return student.name + " (" + group_name_or_none(data, student.group_id) + ")";
+      });
+      print_duplicate_sets(data.groups, groups, "Группы", [](const Group& group) { return group.name; });
+      print_duplicate_sets(data.subjects, subjects, "Предметы", [](const Subject& subject) { return subject.name; });
+      continue;
+    }
+    Entity entity = choice == 2 ? Entity::kStudent : (choice == 3 ? Entity::kGroup : Entity::kSubject);
+    if ((choice == 2 ? students : (choice == 3 ? groups : subjects)).empty()) {
+      std::cout << "Дублей нет.\n";
+      continue;
+    }
+    sync_or_warn(data);
+    if (!data.pending_changes.empty()) {
+      // Слияние пишется отдельной транзакцией, без чужих для него правок.
+      std::cout << "Есть несохраненные изменения: слияние возможно после их записи в базу.\n";
+      continue;
+    }
+    // Синхронизация могла подтянуть удаления и переименования других пользователей:
+    // наборы пересчитываются по текущим данным.
+    std::vector<std::vector<int>> sets = choice == 2   ? data.student_names.duplicates(data.students)
+                                         : choice == 3 ? data.group_names.duplicates(data.groups)
+                                                       : data.subject_names.duplicates(data.subjects);
+    if (sets.empty()) {
+      std::cout << "Дублей больше нет: данные изменил другой пользователь.\n";
+      continue;
+    }
+    std::cout << "Записи каждого набора сливаются в запись с наименьшим ID, остальные удаляются.\n";
+    if (read_int("Слить наборов: " + std::to_string(sets.size()) + "? 1-да, 0-нет: ", 0, 1) != 1) {
+      continue;
+    }
+    MergeStats stats = merge_duplicates(data, entity, sets);
+    std::cout << "Удалено дублей: " << stats.removed << ", перенесено "
+              << (entity == Entity::kGroup ? "студентов: " : "оценок: ") << stats.moved;
+    if (entity != Entity::kGroup) {
+      std::cout << ", пересчитано номеров попыток: " << stats.renumbered;
+    }
+    std::cout << ".\n";
+    sync_or_warn(data);
+  }
+}
+
+// Подменю управления студентами.
+void students_menu(DataStore& data) {
+  while (true) {
+    std::cout << "\n[Студенты]\n"
+              << "1) Добавить студента\n"
+              << "2) Редактировать студента\n"
+              << "3) Удалить студента\n"
+              << "4) Список студентов\n"
+              << "5) Поиск, фильтры и сортировка\n"
+              << "6) Дубли и слияние (студенты, группы, предметы)\n"
+              << "0) Назад\n";
+    int choice = read_int("Выберите: ", 0, 6);
+    sync_or_warn(data);
+    switch (choice) {
+      case 1:
+        add_student(data);
+        break;
+      case 2:
+        edit_student(data);
+        break;
+      case 3:
+        delete_student(data);
+        break;
+      case 4:
+        list_students_detailed(data);
+        break;
+      case 5:
+        students_search_menu(data);
+        break;
+      case 6:
+        duplicates_menu(data);
+        break;
+      case 0:
+        return;
+      default:
+        break;
+    }
+  }
+}
+
+// Подменю управления группами.
+void groups_menu(DataStore& data) {
+  while (true) {
+    std::cout << "\n[Группы]\n"
+              << "1) Добавить группу\n"
+              << "2) Редактировать группу\n"
+              << "3) Удалить группу\n"
+              << "4) Список групп\n"
+              << "5) Добавить студента в группу\n"
+              << "0) Назад\n";
+    int choice = read_int("Выберите: ", 0, 5);
+    sync_or_warn(data);
+    switch (choice) {
+      case 1:
+        add_group(data);
+        break;
+      case 2:
+        edit_group(data);
+        break;
+      case 3:
+        delete_group(data);
+        break;
+      case 4:
+        print_groups_simple(data);
+        break;
+      case 5:
+        add_student_to_group(data);
+        break;
+      case 0:
+        return;
+      default:
+        break;
+    }
+  }
+}
+
+// Подменю управления предметами.
+void subjects_menu(DataStore& data) {
+  while (true) {
+    std::cout << "\n[Предметы]\n"
+              << "1) Добавить предмет\n"
+              << "2) Редактировать предмет\n"
+              << "3) Удалить предмет\n"
+              << "4) Список предметов\n"
+              << "0) Назад\n";
+    int choice = read_int("Выберите: ", 0, 4);
+    sync_or_warn(data);
+    switch (choice) {
+      case 1:
+        add_subject(data);
+        break;
+      case 2:
+        edit_subject(data);
+        break;
+      case 3:
+        delete_subject(data);
+        break;
+      case 4:
+        print_subjects_simple(data);
+        break;
+      case 0:
+        return;
+      default:
+        break;
+    }
+  }
+}
+
+// Подменю управления оценками.
+void grades_menu(DataStore& data) {
+  while (true) {
+    std::cout << "\n[Оценки]\n"
+              << "1) Добавить оценку\n"
+              << "2) Редактировать оценку\n"
+              << "3) Удалить оценку\n"
+              << "4) Список оценок\n"
+              << "5) Ведомость группы (оценки по предмету подряд)\n"
+              << "0) Назад\n";
+    int choice = read_int("Выберите: ", 0, 5);
+    sync_or_warn(data);
+    switch (choice) {
+      case 1:
+        add_grade(data);
+        break;
+      case 2:
+        edit_grade(data);
+        break;
+      case 3:
+        delete_grade(data);
+        break;
+      case 4:
+        print_grades_simple(data);
+        break;
+      case 5:
+        grade_sheet(data);
+        break;
+      case 0:
+        return;
+      default:
+        break;
+    }
+  }
+}
+
+// Подменю отчетов.
+void reports_menu(DataStore& data, const Period& period) {
+  while (true) {
+    std::cout << "\n[Отчеты] период: " << period_name(period) << "\n"
+              << "1) Средние по студентам\n"
+              << "2) Средние по предметам\n"
+              << "3) Подробности по предмету\n"
+              << "4) Топ-N студентов\n"
+              << "5) Пересдачи\n"
+              << "6) Статистика кэша отчетов\n"
+              << "7) Распределение оценок\n"
+              << "8) Сравнение групп\n"
+              << "0) Назад\n";
+    int choice = read_int("Выберите: ", 0, 8);
+    sync_or_warn(data);
+    switch (choice) {
+      case 1:
+        report_overall_averages(data, period);
+        break;
+      case 2:
+        report_subject_averages(data, period);
+        break;
+      case 3:
+        report_subject_detail(data, period);
+        break;
+      case 4:
+        report_top_n(data, period);
+        break;
+      case 5:
+        report_retakes(data, period);
+        break;
+      case 6:
+        print_cache_stats(data);
+        print_idle_stats();
+        break;
+      case 7:
+        report_distribution(data, period);
+        break;
+      case 8:
+        report_groups(data, period);
+        break;
+      case 0:
+        return;
+      default:
+        break;
+    }
+  }
+}
+
+// Прямое чтение отчетов из SQLite (--report ... --direct): без загрузки DataStore,
+// параметризованными запросами по индексам, в одной читающей транзакции. Вывод
+// совпадает с обычным режимом: те же строки, порядок и фильтры. Как и при загрузке,
+// оценки несуществующих студентов и предметов не учитываются, а студент
+// с несуществующей группой считается студентом без группы.
+
+// Выполняет запрос с целочисленными параметрами (1..N) и вызывает fn для каждой строки.
+template <typename Fn>
+bool query_rows(sqlite3* db, const char* sql, std::initializer_list<int64_t> args, Fn&& fn) {
+  sqlite3_stmt* stmt = nullptr;
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+    return false;
+  }
+  int index = 1;
+  for (int64_t arg : args) {
+    sqlite3_bind_int64(stmt, index++, arg);
+  }
+  int rc = SQLITE_ROW;
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    fn(stmt);
+  }
+  sqlite3_finalize(stmt);
+  return rc == SQLITE_DONE;
+}
+
+// Название группы из LEFT JOIN groups: NULL - студент без группы.
+std::string direct_group_name(sqlite3_stmt* stmt, int col) {
+  return sqlite3_column_type(stmt, col) == SQLITE_NULL ? std::string("Без группы") : column_text(stmt, col);
+}
+
+bool direct_subject_detail(sqlite3* db, const ReportRequest& request, ReportSink& sink) {
+  std::string subject_name;
+  query_rows(db, "SELECT name FROM subjects WHERE id = ?1;", {request.id},
+             [&](sqlite3_stmt* stmt) { subject_name = column_text(stmt, 0); });
+  bool started = false;
+  int current = 0;
+  std::string student_name;
+  std::vector<int> values;
+  bool ok = query_rows(db,
+                       "SELECT g.student_id, s.name, g.value FROM grades g "
+                       "JOIN students s ON s.id = g.student_id "
+                       "WHERE g.subject_id = ?1 AND g.semester BETWEEN ?2 AND ?3 "
+                       "ORDER BY g.student_id, g.attempt, g.id;",
+                       {request.id, request.period.from, request.period.to}, [&](sqlite3_stmt* stmt) {
+                         int student_id = sqlite3_column_int(stmt, 0);
+                         if (!started) {
+                           begin_subject_detail(sink, subject_name, request.period);
+                           started = true;
+                         } else if (student_id != current) {
+                           append_subject_detail_row(sink, student_name, values);
+                           values.clear();
+                         }
+                         if (values.empty()) {
+                           current = student_id;
+                           student_name = column_text(stmt, 1);
+                         }
+                         values.push_back(sqlite3_column_int(stmt, 2));
+                       });
+  if (!started) {
+    append_subject_detail_empty(sink, subject_name, request.period);
+    return ok;
+  }
+  append_subject_detail_row(sink, student_name, values);
+  sink.end_table();
+  return ok;
+}
+
+bool direct_retakes(sqlite3* db, const ReportRequest& request, ReportSink& sink) {
+  sink.text("Пересдачи (последняя оценка < ");
+  sink.text_int(kPassGrade);
+  sink.text("):\n");
+  append_period_line(sink, request.period);
+  std::map<int, std::string> subjects;
+  bool ok = query_rows(db, "SELECT id, name FROM subjects;", {}, [&](sqlite3_stmt* stmt) {
+    subjects[sqlite3_column_int(stmt, 0)] = column_text(stmt, 1);
+  });
+  // Студенты по ID, у каждого - оценки из покрывающего индекса (student_id, subject_id, semester, value)
+  // в порядке предметов: строки идут сразу, без сортировки всей таблицы. "+" не дает
+  // планировщику взять индекс по семестру. Последняя оценка пары - с наибольшим ID,
+  // как в subject_aggregates_for_student.
+  bool empty = true;
+  int student_id = 0;
+  int subject_id = 0;
+  int latest_id = 0;
+  int latest_value = 0;
+  std::string student_name;
+  auto flush_pair = [&]() {
+    auto subject = subjects.find(subject_id);
+    if (latest_id == 0 || latest_value >= kPassGrade || subject == subjects.end()) {
+      return;
+    }
+    if (empty) {
+      sink.begin_table({{"Студент", 28, false, true}, {"Предмет", 28, false, true}, {"Оценка", 10, true, true}});
+      empty = false;
+    }
+    sink.cell(student_name);
+    sink.cell(subject->second);
+    sink.cell_int(latest_value);
+    sink.end_row();
+  };
+  ok = ok && query_rows(db,
+                        "SELECT g.student_id, g.subject_id, g.id, g.value, s.name FROM students s "
+                        "JOIN grades g ON g.student_id = s.id "
+                        "WHERE +g.semester BETWEEN ?1 AND ?2 ORDER BY s.id, g.subject_id;",
+                        {request.period.from, request.period.to}, [&](sqlite3_stmt* stmt) {
+                          int row_student = sqlite3_column_int(stmt, 0);
+                          int row_subject = sqlite3_column_int(stmt, 1);
+                          if (row_student != student_id || row_subject != subject_id) {
+                            flush_pair();
+                            if (row_student != student_id) {
+                              student_id = row_student;
+                              student_name = column_text(stmt, 4);
+                            }
+                            subject_id = row_subject;
+                            latest_id = 0;
+                          }
+                          int grade_id = sqlite3_column_int(stmt, 2);
+                          if (grade_id > latest_id) {
+                            latest_id = grade_id;
+                            latest_value = sqlite3_column_int(stmt, 3);
+                          }
+                        });
+  flush_pair();
+  if (empty) {
+    sink.text("  Нет.\n");
+  } else {
+    sink.end_table();
+  }
+  return ok;
+}
+
+bool direct_journal_by_subject(sqlite3* db, const ReportRequest& request, ReportSink& sink) {
+  std::string subject_name;
+  query_rows(db, "SELECT name FROM subjects WHERE id = ?1;", {request.id},
+             [&](sqlite3_stmt* stmt) { subject_name = column_text(stmt, 0); });
+  std::string group_text;
+  if (request.group == -1) {
+    group_text = "Группа: без группы\n";
+  } else if (request.group > 0) {
+    query_rows(db, "SELECT name FROM groups WHERE id = ?1;", {request.group},
+               [&](sqlite3_stmt* stmt) { group_text = "Группа: " + column_text(stmt, 0) + "\n"; });
+  }
+  // Студенты в порядке журнала (lower() в SQLite меняет регистр только у ASCII, как to_lower_ascii),
+  // к каждому - его оценки по предмету через индекс (student_id, subject_id).
+  bool started = false;
+  int current = 0;
+  std::string name;
+  std::string group_name;
+  std::vector<int> values;
+  bool ok = query_rows(db,
+                       "SELECT s.id, s.name, grp.name, g.value FROM students s "
+                       "LEFT JOIN groups grp ON grp.id = s.group_id "
+                       "LEFT JOIN grades g ON g.student_id = s.id AND g.subject_id = ?1 "
+                       "  AND g.semester BETWEEN ?2 AND ?3 "
+                       "WHERE ?4 = 0 OR (?4 = -1 AND grp.id IS NULL) OR (?4 > 0 AND grp.id = ?4) "
+                       "ORDER BY lower(s.name), s.id, g.attempt, g.id;",
+                       {request.id, request.period.from, request.period.to, request.group},
+                       [&](sqlite3_stmt* stmt) {
+                         int student_id = sqlite3_column_int(stmt, 0);
+                         if (!started) {
+                           begin_subject_journal(sink, subject_name, request.period, group_text);
+                           started = true;
+                           current = student_id;
+                         } else if (student_id != current) {
+                           append_subject_journal_row(sink, current, name, group_name, values);
+                           values.clear();
+                           current = student_id;
+                         }
+                         name = column_text(stmt, 1);
+                         group_name = direct_group_name(stmt, 2);
+                         if (sqlite3_column_type(stmt, 3) != SQLITE_NULL) {
+                           values.push_back(sqlite3_column_int(stmt, 3));
+                         }
+                       });
+  if (!started) {
+    sink.text("Нет студентов для выбранного фильтра.\n");
+    return ok;
+  }
+  append_subject_journal_row(sink, current, name, group_name, values);
+  sink.end_table();
+  return ok;
+}
+
+bool direct_journal_by_student(sqlite3* db, const ReportRequest& request, ReportSink& sink) {
+  std::string name;
+  std::string group_name;
+  query_rows(db,
+             "SELECT s.name, grp.name FROM students s LEFT JOIN groups grp ON grp.id = s.group_id "
+             "WHERE s.id = ?1;",
+             {request.id}, [&](sqlite3_stmt* stmt) {
+               name = column_text(stmt, 0);
+               group_name = direct_group_name(stmt, 1);
+             });
+  std::vector<Subject> subjects;
+  bool ok = query_rows(db, "SELECT id, name FROM subjects ORDER BY id;", {}, [&](sqlite3_stmt* stmt) {
+    Subject subject;
+    subject.id = sqlite3_column_int(stmt, 0);
+    subject.name = column_text(stmt, 1);
+    subjects.push_back(std::move(subject));
+  });
+  ReportArena arena;
+  GradesBySubject by_subject(arena.resource());
+  ok = ok && query_rows(db,
+                        "SELECT g.subject_id, g.value FROM grades g "
+                        "JOIN subjects sub ON sub.id = g.subject_id "
+                        "WHERE g.student_id = ?1 AND g.semester BETWEEN ?2 AND ?3 "
+                        "ORDER BY g.subject_id, g.attempt, g.id;",
+                        {request.id, request.period.from, request.period.to}, [&](sqlite3_stmt* stmt) {
+                          by_subject.add(sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1));
+                        });
+  append_student_journal(sink, name, group_name, request.period, subjects, by_subject);
+  return ok;
+}
+
+struct DirectReport {
+  const char* name;
+  bool (*render)(sqlite3*, const ReportRequest&, ReportSink&);
+};
+
+const DirectReport kDirectReports[] = {
+    {"subject-detail", direct_subject_detail},
+    {"retakes", direct_retakes},
+    {"journal-subject", direct_journal_by_subject},
+    {"journal-student", direct_journal_by_student},
+};
+
+const DirectReport* find_direct_report(const std::string& name) {
+  for (const auto& entry : kDirectReports) {
+    if (name == entry.name) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+// Проверяет параметры отчета запросом к базе; пустая строка - все в порядке.
+std::string direct_check_params(sqlite3* db, const ReportEntry& entry, const ReportRequest& request) {
+  auto exists = [&](const char* sql, int64_t id) {
+    bool found = false;
+    query_rows(db, sql, {id}, [&](sqlite3_stmt*) { found = true; });
+    return found;
+  };
+  if (entry.param == ReportParam::kSubject && !exists("SELECT 1 FROM subjects WHERE id = ?1;", request.id)) {
+    return "Предмет не найден (--id).";
+  }
+  if (entry.param == ReportParam::kStudent && !exists("SELECT 1 FROM students WHERE id = ?1;", request.id)) {
+    return "Студент не найден (--id).";
+  }
+  if (request.group > 0 && !exists("SELECT 1 FROM groups WHERE id = ?1;", request.group)) {
+    return "Группа не найдена (--group).";
+  }
+  return std::string();
+}
+
+// Факультеты (шарды): у каждого факультета своя база со своим DataStore. Меню работает
+// с базой одного факультета, поэтому правки попадают в базу, которой принадлежат записи;
+// отчеты по всему учебному заведению загружают базы параллельно, считают отчет по каждой
+// в своем потоке и сливают результаты.
+struct Shard {
+  std::string name;  // имя файла базы без расширения
+  std::string path;
+  DataStore data;
+  bool loaded = false;
+};
+
+// Имя факультета по пути к его базе.
+std::string shard_name(const std::string& path) {
+  return std::filesystem::path(path).stem().string();
+}
+
+// Базы факультетов из --shards: каталог (все файлы *.db по имени) или пути через запятую.
+std::vector<std::string> parse_shard_paths(const std::string& spec) {
+  std::vector<std::string> paths;
+  std::error_code ec;
+  if (std::filesystem::is_directory(spec, ec)) {
+    for (const auto& entry : std::filesystem::directory_iterator(spec, ec)) {
+      if (entry.is_regular_file() && entry.path().extension() == ".db") {
+        paths.push_back(entry.path().string());
+      }
+    }
+    std::sort(paths.begin(), paths.end());
+    return paths;
+  }
+  size_t start = 0;
+  while (start <= spec.size()) {
+    size_t comma = spec.find(',', start);
+    if (comma == std::string::npos) {
+      comma = spec.size();
+    }
+    std::string path = trim(spec.substr(start, comma - start));
+    if (!path.empty()) {
+      paths.push_back(path);
+    }
+    start = comma + 1;
+  }
+  return paths;
+}
+
+// Вызывает fn(i) для i из [0, count) в threads потоках (0 - по числу ядер); индексы
+// раздаются по одному, поэтому крупная база не задерживает остальные.
+template <typename Fn>
+void parallel_for_index(size_t count, unsigned threads, Fn&& fn) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = static_cast<unsigned>(std::min<size_t>(threads, count));
+  std::atomic<size_t> next{0};
+  auto work = [&]() {
+    for (size_t i = next++; i < count; i = next++) {
+      fn(i);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (unsigned t = 1; t < threads; ++t) {
+    workers.emplace_back(work);
+  }
+  work();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+// Загружает базы факультетов параллельно; несуществующий файл не создается.
+std::vector<Shard> load_shards(const std::vector<std::string>& paths, unsigned threads = 0) {
+  std::vector<Shard> shards(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    shards[i].name = shard_name(paths[i]);
+    shards[i].path = paths[i];
+  }
+  parallel_for_index(shards.size(), threads, [&](size_t i) {
+    std::error_code ec;
+    shards[i].loaded = std::filesystem::is_regular_file(shards[i].path, ec) && load_data(shards[i].data, shards[i].path);
+  });
+  return shards;
+}
+
+// Отчет по всем факультетам; threads - потоков на расчет (0 - по числу ядер).
+struct ShardReport {
+  const char* name;
+  void (*render)(const std::vector<Shard>&, const ReportRequest&, unsigned threads, ReportSink&);
+};
+
+// Сводка по факультетам: студентов, оценок за период и средний балл студентов.
+void render_shards_summary(const std::vector<Shard>& shards, const ReportRequest& request, unsigned threads,
+                           ReportSink& sink) {
+  struct Summary {
+    size_t grades = 0;
+    double avg_sum = 0.0;
+    int avg_count = 0;
+  };
+  std::vector<Summary> summaries(shards.size());
+  parallel_for_index(shards.size(), threads, [&](size_t i) {
+    const DataStore& data = shards[i].data;
+    Summary& summary = summaries[i];
+    for_each_partition(data, request.period, [&](const GradePartition& part) { summary.grades += part.size(); });
+    for (double avg : student_averages(data, request.period)) {
+      if (avg >= 0.0) {
+        summary.avg_sum += avg;
+        ++summary.avg_count;
+      }
+    }
+  });
+  sink.text("Сводка по факультетам:\n");
+  append_period_line(sink, request.period);
+  sink.begin_table({{"Факультет", 24}, {"Студентов", 10, true}, {"Оценок", 12, true}, {"Ср.балл", 10, true}});
+  Summary total;
+  size_t total_students = 0;
+  for (size_t i = 0; i < shards.size(); ++i) {
+    const Summary& summary = summaries[i];
+    sink.cell(shards[i].name);
+    sink.cell_int(static_cast<long long>(shards[i].data.students.size()));
+    sink.cell_int(static_cast<long long>(summary.grades));
+    sink.cell_avg(summary.avg_count > 0 ? summary.avg_sum / summary.avg_count : -1.0);
+    sink.end_row();
+    total_students += shards[i].data.students.size();
+    total.grades += summary.grades;
+    total.avg_sum += summary.avg_sum;
+    total.avg_count += summary.avg_count;
+  }
+  sink.cell("Все факультеты");
+  sink.cell_int(static_cast<long long>(total_students));
+  sink.cell_int(static_cast<long long>(total.grades));
+  sink.cell_avg(total.avg_count > 0 ? total.avg_sum / total.avg_count : -1.0);
+  sink.end_row();
+  sink.end_table();
+}
+
+// Средние по предметам всех факультетов: одноименные предметы разных баз складываются.
+void render_shards_subjects(const std::vector<Shard>& shards, const ReportRequest& request, unsigned threads,
+                            ReportSink& sink) {
+  std::vector<std::vector<SubjectTotal>> totals(shards.size());
+  parallel_for_index(shards.size(), threads,
+                     [&](size_t i) { totals[i] = subject_totals(shards[i].data, request.period); });
+  struct Merged {
+    SubjectTotal total;
+    int shards = 0;
+  };
+  std::map<std::string, Merged> by_name;
+  for (size_t i = 0; i < shards.size(); ++i) {
+    const std::vector<Subject>& subjects = shards[i].data.subjects;
+    for (size_t s = 0; s < subjects.size(); ++s) {
+      Merged& merged = by_name[subjects[s].name];
+      merged.total.sum += totals[i][s].sum;
+      merged.total.count += totals[i][s].count;
+      ++merged.shards;
+    }
+  }
+  sink.text("Средние по предметам всех факультетов (все оценки):\n");
+  append_period_line(sink, request.period);
+  sink.begin_table({{"Предмет", 28}, {"Ср.балл", 12, true}, {"Оценок", 10, true}, {"Факультетов", 12, true}});
+  for (const auto& entry : by_name) {
+    sink.cell(entry.first);
+    sink.cell_avg(entry.second.total.average());
+    sink.cell_int(entry.second.total.count);
+    sink.cell_int(entry.second.shards);
+    sink.end_row();
+  }
+  sink.end_table();
+}
+
+// Студент в рейтинге всех факультетов: индекс базы и запись ее рейтинга.
+struct ShardRanked {
+  size_t shard;
+  RankedStudent entry;
+};
+
+// Топ-n всех факультетов: топ-n каждой базы считается в своем потоке, затем k-путевое
+// слияние по куче из голов списков. При равном балле раньше идет факультет, стоящий
+// раньше в списке баз, внутри факультета - порядок его собственного рейтинга.
+std::vector<ShardRanked> top_across_shards(const std::vector<Shard>& shards, const Period& period, size_t n,
+                                           unsigned threads) {
+  std::vector<std::vector<RankedStudent>> tops(shards.size());
+  parallel_for_index(shards.size(), threads, [&](size_t i) {
+    tops[i] = ranked_students(shards[i].data, period);
+    if (tops[i].size() > n) {
+      tops[i].resize(n);
+    }
+  });
+  struct Head {
+    size_t shard;
+    size_t pos;
+  };
+  auto after = [&tops](const Head& a, const Head& b) {
+    double a_avg = tops[a.shard][a.pos].avg;
+    double b_avg = tops[b.shard][b.pos].avg;
+    if (a_avg != b_avg) {
+      return a_avg < b_avg;
+    }
+    return a.shard > b.shard;
+  };
+  std::priority_queue<Head, std::vector<Head>, decltype(after)> heads(after);
+  for (size_t i = 0; i < tops.size(); ++i) {
+    if (!tops[i].empty()) {
+      heads.push({i, 0});
+    }
+  }
+  std::vector<ShardRanked> result;
+  while (result.size() < n && !heads.empty()) {
+    Head head = heads.top();
+    heads.pop();
+    result.push_back({head.shard, tops[head.shard][head.pos]});
+    if (head.pos + 1 < tops[head.shard].size()) {
+      heads.push({head.shard, head.pos + 1});
+    }
+  }
+  return result;
+}
+
+void render_shards_top(const std::vector<Shard>& shards, const ReportRequest& request, unsigned threads,
+                       ReportSink& sink) {
+  const size_t n = static_cast<size_t>(std::max(request.n, 0));
+  std::vector<ShardRanked> top = top_across_shards(shards, request.period, n, threads);
+  sink.text("Топ ");
+  sink.text_int(static_cast<long long>(n));
+  sink.text(" студентов всех факультетов:\n");
+  append_period_line(sink, request.period);
+  sink.begin_table({{"#", 4, true}, {"Факультет", 18}, {"ФИО", 28}, {"Группа", 20}, {"Ср.балл", 12, true}});
+  for (size_t i = 0; i < top.size(); ++i) {
+    const DataStore& data = shards[top[i].shard].data;
+    const Student* student = find_student(data, top[i].entry.student_id);
+    sink.cell_int(static_cast<long long>(i + 1));
+    sink.cell(shards[top[i].shard].name);
+    sink.cell(student ? student->name : "Неизвестно");
+    sink.cell(student ? group_name_or_none(data, student->group_id) : "Неизвестно");
+    sink.cell_avg(top[i].entry.avg);
+    sink.end_row();
+  }
+  sink.end_table();
+}
+
+// Порядок совпадает с пунктами 2-4 меню факультетов.
+const ShardReport kShardReports[] = {
+    {"faculties", render_shards_summary},
+    {"subjects", render_shards_subjects},
+    {"top", render_shards_top},
+};
+
+const ShardReport* find_shard_report(const std::string& name) {
+  for (const auto& report : kShardReports) {
+    if (name == report.name) {
+      return &report;
+    }
+  }
+  return nullptr;
+}
+
+// Замеряет время выполнения функции в миллисекундах.
+template <typename Fn>
+double measure_ms(Fn&& fn) {
+  auto start = std::chrono::steady_clock::now();
+  fn();
+  auto finish = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(finish - start).count();
+}
+
+// Генерирует ФИО на кириллице для синтетических данных и бенчмарков.
+std::string synthetic_name(uint32_t seed) {
+  static const char* const kLastNames[] = {"Иванов", "Петрова", "Сидоренко", "Кузнецова", "Смирнов",
+                                           "Попова", "Васильев", "Михайлова", "Новиков", "Федорова"};
+  static const char* const kFirstNames[] = {"Александр", "Мария", "Дмитрий", "Анна", "Сергей",
+                                            "Екатерина", "Андрей", "Ольга", "Николай", "Татьяна"};
+  static const char* const kMiddleNames[] = {"Иванович", "Петровна", "Сергеевич", "Андреевна",
+                                             "Николаевич", "Дмитриевна", "Олегович", "Павловна"};
+  uint32_t x = seed * 2654435761u + 12345u;
+  std::string name = kLastNames[x % 10];
+  name += ' ';
+  name += kFirstNames[(x / 10) % 10];
+  name += ' ';
+  name += kMiddleNames[(x / 100) % 8];
+  return name;
+}
+
+// Микробенчмарк UTF-8 функций: побайтовые циклы против SSE2/AVX2 на кириллице.
+int bench_utf8() {
+  std::vector<std::string> names;
+  names.reserve(200000);
+  size_t total_bytes = 0;
+  for (uint32_t i = 0; i < 200000; ++i) {
+    names.push_back(synthetic_name(i) + " гр." + std::to_string(i % 300));
+    total_bytes += names.back().size();
+  }
+  std::string text;
+  text.reserve(total_bytes + names.size());
+  for (const auto& name : names) {
+    text += name;
+    text += ' ';
+  }
+
+  struct Impl {
+    const char* name;
+    Utf8Kernels kernels;
+  };
+  std::vector<Impl> impls = {{"scalar", Utf8Kernels{}}};
+#ifdef GRADEBOOK_SIMD_X86
+  impls.push_back({"sse2", {"sse2", utf8_length_sse2, utf8_prefix_sse2, utf8_valid_sse2}});
+  if (cpu_has_avx2()) {
+    impls.push_back({"avx2", {"avx2", utf8_length_avx2, utf8_prefix_avx2, utf8_valid_avx2}});
+  }
+#endif
+
+  const int kRepeats = 20;
+  OutputBuffer out(std::cout);
+  out.append("UTF-8 бенчмарк: ");
+  out.append_int(static_cast<long long>(names.size()));
+  out.append(" ФИО (");
+  out.append_int(static_cast<long long>(total_bytes));
+  out.append(" байт), длинный текст ");
+  out.append_int(static_cast<long long>(text.size()));
+  out.append(" байт, повторов ");
+  out.append_int(kRepeats);
+  out.append(", активная реализация: ");
+  out.append(utf8_kernels().name);
+  out.append("\n");
+  TableWriter table(out, {28, 8, 12, 10}, {false, false, true, true});
+  table.line();
+  table.row({"Операция", "Реализ.", "МБ/с", "Ускорение"});
+  table.line();
+
+  using Op = size_t (*)(const Utf8Kernels&, const std::string&);
+  struct Case {
+    const char* title;
+    bool short_strings;
+    Op op;
+  };
+  const Case cases[] = {
+      {"Длина (ячейки)", true,
+       [](const Utf8Kernels& k, const std::string& s) { return k.length(s.data(), s.size()); }},
+      {"Длина (текст)", false,
+       [](const Utf8Kernels& k, const std::string& s) { return k.length(s.data(), s.size()); }},
+      {"Обрезка до 20 (ячейки)", true,
+       [](const Utf8Kernels& k, const std::string& s) { return k.prefix(s.data(), s.size(), 20); }},
+      {"Обрезка до половины (текст)", false,
+       [](const Utf8Kernels& k, const std::string& s) {
+         return k.prefix(s.data(), s.size(), s.size() / 4);
+       }},
+      {"Проверка (ячейки)", true,
+       [](const Utf8Kernels& k, const std::string& s) { return static_cast<size_t>(k.valid(s.data(), s.size())); }},
+      {"Проверка (текст)", false,
+       [](const Utf8Kernels& k, const std::string& s) { return static_cast<size_t>(k.valid(s.data(), s.size())); }},
+  };
+
+  bool mismatch = false;
+  for (const auto& c : cases) {
+    double scalar_ms = 0.0;
+    size_t expected = 0;
+    for (size_t impl_index = 0; impl_index < impls.size(); ++impl_index) {
+      const Impl& impl = impls[impl_index];
+      size_t checksum = 0;
+      double ms = measure_ms([&] {
+        for (int r = 0; r < kRepeats; ++r) {
+          if (c.short_strings) {
+            for (const auto& name : names) {
+              checksum += c.op(impl.kernels, name);
+            }
+          } else {
+            checksum += c.op(impl.kernels, text);
+          }
+        }
+      });
+      if (impl_index == 0) {
+        scalar_ms = ms;
+        expected = checksum;
+      } else if (checksum != expected) {
+        mismatch = true;
+      }
+      double bytes = static_cast<double>(c.short_strings ? total_bytes : text.size()) * kRepeats;
+      table.cell(c.title);
+      table.cell(impl.name);
+      table.cell_int(ms > 0.0 ? static_cast<long long>(bytes / (ms * 1000.0)) : 0);
+      table.cell_avg(ms > 0.0 ? scalar_ms / ms : 0.0);
+      table.end_row();
+    }
+  }
+  table.line();
+  if (mismatch) {
+    out.append("ОШИБКА: результаты реализаций расходятся.\n");
+    return 1;
+  }
+  return 0;
+}
+
+// Отпечаток данных для проверки, что хранилище сохранило все правки.
+uint64_t data_fingerprint(const DataStore& data) {
+  uint64_t hash = 1469598103934665603ull;
+  auto mix = [&hash](uint64_t value) { hash = (hash ^ value) * 1099511628211ull; };
+  for (const auto& student : data.students) {
+    mix(static_cast<uint64_t>(student.id));
+    mix(static_cast<uint64_t>(student.group_id));
+    mix(std::hash<std::string>()(student.name));
+  }
+  for_each_grade(data, Period(), [&](const Grade& grade) {
+    mix(static_cast<uint64_t>(grade.id));
+    mix(static_cast<uint64_t>(grade.value));
+  });
+  return hash;
+}
+
+// Псевдослучайное число для бенчмарков (линейный конгруэнтный генератор): один и тот же
+// seed дает одни и те же данные и правки.
+uint32_t bench_random(uint32_t& seed) {
+  seed = seed * 1103515245u + 12345u;
+  return seed >> 8;
+}
+
+// Бенчмарк хранилищ (--bench storage): одна и та же синтетическая последовательность
+// правок проходит через каждое хранилище, после каждой правки - синхронизация, как при
+// автосохранении из меню. Базы создаются в data/bench_storage_*.db.
+int bench_storage() {
+  const int kGroups = 20;
+  const int kSubjects = 12;
+  const int kStudents = 2000;
+  const int kGradesPerStudent = 15;
+  DataStore base;
+  for (int g = 0; g < kGroups; ++g) {
+    create_group_record(base, "Группа-" + std::to_string(g + 1));
+  }
+  for (int s = 0; s < kSubjects; ++s) {
+    create_subject_record(base, "Предмет " + std::to_string(s + 1));
+  }
+  uint32_t seed = 12345;
+  for (int i = 0; i < kStudents; ++i) {
+    int student_id = create_student_record(base, synthetic_name(bench_random(seed)), 1 + i % kGroups);
+    for (int k = 0; k < kGradesPerStudent; ++k) {
+      create_grade_record(base, student_id, 1 + k % kSubjects, kMinGrade + static_cast<int>(bench_random(seed) % 5));
+    }
+  }
+  base.pending_changes.clear();
+
+  ensure_storage_dirs();
+  OutputBuffer out(std::cout);
+  out.append("Бенчмарк хранилищ: студентов ");
+  out.append_int(kStudents);
+  out.append(", оценок ");
+  out.append_int(static_cast<long long>(grade_count(base)));
+  out.append("; правка = добавление/изменение/удаление оценки или переименование студента + синхронизация\n");
+  TableWriter table(out, {10, 7, 10, 10, 9, 9, 9, 9}, {false, true, true, true, true, true, true, false});
+  table.line();
+  table.row({"Хранилище", "Правок", "Всего мс", "Правок/с", "p50 мкс", "p99 мкс", "Макс мкс", "Проверка"});
+  table.line();
+  out.flush();
+
+  bool failed = false;
+  for (const char* name : kStorageBackendNames) {
+    std::string path = (std::filesystem::path(kDataDir) / (std::string("bench_storage_") + name + ".db")).string();
+    std::filesystem::path db_file(path);
+    std::error_code ec;
+    for (const auto& file : {db_file, std::filesystem::path(path + "-journal"),
+                             std::filesystem::path(db_file).replace_extension(".log"),
+                             std::filesystem::path(db_file).replace_extension(".log.old")}) {
+      std::filesystem::remove(file, ec);
+    }
+    db_path_override() = path;
+    if (!save_snapshot(base, path)) {
+      out.append("Не удалось создать ");
+      out.append(path);
+      out.append("\n");
+      return 1;
+    }
+
+    std::unique_ptr<StorageBackend> backend = make_storage_backend(name);
+    DataStore data;
+    if (!backend->load(data)) {
+      out.append("Не удалось загрузить ");
+      out.append(path);
+      out.append("\n");
+      return 1;
+    }
+    // Полный снимок переписывает всю базу на каждую правку: ему хватит меньшего числа правок.
+    int edits = std::string(name) == "snapshot" ? 50 : 2000;
+    seed = 777;
+    std::vector<double> latencies;
+    latencies.reserve(edits);
+    bool ok = true;
+    double total_ms = measure_ms([&]() {
+      for (int i = 0; i < edits; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        int student_id = 1 + static_cast<int>(bench_random(seed) % kStudents);
+        Grade grade;
+        bool found = find_grade(data, 1 + static_cast<int>(bench_random(seed) % (data.next_grade_id - 1)), grade);
+        switch (i % 4) {
+          case 0:
+            create_grade_record(data, student_id, 1 + i % kSubjects, kMinGrade + i % 5);
+            break;
+          case 1:
+            if (found) {
+              grade.value = kMinGrade + (grade.value % kGradeLevels);
+              replace_grade(data, grade);
+              record_change(data, Entity::kGrade, ChangeOp::kUpdate, grade.id, grade.version);
+            }
+            break;
+          case 2:
+            if (Student* student = entity_for_update(data.students, student_id)) {
+              student->name = synthetic_name(bench_random(seed));
+              record_change(data, Entity::kStudent, ChangeOp::kUpdate, student->id, student->version);
+            }
+            break;
+          case 3:
+            if (found) {
+              int id = grade.id;
+              record_change(data, Entity::kGrade, ChangeOp::kDelete, id, grade.version);
+              erase_grades_if(data, [id](const Grade& g) { return g.id == id; });
+            }
+            break;
+        }
+        SyncResult result = backend->sync(data);
+        ok = ok && result.ok && result.conflicts == 0;
+        latencies.push_back(
+            std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+      }
+    });
+    backend->close();
+
+    // Повторная загрузка должна увидеть те же данные (хранилище в памяти ничего не пишет).
+    std::string check = "-";
+    if (std::string(name) != "memory") {
+      std::unique_ptr<StorageBackend> reload = make_storage_backend(name);
+      DataStore loaded;
+      bool same = reload->load(loaded) && data_fingerprint(loaded) == data_fingerprint(data);
+      reload->close();
+      check = same ? "совпадает" : "ОШИБКА";
+      ok = ok && same;
+    }
+    failed = failed || !ok;
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) {
+      size_t index = static_cast<size_t>(p * static_cast<double>(latencies.size() - 1));
+      return static_cast<long long>(latencies[index]);
+    };
+    table.cell(name);
+    table.cell_int(edits);
+    table.cell_int(static_cast<long long>(total_ms));
+    table.cell_int(static_cast<long long>(edits * 1000.0 / std::max(total_ms, 0.001)));
+    table.cell_int(percentile(0.5));
+    table.cell_int(percentile(0.99));
+    table.cell_int(static_cast<long long>(latencies.back()));
+    table.cell(ok ? check : "ОШИБКА");
+    table.end_row();
+    out.flush();
+  }
+  table.line();
+  return failed ? 1 : 0;
+}
+
+// Бенчмарк хранения оценок (--bench grades): 10 млн оценок в упакованных партициях
+// против простого массива Grade и массива исходной записи из пяти полей (без даты,
+// семестра и версии) - память и скорость полного прохода.
+int bench_grades() {
+  const int kGrades = 10000000;
+  const int kStudents = 200000;
+  const int kSubjects = 40;
+  const int kSemesters = 8;
+  struct BaselineGrade {
+    int id = 0;
+    int student_id = 0;
+    int subject_id = 0;
+    int value = 0;
+    int attempt = 0;
+  };
+  DataStore data;
+  std::vector<Grade> plain;
+  plain.reserve(kGrades);
+  std::vector<BaselineGrade> baseline;
+  baseline.reserve(kGrades);
+  uint32_t seed = 2024;
+  double build_ms = measure_ms([&]() {
+    for (int i = 0; i < kGrades; ++i) {
+      seed = seed * 1103515245u + 12345u;
+      Grade grade;
+      grade.id = i + 1;
+      grade.student_id = 1 + static_cast<int>((seed >> 8) % kStudents);
+      grade.subject_id = 1 + static_cast<int>((seed >> 4) % kSubjects);
+      grade.value = kMinGrade + static_cast<int>((seed >> 16) % kGradeLevels);
+      grade.attempt = 1 + static_cast<int>((seed >> 20) % 3);
+      grade.semester = make_semester(2018 + (i % kSemesters) / 2, 1 + i % 2);
+      grade.created_at = 1600000000 + i;
+      grade.version = 1;
+      insert_grade(data, grade);
+      plain.push_back(grade);
+      baseline.push_back({grade.id, grade.student_id, grade.subject_id, grade.value, grade.attempt});
+    }
+  });
+  data.next_grade_id = kGrades + 1;
+  shrink_grade_storage(data);
+
+  size_t packed_bytes = 0;
+  for (const GradePartition& part : data.grade_partitions) {
+    packed_bytes += part.memory_bytes();
+  }
+  size_t plain_bytes = plain.capacity() * sizeof(Grade);
+  size_t baseline_bytes = baseline.capacity() * sizeof(BaselineGrade);
+
+  const int kRepeats = 5;
+  // Лучшее время из kRepeats проходов; fn возвращает контрольную сумму.
+  auto best_ms = [&](auto fn, int64_t& checksum) {
+    double best = std::numeric_limits<double>::max();
+    for (int r = 0; r < kRepeats; ++r) {
+      best = std::min(best, measure_ms([&]() { checksum = fn(); }));
+    }
+    return best;
+  };
+  std::vector<int64_t> by_student(kStudents + 1);
+  auto sum_packed = [&]() {
+    int64_t sum = 0;
+    for_each_grade(data, Period(), [&](const Grade& grade) { sum += grade.value; });
+    return sum;
+  };
+  auto sum_plain = [&]() {
+    int64_t sum = 0;
+    for (const auto& grade : plain) {
+      sum += grade.value;
+    }
+    return sum;
+  };
+  auto sum_baseline = [&]() {
+    int64_t sum = 0;
+    for (const auto& grade : baseline) {
+      sum += grade.value;
+    }
+    return sum;
+  };
+  auto students_packed = [&]() {
+    std::fill(by_student.begin(), by_student.end(), 0);
+    for_each_grade(data, Period(), [&](const Grade& grade) { by_student[grade.student_id] += grade.value; });
+    return by_student[1] + by_student[kStudents];
+  };
+  auto students_plain = [&]() {
+    std::fill(by_student.begin(), by_student.end(), 0);
+    for (const auto& grade : plain) {
+      by_student[grade.student_id] += grade.value;
+    }
+    return by_student[1] + by_student[kStudents];
+  };
+  auto students_baseline = [&]() {
+    std::fill(by_student.begin(), by_student.end(), 0);
+    for (const auto& grade : baseline) {
+      by_student[grade.student_id] += grade.value;
+    }
+    return by_student[1] + by_student[kStudents];
+  };
+  int64_t check_packed = 0;
+  int64_t check_plain = 0;
+  int64_t check_baseline = 0;
+  double sum_packed_ms = best_ms(sum_packed, check_packed);
+  double sum_plain_ms = best_ms(sum_plain, check_plain);
+  double sum_baseline_ms = best_ms(sum_baseline, check_baseline);
+  bool mismatch = check_packed != check_plain || check_packed != check_baseline;
+  double students_packed_ms = best_ms(students_packed, check_packed);
+  double students_plain_ms = best_ms(students_plain, check_plain);
+  double students_baseline_ms = best_ms(students_baseline, check_baseline);
+  mismatch = mismatch || check_packed != check_plain || check_packed != check_baseline;
+
+  OutputBuffer out(std::cout);
+  out.append("Бенчмарк оценок: ");
+  out.append_int(kGrades);
+  out.append(" оценок, ");
+  out.append_int(kSemesters);
+  out.append(" семестров, заполнение ");
+  out.append_int(static_cast<long long>(build_ms));
+  out.append(" мс\n");
+  TableWriter table(out, {16, 12, 10, 14, 16, 12}, {false, true, true, true, true, true});
+  table.line();
+  table.row({"Хранение", "Байт/оценку", "МБ", "Сумма мс", "По студентам мс", "Млн оценок/с"});
+  table.line();
+  auto row = [&](const char* name, size_t bytes, double sum_ms, double students_ms) {
+    table.cell(name);
+    table.cell_avg(static_cast<double>(bytes) / kGrades);
+    table.cell_int(static_cast<long long>(bytes / (1024 * 1024)));
+    table.cell_avg(sum_ms);
+    table.cell_avg(students_ms);
+    table.cell_int(static_cast<long long>(kGrades / (std::max(sum_ms, 0.001) * 1000.0)));
+    table.end_row();
+  };
+  row("PackedGrade", packed_bytes, sum_packed_ms, students_packed_ms);
+  row("Grade", plain_bytes, sum_plain_ms, students_plain_ms);
+  row("5 полей (исх.)", baseline_bytes, sum_baseline_ms, students_baseline_ms);
+  table.line();
+  // Упаковка выигрывает у нынешней Grade; исходная запись без даты и версии была
+  // такого же размера, так что по сравнению с ней выигрыш - эти поля без роста памяти.
+  out.append("Памяти меньше, чем у Grade: ");
+  out.append_avg(static_cast<double>(plain_bytes) / static_cast<double>(std::max<size_t>(packed_bytes, 1)));
+  out.append("x, чем у исходной записи из 5 полей: ");
+  out.append_avg(static_cast<double>(baseline_bytes) / static_cast<double>(std::max<size_t>(packed_bytes, 1)));
+  out.append("x\n");
+  if (mismatch) {
+    out.append("ОШИБКА: результаты проходов расходятся.\n");
+    return 1;
+  }
+  return 0;
+}
+
+// Передает вывод другому приемнику и запоминает момент первой строки таблицы.
+class FirstRowSink : public ReportSink {
+ public:
+  FirstRowSink(OutputBuffer& out, ReportSink& inner) : ReportSink(out), inner_(inner) {}
+
+  void text(std::string_view text) override { inner_.text(text); }
+  void begin_table(const std::vector<ReportColumn>& columns) override { inner_.begin_table(columns); }
+  void cell(std::string_view text) override { inner_.cell(text); }
+  void cell_int(long long value) override { inner_.cell_int(value); }
+  void cell_avg(double value) override { inner_.cell_avg(value); }
+  void cell_none(std::string_view shown) override { inner_.cell_none(shown); }
+  void end_row() override {
+    inner_.end_row();
+    if (!has_rows_) {
+      first_row_ = std::chrono::steady_clock::now();
+      has_rows_ = true;
+    }
+  }
+  void end_table() override { inner_.end_table(); }
+  void finish() override { inner_.finish(); }
+
+  // Время первой строки; до нее - момент создания приемника.
+  std::chrono::steady_clock::time_point first_row() const { return first_row_; }
+  bool has_rows() const { return has_rows_; }
+
+ private:
+  ReportSink& inner_;
+  bool has_rows_ = false;
+  std::chrono::steady_clock::time_point first_row_ = std::chrono::steady_clock::now();
+};
+
+// Синтетический журнал для бенчмарков: students студентов по grades_per_student оценок
+// по subjects предметам за semesters семестров, начиная с 2022 года; seed задает
+// последовательность имен и оценок.
+void fill_bench_store(DataStore& base, int groups, int subjects, int students, int grades_per_student,
+                      int semesters, uint32_t seed = 4242) {
+  for (int g = 0; g < groups; ++g) {
+    create_group_record(base, "Группа-" + std::to_string(g + 1));
+  }
+  for (int s = 0; s < subjects; ++s) {
+    create_subject_record(base, "Предмет " + std::to_string(s + 1));
+  }
+  // Оценки собираются напрямую, как в bench_grades: попытки считаются по ходу заполнения.
+  int grade_id = 1;
+  std::vector<int> attempts(subjects + 1);
+  for (int i = 0; i < students; ++i) {
+    int student_id = create_student_record(base, synthetic_name(bench_random(seed)), 1 + i % groups);
+    std::fill(attempts.begin(), attempts.end(), 0);
+    for (int k = 0; k < grades_per_student; ++k) {
+      Grade grade;
+      grade.id = grade_id++;
+      grade.student_id = student_id;
+      grade.subject_id = 1 + static_cast<int>(bench_random(seed) % subjects);
+      grade.value = kMinGrade + static_cast<int>(bench_random(seed) % kGradeLevels);
+      grade.attempt = ++attempts[grade.subject_id];
+      grade.semester = make_semester(2022 + (k % semesters) / 2, 1 + k % 2);
+      grade.created_at = 1650000000 + grade.id;
+      grade.version = 1;
+      insert_grade(base, grade);
+    }
+  }
+  base.next_grade_id = grade_id;
+  base.pending_changes.clear();
 }
 
-// Добавляет новый предмет.
-void add_subject(DataStore& data) {
-  std::string name = trim(read_line("Название предмета: "));
-  Subject subject;
-  subject.id = data.next_subject_id++;
-  subject.name = name;
-  data.subjects.push_back(subject);
-  std::cout << "Добавлен предмет с ID " << subject.id << ".\n";
-  autosave_or_warn(data);
+// Бенчмарк прямого чтения (--bench direct): отчеты с параметром и пересдачи через полную
+// загрузку DataStore и напрямую из базы data/bench_direct.db. Время до первой строки
+// и полное время, вывод обоих путей должен совпадать.
+int bench_direct() {
+  const int kGroups = 100;
+  const int kSubjects = 40;
+  const int kStudents = 20000;
+  const int kGradesPerStudent = 50;
+  const int kSemesters = 4;
+  std::string path = (std::filesystem::path(kDataDir) / "bench_direct.db").string();
+  ensure_storage_dirs();
+  OutputBuffer out(std::cout);
+  {
+    DataStore base;
+    fill_bench_store(base, kGroups, kSubjects, kStudents, kGradesPerStudent, kSemesters);
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+    if (!save_snapshot(base, path)) {
+      out.append("Не удалось создать ");
+      out.append(path);
+      out.append("\n");
+      return 1;
+    }
+    // Индексы обычной базы (init_db), чтобы прямые запросы шли так же, как в рабочем режиме.
+    sqlite3* db = open_db(path);
+    if (!db) {
+      return 1;
+    }
+    sqlite3_close(db);
+  }
+
+  out.append("Бенчмарк прямого чтения: студентов ");
+  out.append_int(kStudents);
+  out.append(", оценок ");
+  out.append_int(static_cast<long long>(kStudents) * kGradesPerStudent);
+  out.append("; вывод в TSV, время в мс\n");
+  TableWriter table(out, {16, 12, 12, 12, 12, 9}, {false, true, true, true, true, false});
+  table.line();
+  table.row({"Отчет", "Загрузка 1с", "Загрузка все", "Прямо 1с", "Прямо все", "Проверка"});
+  table.line();
+  out.flush();
+
+  ReportRequest request;
+  request.id = kStudents / 2;
+  const std::vector<std::pair<const char*, ReportRequest>> cases = {
+      {"journal-student", request},
+      {"journal-subject", [] {
+         ReportRequest r;
+         r.id = 7;
+         r.group = 3;
+         return r;
+       }()},
+      {"subject-detail", [] {
+         ReportRequest r;
+         r.id = 7;
+         return r;
+       }()},
+      {"retakes", ReportRequest()},
+  };
+  // Прогоняет отчет; возвращает полное время, first_ms - время до первой строки.
+  auto run = [](std::string& text, double& first_ms, auto&& render) {
+    text.clear();
+    std::ostringstream stream;
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point first = start;
+    bool has_rows = false;
+    double total_ms = measure_ms([&]() {
+      OutputBuffer buffer(stream);
+      std::unique_ptr<ReportSink> sink = make_report_sink(ReportFormat::kTsv, buffer);
+      FirstRowSink timed(buffer, *sink);
+      render(timed);
+      timed.finish();
+      first = timed.first_row();
+      has_rows = timed.has_rows();
+    });
+    first_ms = has_rows ? std::chrono::duration<double, std::milli>(first - start).count() : total_ms;
+    text = stream.str();
+    return total_ms;
+  };
+  db_path_override() = path;
+  bool failed = false;
+  for (const auto& [name, req] : cases) {
+    const ReportEntry* entry = find_report(name);
+    const DirectReport* direct = find_direct_report(name);
+    std::string loaded_text;
+    std::string direct_text;
+    double loaded_first = 0.0;
+    double direct_first = 0.0;
+    double loaded_ms = run(loaded_text, loaded_first, [&](ReportSink& sink) {
+      std::unique_ptr<StorageBackend> backend = make_storage_backend("sqlite");
+      DataStore data;
+      if (backend->load(data)) {
+        entry->render(data, req, sink);
+      }
+      backend->close();
+    });
+    double direct_ms = run(direct_text, direct_first, [&](ReportSink& sink) {
+      sqlite3* db = open_db_readonly(path);
+      if (db && exec_sql(db, "BEGIN;")) {
+        direct->render(db, req, sink);
+        exec_sql(db, "COMMIT;");
+      }
+      if (db) {
+        sqlite3_close(db);
+      }
+    });
+    bool same = !loaded_text.empty() && loaded_text == direct_text;
+    failed = failed || !same;
+    table.cell(name);
+    table.cell_avg(loaded_first);
+    table.cell_avg(loaded_ms);
+    table.cell_avg(direct_first);
+    table.cell_avg(direct_ms);
+    table.cell(same ? "совпадает" : "ОШИБКА");
+    table.end_row();
+    out.flush();
+  }
+  table.line();
+  return failed ? 1 : 0;
 }
 
-// Редактирует данные предмета.
-void edit_subject(DataStore& data) {
-  if (data.subjects.empty()) {
-    std::cout << "Нет предметов для редактирования.\n";
-    return;
+// Бенчмарк арены отчетов (--bench arena): журналы и отчеты с параметром на синтетическом
+// журнале в памяти, временные контейнеры - из кучи и из арены. Выделения считаются
+// через report_memory_stats(), вывод обоих вариантов должен совпадать.
+int bench_arena() {
+  const int kStudents = 20000;
+  const int kGradesPerStudent = 50;
+  const int kStudentJournals = 500;
+  const int kRepeats = 3;
+  DataStore data;
+  fill_bench_store(data, 100, 40, kStudents, kGradesPerStudent, 4);
+
+  struct Case {
+    const char* name;
+    std::function<void(ReportSink&)> render;
+  };
+  auto render = [&data](const char* name, ReportRequest request) {
+    const ReportEntry* entry = find_report(name);
+    return [&data, entry, request](ReportSink& sink) { entry->render(data, request, sink); };
+  };
+  ReportRequest subject_request;
+  subject_request.id = 7;
+  const std::vector<Case> cases = {
+      {"journal", render("journal", ReportRequest())},
+      {"journal-subject", render("journal-subject", subject_request)},
+      {"subject-detail", render("subject-detail", subject_request)},
+      {"retakes", render("retakes", ReportRequest())},
+      {"journal-student", [&data](ReportSink& sink) {
+         const ReportEntry* entry = find_report("journal-student");
+         ReportRequest request;
+         for (int i = 0; i < kStudentJournals; ++i) {
+           request.id = 1 + i * (kStudents / kStudentJournals);
+           entry->render(data, request, sink);
+         }
+       }},
+  };
+
+  OutputBuffer out(std::cout);
+  out.append("Бенчмарк арены отчетов: студентов ");
+  out.append_int(kStudents);
+  out.append(", оценок ");
+  out.append_int(static_cast<long long>(grade_count(data)));
+  out.append("; journal-student - ");
+  out.append_int(kStudentJournals);
+  out.append(" журналов подряд, вывод в TSV\n");
+  TableWriter table(out, {16, 12, 10, 10, 12, 10, 10, 9},
+                    {false, true, true, true, true, true, true, false});
+  table.line();
+  table.row({"Отчет", "Куча выдел.", "Куча МБ", "Куча мс", "Арена выдел.", "Арена МБ", "Арена мс", "Проверка"});
+  table.line();
+  out.flush();
+
+  bool failed = false;
+  for (const auto& c : cases) {
+    std::string texts[2];
+    uint64_t allocations[2] = {};
+    uint64_t bytes[2] = {};
+    double ms[2] = {};
+    for (int arena = 0; arena < 2; ++arena) {
+      report_arena_enabled() = arena == 1;
+      ms[arena] = std::numeric_limits<double>::max();
+      // Лучшее время из kRepeats прогонов; счетчики одинаковы в каждом.
+      for (int r = 0; r < kRepeats; ++r) {
+        ReportMemoryStats& stats = report_memory_stats();
+        stats.allocations = 0;
+        stats.bytes = 0;
+        std::ostringstream stream;
+        ms[arena] = std::min(ms[arena], measure_ms([&]() {
+          OutputBuffer buffer(stream);
+          DelimitedSink sink(buffer, false);
+          c.render(sink);
+          sink.finish();
+        }));
+        allocations[arena] = stats.allocations;
+        bytes[arena] = stats.bytes;
+        texts[arena] = stream.str();
+      }
+    }
+    bool same = !texts[0].empty() && texts[0] == texts[1];
+    failed = failed || !same;
+    table.cell(c.name);
+    for (int arena = 0; arena < 2; ++arena) {
+      table.cell_int(static_cast<long long>(allocations[arena]));
+      table.cell_avg(static_cast<double>(bytes[arena]) / (1024.0 * 1024.0));
+      table.cell_avg(ms[arena]);
+    }
+    table.cell(same ? "совпадает" : "ОШИБКА");
+    table.end_row();
+    out.flush();
   }
-  print_subjects_simple(data);
-  int id = read_int("ID предмета для редактирования: ", 1, std::numeric_limits<int>::max());
-  Subject* subject = find_subject(data, id);
-  if (!subject) {
-    std::cout << "Предмет не найден.\n";
-    return;
+  report_arena_enabled() = true;
+  table.line();
+  return failed ? 1 : 0;
+}
+
+// Бенчмарк агрегации (--bench aggregates): проходы отчетов по 1 млн оценок с промежуточными
+// итогами в std::map (узел на ключ) и в плоских таблицах по слотам EntitySlots. Для каждого
+// прохода - лучшее время из нескольких прогонов и сверка контрольной суммы результатов.
+int bench_aggregates() {
+  const int kStudents = 20000;
+  const int kGradesPerStudent = 50;
+  const int kStudentRows = 50;
+  const int kSubjectId = 7;
+  const int kRepeats = 3;
+  DataStore data;
+  fill_bench_store(data, 100, 40, kStudents, kGradesPerStudent, 4);
+  const Period period;
+
+  // Контрольная сумма результата прохода: ключи и значения по порядку ключей.
+  struct Case {
+    const char* name;
+    std::function<double()> by_map;
+    std::function<double()> flat;
+  };
+  auto average_of = [](int64_t sum, int count) { return static_cast<double>(sum) / static_cast<double>(count); };
+  const std::vector<Case> cases = {
+      {"overall",
+       [&]() {
+         std::map<int, std::map<int, SubjectAggregate>> table;
+         for_each_grade(data, period, [&](const Grade& grade) {
+           SubjectAggregate& agg = table[grade.student_id][grade.subject_id];
+           agg.sum += grade.value;
+           agg.count += 1;
+         });
+         double checksum = 0.0;
+         for (const auto& student : table) {
+           double sum = 0.0;
+           for (const auto& entry : student.second) {
+             sum += average_of(entry.second.sum, entry.second.count);
+           }
+           checksum += student.first * (sum / static_cast<double>(student.second.size()));
+         }
+         return checksum;
+       },
+       [&]() {
+         std::vector<double> averages = student_averages(data, period);
+         double checksum = 0.0;
+         for (size_t i = 0; i < averages.size(); ++i) {
+           if (averages[i] >= 0.0) {
+             checksum += data.students[i].id * averages[i];
+           }
+         }
+         return checksum;
+       }},
+      {"subjects",
+       [&]() {
+         std::map<int, SubjectTotal> totals;
+         for_each_grade(data, period, [&](const Grade& grade) {
+           SubjectTotal& total = totals[grade.subject_id];
+           total.sum += grade.value;
+           ++total.count;
+         });
+         double checksum = 0.0;
+         for (const auto& entry : totals) {
+           checksum += entry.first * entry.second.average();
+         }
+         return checksum;
+       },
+       [&]() {
+         std::vector<SubjectTotal> totals = subject_totals(data, period);
+         double checksum = 0.0;
+         for (size_t i = 0; i < totals.size(); ++i) {
+           if (totals[i].count > 0) {
+             checksum += data.subjects[i].id * totals[i].average();
+           }
+         }
+         return checksum;
+       }},
+      {"student-subjects",
+       [&]() {
+         double checksum = 0.0;
+         for (int i = 0; i < kStudentRows; ++i) {
+           int student_id = 1 + i * (kStudents / kStudentRows);
+           std::map<int, SubjectAggregate> table;
+           for_each_grade(data, period, [&](const Grade& grade) {
+             if (grade.student_id == student_id) {
+               SubjectAggregate& agg = table[grade.subject_id];
+               agg.sum += grade.value;
+               agg.count += 1;
+             }
+           });
+           for (const auto& entry : table) {
+             checksum += entry.first * average_of(entry.second.sum, entry.second.count);
+           }
+         }
+         return checksum;
+       },
+       [&]() {
+         double checksum = 0.0;
+         for (int i = 0; i < kStudentRows; ++i) {
+           int student_id = 1 + i * (kStudents / kStudentRows);
+           for (const auto& entry : subject_aggregates_for_student(data, student_id, period)) {
+             checksum += entry.first * average_of(entry.second.sum, entry.second.count);
+           }
+         }
+         return checksum;
+       }},
+      {"subject-grades",
+       [&]() {
+         std::map<int, std::vector<int>> grades;
+         for_each_grade(data, period, [&](const Grade& grade) {
+           if (grade.subject_id == kSubjectId) {
+             grades[grade.student_id].push_back(grade.value);
+           }
+         });
+         double checksum = 0.0;
+         for (const auto& entry : grades) {
+           for (int value : entry.second) {
+             checksum += entry.first * value;
+           }
+         }
+         return checksum;
+       },
+       [&]() {
+         ReportArena arena;
+         GradeRuns grades = subject_grades_by_student(data, kSubjectId, period, arena.resource());
+         double checksum = 0.0;
+         grades.for_each([&](int student_id, GradeValues values) {
+           for (int value : values) {
+             checksum += student_id * value;
+           }
+         });
+         return checksum;
+       }},
+  };
+
+  OutputBuffer out(std::cout);
+  out.append("Бенчмарк агрегации: студентов ");
+  out.append_int(kStudents);
+  out.append(", предметов ");
+  out.append_int(static_cast<long long>(data.subjects.size()));
+  out.append(", оценок ");
+  out.append_int(static_cast<long long>(grade_count(data)));
+  out.append("; student-subjects - ");
+  out.append_int(kStudentRows);
+  out.append(" студентов подряд\n");
+  TableWriter table(out, {18, 12, 12, 10, 9}, {false, true, true, true, false});
+  table.line();
+  table.row({"Проход", "std::map мс", "Плоско мс", "Ускорение", "Проверка"});
+  table.line();
+  out.flush();
+
+  bool failed = false;
+  for (const auto& c : cases) {
+    double checksums[2] = {};
+    double ms[2] = {std::numeric_limits<double>::max(), std::numeric_limits<double>::max()};
+    for (int r = 0; r < kRepeats; ++r) {
+      ms[0] = std::min(ms[0], measure_ms([&]() { checksums[0] = c.by_map(); }));
+      ms[1] = std::min(ms[1], measure_ms([&]() { checksums[1] = c.flat(); }));
+    }
+    // Суммы складываются в одном порядке (по возрастанию ID), поэтому совпадают точно.
+    bool same = checksums[0] != 0.0 && checksums[0] == checksums[1];
+    failed = failed || !same;
+    table.cell(c.name);
+    table.cell_avg(ms[0]);
+    table.cell_avg(ms[1]);
+    table.cell_avg(ms[1] > 0.0 ? ms[0] / ms[1] : 0.0);
+    table.cell(same ? "совпадает" : "ОШИБКА");
+    table.end_row();
+    out.flush();
+  }
+  table.line();
+  return failed ? 1 : 0;
+}
+
+// Бенчмарк факультетов (--bench shards): kShards баз в data/bench_shards/ с разными
+// студентами и общим списком предметов. Загрузка и отчеты по всем базам в одном потоке
+// и параллельно; вывод обоих путей сверяется, топ-N - еще и с полной сортировкой
+// рейтингов всех баз.
+int bench_shards() {
+  const int kShards = 16;
+  const int kStudents = 2000;
+  const int kGradesPerStudent = 50;
+  const int kTopN = 100;
+  const int kRepeats = 3;
+  ensure_storage_dirs();
+  std::filesystem::path dir = std::filesystem::path(kDataDir) / "bench_shards";
+  std::error_code ec;
+  std::filesystem::remove_all(dir, ec);
+  std::filesystem::create_directories(dir, ec);
+  std::vector<std::string> paths;
+  for (int i = 0; i < kShards; ++i) {
+    DataStore base;
+    fill_bench_store(base, 10, 40, kStudents, kGradesPerStudent, 4, 4242 + static_cast<uint32_t>(i) * 7919u);
+    std::string number = std::to_string(i + 1);
+    std::string path = (dir / ("faculty_" + std::string(2 - std::min<size_t>(2, number.size()), '0') + number + ".db"))
+                           .string();
+    if (!save_snapshot(base, path)) {
+      std::cout << "Не удалось создать " << path << "\n";
+      return 1;
+    }
+    paths.push_back(path);
+  }
+
+  unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+  OutputBuffer out(std::cout);
+  out.append("Бенчмарк факультетов: баз ");
+  out.append_int(kShards);
+  out.append(", студентов в базе ");
+  out.append_int(kStudents);
+  out.append(", оценок всего ");
+  out.append_int(static_cast<long long>(kShards) * kStudents * kGradesPerStudent);
+  out.append(", потоков ");
+  out.append_int(cores);
+  out.append("; top - первые ");
+  out.append_int(kTopN);
+  out.append("\n");
+  TableWriter table(out, {16, 12, 14, 9}, {false, true, true, false});
+  table.line();
+  table.row({"Этап", "1 поток мс", "Параллельно мс", "Проверка"});
+  table.line();
+  out.flush();
+
+  bool failed = false;
+  std::vector<Shard> shards;
+  std::vector<Shard> serial;
+  double load_serial = measure_ms([&]() { serial = load_shards(paths, 1); });
+  double load_parallel = measure_ms([&]() { shards = load_shards(paths, 0); });
+  bool loaded = shards.size() == serial.size();
+  for (size_t i = 0; loaded && i < shards.size(); ++i) {
+    loaded = shards[i].loaded && serial[i].loaded && grade_count(shards[i].data) == grade_count(serial[i].data);
+  }
+  serial.clear();
+  failed = !loaded;
+  table.cell("загрузка");
+  table.cell_avg(load_serial);
+  table.cell_avg(load_parallel);
+  table.cell(loaded ? "совпадает" : "ОШИБКА");
+  table.end_row();
+  out.flush();
+  if (!loaded) {
+    table.line();
+    return 1;
+  }
+
+  ReportRequest request;
+  request.n = kTopN;
+  for (const auto& report : kShardReports) {
+    std::string texts[2];
+    double ms[2] = {std::numeric_limits<double>::max(), std::numeric_limits<double>::max()};
+    for (int r = 0; r < kRepeats; ++r) {
+      for (int parallel = 0; parallel < 2; ++parallel) {
+        std::ostringstream stream;
+        ms[parallel] = std::min(ms[parallel], measure_ms([&]() {
+          OutputBuffer buffer(stream);
+          DelimitedSink sink(buffer, false);
+          report.render(shards, request, parallel == 1 ? 0 : 1, sink);
+          sink.finish();
+        }));
+        texts[parallel] = stream.str();
+      }
+    }
+    bool same = !texts[0].empty() && texts[0] == texts[1];
+    if (std::string(report.name) == "top") {
+      // Проверка слияния: полный рейтинг всех баз, устойчиво отсортированный по баллу.
+      std::vector<ShardRanked> all;
+      for (size_t i = 0; i < shards.size(); ++i) {
+        for (const auto& entry : ranked_students(shards[i].data, request.period)) {
+          all.push_back({i, entry});
+        }
+      }
+      std::stable_sort(all.begin(), all.end(),
+                       [](const ShardRanked& a, const ShardRanked& b) { return a.entry.avg > b.entry.avg; });
+      all.resize(std::min<size_t>(all.size(), kTopN));
+      std::vector<ShardRanked> merged = top_across_shards(shards, request.period, kTopN, 0);
+      same = same && merged.size() == all.size();
+      for (size_t i = 0; same && i < merged.size(); ++i) {
+        same = merged[i].shard == all[i].shard && merged[i].entry.student_id == all[i].entry.student_id;
+      }
+    }
+    failed = failed || !same;
+    table.cell(report.name);
+    table.cell_avg(ms[0]);
+    table.cell_avg(ms[1]);
+    table.cell(same ? "совпадает" : "ОШИБКА");
+    table.end_row();
+    out.flush();
+  }
+  table.line();
+  return failed ? 1 : 0;
+}
+
+// Бенчмарк снимков (--bench snapshot): цена снимка DataStore с копированием при записи
+// против полной копии таблиц и задержка правок, когда после каждой правки публикуется
+// снимок, а фоновый поток все это время строит по снимкам сводный отчет. Поток проверяет,
+// что снимок не меняется, пока его читают.
+int bench_snapshot() {
+  const int kStudents = 20000;
+  const int kGradesPerStudent = 50;
+  const int kSemesters = 8;
+  const int kEdits = 500;
+  const int kRepeats = 5;
+  DataStore data;
+  fill_bench_store(data, 100, 40, kStudents, kGradesPerStudent, kSemesters);
+
+  OutputBuffer out(std::cout);
+  out.append("Бенчмарк снимков: студентов ");
+  out.append_int(kStudents);
+  out.append(", оценок ");
+  out.append_int(static_cast<long long>(grade_count(data)));
+  out.append(", партиций ");
+  out.append_int(static_cast<long long>(data.grade_partitions.size()));
+  out.append("\n");
+  // Снимок копирует и несохраненные правки: меряем с kEdits правками в pending_changes.
+  for (int id = 1; id <= kEdits; ++id) {
+    record_change(data, Entity::kGrade, ChangeOp::kUpdate, id, 1);
+  }
+  double full_ms = std::numeric_limits<double>::max();
+  double cow_ms = std::numeric_limits<double>::max();
+  for (int r = 0; r < kRepeats; ++r) {
+    full_ms = std::min(full_ms, measure_ms([&]() {
+      DataStore copy = data;
+      copy.students.write();
+      copy.groups.write();
+      copy.subjects.write();
+      for (auto& part : copy.grade_partitions) {
+        part.write();
+      }
+      copy.retakes.detach();
+    }));
+    cow_ms = std::min(cow_ms, measure_ms([&]() { std::make_shared<const DataStore>(data); }));
+  }
+  out.append("Полная копия: ");
+  out.append_avg(full_ms);
+  out.append(" мс, снимок: ");
+  out.append_avg(cow_ms * 1000.0);
+  out.append(" мкс (несохраненных правок ");
+  out.append_int(kEdits);
+  out.append(")\n");
+
+  TableWriter table(out, {30, 8, 10, 10, 10, 8, 9}, {false, true, true, true, true, true, false});
+  table.line();
+  table.row({"Правки", "Правок", "p50 мкс", "p99 мкс", "Макс мкс", "Отчетов", "Проверка"});
+  table.line();
+  out.flush();
+
+  uint32_t seed = 7;
+  // Правка как в меню: оценка меняется на месте, каждая десятая правка - имя студента;
+  // правки копятся в pending_changes (синхронизации нет), и снимок копирует их вместе
+  // с RetakeIndex, так что их цена входит в задержку.
+  auto edit = [&](int i) {
+    Grade grade;
+    if (find_grade(data, 1 + static_cast<int>(bench_random(seed) % static_cast<uint32_t>(data.next_grade_id - 1)),
+                   grade)) {
+      grade.value = kMinGrade + (grade.value - kMinGrade + 1) % kGradeLevels;
+      replace_grade(data, grade);
+      record_change(data, Entity::kGrade, ChangeOp::kUpdate, grade.id, grade.version);
+    }
+    if (i % 10 == 0) {
+      int student_id = 1 + static_cast<int>(bench_random(seed) % static_cast<uint32_t>(kStudents));
+      if (Student* student = entity_for_update(data.students, student_id)) {
+        student->name = synthetic_name(bench_random(seed));
+        record_change(data, Entity::kStudent, ChangeOp::kUpdate, student->id, student->version);
+      }
+    }
+  };
+
+  // Режимы: без снимков; снимок после каждой правки; то же с отчетами в фоновом потоке.
+  const char* const kModes[] = {"без снимков", "снимок после каждой", "снимок и отчеты в фоне"};
+  bool failed = false;
+  for (int mode = 0; mode < 3; ++mode) {
+    bool with_snapshots = mode > 0;
+    data.pending_changes.clear();  // каждый режим начинает с пустого списка правок
+    std::shared_ptr<const DataStore> published = std::make_shared<const DataStore>(data);
+    std::atomic<bool> done{false};
+    std::atomic<bool> torn{false};
+    long long reports = 0;
+    std::thread reader;
+    if (mode == 2) {
+      reader = std::thread([&]() {
+        while (!done.load()) {
+          std::shared_ptr<const DataStore> snapshot = std::atomic_load(&published);
+          uint64_t before = data_fingerprint(*snapshot);
+          std::ostringstream stream;
+          OutputBuffer report_out(stream);
+          TableSink sink(report_out);
+          render_overall_averages(*snapshot, ReportRequest(), sink);
+          if (data_fingerprint(*snapshot) != before) {
+            torn = true;
+          }
+          ++reports;
+        }
+      });
+    }
+    std::vector<double> latencies;
+    latencies.reserve(kEdits);
+    for (int i = 0; i < kEdits; ++i) {
+      auto start = std::chrono::steady_clock::now();
+      edit(i);
+      if (with_snapshots) {
+        std::atomic_store(&published, std::make_shared<const DataStore>(data));
+      }
+      latencies.push_back(
+          std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+    done = true;
+    if (reader.joinable()) {
+      reader.join();
+    }
+    failed = failed || torn;
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) {
+      size_t index = static_cast<size_t>(p * static_cast<double>(latencies.size() - 1));
+      return static_cast<long long>(latencies[index]);
+    };
+    table.cell(kModes[mode]);
+    table.cell_int(kEdits);
+    table.cell_int(percentile(0.5));
+    table.cell_int(percentile(0.99));
+    table.cell_int(static_cast<long long>(latencies.back()));
+    table.cell_int(reports);
+    table.cell(mode < 2 ? "-" : (torn ? "ОШИБКА" : "совпадает"));
+    table.end_row();
+    out.flush();
+  }
+  table.line();
+  return failed ? 1 : 0;
+}
+
+// Бенчмарк ведомости (--bench sheet): kSheetGrades оценок по одному предмету вводятся
+// по одной (номер попытки - проход по всем оценкам, после каждой оценки - синхронизация,
+// как в add_grade, но без печати списков) и ведомостью (create_sheet_grades, одна
+// синхронизация). База - data/bench_sheet.db в хранилище sqlite; после записи данные
+// перечитываются, и новые оценки обоих режимов сверяются.
+int bench_sheet() {
+  const int kStudents = 4000;
+  const int kGradesPerStudent = 25;
+  const int kSheetGrades = 1000;
+  const int kSubjectId = 1;
+  DataStore base;
+  fill_bench_store(base, 40, 12, kStudents, kGradesPerStudent, 4);
+  int first_new_id = base.next_grade_id;
+  std::vector<SheetEntry> entries;
+  for (int i = 0; i < kSheetGrades; ++i) {
+    entries.push_back({1 + i, kMinGrade + i % kGradeLevels});
   }
-  bool changed = false;
-  std::string new_name = trim(read_line("Новое название (пусто - оставить): ", true));
-  if (!new_name.empty() && new_name != subject->name) {
-    subject->name = new_name;
-    changed = true;
+
+  ensure_storage_dirs();
+  std::string path = (std::filesystem::path(kDataDir) / "bench_sheet.db").string();
+  OutputBuffer out(std::cout);
+  out.append("Бенчмарк ведомости: студентов ");
+  out.append_int(kStudents);
+  out.append(", оценок ");
+  out.append_int(static_cast<long long>(grade_count(base)));
+  out.append("; вводится ");
+  out.append_int(kSheetGrades);
+  out.append(" оценок по одному предмету\n");
+  TableWriter table(out, {12, 8, 10, 10, 11, 9}, {false, true, true, true, true, false});
+  table.line();
+  table.row({"Ввод", "Оценок", "Всего мс", "Оценок/с", "Транзакций", "Проверка"});
+  table.line();
+  out.flush();
+
+  bool failed = false;
+  uint64_t expected = 0;
+  for (int mode = 0; mode < 2; ++mode) {
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+    close_db_session();
+    db_path_override() = path;
+    if (!save_snapshot(base, path)) {
+      out.append("Не удалось создать ");
+      out.append(path);
+      out.append("\n");
+      return 1;
+    }
+    std::unique_ptr<StorageBackend> backend = make_storage_backend("sqlite");
+    DataStore data;
+    if (!backend->load(data)) {
+      out.append("Не удалось загрузить ");
+      out.append(path);
+      out.append("\n");
+      return 1;
+    }
+    bool ok = true;
+    int transactions = 0;
+    double ms = measure_ms([&]() {
+      if (mode == 0) {
+        for (const auto& entry : entries) {
+          create_grade_record(data, entry.student_id, kSubjectId, entry.value);
+          ok = backend->sync(data).ok && ok;
+          ++transactions;
+        }
+      } else {
+        create_sheet_grades(data, kSubjectId, entries);
+        ok = backend->sync(data).ok && ok;
+        ++transactions;
+      }
+    });
+    backend->close();
+
+    // Новые оценки после перечитывания: студент, предмет, значение и номер попытки.
+    std::unique_ptr<StorageBackend> reload = make_storage_backend("sqlite");
+    DataStore loaded;
+    uint64_t hash = 1469598103934665603ull;
+    int added = 0;
+    if (reload->load(loaded)) {
+      for_each_grade(loaded, Period(), [&](const Grade& grade) {
+        if (grade.id >= first_new_id) {
+          for (int value : {grade.id, grade.student_id, grade.subject_id, grade.value, grade.attempt}) {
+            hash = (hash ^ static_cast<uint64_t>(value)) * 1099511628211ull;
+          }
+          ++added;
+        }
+      });
+    }
+    reload->close();
+    if (mode == 0) {
+      expected = hash;
+    }
+    ok = ok && added == kSheetGrades && hash == expected;
+    failed = failed || !ok;
+    table.cell(mode == 0 ? "по одной" : "ведомостью");
+    table.cell_int(kSheetGrades);
+    table.cell_int(static_cast<long long>(ms));
+    table.cell_int(static_cast<long long>(kSheetGrades * 1000.0 / std::max(ms, 0.001)));
+    table.cell_int(transactions);
+    table.cell(ok ? (mode == 0 ? "-" : "совпадает") : "ОШИБКА");
+    table.end_row();
+    out.flush();
+  }
+  close_db_session();
+  table.line();
+  return failed ? 1 : 0;
+}
+
+// Бенчмарк пересдач (--bench retakes): список пересдач за всю историю проходом по всем
+// оценкам и из множества пересдач хранилища; затем kEdits новых последних попыток, после
+// каждой - снова список. Списки обоих путей сверяются по контрольной сумме.
+int bench_retakes() {
+  const int kStudents = 20000;
+  const int kGradesPerStudent = 50;
+  const int kEdits = 50;
+  const int kRepeats = 3;
+  DataStore data;
+  fill_bench_store(data, 100, 40, kStudents, kGradesPerStudent, 4);
+  const Period period;
+
+  auto checksum_of = [](const DataStore& store, bool scan) {
+    uint64_t hash = 1469598103934665603ull;
+    auto add = [&hash](const Student& student, const Subject& subject, int value) {
+      for (int field : {student.id, subject.id, value}) {
+        hash = (hash ^ static_cast<uint64_t>(field)) * 1099511628211ull;
+      }
+    };
+    if (scan) {
+      for_each_retake_scan(store, Period(), add);
+    } else {
+      for_each_retake(store, Period(), add);
+    }
+    return hash;
+  };
+  // Новая попытка студента по предмету: попеременно неуд и сдача.
+  auto add_attempt = [](DataStore& store, int k) {
+    Grade grade;
+    grade.id = store.next_grade_id++;
+    grade.student_id = 1 + k * (kStudents / kEdits);
+    grade.subject_id = 1 + k % 40;
+    grade.value = k % 2 == 0 ? kMinGrade : kMaxGrade;
+    grade.attempt = 1;
+    grade.semester = make_semester(2024, kSemesterAutumn);
+    grade.created_at = 1700000000 + grade.id;
+    grade.version = 1;
+    insert_grade(store, grade);
+  };
+
+  size_t debts = 0;
+  for_each_retake(data, period, [&debts](const Student&, const Subject&, int) { ++debts; });
+  OutputBuffer out(std::cout);
+  out.append("Бенчмарк пересдач: студентов ");
+  out.append_int(kStudents);
+  out.append(", оценок ");
+  out.append_int(static_cast<long long>(grade_count(data)));
+  out.append(", долгов ");
+  out.append_int(static_cast<long long>(debts));
+  out.append("; правки - ");
+  out.append_int(kEdits);
+  out.append(" новых попыток, после каждой список пересдач\n");
+  TableWriter table(out, {14, 12, 12, 10, 9}, {false, true, true, true, false});
+  table.line();
+  table.row({"Проход", "Оценки мс", "Индекс мс", "Ускорение", "Проверка"});
+  table.line();
+  out.flush();
+
+  bool failed = false;
+  auto report = [&](const char* name, double scan_ms, double index_ms, bool same) {
+    failed = failed || !same;
+    table.cell(name);
+    table.cell_avg(scan_ms);
+    table.cell_avg(index_ms);
+    table.cell_avg(index_ms > 0.0 ? scan_ms / index_ms : 0.0);
+    table.cell(same ? "совпадает" : "ОШИБКА");
+    table.end_row();
+    out.flush();
+  };
+
+  uint64_t checksums[2] = {};
+  double ms[2] = {std::numeric_limits<double>::max(), std::numeric_limits<double>::max()};
+  for (int r = 0; r < kRepeats; ++r) {
+    ms[0] = std::min(ms[0], measure_ms([&]() { checksums[0] = checksum_of(data, true); }));
+    ms[1] = std::min(ms[1], measure_ms([&]() { checksums[1] = checksum_of(data, false); }));
+  }
+  report("список", ms[0], ms[1], checksums[0] == checksums[1]);
+
+  // Обе копии получают одни и те же попытки; множество пересдач поддерживает каждая.
+  DataStore copies[2] = {data, data};
+  for (int mode = 0; mode < 2; ++mode) {
+    ms[mode] = measure_ms([&]() {
+      for (int k = 0; k < kEdits; ++k) {
+        add_attempt(copies[mode], k);
+        checksums[mode] = checksum_of(copies[mode], mode == 0);
+      }
+    });
   }
-  std::cout << "Предмет обновлен.\n";
-  if (changed) {
-    autosave_or_warn(data);
+  report("правки", ms[0], ms[1], checksums[0] == checksums[1] && checksums[1] == checksum_of(copies[0], false));
+  table.line();
+  return failed ? 1 : 0;
+}
+
+// Запускает бенчмарк по имени (режим --bench).
+int run_benchmark(const std::string& name) {
+  if (name == "utf8") {
+    return bench_utf8();
+  }
+  if (name == "storage") {
+    return bench_storage();
   }
+  if (name == "grades") {
+    return bench_grades();
+  }
+  if (name == "direct") {
+    return bench_direct();
+  }
+  if (name == "arena") {
+    return bench_arena();
+  }
+  if (name == "aggregates") {
+    return bench_aggregates();
+  }
+  if (name == "shards") {
+    return bench_shards();
+  }
+  if (name == "snapshot") {
+    return bench_snapshot();
+  }
+  if (name == "sheet") {
+    return bench_sheet();
+  }
+  if (name == "retakes") {
+    return bench_retakes();
+  }
+  std::cout << "Неизвестный бенчмарк: " << name
+            << ". Доступны: utf8, storage, grades, direct, arena, aggregates, shards, snapshot, sheet, retakes.\n";
+  return 2;
 }
 
-// Удаляет предмет и связанные оценки.
-void delete_subject(DataStore& data) {
-  if (data.subjects.empty()) {
-    std::cout << "Нет предметов для удаления.\n";
-    return;
+const char* kStressGroupName = "Нагрузка";
+const char* kStressSubjectName = "Проверка";
+
+constexpr int kStressRollbackWaitMs = 50;
+constexpr int kStressRollbackAttempts = 20;
+// Код выхода процесса, который отработал без ошибок, но не застал смену ID в
+// откаченной транзакции (см. stress_forced_rollback).
+constexpr int kStressExitNoRemap = 3;
+
+// Записывает предмет процесса через откаченную транзакцию: процесс 1 записывает свой
+// предмет сразу, остальные заводят предмет с тем же ID (данные загружены до его записи),
+// дожидаются предмета процесса 1 в базе и пишут свой, держа блокировку чтения вторым
+// соединением, поэтому COMMIT не получает монопольный доступ и транзакция откатывается
+// уже после смены занятого ID. Повторная запись должна найти предмет по новому ID.
+// Возвращает true, если ID сменился в откаченной транзакции.
+bool stress_forced_rollback(DataStore& data, int worker, const std::function<int()>& sync_until_ok) {
+  std::string name = "Процесс " + std::to_string(worker);
+  int subject_id = create_subject_record(data, name);
+  bool remapped = false;
+  sqlite3* reader = worker > 1 ? open_db_readonly(db_path()) : nullptr;
+  if (reader) {
+    for (int waited = 0; waited < kBusyTimeoutMs &&
+                         query_int64(reader, "SELECT COUNT(*) FROM subjects WHERE name = 'Процесс 1';", 0, 0) == 0;
+         waited += kStressRollbackWaitMs) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(kStressRollbackWaitMs));
+    }
+    sqlite3* db = db_session().db;
+    sqlite3_busy_timeout(db, kStressRollbackWaitMs);
+    // "database is locked" здесь - ожидаемый исход, а не ошибка.
+    sqlite_errors_expected() = true;
+    // Попытка может прерваться и раньше (BEGIN IMMEDIATE ждет запись другого процесса).
+    for (int attempt = 0; attempt < kStressRollbackAttempts && !remapped; ++attempt) {
+      bool locked = exec_sql(reader, "BEGIN;") && read_change_seq(reader) >= 0;
+      bool saved = locked && sync_with_db(data).ok;
+      exec_sql(reader, "COMMIT;");
+      if (!locked || saved) {
+        break;
+      }
+      for (const auto& row : data.subjects) {
+        if (row.name == name && row.id != subject_id) {
+          remapped = true;
+        }
+      }
+    }
+    sqlite_errors_expected() = false;
+    sqlite3_busy_timeout(db, kBusyTimeoutMs);
+    sqlite3_close(reader);
   }
-  print_subjects_simple(data);
-  int id = read_int("ID предмета для удаления: ", 1, std::numeric_limits<int>::max());
-  auto it = std::find_if(data.subjects.begin(), data.subjects.end(),
-                         [id](const Subject& s) { return s.id == id; });
-  if (it == data.subjects.end()) {
-    std::cout << "Предмет не найден.\n";
-    return;
+  sync_until_ok();
+  return remapped;
+}
+
+// Процесс нагрузочной проверки (--stress-worker K N): заводит своего студента, ставит ему
+// N оценок и N раз дописывает метку "K.i" в название общей группы с повтором при конфликте.
+int run_stress_worker(int worker, int iterations) {
+  DataStore data;
+  if (!db_session().db || !load_data(data, db_path()) || data.groups.empty() || data.subjects.empty()) {
+    std::cout << "Процесс " << worker << ": база не подготовлена.\n";
+    return 1;
+  }
+  int group_id = data.groups.front().id;
+  int subject_id = data.subjects.front().id;
+  std::string student_name = "Процесс " + std::to_string(worker);
+  int conflicts = 0;
+  int busy = 0;
+  auto sync_until_ok = [&]() {
+    while (true) {
+      SyncResult result = sync_with_db(data);
+      if (result.ok) {
+        return result.conflicts;
+      }
+      ++busy;
+    }
+  };
+  // Первой - запись предмета: до нее процесс не подтягивает чужие строки.
+  bool remapped = stress_forced_rollback(data, worker, sync_until_ok);
+  create_student_record(data, student_name, group_id);
+  sync_until_ok();
+  // ID студента мог смениться, если его одновременно занял другой процесс.
+  auto student = std::find_if(data.students.begin(), data.students.end(),
+                              [&](const Student& s) { return s.name == student_name; });
+  if (student == data.students.end()) {
+    std::cout << "Процесс " << worker << ": студент не записан.\n";
+    return 1;
+  }
+  int student_id = student->id;
+  for (int i = 1; i <= iterations; ++i) {
+    create_grade_record(data, student_id, subject_id, kMinGrade + i % kMaxGrade);
+    sync_until_ok();
+    std::string tag = " " + std::to_string(worker) + "." + std::to_string(i);
+    while (true) {
+      Group* group = entity_for_update(data.groups, group_id);
+      if (!group) {
+        std::cout << "Процесс " << worker << ": группа удалена.\n";
+        return 1;
+      }
+      group->name += tag;
+      record_change(data, Entity::kGroup, ChangeOp::kUpdate, group->id, group->version);
+      int rejected = sync_until_ok();
+      if (rejected == 0) {
+        break;
+      }
+      conflicts += rejected;
+    }
   }
-  data.subjects.erase(it);
-  // Удаляем все оценки, связанные с этим предметом.
-  size_t before = data.grades.size();
-  data.grades.erase(
-      std::remove_if(data.grades.begin(), data.grades.end(),
-                     [id](const Grade& g) { return g.subject_id == id; }),
-      data.grades.end());
-  size_t removed = before - data.grades.size();
-  std::cout << "Предмет удален. Удалено связанных оценок: " << removed << ".\n";
-  autosave_or_warn(data);
+  std::cout << "Процесс " << worker << ": конфликтов " << conflicts << ", ожиданий базы " << busy
+            << (remapped ? ", ID предмета сменился в откаченной транзакции" : "") << ".\n";
+  return worker > 1 && !remapped ? kStressExitNoRemap : 0;
 }
 
-// Добавляет оценку студенту по предмету.
-void add_grade(DataStore& data) {
-  if (data.students.empty()) {
-    int choice = read_int("Студентов нет. Создать сейчас? 1-да, 0-нет: ", 0, 1);
-    if (choice == 1) {
-      add_student(data);
+// Код выхода команды по результату std::system.
+int command_exit_code(int status) {
+#ifdef _WIN32
+  return status;
+#else
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#endif
+}
+
+// Нагрузочная проверка совместной работы (--stress P N): P процессов одновременно пишут в
+// data/stress_test.db, затем проверяется, что ни одна запись не потеряна.
+int run_stress_test(const std::string& exe, int processes, int iterations) {
+  ensure_storage_dirs();
+  std::string path = (std::filesystem::path(kDataDir) / "stress_test.db").string();
+  std::error_code ec;
+  std::filesystem::remove(path, ec);
+  std::filesystem::remove(path + "-journal", ec);
+  db_path_override() = path;
+  DataStore setup;
+  create_group_record(setup, kStressGroupName);
+  create_subject_record(setup, kStressSubjectName);
+  if (!sync_with_db(setup).ok) {
+    std::cout << "Не удалось создать " << path << ".\n";
+    return 1;
+  }
+
+  std::cout << "Процессов: " << processes << ", итераций: " << iterations << ", база: " << path << "\n";
+  std::vector<int> exit_codes(processes, 0);
+  double ms = measure_ms([&]() {
+    std::vector<std::thread> threads;
+    for (int k = 1; k <= processes; ++k) {
+      threads.emplace_back([&, k]() {
+        std::string command = "\"" + exe + "\" --db \"" + path + "\" --stress-worker " + std::to_string(k) + " " +
+                              std::to_string(iterations);
+#ifdef _WIN32
+        // cmd /c снимает первую и последнюю кавычки строки, если кавычек больше двух:
+        // внешняя пара сохраняет кавычки вокруг пути к exe (например, в Program Files).
+        command = "\"" + command + "\"";
+#endif
+        exit_codes[k - 1] = command_exit_code(std::system(command.c_str()));
+      });
     }
-    if (data.students.empty()) {
-      std::cout << "Сначала добавьте студентов.\n";
-      return;
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  });
+
+  DataStore result;
+  load_data(result, path);
+  bool ok = std::all_of(exit_codes.begin(), exit_codes.end(),
+                        [](int code) { return code == 0 || code == kStressExitNoRemap; });
+  // Процесс 1 записывает предмет первым; смену ID в откаченной транзакции проверяют остальные.
+  int remapped = static_cast<int>(std::count(exit_codes.begin() + 1, exit_codes.end(), 0));
+  if (processes < 2) {
+    std::cout << "Смена ID в откаченной транзакции: не проверялась (нужно не меньше 2 процессов).\n";
+  } else if (remapped == 0) {
+    std::cout << "ОШИБКА: смена ID в откаченной транзакции не проверена: ни один процесс до нее не дошел.\n";
+    ok = false;
+  } else {
+    std::cout << "Смена ID в откаченной транзакции: проверена в " << remapped << " из " << processes - 1
+              << " процессов.\n";
+  }
+  if (static_cast<int>(result.students.size()) != processes) {
+    std::cout << "ОШИБКА: студентов " << result.students.size() << ", ожидалось " << processes << ".\n";
+    ok = false;
+  }
+  for (const auto& student : result.students) {
+    std::vector<int> attempts;
+    for_each_grade(result, Period(), [&](const Grade& grade) {
+      if (grade.student_id == student.id) {
+        attempts.push_back(grade.attempt);
+      }
+    });
+    std::sort(attempts.begin(), attempts.end());
+    for (int i = 0; i < iterations; ++i) {
+      if (static_cast<int>(attempts.size()) != iterations || attempts[i] != i + 1) {
+        std::cout << "ОШИБКА: у студента " << student.id << " потеряны или задвоены оценки.\n";
+        ok = false;
+        break;
+      }
     }
   }
-  if (data.subjects.empty()) {
-    int choice = read_int("Предметов нет. Создать сейчас? 1-да, 0-нет: ", 0, 1);
-    if (choice == 1) {
-      add_subject(data);
+  for (int k = 1; k <= processes; ++k) {
+    std::string name = "Процесс " + std::to_string(k);
+    if (std::count_if(result.subjects.begin(), result.subjects.end(),
+                      [&](const Subject& subject) { return subject.name == name; }) != 1) {
+      std::cout << "ОШИБКА: предмет процесса " << k << " потерян или задвоен после отката записи.\n";
+      ok = false;
     }
-    if (data.subjects.empty()) {
-      std::cout << "Сначала добавьте предметы.\n";
-      return;
+  }
+  std::map<std::string, int> tags;
+  if (!result.groups.empty()) {
+    std::string name = result.groups.front().name;
+    size_t pos = std::string(kStressGroupName).size();
+    while (pos < name.size()) {
+      size_t next = name.find(' ', pos + 1);
+      ++tags[name.substr(pos + 1, next == std::string::npos ? std::string::npos : next - pos - 1)];
+      pos = next == std::string::npos ? name.size() : next;
     }
   }
-  print_students_simple(data);
-  int student_id = read_student_id_or_cancel(data, "ID студента (0 - отмена): ");
-  if (student_id == 0) {
-    std::cout << "Операция отменена.\n";
-    return;
+  int lost = 0;
+  for (int k = 1; k <= processes; ++k) {
+    for (int i = 1; i <= iterations; ++i) {
+      if (tags[std::to_string(k) + "." + std::to_string(i)] != 1) {
+        ++lost;
+      }
+    }
   }
-  print_subjects_simple(data);
-  int subject_id = read_subject_id_or_cancel(data, "ID предмета (0 - отмена): ");
-  if (subject_id == 0) {
-    std::cout << "Операция отменена.\n";
-    return;
+  if (lost > 0) {
+    std::cout << "ОШИБКА: потеряно или задвоено правок названия группы: " << lost << ".\n";
+    ok = false;
   }
-  int value = read_int("Оценка (1-5): ", kMinGrade, kMaxGrade);
-  Grade grade;
-  grade.id = data.next_grade_id++;
-  grade.student_id = student_id;
-  grade.subject_id = subject_id;
-  grade.value = value;
-  // Номер попытки зависит от количества прошлых оценок по предмету.
-  grade.attempt = next_attempt(data, student_id, subject_id);
-  data.grades.push_back(grade);
-  std::cout << "Добавлена оценка с ID " << grade.id << " (попытка "
-            << grade.attempt << ").\n";
-  autosave_or_warn(data);
+  int commits = processes * (2 + 2 * iterations);
+  std::cout << "Записей: " << commits << " за " << static_cast<long long>(ms) << " мс ("
+            << static_cast<long long>(commits * 1000.0 / std::max(ms, 1.0)) << " в секунду)\n"
+            << (ok ? "Потерянных изменений нет.\n" : "Проверка не пройдена.\n");
+  return ok ? 0 : 1;
 }
 
+// Неизменяемые снимки данных для потоков HTTP-сервера: меню работает со своей копией
+// DataStore и после каждой синхронизации публикует новый снимок, поэтому запросы
+// никогда не ждут редактирования, а редактирование - запросов. Снимок делит таблицы
+// с DataStore меню (см. Cow), а публикуется атомарной заменой указателя.
+struct SnapshotStore {
+  std::shared_ptr<const DataStore> current;  // только через std::atomic_load/atomic_store
+  bool enabled = false;  // включается при запуске сервера
+};
 
-// Редактирует значение оценки.
-void edit_grade(DataStore& data) {
-  if (data.grades.empty()) {
-    std::cout << "Нет оценок для редактирования.\n";
-    return;
-  }
-  print_grades_simple(data);
-  int id = read_int("ID оценки для редактирования: ", 1, std::numeric_limits<int>::max());
-  Grade* grade = find_grade(data, id);
-  if (!grade) {
-    std::cout << "Оценка не найдена.\n";
+SnapshotStore& snapshot_store() {
+  static SnapshotStore store;
+  return store;
+}
+
+// Публикует копию данных как текущий снимок (если сервер запущен).
+void publish_snapshot(const DataStore& data) {
+  SnapshotStore& store = snapshot_store();
+  if (!store.enabled) {
     return;
   }
-  bool changed = false;
-  int new_value = 0;
-  if (read_int_optional("Новая оценка (1-5, пусто - оставить): ", kMinGrade, kMaxGrade, new_value)) {
-    if (new_value != grade->value) {
-      grade->value = new_value;
-      changed = true;
+  // Старый снимок освобождает последний читающий его запрос.
+  std::atomic_store(&store.current, std::make_shared<const DataStore>(data));
+}
+
+// Возвращает текущий снимок; он остается неизменным, пока на него есть ссылка.
+std::shared_ptr<const DataStore> current_snapshot() {
+  return std::atomic_load(&snapshot_store().current);
+}
+
+struct HttpRequest {
+  std::string method;
+  std::string path;
+  std::vector<std::pair<std::string, std::string>> query;
+  bool keep_alive = true;
+};
+
+// Декодирует %XX и '+' в параметрах запроса.
+std::string url_decode(std::string_view text) {
+  std::string out;
+  out.reserve(text.size());
+  for (size_t i = 0; i < text.size(); ++i) {
+    if (text[i] == '+') {
+      out.push_back(' ');
+    } else if (text[i] == '%' && i + 2 < text.size()) {
+      int value = 0;
+      auto result = std::from_chars(text.data() + i + 1, text.data() + i + 3, value, 16);
+      if (result.ec == std::errc() && result.ptr == text.data() + i + 3) {
+        out.push_back(static_cast<char>(value));
+        i += 2;
+      } else {
+        out.push_back(text[i]);
+      }
+    } else {
+      out.push_back(text[i]);
     }
   }
-  std::cout << "Оценка обновлена.\n";
-  if (changed) {
-    autosave_or_warn(data);
+  return out;
+}
+
+// Значение параметра запроса или nullptr.
+const std::string* query_param(const HttpRequest& request, std::string_view name) {
+  for (const auto& item : request.query) {
+    if (item.first == name) {
+      return &item.second;
+    }
   }
+  return nullptr;
 }
 
-// Удаляет оценку по ID.
-void delete_grade(DataStore& data) {
-  if (data.grades.empty()) {
-    std::cout << "Нет оценок для удаления.\n";
-    return;
+// Читает целый параметр; false - если параметр есть, но это не число.
+bool query_int(const HttpRequest& request, std::string_view name, int& out) {
+  const std::string* text = query_param(request, name);
+  return !text || parse_int(*text, out);
+}
+
+// Период из параметров semester=КОД или from=КОД&to=КОД (по умолчанию - вся история).
+bool query_period(const HttpRequest& request, Period& period) {
+  int semester = 0;
+  if (query_param(request, "semester")) {
+    if (!query_int(request, "semester", semester) || !is_valid_semester(semester)) {
+      return false;
+    }
+    period.from = semester;
+    period.to = semester;
+    return true;
   }
-  print_grades_simple(data);
-  int id = read_int("ID оценки для удаления: ", 1, std::numeric_limits<int>::max());
-  auto it = std::find_if(data.grades.begin(), data.grades.end(),
-                         [id](const Grade& g) { return g.id == id; });
-  if (it == data.grades.end()) {
-    std::cout << "Оценка не найдена.\n";
-    return;
+  if (!query_int(request, "from", period.from) || !query_int(request, "to", period.to)) {
+    return false;
   }
-  data.grades.erase(it);
-  std::cout << "Оценка удалена.\n";
-  autosave_or_warn(data);
+  return period.from <= period.to;
 }
 
-// Отчет: средние баллы по студентам и общий средний.
-void report_overall_averages(const DataStore& data) {
-  if (data.students.empty()) {
-    std::cout << "Нет студентов.\n";
-    return;
+// Пишет сообщение об ошибке и возвращает HTTP-статус.
+int api_error(JsonWriter& json, int status, std::string_view message) {
+  json.begin_object();
+  json.field("error", message);
+  json.end_object();
+  return status;
+}
+
+void json_grades(JsonWriter& json, GradeValues values) {
+  json.begin_array();
+  for (int value : values) {
+    json.value(value);
+  }
+  json.end_array();
+}
+
+void json_period(JsonWriter& json, const Period& period) {
+  json.field("period", period_name(period));
+}
+
+// GET /api/students/averages - средние по студентам.
+int api_student_averages(const DataStore& data, const HttpRequest& request, JsonWriter& json) {
+  Period period;
+  if (!query_period(request, period)) {
+    return api_error(json, 400, "некорректный период");
   }
-  std::cout << "Средние по студентам (все оценки по предметам):\n";
-  const std::vector<int> widths = {4, 28, 20, 12};
-  const std::vector<bool> align_right = {true, false, false, true};
-  print_table_line(widths);
-  print_table_row({"ID", "ФИО", "Группа", "Ср.балл"}, widths, align_right);
-  print_table_line(widths);
+  json.begin_object();
+  json_period(json, period);
+  json.key("students");
+  json.begin_array();
   double total = 0.0;
   int count = 0;
-  for (const auto& student : data.students) {
-    double avg = average_subjects_for_student(data, student.id);
-    print_table_row({std::to_string(student.id),
-                     student.name,
-                     group_name_or_none(data, student.group_id),
-                     format_avg(avg)},
-                    widths,
-                    align_right);
+  std::vector<double> averages = student_averages(data, period);
+  for (size_t i = 0; i < data.students.size(); ++i) {
+    const Student& student = data.students[i];
+    double avg = averages[i];
+    json.begin_object();
+    json.field("id", student.id);
+    json.field("name", student.name);
+    json.field("group", group_name_or_none(data, student.group_id));
+    json.key("avg");
+    json.value_avg(avg);
+    json.end_object();
     if (avg >= 0.0) {
       total += avg;
       ++count;
     }
   }
-  print_table_line(widths);
-  if (count > 0) {
-    std::cout << "Общий средний балл: " << format_avg(total / static_cast<double>(count)) << "\n";
+  json.end_array();
+  json.key("overall_avg");
+  json.value_avg(count > 0 ? total / static_cast<double>(count) : -1.0);
+  json.end_object();
+  return 200;
+}
+
+// GET /api/subjects/averages - средние по предметам.
+int api_subject_averages(const DataStore& data, const HttpRequest& request, JsonWriter& json) {
+  Period period;
+  if (!query_period(request, period)) {
+    return api_error(json, 400, "некорректный период");
+  }
+  json.begin_object();
+  json_period(json, period);
+  json.key("subjects");
+  json.begin_array();
+  std::vector<SubjectTotal> totals = subject_totals(data, period);
+  for (size_t i = 0; i < data.subjects.size(); ++i) {
+    const Subject& subject = data.subjects[i];
+    json.begin_object();
+    json.field("id", subject.id);
+    json.field("name", subject.name);
+    json.key("avg");
+    json.value_avg(totals[i].average());
+    json.field("count", totals[i].count);
+    json.end_object();
+  }
+  json.end_array();
+  json.end_object();
+  return 200;
+}
+
+// Поля распределения оценок: счетчики по значениям kMinGrade..kMaxGrade и сводка.
+void json_distribution(JsonWriter& json, const GradeHistogram& histogram) {
+  GradeDistribution stats = describe_distribution(histogram);
+  json.field("count", static_cast<long long>(stats.count));
+  json.key("counts");
+  json.begin_array();
+  for (int64_t count : histogram.counts) {
+    json.value(static_cast<long long>(count));
+  }
+  json.end_array();
+  json.key("median");
+  json.value_avg(stats.median);
+  json.key("mode");
+  if (stats.mode == 0) {
+    json.value_null();
   } else {
-    std::cout << "Общий средний балл: нет\n";
+    json.value(stats.mode);
+  }
+  json.key("avg");
+  json.value_avg(stats.mean);
+  json.key("stddev");
+  json.value_avg(stats.stddev);
+  json.key("pass_rate");
+  json.value_avg(stats.pass_rate);
+  json.key("percentiles");
+  json.begin_object();
+  for (int p : {10, 25, 75, 90}) {
+    json.key("p" + std::to_string(p));
+    if (stats.count == 0) {
+      json.value_null();
+    } else {
+      json.value(histogram_percentile(histogram, p / 100.0));
+    }
   }
+  json.end_object();
 }
 
-// Отчет: средние баллы по предметам.
-void report_subject_averages(const DataStore& data) {
-  if (data.subjects.empty()) {
-    std::cout << "Нет предметов.\n";
-    return;
-  }
-  std::cout << "Средние по предметам (все оценки):\n";
-  const std::vector<int> widths = {4, 28, 12, 10};
-  const std::vector<bool> align_right = {true, false, true, true};
-  print_table_line(widths);
-  print_table_row({"ID", "Предмет", "Ср.балл", "Оценок"}, widths, align_right);
-  print_table_line(widths);
+// GET /api/subjects/distribution - распределения оценок по предметам.
+int api_subject_distribution(const DataStore& data, const HttpRequest& request, JsonWriter& json) {
+  Period period;
+  if (!query_period(request, period)) {
+    return api_error(json, 400, "некорректный период");
+  }
+  json.begin_object();
+  json_period(json, period);
+  json.field("min_grade", kMinGrade);
+  json.field("pass_grade", kPassGrade);
+  json.key("subjects");
+  json.begin_array();
   for (const auto& subject : data.subjects) {
-    int count = 0;
-    double avg = average_all_for_subject(data, subject.id, &count);
-    print_table_row({std::to_string(subject.id),
-                     subject.name,
-                     format_avg(avg),
-                     std::to_string(count)},
-                    widths,
-                    align_right);
-  }
-  print_table_line(widths);
+    json.begin_object();
+    json.field("id", subject.id);
+    json.field("name", subject.name);
+    json_distribution(json, subject_histogram(data, subject.id, period));
+    json.end_object();
+  }
+  json.end_array();
+  json.end_object();
+  return 200;
 }
 
-// Отчет: подробности по выбранному предмету.
-void report_subject_detail(const DataStore& data) {
-  if (data.subjects.empty()) {
-    std::cout << "Нет предметов.\n";
-    return;
+// GET /api/subjects/detail?id=ID - все попытки студентов по предмету.
+int api_subject_detail(const DataStore& data, const HttpRequest& request, JsonWriter& json) {
+  Period period;
+  int subject_id = 0;
+  if (!query_period(request, period) || !query_int(request, "id", subject_id)) {
+    return api_error(json, 400, "некорректные параметры");
   }
-  print_subjects_simple(data);
-  int subject_id = read_int("ID предмета для подробностей: ", 1, std::numeric_limits<int>::max());
   const Subject* subject = find_subject(data, subject_id);
   if (!subject) {
-    std::cout << "Предмет не найден.\n";
-    return;
-  }
-  // Группируем оценки по студентам для выбранного предмета.
-  std::map<int, std::vector<Grade>> by_student;
-  for (const auto& grade : data.grades) {
-    if (grade.subject_id == subject_id) {
-      by_student[grade.student_id].push_back(grade);
-    }
-  }
-  if (by_student.empty()) {
-    std::cout << "Нет оценок по предмету " << subject->name << ".\n";
-    return;
-  }
-  std::cout << "Подробности по предмету: " << subject->name << "\n";
-  const std::vector<int> widths = {28, 10, 10, 36};
-  const std::vector<bool> align_right = {false, true, true, false};
-  print_table_line(widths);
-  print_table_row({"Студент", "Ср.балл", "Последн.", "Оценки"}, widths, align_right);
-  print_table_line(widths);
-  for (const auto& entry : by_student) {
-    const Student* student = find_student(data, entry.first);
-    std::string student_name = student ? student->name : "Неизвестно";
-    std::vector<Grade> grades = entry.second;
-    // Сортируем попытки по порядку сдачи.
-    std::sort(grades.begin(), grades.end(),
-              [](const Grade& a, const Grade& b) { return a.attempt < b.attempt; });
-    int sum = 0;
-    int latest_value = grades.back().value;
-    std::vector<int> values;
-    values.reserve(grades.size());
-    for (const auto& grade : grades) {
-      sum += grade.value;
-      values.push_back(grade.value);
-    }
-    double avg = static_cast<double>(sum) / static_cast<double>(grades.size());
-    print_table_row({student_name,
-                     format_avg(avg),
-                     std::to_string(latest_value),
-                     join_grades(values)},
-                    widths,
-                    align_right);
-  }
-  print_table_line(widths);
+    return api_error(json, 404, "предмет не найден");
+  }
+  ReportArena arena;
+  GradeRuns by_student = subject_grades_by_student(data, subject_id, period, arena.resource());
+  EntitySlots students(data.students);
+  json.begin_object();
+  json_period(json, period);
+  json.field("subject_id", subject->id);
+  json.field("subject", subject->name);
+  json.key("students");
+  json.begin_array();
+  by_student.for_each([&](int student_id, GradeValues values) {
+    json.begin_object();
+    json.field("id", student_id);
+    int slot = students.slot(student_id);
+    json.field("name", slot >= 0 ? data.students[students.index(slot)].name : std::string("Неизвестно"));
+    json.key("avg");
+    json.value_avg(average_from_values(values));
+    json.field("last", values.back());
+    json.key("grades");
+    json_grades(json, values);
+    json.end_object();
+  });
+  json.end_array();
+  json.end_object();
+  return 200;
 }
 
-// Отчет: топ-N студентов по среднему баллу.
-void report_top_n(const DataStore& data) {
-  if (data.students.empty()) {
-    std::cout << "Нет студентов.\n";
-    return;
-  }
-  struct Entry {
-    int student_id = 0;
-    double avg = -1.0;
-  };
-  std::vector<Entry> entries;
-  for (const auto& student : data.students) {
-    double avg = average_subjects_for_student(data, student.id);
-    if (avg >= 0.0) {
-      entries.push_back({student.id, avg});
-    }
-  }
-  if (entries.empty()) {
-    std::cout << "Нет оценок.\n";
-    return;
-  }
-  // Сортируем по среднему баллу по убыванию, затем по ID.
-  std::sort(entries.begin(), entries.end(),
-            [](const Entry& a, const Entry& b) {
-              if (a.avg != b.avg) {
-                return a.avg > b.avg;
-              }
-              return a.student_id < b.student_id;
-            });
-  int max_n = static_cast<int>(entries.size());
-  int n = read_int("Топ N (1.." + std::to_string(max_n) + "): ", 1, max_n);
-  std::cout << "Топ " << n << " студентов:\n";
-  const std::vector<int> widths = {3, 28, 20, 12};
-  const std::vector<bool> align_right = {true, false, false, true};
-  print_table_line(widths);
-  print_table_row({"#", "ФИО", "Группа", "Ср.балл"}, widths, align_right);
-  print_table_line(widths);
+// GET /api/top?n=N - топ-N студентов по среднему баллу (по умолчанию 10).
+int api_top(const DataStore& data, const HttpRequest& request, JsonWriter& json) {
+  Period period;
+  int n = 10;
+  if (!query_period(request, period) || !query_int(request, "n", n) || n < 1) {
+    return api_error(json, 400, "некорректные параметры");
+  }
+  std::vector<RankedStudent> entries = ranked_students(data, period);
+  n = std::min(n, static_cast<int>(entries.size()));
+  json.begin_object();
+  json_period(json, period);
+  json.key("students");
+  json.begin_array();
   for (int i = 0; i < n; ++i) {
-    const Entry& entry = entries[i];
-    const Student* student = find_student(data, entry.student_id);
-    std::string name = student ? student->name : "Неизвестно";
-    std::string group_name = student ? group_name_or_none(data, student->group_id) : "Неизвестно";
-    print_table_row({std::to_string(i + 1), name, group_name, format_avg(entry.avg)},
-                    widths,
-                    align_right);
-  }
-  print_table_line(widths);
+    const Student* student = find_student(data, entries[i].student_id);
+    json.begin_object();
+    json.field("rank", i + 1);
+    json.field("id", entries[i].student_id);
+    json.field("name", student ? student->name : std::string("Неизвестно"));
+    json.field("group", student ? group_name_or_none(data, student->group_id) : std::string("Неизвестно"));
+    json.key("avg");
+    json.value_avg(entries[i].avg);
+    json.end_object();
+  }
+  json.end_array();
+  json.end_object();
+  return 200;
 }
 
-// Отчет: список пересдач по последним оценкам.
-void report_retakes(const DataStore& data) {
-  if (data.students.empty() || data.subjects.empty()) {
-    std::cout << "Нет студентов или предметов.\n";
-    return;
-  }
-  std::cout << "Пересдачи (последняя оценка < " << kPassGrade << "):\n";
-  std::vector<std::vector<std::string>> rows;
-  for (const auto& student : data.students) {
-    // Анализируем только последнюю оценку по каждому предмету.
-    auto aggregates = subject_aggregates_for_student(data, student.id);
-    for (const auto& entry : aggregates) {
-      if (entry.second.latest_value < kPassGrade) {
-        rows.push_back({student.name,
-                        subject_name_or_unknown(data, entry.first),
-                        std::to_string(entry.second.latest_value)});
-      }
-    }
-  }
-  if (rows.empty()) {
-    std::cout << "  Нет.\n";
-    return;
-  }
-  const std::vector<int> widths = {28, 28, 10};
-  const std::vector<bool> align_right = {false, false, true};
-  print_table_line(widths);
-  print_table_row({"Студент", "Предмет", "Оценка"}, widths, align_right);
-  print_table_line(widths);
-  for (const auto& row : rows) {
-    print_table_row(row, widths, align_right);
-  }
-  print_table_line(widths);
+// GET /api/retakes - пересдачи (последняя оценка ниже проходного балла).
+int api_retakes(const DataStore& data, const HttpRequest& request, JsonWriter& json) {
+  Period period;
+  if (!query_period(request, period)) {
+    return api_error(json, 400, "некорректный период");
+  }
+  json.begin_object();
+  json_period(json, period);
+  json.field("pass_grade", kPassGrade);
+  json.key("retakes");
+  json.begin_array();
+  for_each_retake(data, period, [&](const Student& student, const Subject& subject, int value) {
+    json.begin_object();
+    json.field("student_id", student.id);
+    json.field("student", student.name);
+    json.field("subject_id", subject.id);
+    json.field("subject", subject.name);
+    json.field("grade", value);
+    json.end_object();
+  });
+  json.end_array();
+  json.end_object();
+  return 200;
 }
 
-void journal_matrix(const DataStore& data) {
-  if (data.students.empty()) {
-    std::cout << "Нет студентов.\n";
-    return;
-  }
-  if (data.subjects.empty()) {
-    std::cout << "Нет предметов.\n";
-    return;
-  }
+// GET /api/journal?group=ID - сводный журнал (последние оценки); group: 0 - все, -1 - без группы.
+int api_journal(const DataStore& data, const HttpRequest& request, JsonWriter& json) {
+  Period period;
   int group_filter = 0;
-  if (!data.groups.empty()) {
-    print_groups_simple(data);
-    group_filter = read_group_filter(data, "ID группы (0 - все, -1 - без группы): ");
-  }
-  auto students = students_for_group_sorted(data, group_filter);
-  if (students.empty()) {
-    std::cout << "Нет студентов для выбранного фильтра.\n";
-    return;
-  }
-  std::cout << "Электронный журнал (последние оценки):\n";
-  if (group_filter == -1) {
-    std::cout << "Группа: без группы\n";
-  } else if (group_filter > 0) {
-    std::cout << "Группа: " << group_name_or_none(data, group_filter) << "\n";
+  if (!query_period(request, period) || !query_int(request, "group", group_filter)) {
+    return api_error(json, 400, "некорректные параметры");
   }
-
-  std::vector<int> widths = {4, 24, 18};
-  std::vector<bool> align_right = {true, false, false};
-  std::vector<std::string> header = {"ID", "ФИО", "Группа"};
+  json.begin_object();
+  json_period(json, period);
+  json.key("subjects");
+  json.begin_array();
   for (const auto& subject : data.subjects) {
-    widths.push_back(8);
-    align_right.push_back(true);
-    header.push_back(subject.name);
-  }
-  widths.push_back(10);
-  align_right.push_back(true);
-  header.push_back("Ср.балл");
-
-  print_table_line(widths);
-  print_table_row(header, widths, align_right);
-  print_table_line(widths);
-  for (const auto* student : students) {
-    auto by_subject = grades_by_subject_for_student(data, student->id);
-    std::vector<std::string> row;
-    row.reserve(header.size());
-    row.push_back(std::to_string(student->id));
-    row.push_back(student->name);
-    row.push_back(group_name_or_none(data, student->group_id));
-    for (const auto& subject : data.subjects) {
-      auto it = by_subject.find(subject.id);
-      if (it == by_subject.end() || it->second.empty()) {
-        row.push_back("-");
+    json.begin_object();
+    json.field("id", subject.id);
+    json.field("name", subject.name);
+    json.end_object();
+  }
+  json.end_array();
+  json.key("students");
+  json.begin_array();
+  // Агрегаты - блоками студентов, как в сводном журнале: последняя оценка - последняя попытка.
+  auto write_student = [&](const Student& student, const SubjectAggregate* cells) {
+    json.begin_object();
+    json.field("id", student.id);
+    json.field("name", student.name);
+    json.field("group", group_name_or_none(data, student.group_id));
+    // Последние оценки в порядке массива subjects; null - оценок нет.
+    json.key("last");
+    json.begin_array();
+    for (size_t i = 0; i < data.subjects.size(); ++i) {
+      if (cells[i].count == 0) {
+        json.value_null();
       } else {
-        row.push_back(std::to_string(it->second.back()));
+        json.value(cells[i].latest_value);
       }
     }
-    row.push_back(format_avg(average_subjects_for_student(data, student->id)));
-    print_table_row(row, widths, align_right);
+    json.end_array();
+    json.key("avg");
+    json.value_avg(cells ? journal_row_average(cells, data.subjects.size()) : -1.0);
+    json.end_object();
+  };
+  auto students = students_for_group_sorted(data, group_filter);
+  if (data.subjects.empty()) {
+    for (const auto* student : students) {
+      write_student(*student, nullptr);
+    }
+  } else {
+    for_each_journal_row(data, period, students, write_student);
   }
-  print_table_line(widths);
+  json.end_array();
+  json.end_object();
+  return 200;
 }
 
-void journal_by_subject(const DataStore& data) {
-  if (data.students.empty()) {
-    std::cout << "Нет студентов.\n";
-    return;
-  }
-  if (data.subjects.empty()) {
-    std::cout << "Нет предметов.\n";
-    return;
+// Попытки, среднее, последняя оценка и число попыток - общая часть журналов.
+void json_attempts(JsonWriter& json, GradeValues values) {
+  json.key("grades");
+  json_grades(json, values);
+  json.key("avg");
+  json.value_avg(average_from_values(values));
+  json.key("last");
+  if (values.empty()) {
+    json.value_null();
+  } else {
+    json.value(values.back());
   }
-  print_subjects_simple(data);
-  int subject_id = read_subject_id_or_cancel(data, "ID предмета (0 - отмена): ");
-  if (subject_id == 0) {
-    std::cout << "Операция отменена.\n";
-    return;
+  json.field("attempts", static_cast<long long>(values.size()));
+}
+
+// GET /api/journal/subject?id=ID&group=ID - журнал по предмету.
+int api_journal_subject(const DataStore& data, const HttpRequest& request, JsonWriter& json) {
+  Period period;
+  int subject_id = 0;
+  int group_filter = 0;
+  if (!query_period(request, period) || !query_int(request, "id", subject_id) ||
+      !query_int(request, "group", group_filter)) {
+    return api_error(json, 400, "некорректные параметры");
   }
   const Subject* subject = find_subject(data, subject_id);
   if (!subject) {
-    std::cout << "Предмет не найден.\n";
-    return;
-  }
-  int group_filter = 0;
-  if (!data.groups.empty()) {
-    print_groups_simple(data);
-    group_filter = read_group_filter(data, "ID группы (0 - все, -1 - без группы): ");
-  }
-  auto students = students_for_group_sorted(data, group_filter);
-  if (students.empty()) {
-    std::cout << "Нет студентов для выбранного фильтра.\n";
-    return;
-  }
-  std::cout << "Электронный журнал по предмету: " << subject->name << "\n";
-  if (group_filter == -1) {
-    std::cout << "Группа: без группы\n";
-  } else if (group_filter > 0) {
-    std::cout << "Группа: " << group_name_or_none(data, group_filter) << "\n";
-  }
+    return api_error(json, 404, "предмет не найден");
+  }
+  json.begin_object();
+  json_period(json, period);
+  json.field("subject_id", subject->id);
+  json.field("subject", subject->name);
+  json.key("students");
+  json.begin_array();
+  ReportArena arena;
+  GradeRuns by_student = subject_grades_by_student(data, subject_id, period, arena.resource());
+  for (const auto* student : students_for_group_sorted(data, group_filter)) {
+    json.begin_object();
+    json.field("id", student->id);
+    json.field("name", student->name);
+    json.field("group", group_name_or_none(data, student->group_id));
+    json_attempts(json, by_student.find(student->id));
+    json.end_object();
+  }
+  json.end_array();
+  json.end_object();
+  return 200;
+}
 
-  const std::vector<int> widths = {4, 24, 18, 24, 10, 10, 8};
-  const std::vector<bool> align_right = {true, false, false, false, true, true, true};
-  print_table_line(widths);
-  print_table_row({"ID", "ФИО", "Группа", "Оценки", "Ср.балл", "Последн.", "Попыток"},
-                  widths, align_right);
-  print_table_line(widths);
-  for (const auto* student : students) {
-    std::vector<int> values = grades_for_student_subject(data, student->id, subject_id);
-    std::string grades_text = values.empty() ? "нет" : join_grades(values);
-    std::string latest_text = values.empty() ? "нет" : std::to_string(values.back());
-    print_table_row({std::to_string(student->id),
-                     student->name,
-                     group_name_or_none(data, student->group_id),
-                     grades_text,
-                     format_avg(average_from_values(values)),
-                     latest_text,
-                     std::to_string(values.size())},
-                    widths, align_right);
-  }
-  print_table_line(widths);
-}
-
-void journal_by_student(const DataStore& data) {
-  if (data.students.empty()) {
-    std::cout << "Нет студентов.\n";
-    return;
-  }
-  print_students_simple(data);
-  int student_id = read_student_id_or_cancel(data, "ID студента (0 - отмена): ");
-  if (student_id == 0) {
-    std::cout << "Операция отменена.\n";
-    return;
+// GET /api/journal/student?id=ID - журнал студента.
+int api_journal_student(const DataStore& data, const HttpRequest& request, JsonWriter& json) {
+  Period period;
+  int student_id = 0;
+  if (!query_period(request, period) || !query_int(request, "id", student_id)) {
+    return api_error(json, 400, "некорректные параметры");
   }
   const Student* student = find_student(data, student_id);
   if (!student) {
-    std::cout << "Студент не найден.\n";
-    return;
-  }
-  if (data.subjects.empty()) {
-    std::cout << "Нет предметов.\n";
-    return;
-  }
-  std::cout << "Электронный журнал студента: " << student->name << "\n";
-  std::cout << "Группа: " << group_name_or_none(data, student->group_id) << "\n";
-
-  const std::vector<int> widths = {4, 26, 24, 10, 10, 8};
-  const std::vector<bool> align_right = {true, false, false, true, true, true};
-  print_table_line(widths);
-  print_table_row({"ID", "Предмет", "Оценки", "Ср.балл", "Последн.", "Попыток"},
-                  widths, align_right);
-  print_table_line(widths);
+    return api_error(json, 404, "студент не найден");
+  }
+  json.begin_object();
+  json_period(json, period);
+  json.field("student_id", student->id);
+  json.field("student", student->name);
+  json.field("group", group_name_or_none(data, student->group_id));
+  ReportArena arena;
+  GradesBySubject by_subject = grades_by_subject_for_student(data, student->id, period, arena.resource());
+  json.key("subjects");
+  json.begin_array();
   for (const auto& subject : data.subjects) {
-    std::vector<int> values = grades_for_student_subject(data, student->id, subject.id);
-    std::string grades_text = values.empty() ? "нет" : join_grades(values);
-    std::string latest_text = values.empty() ? "нет" : std::to_string(values.back());
-    print_table_row({std::to_string(subject.id),
-                     subject.name,
-                     grades_text,
-                     format_avg(average_from_values(values)),
-                     latest_text,
-                     std::to_string(values.size())},
-                    widths, align_right);
-  }
-  print_table_line(widths);
-  std::cout << "Средний балл по предметам: "
-            << format_avg(average_subjects_for_student(data, student->id)) << "\n";
-}
-
-void journal_menu(const DataStore& data) {
-  while (true) {
-    std::cout << "\n[Электронный журнал]\n"
-              << "1) Сводный журнал (последние оценки)\n"
-              << "2) Журнал по предмету (все попытки)\n"
-              << "3) Журнал по студенту (все попытки)\n"
-              << "0) Назад\n";
-    int choice = read_int("Выберите: ", 0, 3);
-    switch (choice) {
-      case 1:
-        journal_matrix(data);
-        break;
-      case 2:
-        journal_by_subject(data);
-        break;
-      case 3:
-        journal_by_student(data);
-        break;
-      case 0:
-        return;
-      default:
-        break;
-    }
-  }
+    json.begin_object();
+    json.field("id", subject.id);
+    json.field("name", subject.name);
+    json_attempts(json, by_subject.find(subject.id));
+    json.end_object();
+  }
+  json.end_array();
+  json.key("avg");
+  json.value_avg(average_by_subject(by_subject));
+  json.end_object();
+  return 200;
 }
 
-// Выполняет SQL без возвращаемых строк.
-bool exec_sql(sqlite3* db, const std::string& sql) {
-  char* err = nullptr;
-  int rc = sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &err);
-  if (rc != SQLITE_OK) {
-    if (err) {
-      std::cout << "Ошибка SQLite: " << err << "\n";
-      sqlite3_free(err);
+using ApiHandler = int (*)(const DataStore& data, const HttpRequest& request, JsonWriter& json);
+
+struct ApiRoute {
+  const char* path;
+  ApiHandler handler;
+};
+
+const ApiRoute kApiRoutes[] = {
+    {"/api/students/averages", api_student_averages},
+    {"/api/subjects/averages", api_subject_averages},
+    {"/api/subjects/detail", api_subject_detail},
+    {"/api/subjects/distribution", api_subject_distribution},
+    {"/api/top", api_top},
+    {"/api/retakes", api_retakes},
+    {"/api/journal", api_journal},
+    {"/api/journal/subject", api_journal_subject},
+    {"/api/journal/student", api_journal_student},
+};
+
+// Гистограмма задержек без блокировок: 4 корзины на каждую степень двойки
+// микросекунд (погрешность перцентиля не больше ~25%), память не растет.
+class LatencyHistogram {
+ public:
+  static constexpr int kBuckets = 160;
+
+  void record(uint64_t micros) {
+    buckets_[bucket_for(micros)].fetch_add(1, std::memory_order_relaxed);
+    uint64_t seen = max_.load(std::memory_order_relaxed);
+    while (micros > seen && !max_.compare_exchange_weak(seen, micros, std::memory_order_relaxed)) {
     }
-    return false;
   }
-  return true;
-}
-
-// Создает таблицы, если они еще не созданы.
-bool init_db(sqlite3* db) {
-  const char* sql =
-      "PRAGMA foreign_keys = ON;"
-      "CREATE TABLE IF NOT EXISTS groups ("
-      "  id INTEGER PRIMARY KEY,"
-      "  name TEXT NOT NULL"
-      ");"
-      "CREATE TABLE IF NOT EXISTS students ("
-      "  id INTEGER PRIMARY KEY,"
-      "  name TEXT NOT NULL,"
-      "  group_id INTEGER,"
-      "  FOREIGN KEY(group_id) REFERENCES groups(id)"
-      ");"
-      "CREATE TABLE IF NOT EXISTS subjects ("
-      "  id INTEGER PRIMARY KEY,"
-      "  name TEXT NOT NULL"
-      ");"
-      "CREATE TABLE IF NOT EXISTS grades ("
-      "  id INTEGER PRIMARY KEY,"
-      "  student_id INTEGER NOT NULL,"
-      "  subject_id INTEGER NOT NULL,"
-      "  value INTEGER NOT NULL,"
-      "  attempt INTEGER NOT NULL,"
-      "  FOREIGN KEY(student_id) REFERENCES students(id),"
-      "  FOREIGN KEY(subject_id) REFERENCES subjects(id)"
-      ");";
-  return exec_sql(db, sql);
-}
 
-// Безопасно читает текстовую колонку.
-std::string column_text(sqlite3_stmt* stmt, int col) {
-  const unsigned char* text = sqlite3_column_text(stmt, col);
-  if (!text) {
-    return std::string();
+  uint64_t count() const {
+    uint64_t total = 0;
+    for (const auto& bucket : buckets_) {
+      total += bucket.load(std::memory_order_relaxed);
+    }
+    return total;
   }
-  return std::string(reinterpret_cast<const char*>(text));
-}
 
-// Экранирует значение для CSV с учетом разделителя.
-std::string csv_escape(const std::string& text, char delim) {
-  bool needs_quotes = false;
-  for (char c : text) {
-    if (c == delim || c == '"' || c == '\n' || c == '\r') {
-      needs_quotes = true;
-      break;
+  uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+  // Верхняя граница корзины, в которую попадает перцентиль p (0..1).
+  uint64_t percentile(double p) const {
+    uint64_t total = count();
+    if (total == 0) {
+      return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(p * static_cast<double>(total - 1)) + 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < kBuckets; ++i) {
+      seen += buckets_[i].load(std::memory_order_relaxed);
+      if (seen >= rank) {
+        return std::min(bucket_upper(i), max());
+      }
     }
+    return max();
   }
-  if (!needs_quotes) {
-    return text;
+
+ private:
+  static int bucket_for(uint64_t micros) {
+    if (micros < 4) {
+      return static_cast<int>(micros);
+    }
+    int msb = 0;
+    while ((micros >> (msb + 1)) != 0) {
+      ++msb;
+    }
+    int bucket = (msb - 1) * 4 + static_cast<int>((micros >> (msb - 2)) & 3);
+    return std::min(bucket, kBuckets - 1);
   }
-  std::string out;
-  out.reserve(text.size() + 2);
-  out.push_back('"');
-  for (char c : text) {
-    if (c == '"') {
-      out.push_back('"');
-      out.push_back('"');
-    } else {
-      out.push_back(c);
+
+  static uint64_t bucket_upper(int bucket) {
+    if (bucket < 4) {
+      return static_cast<uint64_t>(bucket);
     }
+    int msb = bucket / 4 + 1;
+    uint64_t step = uint64_t{1} << (msb - 2);
+    return (4 + static_cast<uint64_t>(bucket % 4)) * step + step - 1;
   }
-  out.push_back('"');
-  return out;
+
+  std::atomic<uint64_t> buckets_[kBuckets] = {};
+  std::atomic<uint64_t> max_{0};
+};
+
+struct ServerMetrics {
+  std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+  std::atomic<uint64_t> connections{0};
+  std::atomic<uint64_t> errors{0};
+  LatencyHistogram latency;
+};
+
+#ifdef _WIN32
+using socket_t = SOCKET;
+const socket_t kInvalidSocket = INVALID_SOCKET;
+constexpr int kSendFlags = 0;
+using poll_entry = WSAPOLLFD;
+
+void close_socket(socket_t sock) {
+  closesocket(sock);
 }
 
-// Автосохранение после изменений.
-void autosave_or_warn(const DataStore& data) {
-  if (!save_data(data, db_path())) {
-    std::cout << "Автосохранение не удалось.\n";
-  }
+int poll_sockets(poll_entry* entries, size_t count, int timeout_ms) {
+  return WSAPoll(entries, static_cast<ULONG>(count), timeout_ms);
 }
 
-// Сохраняет все данные в SQLite для восстановления при следующем запуске.
-bool save_data(const DataStore& data, const std::string& path) {
-  sqlite3* db = nullptr;
-  if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
-    if (db) {
-      sqlite3_close(db);
+// Ошибка последней операции с сокетом - только отсутствие данных или прерывание.
+bool socket_would_block() {
+  int error = WSAGetLastError();
+  return error == WSAEWOULDBLOCK || error == WSAETIMEDOUT || error == WSAEINTR;
+}
+#else
+using socket_t = int;
+const socket_t kInvalidSocket = -1;
+constexpr int kSendFlags = MSG_NOSIGNAL;
+using poll_entry = pollfd;
+
+void close_socket(socket_t sock) {
+  close(sock);
+}
+
+int poll_sockets(poll_entry* entries, size_t count, int timeout_ms) {
+  return poll(entries, static_cast<nfds_t>(count), timeout_ms);
+}
+
+bool socket_would_block() {
+  return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+#endif
+
+constexpr size_t kHttpMaxHeaderBytes = 16 * 1024;
+constexpr int kHttpPollMs = 1000;          // период проверки простоя соединений
+constexpr int kHttpKeepAliveSeconds = 5;   // простой keep-alive соединения до закрытия
+constexpr int kHttpAcceptBackoffMs = 100;  // пауза после ошибки accept (например, EMFILE)
+
+// Соединение клиента между запросами: принятая, но еще не разобранная часть запроса
+// и время последней активности (для закрытия по простою).
+struct HttpConnection {
+  socket_t sock = kInvalidSocket;
+  std::string buffer;
+  std::chrono::steady_clock::time_point last_active;
+};
+
+// HTTP/1.1 сервер только для чтения на 127.0.0.1. Поток опроса ждет в poll() новые
+// соединения и данные на простаивающих keep-alive соединениях и отдает пулу рабочих
+// потоков только соединения с пришедшими данными. Рабочий поток читает их, отвечает на
+// все целые запросы и возвращает соединение в опрос, поэтому открытых соединений может
+// быть сколько угодно больше, чем потоков.
+class HttpServer {
+ public:
+  ~HttpServer() { stop(); }
+
+  bool start(int port, int threads) {
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+      return false;
     }
-    return false;
-  }
-  if (!init_db(db)) {
-    sqlite3_close(db);
-    return false;
-  }
-  bool ok = exec_sql(db, "BEGIN IMMEDIATE;");
-  if (!ok) {
-    sqlite3_close(db);
-    return false;
+#endif
+    listener_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    // Датаграмма на этот сокет будит poll(), когда рабочий поток вернул соединение.
+    wake_ = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (listener_ == kInvalidSocket || wake_ == kInvalidSocket) {
+      close_sockets();
+      return false;
+    }
+    int reuse = 1;
+    setsockopt(listener_, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    wake_addr_.sin_family = AF_INET;
+    wake_addr_.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t wake_size = sizeof(wake_addr_);
+    if (bind(listener_, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        listen(listener_, SOMAXCONN) != 0 ||
+        bind(wake_, reinterpret_cast<const sockaddr*>(&wake_addr_), sizeof(wake_addr_)) != 0 ||
+        getsockname(wake_, reinterpret_cast<sockaddr*>(&wake_addr_), &wake_size) != 0) {
+      close_sockets();
+      return false;
+    }
+    stopping_ = false;
+    for (int i = 0; i < threads; ++i) {
+      workers_.emplace_back([this]() { worker_loop(); });
+    }
+    poller_ = std::thread([this]() { poll_loop(); });
+    return true;
   }
-  ok = exec_sql(db, "DELETE FROM grades; DELETE FROM students; DELETE FROM subjects; DELETE FROM groups;");
-  if (!ok) {
-    exec_sql(db, "ROLLBACK;");
-    sqlite3_close(db);
-    return false;
+
+  // Останавливает потоки; сокеты закрываются только после того, как их никто не читает.
+  void stop() {
+    if (!poller_.joinable()) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    wake_poller();
+    ready_.notify_all();
+    poller_.join();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+    workers_.clear();
+    for (const auto& connection : pending_) {
+      close_socket(connection.sock);
+    }
+    for (const auto& connection : returned_) {
+      close_socket(connection.sock);
+    }
+    pending_.clear();
+    returned_.clear();
+    close_sockets();
+#ifdef _WIN32
+    WSACleanup();
+#endif
   }
 
-  sqlite3_stmt* stmt = nullptr;
-  ok = sqlite3_prepare_v2(db, "INSERT INTO groups(id, name) VALUES(?, ?);", -1, &stmt, nullptr) == SQLITE_OK;
-  if (ok) {
-    for (const auto& group : data.groups) {
-      sqlite3_bind_int(stmt, 1, group.id);
-      sqlite3_bind_text(stmt, 2, group.name.c_str(), -1, SQLITE_TRANSIENT);
-      if (sqlite3_step(stmt) != SQLITE_DONE) {
-        ok = false;
-        break;
+  const ServerMetrics& metrics() const { return metrics_; }
+
+ private:
+  void close_sockets() {
+    for (socket_t* sock : {&listener_, &wake_}) {
+      if (*sock != kInvalidSocket) {
+        close_socket(*sock);
+        *sock = kInvalidSocket;
       }
-      sqlite3_reset(stmt);
-      sqlite3_clear_bindings(stmt);
     }
   }
-  if (stmt) {
-    sqlite3_finalize(stmt);
-  }
 
-  stmt = nullptr;
-  if (ok) {
-    ok = sqlite3_prepare_v2(db, "INSERT INTO students(id, name, group_id) VALUES(?, ?, ?);",
-                            -1, &stmt, nullptr) == SQLITE_OK;
+  void wake_poller() {
+    char byte = 0;
+    sendto(wake_, &byte, 1, 0, reinterpret_cast<const sockaddr*>(&wake_addr_), sizeof(wake_addr_));
   }
-  if (ok) {
-    for (const auto& student : data.students) {
-      sqlite3_bind_int(stmt, 1, student.id);
-      sqlite3_bind_text(stmt, 2, student.name.c_str(), -1, SQLITE_TRANSIENT);
-      if (student.group_id == 0) {
-        sqlite3_bind_null(stmt, 3);
-      } else {
-        sqlite3_bind_int(stmt, 3, student.group_id);
+
+  void poll_loop() {
+    std::vector<HttpConnection> idle;
+    std::vector<HttpConnection> kept;
+    std::vector<HttpConnection> ready;
+    std::vector<poll_entry> entries;
+    while (!stopping_) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& connection : returned_) {
+          idle.push_back(std::move(connection));
+        }
+        returned_.clear();
       }
-      if (sqlite3_step(stmt) != SQLITE_DONE) {
-        ok = false;
-        break;
+      entries.clear();
+      entries.push_back({listener_, POLLIN, 0});
+      entries.push_back({wake_, POLLIN, 0});
+      for (const auto& connection : idle) {
+        entries.push_back({connection.sock, POLLIN, 0});
       }
-      sqlite3_reset(stmt);
-      sqlite3_clear_bindings(stmt);
+      if (poll_sockets(entries.data(), entries.size(), kHttpPollMs) < 0) {
+        if (!socket_would_block()) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(kHttpAcceptBackoffMs));
+        }
+        continue;
+      }
+      if (entries[1].revents != 0) {
+        char byte = 0;
+        recv(wake_, &byte, 1, 0);
+      }
+      auto now = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < idle.size(); ++i) {
+        if (entries[i + 2].revents != 0) {
+          ready.push_back(std::move(idle[i]));
+        } else if (now - idle[i].last_active >= std::chrono::seconds(kHttpKeepAliveSeconds)) {
+          close_socket(idle[i].sock);
+        } else {
+          kept.push_back(std::move(idle[i]));
+        }
+      }
+      idle.swap(kept);
+      kept.clear();
+      if (entries[0].revents != 0) {
+        accept_client(idle, now);
+      }
+      if (!ready.empty()) {
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          for (auto& connection : ready) {
+            pending_.push_back(std::move(connection));
+          }
+        }
+        ready.clear();
+        ready_.notify_all();
+      }
+    }
+    for (const auto& connection : idle) {
+      close_socket(connection.sock);
     }
   }
-  if (stmt) {
-    sqlite3_finalize(stmt);
+
+  // Принимает соединение в опрос: рабочий поток получит его, когда придет запрос.
+  void accept_client(std::vector<HttpConnection>& idle, std::chrono::steady_clock::time_point now) {
+    socket_t client = accept(listener_, nullptr, nullptr);
+    if (client == kInvalidSocket) {
+      // Постоянная ошибка (кончились дескрипторы) не должна крутить цикл вхолостую.
+      if (!socket_would_block()) {
+        metrics_.errors.fetch_add(1, std::memory_order_relaxed);
+        std::this_thread::sleep_for(std::chrono::milliseconds(kHttpAcceptBackoffMs));
+      }
+      return;
+    }
+    metrics_.connections.fetch_add(1, std::memory_order_relaxed);
+    int nodelay = 1;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&nodelay), sizeof(nodelay));
+    // Клиент, который не читает ответ, не должен занимать рабочий поток навсегда.
+#ifdef _WIN32
+    DWORD timeout = kHttpKeepAliveSeconds * 1000;
+#else
+    timeval timeout{kHttpKeepAliveSeconds, 0};
+#endif
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+    HttpConnection connection;
+    connection.sock = client;
+    connection.last_active = now;
+    idle.push_back(std::move(connection));
+  }
+
+  void worker_loop() {
+    while (true) {
+      HttpConnection connection;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_.wait(lock, [this]() { return stopping_ || !pending_.empty(); });
+        if (stopping_) {
+          return;
+        }
+        connection = std::move(pending_.front());
+        pending_.pop_front();
+      }
+      if (!serve_ready(connection)) {
+        close_socket(connection.sock);
+        continue;
+      }
+      connection.last_active = std::chrono::steady_clock::now();
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        returned_.push_back(std::move(connection));
+      }
+      wake_poller();
+    }
   }
 
-  stmt = nullptr;
-  if (ok) {
-    ok = sqlite3_prepare_v2(db, "INSERT INTO subjects(id, name) VALUES(?, ?);",
-                            -1, &stmt, nullptr) == SQLITE_OK;
+  // Читает пришедшие данные и отвечает на все целые запросы. false - соединение надо
+  // закрыть (клиент закрыл его, ошибка, Connection: close); иначе оно ждет следующего запроса.
+  bool serve_ready(HttpConnection& connection) {
+    char chunk[4096];
+    int received = recv(connection.sock, chunk, sizeof(chunk), 0);
+    if (received == 0) {
+      return false;
+    }
+    if (received < 0) {
+      // Ложное пробуждение poll - ждем дальше; настоящая ошибка закрывает соединение.
+      return socket_would_block();
+    }
+    connection.buffer.append(chunk, static_cast<size_t>(received));
+    std::string response;
+    while (!stopping_) {
+      size_t header_end = connection.buffer.find("\r\n\r\n");
+      if (header_end == std::string::npos) {
+        return connection.buffer.size() <= kHttpMaxHeaderBytes;
+      }
+      auto started = std::chrono::steady_clock::now();
+      HttpRequest request;
+      bool parsed = parse_request(std::string_view(connection.buffer).substr(0, header_end), request);
+      connection.buffer.erase(0, header_end + 4);
+      response.clear();
+      handle_request(request, parsed, response);
+      if (!send_all(connection.sock, response)) {
+        return false;
+      }
+      auto finished = std::chrono::steady_clock::now();
+      metrics_.latency.record(static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::microseconds>(finished - started).count()));
+      if (!parsed || !request.keep_alive) {
+        return false;
+      }
+    }
+    return false;
   }
-  if (ok) {
-    for (const auto& subject : data.subjects) {
-      sqlite3_bind_int(stmt, 1, subject.id);
-      sqlite3_bind_text(stmt, 2, subject.name.c_str(), -1, SQLITE_TRANSIENT);
-      if (sqlite3_step(stmt) != SQLITE_DONE) {
-        ok = false;
-        break;
+
+  static bool send_all(socket_t client, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+      int chunk = static_cast<int>(std::min<size_t>(data.size() - sent, 1 << 20));
+      int written = send(client, data.data() + sent, chunk, kSendFlags);
+      if (written <= 0) {
+        return false;
       }
-      sqlite3_reset(stmt);
-      sqlite3_clear_bindings(stmt);
+      sent += static_cast<size_t>(written);
     }
+    return true;
   }
-  if (stmt) {
-    sqlite3_finalize(stmt);
+
+  // Разбирает строку запроса и заголовки; тело запроса не поддерживается (только GET).
+  static bool parse_request(std::string_view head, HttpRequest& request) {
+    size_t line_end = head.find("\r\n");
+    std::string_view line = head.substr(0, line_end);
+    size_t first_space = line.find(' ');
+    size_t second_space = line.find(' ', first_space + 1);
+    if (first_space == std::string_view::npos || second_space == std::string_view::npos) {
+      return false;
+    }
+    request.method = std::string(line.substr(0, first_space));
+    std::string_view target = line.substr(first_space + 1, second_space - first_space - 1);
+    std::string_view version = line.substr(second_space + 1);
+    request.keep_alive = version == "HTTP/1.1";
+    size_t question = target.find('?');
+    request.path = url_decode(target.substr(0, question));
+    if (question != std::string_view::npos) {
+      std::string_view query = target.substr(question + 1);
+      while (!query.empty()) {
+        size_t amp = query.find('&');
+        std::string_view pair = query.substr(0, amp);
+        size_t eq = pair.find('=');
+        request.query.emplace_back(url_decode(pair.substr(0, eq)),
+                                   eq == std::string_view::npos ? std::string() : url_decode(pair.substr(eq + 1)));
+        query = amp == std::string_view::npos ? std::string_view() : query.substr(amp + 1);
+      }
+    }
+    while (line_end != std::string_view::npos) {
+      size_t next = head.find("\r\n", line_end + 2);
+      std::string_view header = head.substr(line_end + 2, next == std::string_view::npos ? next : next - line_end - 2);
+      line_end = next;
+      size_t colon = header.find(':');
+      if (colon == std::string_view::npos) {
+        continue;
+      }
+      std::string name = to_lower_ascii(std::string(header.substr(0, colon)));
+      std::string value = to_lower_ascii(trim(std::string(header.substr(colon + 1))));
+      if (name == "connection") {
+        request.keep_alive = value == "keep-alive" || (request.keep_alive && value != "close");
+      } else if (name == "content-length" && value != "0") {
+        return false;
+      }
+    }
+    return true;
   }
 
-  stmt = nullptr;
-  if (ok) {
-    ok = sqlite3_prepare_v2(db,
-                            "INSERT INTO grades(id, student_id, subject_id, value, attempt) "
-                            "VALUES(?, ?, ?, ?, ?);",
-                            -1, &stmt, nullptr) == SQLITE_OK;
+  void handle_request(const HttpRequest& request, bool parsed, std::string& response) {
+    JsonWriter json;
+    std::shared_ptr<const std::string> cached;  // тело ответа отчета (из кэша или только что посчитанное)
+    int status = 404;
+    if (!parsed) {
+      status = api_error(json, 400, "некорректный запрос");
+    } else if (request.method != "GET") {
+      status = api_error(json, 405, "поддерживается только GET");
+    } else if (request.path == "/metrics") {
+      status = write_metrics(json);
+    } else if (request.path == "/" || request.path == "/api") {
+      json.begin_object();
+      json.key("endpoints");
+      json.begin_array();
+      for (const auto& route : kApiRoutes) {
+        json.value(route.path);
+      }
+      json.value("/metrics");
+      json.end_array();
+      json.end_object();
+      status = 200;
+    } else {
+      const ApiRoute* route = nullptr;
+      for (const auto& candidate : kApiRoutes) {
+        if (request.path == candidate.path) {
+          route = &candidate;
+        }
+      }
+      std::shared_ptr<const DataStore> snapshot = current_snapshot();
+      if (!route) {
+        status = api_error(json, 404, "неизвестный адрес");
+      } else if (!snapshot) {
+        status = api_error(json, 503, "данные еще не загружены");
+      } else {
+        std::string key = "http|" + request.path;
+        for (const auto& param : request.query) {
+          key += '|';
+          key += param.first;
+          key += '=';
+          key += param.second;
+        }
+        cached = report_cache().find(key, snapshot->generation);
+        if (cached) {
+          status = 200;
+        } else {
+          status = route->handler(*snapshot, request, json);
+          if (status == 200) {
+            cached = report_cache().store(key, snapshot->generation, std::move(json.str()));
+          }
+        }
+      }
+    }
+    if (status != 200) {
+      metrics_.errors.fetch_add(1, std::memory_order_relaxed);
+    }
+    const std::string& body = cached ? *cached : json.str();
+    response += "HTTP/1.1 ";
+    append_int(response, status);
+    response += status == 200   ? " OK"
+                : status == 400 ? " Bad Request"
+                : status == 404 ? " Not Found"
+                : status == 405 ? " Method Not Allowed"
+                                : " Service Unavailable";
+    response += "\r\nContent-Type: application/json; charset=utf-8\r\nContent-Length: ";
+    append_int(response, static_cast<long long>(body.size()));
+    response += request.keep_alive && parsed ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n";
+    response += body;
+  }
+
+  int write_metrics(JsonWriter& json) const {
+    auto uptime = std::chrono::steady_clock::now() - metrics_.started;
+    json.begin_object();
+    json.field("uptime_s", static_cast<long long>(std::chrono::duration_cast<std::chrono::seconds>(uptime).count()));
+    json.field("requests", static_cast<long long>(metrics_.latency.count()));
+    json.field("errors", static_cast<long long>(metrics_.errors.load(std::memory_order_relaxed)));
+    json.field("connections", static_cast<long long>(metrics_.connections.load(std::memory_order_relaxed)));
+    json.field("threads", static_cast<long long>(workers_.size()));
+    json.key("latency_us");
+    json.begin_object();
+    json.field("p50", static_cast<long long>(metrics_.latency.percentile(0.50)));
+    json.field("p90", static_cast<long long>(metrics_.latency.percentile(0.90)));
+    json.field("p99", static_cast<long long>(metrics_.latency.percentile(0.99)));
+    json.field("p999", static_cast<long long>(metrics_.latency.percentile(0.999)));
+    json.field("max", static_cast<long long>(metrics_.latency.max()));
+    json.end_object();
+    ReportCache::Stats cache = report_cache().stats();
+    json.key("report_cache");
+    json.begin_object();
+    json.field("hits", static_cast<long long>(cache.hits));
+    json.field("misses", static_cast<long long>(cache.misses));
+    json.key("hit_rate");
+    json.value_avg(cache_hit_rate(cache));
+    json.field("entries", static_cast<long long>(cache.entries));
+    json.field("generation", static_cast<long long>(cache.generation));
+    json.end_object();
+    json.end_object();
+    return 200;
+  }
+
+  socket_t listener_ = kInvalidSocket;
+  socket_t wake_ = kInvalidSocket;
+  sockaddr_in wake_addr_{};
+  std::atomic<bool> stopping_{false};
+  std::thread poller_;
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::deque<HttpConnection> pending_;        // соединения с данными для рабочих потоков
+  std::vector<HttpConnection> returned_;      // обслужены, ждут возврата в опрос
+  ServerMetrics metrics_;
+};
+
+// Печатает итоговую статистику сервера.
+void print_server_metrics(const HttpServer& server) {
+  const ServerMetrics& metrics = server.metrics();
+  std::cout << "HTTP: запросов " << metrics.latency.count() << ", ошибок " << metrics.errors.load()
+            << ", соединений " << metrics.connections.load() << "; задержка, мкс: p50 "
+            << metrics.latency.percentile(0.50) << ", p90 " << metrics.latency.percentile(0.90) << ", p99 "
+            << metrics.latency.percentile(0.99) << ", max " << metrics.latency.max() << "\n";
+  ReportCache::Stats cache = report_cache().stats();
+  std::cout << "Кэш отчетов: попаданий " << cache.hits << ", промахов " << cache.misses << "\n";
+}
+
+// Сколько записей каждой таблицы получили новый ID при перенумерации.
+struct RenumberStats {
+  int groups = 0;
+  int students = 0;
+  int subjects = 0;
+  int64_t grades = 0;
+};
+
+// Перенумеровывает ID всех таблиц подряд с 1 в порядке прежних ID и переписывает ссылки
+// на группы, студентов и предметы. Порядок оценок по ID сохраняется, поэтому последняя
+// попытка каждой пары остается последней. Партиции собираются заново (с распределениями).
+RenumberStats renumber_ids(DataStore& data) {
+  RenumberStats stats;
+  // Новый ID - слот записи + 1 (слоты идут по возрастанию ID).
+  auto renumber = [](auto& table, int& changed) {
+    EntitySlots slots(table);
+    for (size_t i = 0; i < table.size(); ++i) {
+      int id = slots.slot(table[i].id) + 1;
+      if (id != table[i].id) {
+        table.write()[i].id = id;
+        ++changed;
+      }
+    }
+    return slots;
+  };
+  EntitySlots groups = renumber(data.groups, stats.groups);
+  EntitySlots students = renumber(data.students, stats.students);
+  EntitySlots subjects = renumber(data.subjects, stats.subjects);
+  for (size_t i = 0; i < data.students.size(); ++i) {
+    int group_id = data.students[i].group_id;
+    int slot = groups.slot(group_id);
+    int to = group_id != 0 && slot >= 0 ? slot + 1 : 0;
+    if (to != group_id) {
+      data.students.write()[i].group_id = to;
+    }
   }
-  if (ok) {
-    for (const auto& grade : data.grades) {
-      sqlite3_bind_int(stmt, 1, grade.id);
-      sqlite3_bind_int(stmt, 2, grade.student_id);
-      sqlite3_bind_int(stmt, 3, grade.subject_id);
-      sqlite3_bind_int(stmt, 4, grade.value);
-      sqlite3_bind_int(stmt, 5, grade.attempt);
-      if (sqlite3_step(stmt) != SQLITE_DONE) {
-        ok = false;
-        break;
+
+  std::vector<int> grade_ids;
+  grade_ids.reserve(grade_count(data));
+  for_each_grade(data, Period(), [&](const Grade& grade) { grade_ids.push_back(grade.id); });
+  std::sort(grade_ids.begin(), grade_ids.end());
+  for (auto& cow : data.grade_partitions) {
+    const GradePartition& old = cow;
+    GradePartition part;
+    part.semester = old.semester;
+    part.grades.reserve(old.size());
+    for (size_t i = 0; i < old.size(); ++i) {
+      Grade grade = old.grade_at(i);
+      int id = static_cast<int>(std::lower_bound(grade_ids.begin(), grade_ids.end(), grade.id) - grade_ids.begin()) + 1;
+      if (id != grade.id) {
+        ++stats.grades;
       }
-      sqlite3_reset(stmt);
-      sqlite3_clear_bindings(stmt);
+      grade.id = id;
+      grade.student_id = students.slot(grade.student_id) + 1;
+      grade.subject_id = subjects.slot(grade.subject_id) + 1;
+      part.append(grade);
+      count_grade(part, grade, 1);
     }
+    cow = Cow<GradePartition>(std::move(part));
   }
-  if (stmt) {
-    sqlite3_finalize(stmt);
+  rebuild_retakes(data);
+
+  data.next_group_id = static_cast<int>(data.groups.size()) + 1;
+  data.next_student_id = static_cast<int>(data.students.size()) + 1;
+  data.next_subject_id = static_cast<int>(data.subjects.size()) + 1;
+  data.next_grade_id = static_cast<int>(grade_ids.size()) + 1;
+  ++data.generation;
+  return stats;
+}
+
+// Строки PRAGMA integrity_check: "ok" или описания повреждений.
+std::vector<std::string> integrity_check(sqlite3* db) {
+  std::vector<std::string> lines;
+  if (!for_each_row(db, "PRAGMA integrity_check;", 0,
+                    [&](sqlite3_stmt* stmt) { lines.push_back(column_text(stmt, 0)); })) {
+    lines.push_back(sqlite3_errmsg(db));
   }
+  return lines;
+}
 
-  if (ok) {
-    ok = exec_sql(db, "COMMIT;");
-  } else {
-    exec_sql(db, "ROLLBACK;");
+// Печатает результат проверки целостности; true - база цела.
+bool print_integrity(const std::vector<std::string>& lines) {
+  bool ok = lines.size() == 1 && lines.front() == "ok";
+  std::cout << "Проверка целостности (PRAGMA integrity_check): " << (ok ? "ok" : "ОШИБКИ") << "\n";
+  for (size_t i = 0; !ok && i < lines.size() && i < 10; ++i) {
+    std::cout << "  " << lines[i] << "\n";
   }
-  sqlite3_close(db);
   return ok;
 }
 
-// Загружает данные из SQLite; возвращает true, если файл существовал.
-bool load_data(DataStore& data, const std::string& path) {
-  bool existed = static_cast<bool>(std::ifstream(path));
-  sqlite3* db = nullptr;
-  if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
-    if (db) {
-      sqlite3_close(db);
-    }
-    return false;
-  }
-  if (!init_db(db)) {
+// Размер файла в КБ для отчета (0 - файла нет).
+long long file_kb(const std::string& path) {
+  std::error_code ec;
+  uintmax_t size = std::filesystem::file_size(path, ec);
+  return ec ? 0 : static_cast<long long>((size + 1023) / 1024);
+}
+
+// Обслуживание базы (--maintain): проверка целостности, отчет о висячих ссылках и
+// внешних ключах, затем перенумерация ID подряд, перезапись таблиц, REINDEX и VACUUM.
+// Данные читаются так же, как при запуске: висячие оценки отбрасываются, а ссылки на
+// несуществующие группы сбрасываются, так что перезапись исправляет найденное. Журнал
+// изменений (--storage log), если он есть, переносится в базу и удаляется. В ленты
+// изменений этой базы (<база>.feeds) дописывается строка reset. Запускать, когда с базой
+// никто не работает: другие процессы держат в памяти прежние ID.
+int run_maintenance() {
+  const std::string path = db_path();
+  if (!std::filesystem::exists(path)) {
+    std::cout << "База " << path << " не найдена.\n";
+    return 1;
+  }
+  std::string log_path = std::filesystem::path(path).replace_extension(".log").string();
+  std::string old_log_path = log_path + ".old";
+  bool has_log = std::filesystem::exists(log_path) || std::filesystem::exists(old_log_path);
+  long long size_before = file_kb(path);
+  std::cout << "Обслуживание базы " << path << " (" << size_before << " КБ";
+  if (has_log) {
+    std::cout << ", журнал изменений " << file_kb(log_path) + file_kb(old_log_path) << " КБ";
+  }
+  std::cout << ").\n";
+
+  sqlite3* db = open_db(path);
+  if (!db) {
+    std::cout << "Не удалось открыть базу " << path << ".\n";
+    return 1;
+  }
+  if (!print_integrity(integrity_check(db))) {
+    std::cout << "База повреждена: перенумерация и перезапись не выполняются.\n";
     sqlite3_close(db);
-    return false;
+    return 1;
   }
 
-  DataStore temp;
-  sqlite3_stmt* stmt = nullptr;
-
-  if (sqlite3_prepare_v2(db, "SELECT id, name FROM groups ORDER BY id;", -1, &stmt, nullptr) == SQLITE_OK) {
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-      int id = sqlite3_column_int(stmt, 0);
-      std::string name = column_text(stmt, 1);
-      temp.groups.push_back({id, name});
+  struct OrphanCheck {
+    const char* title;
+    const char* sql;
+  };
+  const OrphanCheck checks[] = {
+      {"Оценки несуществующих студентов",
+       "SELECT id FROM grades WHERE student_id NOT IN (SELECT id FROM students) ORDER BY id;"},
+      {"Оценки несуществующих предметов",
+       "SELECT id FROM grades WHERE subject_id NOT IN (SELECT id FROM subjects) ORDER BY id;"},
+      {"Студенты в несуществующих группах",
+       "SELECT id FROM students WHERE group_id IS NOT NULL AND group_id NOT IN (SELECT id FROM groups) ORDER BY id;"},
+  };
+  for (const auto& check : checks) {
+    std::vector<int> ids;
+    query_rows(db, check.sql, {}, [&](sqlite3_stmt* stmt) { ids.push_back(sqlite3_column_int(stmt, 0)); });
+    std::cout << check.title << ": ";
+    if (ids.empty()) {
+      std::cout << "нет\n";
+      continue;
     }
+    std::cout << ids.size() << " (ID";
+    for (size_t i = 0; i < ids.size() && i < 10; ++i) {
+      std::cout << (i == 0 ? " " : ", ") << ids[i];
+    }
+    std::cout << (ids.size() > 10 ? ", ...)" : ")") << "\n";
+  }
+  int64_t violations = 0;
+  query_rows(db, "PRAGMA foreign_key_check;", {}, [&](sqlite3_stmt*) { ++violations; });
+  std::cout << "Нарушений внешних ключей (PRAGMA foreign_key_check): " << violations << "\n";
+  for (const char* table : {"groups", "students", "subjects", "grades"}) {
+    std::string sql = std::string("SELECT COUNT(*), COALESCE(MAX(id), 0) FROM ") + table + ";";
+    query_rows(db, sql.c_str(), {}, [&](sqlite3_stmt* stmt) {
+      std::cout << "Таблица " << table << ": записей " << sqlite3_column_int64(stmt, 0) << ", наибольший ID "
+                << sqlite3_column_int64(stmt, 1) << "\n";
+    });
   }
-  if (stmt) {
-    sqlite3_finalize(stmt);
-  }
+  sqlite3_close(db);
 
-  stmt = nullptr;
-  if (sqlite3_prepare_v2(db, "SELECT id, name, group_id FROM students ORDER BY id;", -1, &stmt, nullptr) ==
-      SQLITE_OK) {
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-      int id = sqlite3_column_int(stmt, 0);
-      std::string name = column_text(stmt, 1);
-      int group_id = 0;
-      if (sqlite3_column_type(stmt, 2) != SQLITE_NULL) {
-        group_id = sqlite3_column_int(stmt, 2);
-      }
-      temp.students.push_back({id, name, group_id});
+  DataStore data;
+  std::unique_ptr<StorageBackend> backend = make_storage_backend(has_log ? "log" : "sqlite");
+  bool loaded = false;
+  double load_before_ms = measure_ms([&]() { loaded = backend->load(data); });
+  backend->close();
+  backend.reset();
+  close_db_session();
+  if (!loaded) {
+    std::cout << "Не удалось загрузить данные.\n";
+    return 1;
+  }
+  size_t grades = grade_count(data);
+  RenumberStats stats = renumber_ids(data);
+  std::cout << "Новые ID: групп " << stats.groups << ", студентов " << stats.students << ", предметов "
+            << stats.subjects << ", оценок " << stats.grades << ".\n";
+  if (!save_snapshot(data, path)) {
+    std::cout << "Не удалось перезаписать базу: данные не изменены.\n";
+    return 1;
+  }
+  if (has_log) {
+    std::error_code ec;
+    std::filesystem::remove(log_path, ec);
+    std::filesystem::remove(old_log_path, ec);
+  }
+  for (const auto& feed_path : read_feed_registry(path)) {
+    ChangeFeed feed;
+    if (!feed.open(feed_path)) {
+      std::cout << "Не удалось открыть ленту изменений " << feed_path << ": строка reset не записана.\n";
+      continue;
     }
-  }
-  if (stmt) {
-    sqlite3_finalize(stmt);
+    int64_t seq = feed_reset(feed, path);
+    feed.close();
+    std::cout << "Лента изменений " << feed_path << ": строка reset (seq " << seq << ").\n";
   }
 
-  stmt = nullptr;
-  if (sqlite3_prepare_v2(db, "SELECT id, name FROM subjects ORDER BY id;", -1, &stmt, nullptr) == SQLITE_OK) {
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-      int id = sqlite3_column_int(stmt, 0);
-      std::string name = column_text(stmt, 1);
-      temp.subjects.push_back({id, name});
-    }
+  db = open_db(path);
+  bool ok = db && exec_sql(db, "REINDEX;") && exec_sql(db, "VACUUM;");
+  ok = ok && print_integrity(integrity_check(db));
+  if (db) {
+    sqlite3_close(db);
   }
-  if (stmt) {
-    sqlite3_finalize(stmt);
+  DataStore check;
+  bool reloaded = false;
+  double load_after_ms = measure_ms([&]() { reloaded = load_data(check, path); });
+  ok = ok && reloaded && grade_count(check) == grades && check.students.size() == data.students.size();
+  std::cout << "Размер файла: " << size_before << " КБ -> " << file_kb(path) << " КБ\n"
+            << "Загрузка: " << static_cast<long long>(load_before_ms) << " мс -> "
+            << static_cast<long long>(load_after_ms) << " мс (" << grades << " оценок)\n";
+  if (!ok) {
+    std::cout << "ОШИБКА: база после обслуживания не прошла проверку.\n";
+    return 1;
   }
+  std::cout << "Обслуживание завершено.\n";
+  return 0;
+}
 
-  stmt = nullptr;
-  if (sqlite3_prepare_v2(
-          db, "SELECT id, student_id, subject_id, value, attempt FROM grades ORDER BY id;", -1, &stmt, nullptr) ==
-      SQLITE_OK) {
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-      Grade grade;
-      grade.id = sqlite3_column_int(stmt, 0);
-      grade.student_id = sqlite3_column_int(stmt, 1);
-      grade.subject_id = sqlite3_column_int(stmt, 2);
-      grade.value = sqlite3_column_int(stmt, 3);
-      grade.attempt = sqlite3_column_int(stmt, 4);
-      temp.grades.push_back(grade);
+// Параметры командной строки.
+struct AppOptions {
+  std::string bench;
+  std::string db;
+  int stress_processes = 0;
+  int stress_worker = 0;
+  int stress_iterations = 0;
+  int serve_port = 0;
+  bool headless = false;
+  bool precompute = true;  // прогрев отчетов, пока меню ждет ввода
+  std::string storage = "sqlite";
+  std::string report;
+  bool direct = false;
+  std::string shards;  // базы факультетов: каталог или пути через запятую
+  bool maintain = false;    // обслуживание базы (run_maintenance)
+  std::string feed;         // лента изменений (ChangeFeed)
+  int64_t feed_since = -1;  // --since: вывести ленту после этого номера (run_feed_read)
+  ReportFormat format = ReportFormat::kTable;
+  ReportRequest report_request;
+};
+
+// Читает пару положительных чисел после параметра (--stress P N, --stress-worker K N).
+bool parse_int_pair(int argc, char* argv[], int& i, int& first, int& second) {
+  if (i + 2 >= argc || !parse_int(argv[i + 1], first) || !parse_int(argv[i + 2], second) ||
+      first <= 0 || second <= 0) {
+    return false;
+  }
+  i += 2;
+  return true;
+}
+
+// Разбирает аргументы командной строки; false - если аргументы некорректны.
+bool parse_options(int argc, char* argv[], AppOptions& options) {
+  int semester = 0;
+  bool format_given = false;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--bench" && i + 1 < argc) {
+      options.bench = argv[++i];
+    } else if (arg == "--db" && i + 1 < argc) {
+      options.db = argv[++i];
+    } else if (arg == "--serve" && i + 1 < argc && parse_int(argv[i + 1], options.serve_port) &&
+               options.serve_port > 0 && options.serve_port <= 65535) {
+      ++i;
+    } else if (arg == "--headless") {
+      options.headless = true;
+    } else if (arg == "--no-precompute") {
+      options.precompute = false;
+    } else if (arg == "--storage" && i + 1 < argc && make_storage_backend(argv[i + 1])) {
+      options.storage = argv[++i];
+    } else if (arg == "--report" && i + 1 < argc && (find_report(argv[i + 1]) || find_shard_report(argv[i + 1]))) {
+      options.report = argv[++i];
+    } else if (arg == "--direct") {
+      options.direct = true;
+    } else if (arg == "--maintain") {
+      options.maintain = true;
+    } else if (arg == "--shards" && i + 1 < argc) {
+      options.shards = argv[++i];
+    } else if (arg == "--feed" && i + 1 < argc) {
+      options.feed = argv[++i];
+    } else if (arg == "--since" && i + 1 < argc && parse_int(argv[i + 1], options.feed_since) &&
+               options.feed_since >= 0) {
+      ++i;
+    } else if (arg == "--format" && i + 1 < argc && parse_report_format(argv[i + 1], options.format)) {
+      format_given = true;
+      ++i;
+    } else if (arg == "--semester" && i + 1 < argc && parse_int(argv[i + 1], semester) &&
+               is_valid_semester(semester)) {
+      options.report_request.period.from = semester;
+      options.report_request.period.to = semester;
+      ++i;
+    } else if (arg == "--from" && i + 1 < argc && parse_int(argv[i + 1], options.report_request.period.from)) {
+      ++i;
+    } else if (arg == "--to" && i + 1 < argc && parse_int(argv[i + 1], options.report_request.period.to)) {
+      ++i;
+    } else if (arg == "--id" && i + 1 < argc && parse_int(argv[i + 1], options.report_request.id)) {
+      ++i;
+    } else if (arg == "--group" && i + 1 < argc && parse_int(argv[i + 1], options.report_request.group) &&
+               options.report_request.group >= -1) {
+      ++i;
+    } else if (arg == "--n" && i + 1 < argc && parse_int(argv[i + 1], options.report_request.n) &&
+               options.report_request.n > 0) {
+      ++i;
+    } else if (arg == "--stress" && parse_int_pair(argc, argv, i, options.stress_processes,
+                                                   options.stress_iterations)) {
+      continue;
+    } else if (arg == "--stress-worker" && parse_int_pair(argc, argv, i, options.stress_worker,
+                                                          options.stress_iterations)) {
+      continue;
+    } else {
+      std::cout << "Неизвестный аргумент: " << arg << "\n"
+                << "Использование: cpp-gradebook [--db ПУТЬ] [--serve ПОРТ [--headless]] [--bench utf8|storage|grades|direct|arena|aggregates|shards|snapshot|sheet|retakes]\n"
+                << "                     [--storage sqlite|snapshot|log|memory] [--stress ПРОЦЕССОВ ИТЕРАЦИЙ] [--no-precompute]\n"
+                << "                     [--report ОТЧЕТ [--direct] [--format table|tsv|csv|json|ndjson]\n"
+                << "                      [--semester КОД | --from КОД --to КОД] [--id ID] [--group ID] [--n N]]\n"
+                << "                     [--shards КАТАЛОГ|БАЗА,БАЗА,...] [--maintain] [--feed ПУТЬ [--since N]]\n"
+                << "Отчеты:";
+      for (const auto& entry : kReports) {
+        std::cout << " " << entry.name;
+      }
+      std::cout << "\nОтчеты по всем факультетам (--shards):";
+      for (const auto& report : kShardReports) {
+        std::cout << " " << report.name;
+      }
+      std::cout << "\n";
+      return false;
     }
   }
-  if (stmt) {
-    sqlite3_finalize(stmt);
+  if (options.headless && options.serve_port == 0) {
+    std::cout << "--headless используется только вместе с --serve ПОРТ.\n";
+    return false;
+  }
+  if (!options.shards.empty() && (options.direct || !options.db.empty())) {
+    std::cout << "--shards не совмещается с --db и --direct.\n";
+    return false;
+  }
+  if (options.maintain && (!options.shards.empty() || !options.report.empty() || options.serve_port > 0)) {
+    std::cout << "--maintain не совмещается с --shards, --report и --serve.\n";
+    return false;
   }
-  sqlite3_close(db);
-
-  std::set<int> group_ids;
-  for (const auto& group : temp.groups) {
-    group_ids.insert(group.id);
+  if (options.feed_since >= 0 && options.feed.empty()) {
+    std::cout << "--since используется только вместе с --feed ПУТЬ.\n";
+    return false;
   }
-  for (auto& student : temp.students) {
-    if (student.group_id != 0 && group_ids.find(student.group_id) == group_ids.end()) {
-      student.group_id = 0;
-    }
+  if (!options.feed.empty() && options.feed_since < 0 && (!options.report.empty() || options.maintain)) {
+    std::cout << "--feed не совмещается с --report и --maintain.\n";
+    return false;
   }
-
-  std::set<int> student_ids;
-  for (const auto& student : temp.students) {
-    student_ids.insert(student.id);
+  if (options.direct && (options.report.empty() || options.storage != "sqlite")) {
+    std::cout << "--direct используется только с --report и хранилищем sqlite.\n";
+    return false;
   }
-  std::set<int> subject_ids;
-  for (const auto& subject : temp.subjects) {
-    subject_ids.insert(subject.id);
+  if (format_given && options.report.empty()) {
+    std::cout << "--format используется только с --report.\n";
+    return false;
+  }
+  if (options.report_request.period.from > options.report_request.period.to) {
+    std::cout << "Некорректный период: --from больше --to.\n";
+    return false;
   }
-  temp.grades.erase(
-      std::remove_if(temp.grades.begin(), temp.grades.end(),
-                     [&](const Grade& g) {
-                       return student_ids.find(g.student_id) == student_ids.end() ||
-                              subject_ids.find(g.subject_id) == subject_ids.end();
-                     }),
-      temp.grades.end());
+  return true;
+}
 
-  auto next_id_from = [](int start, const auto& items) {
-    int max_id = 0;
-    for (const auto& item : items) {
-      if (item.id > max_id) {
-        max_id = item.id;
-      }
+// Выводит строки ленты изменений с номером больше since (--feed ПУТЬ --since N), чтобы
+// потребитель продолжил с последнего обработанного номера. Номера в файле растут,
+// поэтому начало ищется двоичным поиском по смещению, а не чтением всего файла.
+int run_feed_read(const std::string& path, int64_t since) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    std::cerr << "Не удалось открыть ленту изменений " << path << ".\n";
+    return 1;
+  }
+  in.seekg(0, std::ios::end);
+  int64_t size = static_cast<int64_t>(in.tellg());
+  std::string line;
+  // Начало первой целой строки после offset; seq - ее номер (или -1 в конце файла).
+  auto line_after = [&](int64_t offset, int64_t& seq) -> int64_t {
+    in.clear();
+    in.seekg(offset);
+    if (offset > 0) {
+      std::getline(in, line);
     }
-    return std::max(start, max_id + 1);
+    int64_t start = static_cast<int64_t>(in.tellg());
+    seq = std::getline(in, line) ? feed_line_seq(line) : -1;
+    return start;
   };
-
-  temp.next_student_id = next_id_from(1, temp.students);
-  temp.next_subject_id = next_id_from(1, temp.subjects);
-  temp.next_group_id = next_id_from(1, temp.groups);
-  temp.next_grade_id = next_id_from(1, temp.grades);
-
-  data = std::move(temp);
-  return existed;
-}
-
-// Экспортирует данные в CSV-файлы для открытия в Excel.
-void export_csv(const DataStore& data) {
-  ensure_storage_dirs();
-  std::ofstream groups_file(export_path("export_groups.csv"), std::ios::binary);
-  std::ofstream students_file(export_path("export_students.csv"), std::ios::binary);
-  std::ofstream subjects_file(export_path("export_subjects.csv"), std::ios::binary);
-  std::ofstream grades_file(export_path("export_grades.csv"), std::ios::binary);
-  if (!groups_file || !students_file || !subjects_file || !grades_file) {
-    std::cout << "Не удалось открыть файлы для экспорта.\n";
-    return;
+  int64_t lo = 0;
+  int64_t hi = size;
+  while (hi - lo > static_cast<int64_t>(kFeedTailBytes)) {
+    int64_t mid = lo + (hi - lo) / 2;
+    int64_t seq = -1;
+    line_after(mid, seq);
+    if (seq >= 0 && seq <= since) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
   }
-
-  auto write_utf8_bom = [](std::ofstream& out) {
-    const unsigned char bom[] = {0xEF, 0xBB, 0xBF};
-    out.write(reinterpret_cast<const char*>(bom), sizeof(bom));
-  };
-  write_utf8_bom(groups_file);
-  write_utf8_bom(students_file);
-  write_utf8_bom(subjects_file);
-  write_utf8_bom(grades_file);
-
-
-  groups_file << "ID_группы" << kCsvDelim << "Название_группы\n";
-  for (const auto& group : data.groups) {
-    groups_file << group.id << kCsvDelim
-                << csv_escape(group.name, kCsvDelim) << "\n";
+  int64_t seq = -1;
+  int64_t start = line_after(lo, seq);
+  if (start < 0) {
+    return 0;
   }
-
-  // Используем точку с запятой - привычный разделитель для Excel в RU локали.
-  students_file << "ID_студента" << kCsvDelim << "Имя_студента" << kCsvDelim
-                << "ID_группы" << kCsvDelim << "Группа\n";
-  for (const auto& student : data.students) {
-    students_file << student.id << kCsvDelim
-                  << csv_escape(student.name, kCsvDelim) << kCsvDelim
-                  << student.group_id << kCsvDelim
-                  << csv_escape(group_name_or_none(data, student.group_id), kCsvDelim) << "\n";
+  in.clear();
+  in.seekg(start);
+  OutputBuffer out(std::cout);
+  while (std::getline(in, line)) {
+    if (feed_line_seq(line) > since) {
+      out.append(line);
+      out.append("\n");
+    }
   }
+  return 0;
+}
 
-  subjects_file << "ID_предмета" << kCsvDelim << "Название_предмета\n";
-  for (const auto& subject : data.subjects) {
-    subjects_file << subject.id << kCsvDelim
-                  << csv_escape(subject.name, kCsvDelim) << "\n";
+// Отчет напрямую из базы (--direct): соединение только для чтения, одна транзакция.
+int run_report_direct(const AppOptions& options, const ReportEntry& entry, const DirectReport& direct) {
+  sqlite3* db = open_db_readonly(db_path());
+  if (!db || !exec_sql(db, "BEGIN;")) {
+    std::cerr << "Не удалось открыть базу " << db_path() << ".\n";
+    if (db) {
+      sqlite3_close(db);
+    }
+    return 1;
   }
-
-  grades_file << "ID_оценки" << kCsvDelim << "ID_студента" << kCsvDelim
-              << "ID_предмета" << kCsvDelim << "Попытка" << kCsvDelim
-              << "Оценка\n";
-  for (const auto& grade : data.grades) {
-    grades_file << grade.id << kCsvDelim
-                << grade.student_id << kCsvDelim
-                << grade.subject_id << kCsvDelim
-                << grade.attempt << kCsvDelim
-                << grade.value << "\n";
+  int status = 0;
+  std::string error = direct_check_params(db, entry, options.report_request);
+  if (!error.empty()) {
+    std::cerr << error << "\n";
+    status = 2;
+  } else {
+    OutputBuffer out(std::cout);
+    std::unique_ptr<ReportSink> sink = make_report_sink(options.format, out);
+    if (!direct.render(db, options.report_request, *sink)) {
+      std::cerr << "Ошибка чтения базы: " << sqlite3_errmsg(db) << "\n";
+      status = 1;
+    }
+    sink->finish();
   }
-
-  std::cout << "Экспортировано в папку '" << kExportDir << "': "
-               "export_groups.csv, export_students.csv, "
-               "export_subjects.csv, export_grades.csv\n";
+  exec_sql(db, "COMMIT;");
+  sqlite3_close(db);
+  return status;
 }
 
-// Подменю управления студентами.
-void students_menu(DataStore& data) {
-  while (true) {
-    std::cout << "\n[Студенты]\n"
-              << "1) Добавить студента\n"
-              << "2) Редактировать студента\n"
-              << "3) Удалить студента\n"
-              << "4) Список студентов\n"
-              << "5) Поиск, фильтры и сортировка\n"
-              << "0) Назад\n";
-    int choice = read_int("Выберите: ", 0, 5);
-    switch (choice) {
-      case 1:
-        add_student(data);
-        break;
-      case 2:
-        edit_student(data);
-        break;
-      case 3:
-        delete_student(data);
-        break;
-      case 4:
-        list_students_detailed(data);
-        break;
-      case 5:
-        students_search_menu(data);
-        break;
-      case 0:
-        return;
-      default:
-        break;
-    }
-  }
+// Открывает хранилище базы db_path(), загружает данные и сообщает, откуда и за сколько.
+bool open_storage(DataStore& data, const std::string& storage_name) {
+  storage_slot() = make_storage_backend(storage_name);
+  bool existed = std::filesystem::exists(db_path());
+  bool loaded = false;
+  double load_ms = measure_ms([&]() { loaded = storage().load(data); });
+  if (!loaded) {
+    std::cout << "Не удалось открыть базу " << db_path() << ".\n";
+  } else if (existed) {
+    std::cout << "Данные загружены из " << db_path() << " за " << static_cast<long long>(load_ms) << " мс ("
+              << grade_count(data) << " оценок).\n";
+  }
+  if (!storage().load_message().empty()) {
+    std::cout << storage().load_message() << "\n";
+  }
+  return loaded;
 }
 
-// Подменю управления группами.
-void groups_menu(DataStore& data) {
-  while (true) {
-    std::cout << "\n[Группы]\n"
-              << "1) Добавить группу\n"
-              << "2) Редактировать группу\n"
-              << "3) Удалить группу\n"
-              << "4) Список групп\n"
-              << "5) Добавить студента в группу\n"
-              << "0) Назад\n";
-    int choice = read_int("Выберите: ", 0, 5);
-    switch (choice) {
-      case 1:
-        add_group(data);
-        break;
-      case 2:
-        edit_group(data);
-        break;
-      case 3:
-        delete_group(data);
-        break;
-      case 4:
-        print_groups_simple(data);
-        break;
-      case 5:
-        add_student_to_group(data);
-        break;
-      case 0:
-        return;
-      default:
-        break;
-    }
+// Переключает меню на базу другого факультета: изменения текущей базы записываются,
+// ее хранилище закрывается, и дальше все правки идут в новую базу. Если новая база
+// не открылась, меню возвращается к прежней: она заново открывается и загружается
+// (несохраненных правок в ней нет, поэтому ничего не теряется).
+bool switch_shard(DataStore& data, const std::string& storage_name, const std::string& path) {
+  sync_or_warn(data);
+  if (!data.pending_changes.empty()) {
+    std::cout << "Изменения текущего факультета не сохранены, переключение отменено.\n";
+    return false;
+  }
+  std::string previous = db_path();
+  // Поколение только растет: кэш отчетов не выдаст результаты прежней базы.
+  uint64_t generation = data.generation;
+  auto reopen = [&](const std::string& target) {
+    storage().close();
+    close_db_session();
+    db_path_override() = target;
+    data = DataStore();
+    data.generation = ++generation;
+    bool opened = open_storage(data, storage_name);
+    publish_snapshot(data);
+    return opened;
+  };
+  if (reopen(path)) {
+    return true;
   }
+  std::cout << "Факультет не сменился, остается " << shard_name(previous) << ".\n";
+  reopen(previous);
+  return false;
 }
 
-// Подменю управления предметами.
-void subjects_menu(DataStore& data) {
+// Меню факультетов (--shards): выбор базы для правок и отчеты по всем базам сразу.
+void shards_menu(DataStore& data, const std::string& storage_name, const std::vector<std::string>& paths,
+                 const Period& period) {
+  // Базы загружаются при первом отчете и служат всем отчетам до выхода из меню.
+  std::vector<Shard> shards;
+  bool shards_loaded = false;
   while (true) {
-    std::cout << "\n[Предметы]\n"
-              << "1) Добавить предмет\n"
-              << "2) Редактировать предмет\n"
-              << "3) Удалить предмет\n"
-              << "4) Список предметов\n"
+    std::cout << "\n[Факультеты] сейчас: " << shard_name(db_path()) << ", период: " << period_name(period) << "\n"
+              << "1) Сменить факультет\n"
+              << "2) Сводка по факультетам\n"
+              << "3) Средние по предметам всех факультетов\n"
+              << "4) Топ-N студентов всех факультетов\n"
               << "0) Назад\n";
     int choice = read_int("Выберите: ", 0, 4);
-    switch (choice) {
-      case 1:
-        add_subject(data);
-        break;
-      case 2:
-        edit_subject(data);
-        break;
-      case 3:
-        delete_subject(data);
-        break;
-      case 4:
-        print_subjects_simple(data);
-        break;
-      case 0:
-        return;
-      default:
-        break;
+    sync_or_warn(data);
+    if (choice == 0) {
+      return;
+    }
+    if (choice == 1) {
+      for (size_t i = 0; i < paths.size(); ++i) {
+        std::cout << (i + 1) << ") " << shard_name(paths[i]) << " - " << paths[i] << "\n";
+      }
+      int index = read_int("Факультет (0 - отмена): ", 0, static_cast<int>(paths.size()));
+      if (index > 0 && paths[static_cast<size_t>(index - 1)] != db_path()) {
+        switch_shard(data, storage_name, paths[static_cast<size_t>(index - 1)]);
+      }
+      continue;
+    }
+    ReportRequest request;
+    request.period = period;
+    if (choice == 4) {
+      request.n = read_int("Сколько студентов показать: ", 1, 1000);
+    }
+    if (!shards_loaded) {
+      double load_ms = measure_ms([&]() { shards = load_shards(paths); });
+      size_t loaded = static_cast<size_t>(
+          std::count_if(shards.begin(), shards.end(), [](const Shard& shard) { return shard.loaded; }));
+      std::cout << "Загружено баз: " << loaded << " из " << shards.size() << " за "
+                << static_cast<long long>(load_ms) << " мс.\n";
+      shards.erase(std::remove_if(shards.begin(), shards.end(), [](const Shard& shard) { return !shard.loaded; }),
+                   shards.end());
+      shards_loaded = true;
     }
+    OutputBuffer out(std::cout);
+    TableSink sink(out);
+    kShardReports[choice - 2].render(shards, request, 0, sink);
   }
 }
 
-// Подменю управления оценками.
-void grades_menu(DataStore& data) {
-  while (true) {
-    std::cout << "\n[Оценки]\n"
-              << "1) Добавить оценку\n"
-              << "2) Редактировать оценку\n"
-              << "3) Удалить оценку\n"
-              << "4) Список оценок\n"
-              << "0) Назад\n";
-    int choice = read_int("Выберите: ", 0, 4);
-    switch (choice) {
-      case 1:
-        add_grade(data);
-        break;
-      case 2:
-        edit_grade(data);
-        break;
-      case 3:
-        delete_grade(data);
-        break;
-      case 4:
-        print_grades_simple(data);
-        break;
-      case 0:
-        return;
-      default:
-        break;
+// Отчет по всем факультетам (--report с --shards): базы загружаются и считаются параллельно.
+int run_shard_report(const AppOptions& options) {
+  const ShardReport* report = find_shard_report(options.report);
+  if (!report) {
+    std::cerr << "Отчет " << options.report << " не строится по всем факультетам. С --shards доступны:";
+    for (const auto& item : kShardReports) {
+      std::cerr << " " << item.name;
+    }
+    std::cerr << ".\n";
+    return 2;
+  }
+  std::vector<std::string> paths = parse_shard_paths(options.shards);
+  if (paths.empty()) {
+    std::cerr << "Не найдено баз факультетов: " << options.shards << ".\n";
+    return 1;
+  }
+  std::vector<Shard> shards = load_shards(paths);
+  for (const auto& shard : shards) {
+    if (!shard.loaded) {
+      std::cerr << "Не удалось открыть базу " << shard.path << ".\n";
+      return 1;
     }
   }
+  OutputBuffer out(std::cout);
+  std::unique_ptr<ReportSink> sink = make_report_sink(options.format, out);
+  report->render(shards, options.report_request, 0, *sink);
+  sink->finish();
+  return 0;
 }
 
-// Подменю отчетов.
-void reports_menu(DataStore& data) {
-  while (true) {
-    std::cout << "\n[Отчеты]\n"
-              << "1) Средние по студентам\n"
-              << "2) Средние по предметам\n"
-              << "3) Подробности по предмету\n"
-              << "4) Топ-N студентов\n"
-              << "5) Пересдачи\n"
-              << "0) Назад\n";
-    int choice = read_int("Выберите: ", 0, 5);
-    switch (choice) {
-      case 1:
-        report_overall_averages(data);
-        break;
-      case 2:
-        report_subject_averages(data);
-        break;
-      case 3:
-        report_subject_detail(data);
-        break;
-      case 4:
-        report_top_n(data);
-        break;
-      case 5:
-        report_retakes(data);
-        break;
-      case 0:
-        return;
-      default:
-        break;
+// Выводит один отчет в stdout и завершает работу (--report). Строки уходят в поток
+// по мере построения, поэтому вывод можно сразу передавать другой программе.
+// Сообщения об ошибках пишутся в stderr, чтобы не смешиваться с данными.
+int run_report(const AppOptions& options) {
+  if (!options.shards.empty()) {
+    return run_shard_report(options);
+  }
+  const ReportEntry* entry = find_report(options.report);
+  if (!entry) {
+    std::cerr << "Отчет " << options.report << " строится только по всем факультетам (--shards).\n";
+    return 2;
+  }
+  const ReportRequest& request = options.report_request;
+  if (options.direct) {
+    const DirectReport* direct = find_direct_report(options.report);
+    if (!direct) {
+      std::cerr << "Отчет " << options.report << " не поддерживает --direct. Напрямую из базы читаются:";
+      for (const auto& item : kDirectReports) {
+        std::cerr << " " << item.name;
+      }
+      std::cerr << ".\n";
+      return 2;
     }
+    return run_report_direct(options, *entry, *direct);
+  }
+  ensure_storage_dirs();
+  storage_slot() = make_storage_backend(options.storage);
+  DataStore data;
+  if (!storage().load(data)) {
+    std::cerr << "Не удалось открыть базу " << db_path() << ".\n";
+    return 1;
+  }
+  int status = 0;
+  if (entry->param == ReportParam::kSubject && !find_subject(data, request.id)) {
+    std::cerr << "Предмет не найден (--id).\n";
+    status = 2;
+  } else if (entry->param == ReportParam::kStudent && !find_student(data, request.id)) {
+    std::cerr << "Студент не найден (--id).\n";
+    status = 2;
+  } else if (request.group > 0 && !find_group(data, request.group)) {
+    std::cerr << "Группа не найдена (--group).\n";
+    status = 2;
+  } else {
+    OutputBuffer out(std::cout);
+    std::unique_ptr<ReportSink> sink = make_report_sink(options.format, out);
+    entry->render(data, request, *sink);
+    sink->finish();
   }
+  storage().close();
+  return status;
 }
 
 // Точка входа: главное меню приложения.
-int main() {
+int main(int argc, char* argv[]) {
   DataStore data;
 #ifdef _WIN32
   // Переключаем консоль на UTF-8, чтобы корректно отображать кириллицу.
   SetConsoleOutputCP(CP_UTF8);
   SetConsoleCP(CP_UTF8);
 #endif
+  // Отвязываем iostream от stdio: вывод идет крупными блоками через OutputBuffer.
+  std::ios::sync_with_stdio(false);
+  AppOptions options;
+  if (!parse_options(argc, argv, options)) {
+    return 2;
+  }
+  if (!options.bench.empty()) {
+    return run_benchmark(options.bench);
+  }
+  if (options.feed_since >= 0) {
+    return run_feed_read(options.feed, options.feed_since);
+  }
+  if (!options.db.empty()) {
+    db_path_override() = options.db;
+  }
+  if (!options.report.empty()) {
+    return run_report(options);
+  }
+  if (options.maintain) {
+    return run_maintenance();
+  }
+  if (options.stress_worker > 0) {
+    return run_stress_worker(options.stress_worker, options.stress_iterations);
+  }
+  if (options.stress_processes > 0) {
+    return run_stress_test(argv[0], options.stress_processes, options.stress_iterations);
+  }
+  std::vector<std::string> shard_paths;
+  if (!options.shards.empty()) {
+    shard_paths = parse_shard_paths(options.shards);
+    if (shard_paths.empty()) {
+      std::cout << "Не найдено баз факультетов: " << options.shards << ".\n";
+      return 1;
+    }
+    db_path_override() = shard_paths.front();
+    std::cout << "Факультет: " << shard_name(shard_paths.front()) << " (баз факультетов: " << shard_paths.size()
+              << ").\n";
+  }
   ensure_storage_dirs();
-  if (load_data(data, db_path())) {
-    std::cout << "Данные загружены из " << db_path() << ".\n";
+  open_storage(data, options.storage);
+  if (!options.feed.empty()) {
+    if (!change_feed().open(options.feed)) {
+      std::cout << "Не удалось открыть ленту изменений " << options.feed << ".\n";
+      return 1;
+    }
+    std::cout << "Лента изменений: " << options.feed << " (следующий номер " << (change_feed().last_seq() + 1)
+              << ").\n";
+  }
+  HttpServer server;
+  if (options.serve_port > 0) {
+    snapshot_store().enabled = true;
+    publish_snapshot(data);
+    int threads = static_cast<int>(std::max(4u, std::thread::hardware_concurrency()));
+    if (!server.start(options.serve_port, threads)) {
+      std::cout << "Не удалось запустить HTTP-сервер на порту " << options.serve_port << ".\n";
+      return 1;
+    }
+    std::cout << "HTTP API: http://127.0.0.1:" << options.serve_port << "/ (рабочих потоков: " << threads
+              << ", метрики - /metrics)\n";
+    if (options.headless) {
+      // Без меню: раз в секунду подтягиваем изменения других процессов до остановки (Ctrl+C).
+      std::cout << std::flush;
+      while (true) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        sync_or_warn(data);
+      }
+    }
+  }
+  if (options.precompute) {
+    // До первых открытых отчетов прогреваются сводные средние за всю историю.
+    idle_precompute().remember(report_key("subject_averages", Period()), render_subject_averages, ReportRequest());
+    idle_precompute().remember(report_key("overall", Period()), render_overall_averages, ReportRequest());
+    idle_precompute().attach(data);
   }
+  Period period;
   while (true) {
     std::cout << "\n[Главное меню]\n"
               << "1) Студенты\n"
@@ -2270,9 +12804,15 @@ int main() {
               << "4) Оценки\n"
               << "5) Отчеты\n"
               << "6) Электронный журнал\n"
-              << "7) Экспорт в CSV (Excel)\n"
-              << "0) Выход\n";
-    int choice = read_int("Выберите: ", 0, 7);
+              << "7) Экспорт в Excel (CSV/XLSX)\n"
+              << "8) Период отчетов (сейчас: " << period_name(period) << ")\n";
+    if (!shard_paths.empty()) {
+      std::cout << "9) Факультеты (сейчас: " << shard_name(db_path()) << ")\n";
+    }
+    std::cout << "0) Выход\n";
+    int choice = read_int("Выберите: ", 0, shard_paths.empty() ? 8 : 9);
+    // Перед каждым действием подтягиваем изменения других процессов (проверка PRAGMA data_version дешевая).
+    sync_or_warn(data);
     switch (choice) {
       case 1:
         students_menu(data);
@@ -2287,20 +12827,33 @@ int main() {
         grades_menu(data);
         break;
       case 5:
-        reports_menu(data);
+        reports_menu(data, period);
         break;
       case 6:
-        journal_menu(data);
+        journal_menu(data, period);
         break;
       case 7:
-        export_csv(data);
+        export_menu(data, period);
+        break;
+      case 8:
+        period = read_period(data, period);
+        break;
+      case 9:
+        shards_menu(data, options.storage, shard_paths, period);
         break;
       case 0:
-        if (save_data(data, db_path())) {
+        sync_or_warn(data);
+        storage().close();
+        change_feed().close();
+        if (data.pending_changes.empty()) {
           std::cout << "Данные сохранены.\n";
         } else {
           std::cout << "Не удалось сохранить данные.\n";
         }
+        if (options.serve_port > 0) {
+          server.stop();
+          print_server_metrics(server);
+        }
         std::cout << "До свидания.\n";
         return 0;
       default: